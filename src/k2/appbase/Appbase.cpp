@@ -37,15 +37,41 @@ int App::start(int argc, char** argv) {
     k2::RPCProtocolFactory::Dist_t tcpproto;
     k2::RPCProtocolFactory::Dist_t rrdmaproto;
     k2::RPCProtocolFactory::Dist_t autoproto;
+    k2::RPCProtocolFactory::Dist_t shmproto;
+    k2::RPCProtocolFactory::Dist_t unixproto;
     k2::Prometheus prometheus;
     MultiAddressProvider addrProvider;
+    MultiAddressProvider unixAddrProvider;
     RPCProtocolFactory::BuilderFunc_t tcpProtobuilder;
+    RPCProtocolFactory::BuilderFunc_t unixProtobuilder;
 
     addOptions()
     ("prometheus_port", bpo::value<uint16_t>()->default_value(8089), "HTTP port for the prometheus server")
     ("tcp_port", bpo::value<uint16_t>(), "If specified, this TCP port will be opened on all shards (kernel-based incoming connection load-balancing via shared bind on same port from multiple listeners. Conflicts with --tcp_endpoints")
     ("tcp_endpoints", bpo::value<std::vector<k2::String>>()->multitoken(), "A list(space-delimited) of TCP listening endpoints to assign to each core. You can specify either full endpoints, e.g. 'tcp+k2rpc://192.168.1.2:12345' or just ports , e.g. '12345'. If simple ports are specified, the stack will bind to 0.0.0.0. Conflicts with --tcp_port")
     ("enable_tx_checksum", bpo::value<bool>()->default_value(false), "enables transport-level checksums (and validation) on all messages. it incurs double - read penalty(data is read separately to compute checksum)")
+    ("enable_tx_compression", bpo::value<bool>()->default_value(false), "enables LZ4 compression of large payloads on TCP, unix socket and RDMA channels. Payloads are only compressed for peers which have also enabled it")
+    ("tx_compression_threshold", bpo::value<uint32_t>()->default_value(4096), "payloads smaller than this many bytes are sent uncompressed when transport compression is enabled")
+    ("tx_compression_max_size", bpo::value<uint32_t>()->default_value(256*1024), "payloads larger than this many bytes are sent uncompressed, so that compressing a single payload doesn't stall the reactor for long")
+    ("tx_max_decompressed_size", bpo::value<uint32_t>()->default_value(64*1024*1024), "compressed payloads which claim to decompress to more than this many bytes are rejected, and the channel they arrived on is closed")
+    ("tcp_coalesce_max_bytes", bpo::value<size_t>()->default_value(64*1024), "max number of bytes to coalesce into a single TCP socket write+flush")
+    ("tcp_coalesce_max_delay", bpo::value<k2::ParseableDuration>(), "how long an idle TCP channel holds outgoing messages to coalesce them into a single write. By default only the messages sent in the same reactor poll cycle are coalesced")
+    ("tx_buffer_pool_max_bytes", bpo::value<size_t>()->default_value(16*1024*1024), "max number of bytes each core keeps in free transport buffers for reuse. Set to 0 to disable buffer recycling")
+    ("tcp_connections_per_endpoint", bpo::value<size_t>()->default_value(1), "max number of TCP connections to open to the same remote endpoint. Additional connections are opened lazily when all existing connections have requests in flight")
+    ("tcp_least_outstanding", bpo::value<bool>()->default_value(true), "send each message over the TCP connection with fewest outstanding requests. If false, connections to the same endpoint are used round-robin")
+    ("tcp_channel_idle_timeout", bpo::value<k2::ParseableDuration>(), "close TCP connections which have not sent or received messages for this long. By default idle connections are kept open")
+    ("tcp_outstanding_request_expiry", bpo::value<k2::ParseableDuration>(), "how long a request counts as outstanding on a TCP connection if no response arrives, e.g. because it timed out. Should be no shorter than the RPC timeouts in use. Defaults to 10s")
+    ("shm_listen", bpo::value<bool>()->default_value(false), "accept shared memory(shm+k2rpc) connections from processes on the same host")
+    ("shm_ring_size", bpo::value<size_t>()->default_value(1024*1024), "the size(power of 2) of each of the send/receive rings of the shm connections we create")
+    ("shm_spin_duration", bpo::value<k2::ParseableDuration>(), "how long the shm protocol keeps polling its connections on every reactor cycle after the last activity")
+    ("shm_idle_poll_interval", bpo::value<k2::ParseableDuration>(), "how often the shm protocol polls its connections when idle")
+    ("shm_peer_check_interval", bpo::value<k2::ParseableDuration>(), "how often the shm protocol checks if the peer processes of its connections are alive")
+    ("shm_local_url_ttl", bpo::value<k2::ParseableDuration>(), "how long the shm protocol trusts its check if an url is a mailbox on this host")
+    ("unix_endpoints", bpo::value<std::vector<k2::String>>()->multitoken(), "A list(space-delimited) of unix domain socket listening endpoints to assign to each core. You can specify either full endpoints, e.g. 'unix+k2rpc:///run/k2/node0.sock' or just socket paths, e.g. '/run/k2/node0.sock'. Requires the posix network stack")
+    ("rpc_timer_wheel_tick", bpo::value<k2::ParseableDuration>(), "the resolution of RPC request timeouts (default 20us). Requests may time out up to one tick late")
+    ("rpc_stream_credit_timeout", bpo::value<k2::ParseableDuration>(), "how long the server of a streaming RPC waits for the client to grant it credits before it gives up on the stream")
+    ("rpc_loopback", bpo::value<bool>()->default_value(false), "deliver RPCs to endpoints served by this process in-process, without serializing requests and responses. Only applies to RPC types marked with K2_RPC_LOOPBACK_SAFE")
+    ("rpc_compact_encoding", bpo::value<bool>()->default_value(true), "send RPC requests with the compact(varint) payload encoding to peers which advertise support for it. Replies always use the encoding of the request")
     //("vservers", bpo::value<std::vector<int>>()->multitoken(), "This option accepts exactly 2 integers, which specify how many virtual servers to create(1) and how many cores each server should have(2). The servers are reachable within the same process over the sim protocol, with auto-assigned names.")
     ;
 
@@ -93,6 +119,13 @@ int App::start(int argc, char** argv) {
             tcpProtobuilder = k2::TCPRPCProtocol::builder(std::ref(vnet));
         }
 
+        if (config.count("unix_endpoints")) {
+            unixAddrProvider = MultiAddressProvider(config["unix_endpoints"].as<std::vector<k2::String>>());
+            unixProtobuilder = k2::UnixRPCProtocol::builder(std::ref(vnet), std::ref(unixAddrProvider));
+        } else {
+            unixProtobuilder = k2::UnixRPCProtocol::builder(std::ref(vnet));
+        }
+
         // call the stop() method on each object when we're about to exit. This also deletes the objects
         seastar::engine().at_exit([&] {
             K2INFO("stop config");
@@ -122,6 +155,14 @@ int App::start(int argc, char** argv) {
             K2INFO("stop autoproto");
             return autoproto.stop();
         });
+        seastar::engine().at_exit([&] {
+            K2INFO("stop shmproto");
+            return shmproto.stop();
+        });
+        seastar::engine().at_exit([&] {
+            K2INFO("stop unixproto");
+            return unixproto.stop();
+        });
         seastar::engine().at_exit([&] {
             K2INFO("hard stop user applets");
             return seastar::do_for_each(_stoppers.rbegin(), _stoppers.rend(), [](auto& func) {
@@ -171,6 +212,14 @@ int App::start(int argc, char** argv) {
                     K2INFO("create auto-rrdma proto");
                     return autoproto.start(k2::AutoRRDMARPCProtocol::builder(std::ref(vnet), std::ref(rrdmaproto)));
                 })
+                .then([&]() {
+                    K2INFO("create shm proto");
+                    return shmproto.start(k2::ShmRPCProtocol::builder(std::ref(vnet)));
+                })
+                .then([&]() {
+                    K2INFO("create unix proto");
+                    return unixproto.start(unixProtobuilder);
+                })
                 .then([&]() {
                     K2INFO("create dispatcher");
                     return RPCDist().start();
@@ -215,6 +264,24 @@ int App::start(int argc, char** argv) {
                     // Could register more protocols here via separate invoke_on_all calls
                     return RPCDist().invoke_on_all(&k2::RPCDispatcher::registerProtocol, seastar::ref(autoproto));
                 })
+                .then([&]() {
+                    K2INFO("start shm protocol");
+                    return shmproto.invoke_on_all(&k2::RPCProtocolFactory::start);
+                })
+                .then([&]() {
+                    K2INFO("register shm protocol");
+                    // Could register more protocols here via separate invoke_on_all calls
+                    return RPCDist().invoke_on_all(&k2::RPCDispatcher::registerProtocol, seastar::ref(shmproto));
+                })
+                .then([&]() {
+                    K2INFO("start unix protocol");
+                    return unixproto.invoke_on_all(&k2::RPCProtocolFactory::start);
+                })
+                .then([&]() {
+                    K2INFO("register unix protocol");
+                    // Could register more protocols here via separate invoke_on_all calls
+                    return RPCDist().invoke_on_all(&k2::RPCDispatcher::registerProtocol, seastar::ref(unixproto));
+                })
                 .then([&]() {
                     K2INFO("start dispatcher");
                     return RPCDist().invoke_on_all(&k2::RPCDispatcher::start);
@@ -30,6 +30,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <boost/program_options.hpp>
 #include <boost/pointer_cast.hpp>
 #include <seastar/core/app-template.hh>  // for app_template
+#include <seastar/net/unix_address.hh>
 
 // k2 base
 #include <k2/common/TypeMap.h>
@@ -39,14 +40,16 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/transport/Discovery.h>
 #include <k2/transport/RPCProtocolFactory.h>
 #include <k2/transport/RRDMARPCProtocol.h>
+#include <k2/transport/ShmRPCProtocol.h>
 #include <k2/transport/TCPRPCProtocol.h>
+#include <k2/transport/UnixRPCProtocol.h>
 #include <k2/transport/VirtualNetworkStack.h>
 
 #include "AppEssentials.h"
 
 namespace k2 {
 
-// Helper class used to provide listening addresses for the TCP protocol
+// Helper class used to provide listening addresses for the TCP and Unix protocols
 class MultiAddressProvider : public k2::IAddressProvider {
    public:
     MultiAddressProvider() = default;
@@ -56,10 +59,16 @@ class MultiAddressProvider : public k2::IAddressProvider {
         if (size_t(coreID) < _urls.size()) {
             K2DEBUG("Have url: " << coreID << ":" << _urls[coreID]);
             auto ep = k2::TXEndpoint::fromURL(_urls[coreID], nullptr);
+            if (ep && !ep->getIP().empty() && ep->getIP()[0] == '/') {
+                return seastar::socket_address(seastar::unix_domain_addr(ep->getIP().c_str()));
+            }
             if (ep) {
                 return seastar::socket_address(seastar::ipv4_addr(ep->getIP(), uint16_t(ep->getPort())));
             }
-            // might not be in URL form (e.g. just a plain port)
+            // might not be in URL form (e.g. just a plain socket path or a plain port)
+            if (!_urls[coreID].empty() && _urls[coreID][0] == '/') {
+                return seastar::socket_address(seastar::unix_domain_addr(_urls[coreID].c_str()));
+            }
             K2DEBUG("attempting to use url as a simple port");
             try {
                 auto port = std::stoi(_urls[coreID]);
@@ -33,7 +33,13 @@ int main(int argc, char** argv) {
 
     app.addOptions()
         ("tso_endpoint", bpo::value<k2::String>(), "URL of Timestamp Oracle (TSO) endpoint")
+        ("tso_standby_endpoints", bpo::value<std::vector<k2::String>>()->multitoken()->default_value(std::vector<k2::String>()), "A list(space-delimited) of URLs of other TSO server instances to fail over to")
         ("partition_request_timeout", bpo::value<k2::ParseableDuration>(), "Timeout of K23SI operations, as chrono literals")
+        ("partition_request_hedging", bpo::value<bool>()->default_value(false), "Hedge slow idempotent K23SI operations(reads, heartbeats, finalize) by sending a duplicate to another node which serves the partition. The loser is cancelled")
+        ("partition_request_adaptive_timeout", bpo::value<bool>()->default_value(false), "Derive the timeout of K23SI operations from the observed latency of the partition endpoint")
+        ("partition_request_timeout_multiplier", bpo::value<double>(), "Adaptive timeout of K23SI operations as a multiple of the p99 latency of the endpoint")
+        ("partition_request_min_timeout", bpo::value<k2::ParseableDuration>(), "Lower bound of the adaptive timeout of K23SI operations, as chrono literals")
+        ("partition_map_subscribe", bpo::value<bool>()->default_value(false), "Subscribe to partition map changes so that the CPO pushes them instead of clients discovering them through failed requests")
         ("cpo_request_timeout", bpo::value<k2::ParseableDuration>(), "CPO request timeout")
         ("cpo_request_backoff", bpo::value<k2::ParseableDuration>(), "CPO request backoff")
         ("k23si_cpo_endpoint", bpo::value<k2::String>(), "the endpoint for k2 CPO service")
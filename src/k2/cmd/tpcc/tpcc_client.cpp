@@ -269,6 +269,11 @@ int main(int argc, char** argv) {;
         ("num_concurrent_txns", bpo::value<int>()->default_value(2), "Number of concurrent transactions to use")
         ("test_duration_s", bpo::value<uint32_t>()->default_value(30), "How long in seconds to run")
         ("partition_request_timeout", bpo::value<ParseableDuration>(), "Timeout of K23SI operations, as chrono literals")
+        ("partition_request_hedging", bpo::value<bool>()->default_value(false), "Hedge slow idempotent K23SI operations(reads, heartbeats, finalize) by sending a duplicate to another node which serves the partition. The loser is cancelled")
+        ("partition_request_adaptive_timeout", bpo::value<bool>()->default_value(false), "Derive the timeout of K23SI operations from the observed latency of the partition endpoint")
+        ("partition_request_timeout_multiplier", bpo::value<double>(), "Adaptive timeout of K23SI operations as a multiple of the p99 latency of the endpoint")
+        ("partition_request_min_timeout", bpo::value<ParseableDuration>(), "Lower bound of the adaptive timeout of K23SI operations, as chrono literals")
+        ("partition_map_subscribe", bpo::value<bool>()->default_value(false), "Subscribe to partition map changes so that the CPO pushes them instead of clients discovering them through failed requests")
         ("dataload_txn_timeout", bpo::value<ParseableDuration>(), "Timeout of dataload txn, as chrono literal")
         ("writes_per_load_txn", bpo::value<size_t>()->default_value(10), "The number of writes to do in the load phase between txn commit calls")
         ("districts_per_warehouse", bpo::value<uint16_t>()->default_value(10), "The number of districts per warehouse")
@@ -26,6 +26,11 @@ Copyright(c) 2020 Futurewei Cloud
 int main(int argc, char** argv)
 {
     k2::App app("TSOService");
+    app.addOptions()
+        ("tso.id", bpo::value<uint32_t>(), "Id of this TSO server instance, included in issued timestamps. A random id is derived if not set")
+        ("tso.lease_store_path", bpo::value<k2::String>(), "Path of the lease file shared by TSO server instances for master election. In process lease store if not set")
+        ("tso.ctrol_heart_beat_interval", bpo::value<k2::ParseableDuration>(), "TSO controller heartbeat interval, master lease is three heartbeats plus 1ms")
+        ("tso.worker_stall_probe_interval", bpo::value<k2::ParseableDuration>(), "How often TSO workers probe the reactor for stalls(reactor_stall metric)");
 
     app.addApplet<k2::TSOService>();
 
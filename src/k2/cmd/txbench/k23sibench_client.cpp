@@ -299,6 +299,11 @@ int main(int argc, char** argv) {
         // config for dependencies
         ("tcp_remotes", bpo::value<std::vector<k2::String>>()->multitoken()->default_value(std::vector<k2::String>()), "A list(space-delimited) of endpoints to assign in the test collection")
         ("partition_request_timeout", bpo::value<k2::ParseableDuration>(), "Timeout of K23SI operations, as chrono literals")
+        ("partition_request_hedging", bpo::value<bool>()->default_value(false), "Hedge slow idempotent K23SI operations(reads, heartbeats, finalize) by sending a duplicate to another node which serves the partition. The loser is cancelled")
+        ("partition_request_adaptive_timeout", bpo::value<bool>()->default_value(false), "Derive the timeout of K23SI operations from the observed latency of the partition endpoint")
+        ("partition_request_timeout_multiplier", bpo::value<double>(), "Adaptive timeout of K23SI operations as a multiple of the p99 latency of the endpoint")
+        ("partition_request_min_timeout", bpo::value<k2::ParseableDuration>(), "Lower bound of the adaptive timeout of K23SI operations, as chrono literals")
+        ("partition_map_subscribe", bpo::value<bool>()->default_value(false), "Subscribe to partition map changes so that the CPO pushes them instead of clients discovering them through failed requests")
         ("cpo", bpo::value<k2::String>(), "URL of Control Plane Oracle (CPO), e.g. 'tcp+k2rpc://192.168.1.2:12345'")
         ("tso_endpoint", bpo::value<k2::String>(), "URL of Timestamp Oracle (TSO), e.g. 'tcp+k2rpc://192.168.1.2:12345'")
         ("cpo_request_timeout", bpo::value<k2::ParseableDuration>(), "CPO request timeout")
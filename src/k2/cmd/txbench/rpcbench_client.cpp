@@ -180,7 +180,7 @@ int main(int argc, char** argv) {
         ("multi_conn", bpo::value<uint32_t>()->default_value(1), "how many conns to use per core (each with the pipeline_depth below)")
         ("response_size", bpo::value<uint32_t>()->default_value(512), "How many bytes to receive with each response")
         ("pipeline_depth", bpo::value<uint32_t>()->default_value(10), "How many requests to have in the pipeline")
-        ("remote_eps", bpo::value<std::vector<k2::String>>()->multitoken()->default_value(std::vector<k2::String>()), "A list(space-delimited) of remote endpoints to assign to each core. e.g. 'tcp+k2rpc://192.168.1.2:12345'")
+        ("remote_eps", bpo::value<std::vector<k2::String>>()->multitoken()->default_value(std::vector<k2::String>()), "A list(space-delimited) of remote endpoints to assign to each core. e.g. 'tcp+k2rpc://192.168.1.2:12345' or 'unix+k2rpc:///run/k2/rpcbench0.sock'")
         ("test_duration", bpo::value<k2::ParseableDuration>(), "How long to run");
     return app.start(argc, argv);
 }
@@ -0,0 +1,325 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// stl
+#include <fstream>
+#include <sstream>
+
+#include <k2/appbase/Appbase.h>
+#include <k2/appbase/AppEssentials.h>
+#include <k2/dto/MessageVerbs.h>
+#include <k2/dto/TimestampBatch.h>
+#include <k2/tso/client_lib/tso_clientlib.h>
+#include <seastar/core/sleep.hh>
+
+// Load generator for the TSO service. It runs on all cores, and in each core keeps pipeline_depth requests in flight, either
+// - mode "raw": GET_TSO_TIMESTAMP_BATCH requests with batch_size sent directly to the TSO worker cores, or
+// - mode "clientlib": TSO_ClientLib::GetTimestampFromTSO() calls, which fetch batches from the TSO on our behalf.
+// Reports timestamp throughput, hit ratio(clientlib requests fulfilled without waiting) and latency histograms through prometheus,
+// and a JSON summary aggregated from all cores at the end of the run.
+
+// per-core results, aggregated on core 0 for the summary
+struct BenchStats {
+    uint64_t requests{0};
+    uint64_t timestamps{0};
+    uint64_t hits{0};
+    uint64_t failed{0};
+    uint64_t requestedTimestamps{0};
+    double seconds{0};
+    double latencySum{0};
+    uint64_t latencyCount{0};
+    std::vector<double> bucketBounds;
+    std::vector<uint64_t> bucketCounts;  // cumulative
+
+    void merge(const BenchStats& o) {
+        requests += o.requests;
+        timestamps += o.timestamps;
+        hits += o.hits;
+        failed += o.failed;
+        requestedTimestamps += o.requestedTimestamps;
+        seconds = std::max(seconds, o.seconds);
+        latencySum += o.latencySum;
+        latencyCount += o.latencyCount;
+        if (bucketCounts.empty()) {
+            bucketBounds = o.bucketBounds;
+            bucketCounts = o.bucketCounts;
+        }
+        else {
+            for (size_t i = 0; i < bucketCounts.size() && i < o.bucketCounts.size(); ++i) {
+                bucketCounts[i] += o.bucketCounts[i];
+            }
+        }
+    }
+
+    // upper bound of the bucket containing the given percentile
+    double percentile(double p) const {
+        uint64_t target = (uint64_t)std::ceil(latencyCount * p);
+        for (size_t i = 0; i < bucketCounts.size(); ++i) {
+            if (bucketCounts[i] >= target) {
+                return bucketBounds[i];
+            }
+        }
+        return bucketBounds.empty() ? 0 : bucketBounds.back();
+    }
+};
+
+class Client {
+public:  // application lifespan
+    // required for seastar::distributed interface
+    seastar::future<> gracefulStop() {
+        K2INFO("stopping");
+        _stopped = true;
+        return std::move(_benchFut);
+    }
+
+    void registerMetrics() {
+        _metric_groups.clear();
+        std::vector<sm::label_instance> labels;
+        labels.push_back(sm::label_instance("total_cores", seastar::smp::count));
+        labels.push_back(sm::label_instance("mode", _mode()));
+        labels.push_back(sm::label_instance("batch_size", _batchSize()));
+        labels.push_back(sm::label_instance("pipeline_depth", _pipelineDepth()));
+        _metric_groups.add_group("tsobench",
+        {
+            sm::make_counter("total_requests", _stats.requests, sm::description("Total number of successful requests(batches in raw mode)"), labels),
+            sm::make_counter("total_timestamps", _stats.timestamps, sm::description("Total number of timestamps received"), labels),
+            sm::make_counter("hit_requests", _stats.hits, sm::description("Number of clientlib requests fulfilled without waiting"), labels),
+            sm::make_counter("failed_requests", _stats.failed, sm::description("Total number of failed requests"), labels),
+            sm::make_gauge("hit_ratio", [this]{ return _stats.requests == 0 ? 0.0 : (double)_stats.hits / _stats.requests; },
+                            sm::description("Fraction of clientlib requests fulfilled without waiting"), labels),
+            sm::make_histogram("request_latency", [this]{ return _requestLatency.getHistogram();}, sm::description("Latency of requests"), labels)
+        });
+    }
+
+    seastar::future<> start() {
+        _stopped = false;
+        if (_mode() != "raw" && _mode() != "clientlib") {
+            K2ERROR("unknown mode: " << _mode());
+            return seastar::make_exception_future(std::runtime_error("unknown mode"));
+        }
+        registerMetrics();
+        _benchFut = _benchFut
+        .then([this]{
+            return _mode() == "raw" ? _discoverWorkers() : seastar::make_ready_future();
+        })
+        .then([this]() {
+            return _benchmark();
+        })
+        .handle_exception([this](auto exc) {
+            K2ERROR_EXC("Unable to execute benchmark", exc);
+            return seastar::make_ready_future<>();
+        })
+        .then([this] {
+            // report to core 0 for the summary
+            BenchStats stats = _stats;
+            stats.seconds = std::chrono::duration<double>(_end - _start).count();
+            auto& hist = _requestLatency.getHistogram();
+            stats.latencySum = hist.sample_sum;
+            stats.latencyCount = hist.sample_count;
+            for (auto& bucket: hist.buckets) {
+                stats.bucketBounds.push_back(bucket.upper_bound);
+                stats.bucketCounts.push_back(bucket.count);
+            }
+            return k2::AppBase().getDist<Client>().invoke_on(0, &Client::_addReport, std::move(stats));
+        })
+        .finally([this]() {
+            K2INFO("Done with benchmark");
+        });
+
+        return seastar::make_ready_future();
+    }
+
+private:
+    seastar::future<> _discoverWorkers() {
+        auto tso = k2::RPC().getTXEndpoint(_tsoEndpoint());
+        if (!tso) {
+            return seastar::make_exception_future(std::runtime_error("invalid tso endpoint"));
+        }
+        return k2::RPC().sendRequest(k2::dto::Verbs::GET_TSO_WORKERS_URLS, tso->newPayload(), *tso, 1s)
+        .then([this](std::unique_ptr<k2::Payload> payload) {
+            std::vector<std::vector<k2::String>> workerURLs;
+            if (!payload || !payload->read(workerURLs) || workerURLs.empty()) {
+                return seastar::make_exception_future(std::runtime_error("no TSO workers"));
+            }
+            for (auto& urls: workerURLs) {
+                for (auto& url: urls) {
+                    auto ep = k2::RPC().getTXEndpoint(url);
+                    if (ep && ep->getProtocol() == k2::TCPRPCProtocol::proto) {
+                        _workers.push_back(std::move(ep));
+                        break;
+                    }
+                }
+            }
+            if (_workers.empty()) {
+                return seastar::make_exception_future(std::runtime_error("no usable TSO worker endpoint"));
+            }
+            return seastar::make_ready_future();
+        });
+    }
+
+    seastar::future<> _benchmark() {
+        K2INFO("Starting benchmark with mode=" << _mode() <<
+             ", with batchSize=" << _batchSize() <<
+             ", with pipelineDepth=" << _pipelineDepth() <<
+             ", with testDuration=" << _testDuration());
+        _start = k2::Clock::now();
+        std::vector<seastar::future<>> reqFuts;
+        reqFuts.push_back(seastar::sleep(_testDuration()).then([this]{_stopped = true;}));
+        for (size_t i = 0; i < _pipelineDepth(); ++i) {
+            reqFuts.push_back(_mode() == "raw" ? _runRawRequest(seastar::engine().cpu_id() + i) : _runClientLibRequest());
+        }
+        return seastar::when_all_succeed(reqFuts.begin(), reqFuts.end())
+        .then([this] {
+            _end = k2::Clock::now();
+        });
+    }
+
+    seastar::future<> _runRawRequest(size_t workerIdx) {
+        return seastar::do_with(workerIdx, [this](size_t& workerIdx) {
+            return seastar::do_until(
+                [this] { return _stopped; },
+                [this, &workerIdx] {
+                    auto& ep = *_workers[(workerIdx++) % _workers.size()];
+                    auto payload = ep.newPayload();
+                    payload->write(_batchSize());
+                    payload->write(k2::dto::TimestampBatch::WireVersion);
+                    auto started = k2::Clock::now();
+                    return k2::RPC().sendRequest(k2::dto::Verbs::GET_TSO_TIMESTAMP_BATCH, std::move(payload), ep, 1s)
+                    .then([this, started](std::unique_ptr<k2::Payload> reply) {
+                        k2::dto::TimestampBatch batch;
+                        if (!reply || !reply->read(batch)) {
+                            _stats.failed++;
+                            return;
+                        }
+                        _requestLatency.add(k2::Clock::now() - started);
+                        _stats.requests++;
+                        _stats.timestamps += batch.TSCount;
+                        _stats.requestedTimestamps += _batchSize();
+                    })
+                    .handle_exception([this](auto exc) {
+                        _stats.failed++;
+                        K2WARN_EXC("batch request failed", exc);
+                    });
+                });
+        });
+    }
+
+    seastar::future<> _runClientLibRequest() {
+        return seastar::do_until(
+            [this] { return _stopped; },
+            [this] {
+                auto started = k2::Clock::now();
+                auto fut = k2::AppBase().getDist<k2::TSO_ClientLib>().local().GetTimestampFromTSO(started);
+                if (fut.available() && !fut.failed()) {
+                    _stats.hits++;
+                }
+                return fut.then([this, started](k2::dto::Timestamp&&) {
+                    _requestLatency.add(k2::Clock::now() - started);
+                    _stats.requests++;
+                    _stats.timestamps++;
+                })
+                .handle_exception([this](auto exc) {
+                    _stats.failed++;
+                    K2WARN_EXC("timestamp request failed", exc);
+                });
+            });
+    }
+
+    // runs on core 0, aggregates reports from all cores and outputs the summary once all of them reported
+    void _addReport(BenchStats stats) {
+        _summary.merge(stats);
+        if (++_reports < seastar::smp::count) {
+            return;
+        }
+
+        double secs = std::max(_summary.seconds, 1e-9);
+        std::ostringstream json;
+        json << "{\"mode\": \"" << _mode() << "\""
+             << ", \"cores\": " << seastar::smp::count
+             << ", \"pipeline_depth\": " << _pipelineDepth()
+             << ", \"batch_size\": " << _batchSize()
+             << ", \"duration_sec\": " << _summary.seconds
+             << ", \"requests\": " << _summary.requests
+             << ", \"failed_requests\": " << _summary.failed
+             << ", \"timestamps\": " << _summary.timestamps
+             << ", \"timestamps_per_sec\": " << (uint64_t)(_summary.timestamps / secs)
+             << ", \"requests_per_sec\": " << (uint64_t)(_summary.requests / secs)
+             << ", \"hit_ratio\": " << (_summary.requests == 0 ? 0.0 : (double)_summary.hits / _summary.requests)
+             << ", \"batch_fill_ratio\": " << (_summary.requestedTimestamps == 0 ? 0.0 : (double)_summary.timestamps / _summary.requestedTimestamps)
+             << ", \"latency_usec\": {\"mean\": " << (_summary.latencyCount == 0 ? 0.0 : _summary.latencySum / _summary.latencyCount)
+             << ", \"p50\": " << _summary.percentile(0.5)
+             << ", \"p90\": " << _summary.percentile(0.9)
+             << ", \"p99\": " << _summary.percentile(0.99)
+             << ", \"p999\": " << _summary.percentile(0.999) << "}}";
+        K2INFO("Summary: " << json.str());
+        if (!_jsonSummary().empty()) {
+            std::ofstream out(_jsonSummary());
+            out << json.str() << std::endl;
+        }
+    }
+
+private:
+    k2::ConfigVar<k2::String> _tsoEndpoint{"tso_endpoint"};
+    k2::ConfigVar<k2::String> _mode{"mode", "raw"};
+    k2::ConfigDuration _testDuration{"test_duration", 30s};
+    k2::ConfigVar<uint16_t> _batchSize{"batch_size"};
+    k2::ConfigVar<uint32_t> _pipelineDepth{"pipeline_depth"};
+    k2::ConfigVar<std::string> _jsonSummary{"json_summary"};
+    std::vector<std::unique_ptr<k2::TXEndpoint>> _workers;
+    sm::metric_groups _metric_groups;
+    k2::ExponentialHistogram _requestLatency;
+    BenchStats _stats;
+    // core 0 only
+    BenchStats _summary;
+    unsigned _reports{0};
+    k2::TimePoint _start;
+    k2::TimePoint _end;
+    seastar::future<> _benchFut = seastar::make_ready_future();
+    bool _stopped = true;
+}; // class Client
+
+int main(int argc, char** argv) {
+    k2::App app("TSOBenchClient");
+    app.addApplet<k2::TSO_ClientLib>(0s);
+    app.addApplet<Client>();
+    app.addOptions()
+        ("tso_endpoint", bpo::value<k2::String>(), "URL of Timestamp Oracle (TSO), e.g. 'tcp+k2rpc://192.168.1.2:12345'")
+        ("tso_standby_endpoints", bpo::value<std::vector<k2::String>>()->multitoken()->default_value(std::vector<k2::String>()), "clientlib mode: A list(space-delimited) of URLs of other TSO server instances to fail over to")
+        ("tso_client_failover_timeout", bpo::value<k2::ParseableDuration>(), "clientlib mode: max time to find a new master TSO server")
+        ("mode", bpo::value<k2::String>()->default_value("raw"), "'raw' to send GET_TSO_TIMESTAMP_BATCH to TSO workers directly, or 'clientlib' to get timestamps through TSO client lib")
+        ("batch_size", bpo::value<uint16_t>()->default_value(8), "How many timestamps to request in each batch in raw mode")
+        ("pipeline_depth", bpo::value<uint32_t>()->default_value(10), "How many requests to have in the pipeline per core")
+        ("tso_client_min_batch_size", bpo::value<uint16_t>(), "clientlib mode: min timestamp batch size")
+        ("tso_client_max_batch_size", bpo::value<uint16_t>(), "clientlib mode: max timestamp batch size")
+        ("tso_client_prefetch", bpo::value<bool>(), "clientlib mode: enable timestamp batch prefetch")
+        ("tso_client_prefetch_margin", bpo::value<k2::ParseableDuration>(), "clientlib mode: extra time ahead of batch RTT to prefetch")
+        ("tso_client_adaptive_timeout", bpo::value<bool>(), "clientlib mode: derive the batch request timeout from the observed batch RTT")
+        ("tso_client_timeout_multiplier", bpo::value<double>(), "clientlib mode: adaptive batch request timeout as a multiple of the p99 batch RTT")
+        ("tso_client_min_timeout", bpo::value<k2::ParseableDuration>(), "clientlib mode: lower bound of the adaptive batch request timeout")
+        ("tso_client_master_lease", bpo::value<k2::ParseableDuration>(), "clientlib mode: the TSO master lease, batch requests to a server give up within it and fail over")
+        ("tso_client_batch_retries", bpo::value<int>(), "clientlib mode: how many times a batch request is tried before failing over")
+        ("tso_client_master_check_timeout", bpo::value<k2::ParseableDuration>(), "clientlib mode: timeout of asking a TSO server if it is the master")
+        ("json_summary", bpo::value<std::string>()->default_value(""), "Write the JSON summary to this file, in addition to the log")
+        ("test_duration", bpo::value<k2::ParseableDuration>(), "How long to run");
+    return app.start(argc, argv);
+}
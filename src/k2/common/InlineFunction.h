@@ -0,0 +1,132 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace k2 {
+
+// A move-only, type-erased callable, similar to std::function, but which always stores the callable inline, in a
+// buffer of the given capacity. Callables which don't fit are rejected at compile time, so construction never
+// allocates and calling it is a single indirect call.
+template <typename Signature, size_t Capacity = 64>
+class InlineFunction;
+
+template <typename R, typename... Args, size_t Capacity>
+class InlineFunction<R(Args...), Capacity> {
+public:
+    // the largest callable this function can hold
+    static constexpr size_t capacity = Capacity;
+
+    InlineFunction() = default;
+    InlineFunction(std::nullptr_t) {}
+
+    template <typename Func, typename = std::enable_if_t<!std::is_same_v<std::decay_t<Func>, InlineFunction>>>
+    InlineFunction(Func&& func) {
+        using F = std::decay_t<Func>;
+        static_assert(sizeof(F) <= Capacity,
+                      "callable is too large for this InlineFunction: capture less state by value(e.g. capture a "
+                      "pointer to it), or move the state to the heap and capture the owning pointer");
+        static_assert(alignof(F) <= alignof(std::max_align_t), "callable alignment is not supported");
+        new (&_storage) F(std::forward<Func>(func));
+        _call = &_callImpl<F>;
+        _manage = &_manageImpl<F>;
+    }
+
+    InlineFunction(InlineFunction&& o) noexcept {
+        _moveFrom(o);
+    }
+
+    InlineFunction& operator=(InlineFunction&& o) noexcept {
+        if (this != &o) {
+            _reset();
+            _moveFrom(o);
+        }
+        return *this;
+    }
+
+    InlineFunction& operator=(std::nullptr_t) noexcept {
+        _reset();
+        return *this;
+    }
+
+    ~InlineFunction() {
+        _reset();
+    }
+
+    R operator()(Args... args) {
+        return _call(&_storage, std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const { return _call != nullptr; }
+
+private:
+    // moves the callable from src into dst when dst is given, otherwise destroys the callable in src
+    typedef void (*Manager_t)(void* src, void* dst);
+    typedef R (*Caller_t)(void* storage, Args&&... args);
+
+    template <typename F>
+    static R _callImpl(void* storage, Args&&... args) {
+        return (*static_cast<F*>(storage))(std::forward<Args>(args)...);
+    }
+
+    template <typename F>
+    static void _manageImpl(void* src, void* dst) {
+        if (dst) {
+            new (dst) F(std::move(*static_cast<F*>(src)));
+        }
+        static_cast<F*>(src)->~F();
+    }
+
+    void _moveFrom(InlineFunction& o) noexcept {
+        if (o._call) {
+            o._manage(&o._storage, &_storage);
+            _call = o._call;
+            _manage = o._manage;
+            o._call = nullptr;
+            o._manage = nullptr;
+        }
+    }
+
+    void _reset() noexcept {
+        if (_call) {
+            _manage(&_storage, nullptr);
+            _call = nullptr;
+            _manage = nullptr;
+        }
+    }
+
+    std::aligned_storage_t<Capacity, alignof(std::max_align_t)> _storage;
+    Caller_t _call = nullptr;
+    Manager_t _manage = nullptr;
+
+private: // not needed
+    InlineFunction(const InlineFunction&) = delete;
+    InlineFunction& operator=(const InlineFunction&) = delete;
+};
+
+} // ns k2
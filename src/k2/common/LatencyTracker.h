@@ -0,0 +1,116 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// stl
+#include <algorithm>
+#include <array>
+
+// k2
+#include "Common.h"
+
+namespace k2 {
+
+// Tracks the latencies of recent operations (e.g. the requests sent to an endpoint) and estimates percentiles
+// over a sliding window of the most recent samples, as well as an exponentially weighted moving average.
+// The sorted view of the window is only refreshed every few samples, so percentiles may lag slightly behind
+class LatencyTracker {
+public:
+    // the number of most recent samples we keep
+    static constexpr size_t WINDOW = 128;
+    // how many new samples we allow before refreshing the sorted view
+    static constexpr size_t RESORT_INTERVAL = 16;
+    // the weight of the newest sample in the moving average
+    static constexpr double EWMA_WEIGHT = 0.125;
+    // the estimates are only considered reliable once we have this many samples
+    static constexpr size_t MIN_SAMPLES = 32;
+
+    // record the latency of a completed operation
+    void record(Duration latency) {
+        double nanos = nsec(latency).count();
+        _ewmaNanos = _count == 0 ? nanos : (1 - EWMA_WEIGHT) * _ewmaNanos + EWMA_WEIGHT * nanos;
+        _samples[_next] = latency;
+        _next = (_next + 1) % WINDOW;
+        if (_count < WINDOW) {
+            _count++;
+        }
+        _unsorted++;
+    }
+
+    // Record an operation which did not complete within the given timeout. We only know that its latency is at
+    // least the timeout, so the timeout is recorded as a (censored) sample. Without these samples, a timeout derived
+    // from the estimate would never grow after the latency goes up, since all the slow operations would time out.
+    // The sorted view is refreshed on the next query, so that the tail estimate reacts to the timeout right away
+    void recordTimeout(Duration timeout) {
+        record(timeout);
+        _unsorted = RESORT_INTERVAL;
+    }
+
+    // the estimated latency at the given percentile (in [0, 100]). Returns Duration::zero() if there are no samples
+    Duration percentile(double p) {
+        if (_count == 0) {
+            return Duration::zero();
+        }
+        if (_unsorted >= RESORT_INTERVAL || _sortedCount != _count) {
+            std::copy(_samples.begin(), _samples.begin() + _count, _sorted.begin());
+            std::sort(_sorted.begin(), _sorted.begin() + _count);
+            _sortedCount = _count;
+            _unsorted = 0;
+        }
+        auto idx = static_cast<size_t>(p / 100 * (_sortedCount - 1) + 0.5);
+        return _sorted[std::min(idx, _sortedCount - 1)];
+    }
+
+    // the moving average of the latency. Returns Duration::zero() if there are no samples
+    Duration average() const {
+        return std::chrono::duration_cast<Duration>(std::chrono::nanoseconds(static_cast<int64_t>(_ewmaNanos)));
+    }
+
+    // A timeout derived from the tail latency: multiplier x p99, clamped to [minTimeout, maxTimeout].
+    // Returns maxTimeout until we have enough samples to trust the estimate
+    Duration timeout(double multiplier, Duration minTimeout, Duration maxTimeout) {
+        if (_count < MIN_SAMPLES) {
+            return maxTimeout;
+        }
+        auto derived = std::chrono::duration_cast<Duration>(
+            std::chrono::nanoseconds(static_cast<int64_t>(nsec(percentile(99)).count() * multiplier)));
+        return std::clamp(derived, minTimeout, std::max(minTimeout, maxTimeout));
+    }
+
+    // the number of samples in the window
+    size_t count() const {
+        return _count;
+    }
+
+private:
+    std::array<Duration, WINDOW> _samples;
+    std::array<Duration, WINDOW> _sorted;
+    size_t _next = 0;
+    size_t _count = 0;
+    size_t _sortedCount = 0;
+    size_t _unsorted = 0;
+    double _ewmaNanos = 0;
+};
+
+} // namespace k2
@@ -25,8 +25,214 @@ Copyright(c) 2020 Futurewei Cloud
 
 namespace k2 {
 
+// the client which receives the partition map updates pushed by the CPO to this core
+static thread_local CPOClient* updateReceiver = nullptr;
+
 CPOClient::CPOClient(String cpo_url) {
     cpo = RPC().getTXEndpoint(cpo_url);
+    _registerMetrics();
+}
+
+CPOClient::CPOClient() {
+    _registerMetrics();
+}
+
+seastar::future<> CPOClient::gracefulStop() {
+    if (_receivesUpdates) {
+        RPC().registerMessageObserver(dto::Verbs::CPO_PARTITION_MAP_UPDATE, nullptr);
+        updateReceiver = nullptr;
+        _receivesUpdates = false;
+    }
+    return seastar::make_ready_future<>();
+}
+
+void CPOClient::_registerMetrics() {
+    namespace sm = seastar::metrics;
+    // there may be multiple clients on a core
+    static thread_local uint64_t clientId = 0;
+    _clientId = clientId++;
+    _metricGroups.clear();
+    std::vector<sm::label_instance> labels{sm::label_instance("cpo_client_id", _clientId)};
+    _metricGroups.add_group("cpo_client", {
+        sm::make_counter("hedgeable_requests", _hedgeStats->hedgeable,
+            sm::description("Total partition requests eligible for hedging"), labels),
+        sm::make_counter("hedged_requests", _hedgeStats->hedged,
+            sm::description("Total partition requests which were hedged"), labels),
+        sm::make_counter("hedge_wins", _hedgeStats->hedgeWins,
+            sm::description("Total hedged partition requests which were answered by the hedge first"), labels),
+        sm::make_gauge("hedge_rate",
+            [stats=_hedgeStats] { return stats->hedgeable ? double(stats->hedged) / stats->hedgeable : 0.0; },
+            sm::description("Fraction of hedgeable partition requests which were hedged"), labels),
+    });
+}
+
+void CPOClient::_registerEndpointMetrics(const String& url) {
+    namespace sm = seastar::metrics;
+    std::vector<sm::label_instance> labels{sm::label_instance("cpo_client_id", _clientId),
+                                           sm::label_instance("endpoint", url)};
+    auto nanos = [latencies=_latencies, url] (auto&& getter) {
+        return [latencies, url, getter] {
+            auto it = latencies->find(url);
+            return it == latencies->end() ? 0.0 : double(nsec(getter(it->second)).count());
+        };
+    };
+    _endpointMetricGroups[url].add_group("cpo_client", {
+        sm::make_gauge("endpoint_latency_ewma_ns", nanos([] (LatencyTracker& lt) { return lt.average(); }),
+            sm::description("Moving average of the partition request latency to the endpoint in nanoseconds"), labels),
+        sm::make_gauge("endpoint_latency_p50_ns", nanos([] (LatencyTracker& lt) { return lt.percentile(50); }),
+            sm::description("Recent median partition request latency to the endpoint in nanoseconds"), labels),
+        sm::make_gauge("endpoint_latency_p99_ns", nanos([] (LatencyTracker& lt) { return lt.percentile(99); }),
+            sm::description("Recent 99th percentile partition request latency to the endpoint in nanoseconds"), labels),
+        sm::make_gauge("endpoint_timeout_ns",
+            nanos([adaptive=partition_request_adaptive_timeout(), k=partition_request_timeout_multiplier(),
+                   minTimeout=partition_request_min_timeout(), maxTimeout=partition_request_timeout()] (LatencyTracker& lt) {
+                return adaptive ? lt.timeout(k, minTimeout, maxTimeout) : maxTimeout;
+            }),
+            sm::description("Timeout currently used for partition requests to the endpoint in nanoseconds"), labels),
+    });
+}
+
+LatencyTracker& CPOClient::_getLatency(const String& url) {
+    auto [it, inserted] = _latencies->try_emplace(url);
+    if (inserted) {
+        _registerEndpointMetrics(url);
+    }
+    return it->second;
+}
+
+dto::PartitionGetter* CPOClient::_findCollection(const String& name) {
+    if (_lastCollection && name == _lastCollectionName) {
+        return _lastCollection;
+    }
+    auto it = collections.find(name);
+    if (it == collections.end()) {
+        return nullptr;
+    }
+    _lastCollectionName = name;
+    _lastCollection = &it->second;
+    return _lastCollection;
+}
+
+void CPOClient::_pruneEndpoints() {
+    std::unordered_set<String> live;
+    for (auto& [name, getter]: collections) {
+        live.merge(getter.getEndpointURLs());
+    }
+    for (auto it = _latencies->begin(); it != _latencies->end();) {
+        if (live.count(it->first) == 0) {
+            K2DEBUG("no longer tracking endpoint " << it->first);
+            _endpointMetricGroups.erase(it->first);
+            it = _latencies->erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+Duration CPOClient::_partitionTimeout(const String& url) {
+    if (!partition_request_adaptive_timeout()) {
+        return partition_request_timeout();
+    }
+    return _getLatency(url).timeout(partition_request_timeout_multiplier(), partition_request_min_timeout(),
+                                    partition_request_timeout());
+}
+
+Duration CPOClient::_partitionBackoff(const String& url) {
+    if (!partition_request_adaptive_timeout()) {
+        // retry right away, as we always have
+        return Duration::zero();
+    }
+    return _getLatency(url).average();
+}
+
+bool CPOClient::_registerUpdateObserver() {
+    if (_receivesUpdates) {
+        return true;
+    }
+    if (updateReceiver != nullptr) {
+        K2DEBUG("another client already receives partition map updates on this core");
+        return false;
+    }
+    RPC().registerRPCObserver<dto::PartitionMapUpdateRequest, dto::PartitionMapUpdateResponse>
+    (dto::Verbs::CPO_PARTITION_MAP_UPDATE, [this](dto::PartitionMapUpdateRequest&& update) {
+        return _handlePartitionMapUpdate(std::move(update));
+    });
+    updateReceiver = this;
+    _receivesUpdates = true;
+    return true;
+}
+
+void CPOClient::_subscribe(const String& name) {
+    if (!cpo || _subscriptions.count(name) || !_registerUpdateObserver()) {
+        return;
+    }
+    // the CPO pushes the updates over our connection to it, so we don't need to accept connections
+    _subscriptions.insert(name);
+    auto request = seastar::make_lw_shared<dto::CollectionSubscribeRequest>();
+    request->name = name;
+    (void) RPC().callRPC<dto::CollectionSubscribeRequest, dto::CollectionSubscribeResponse>
+    (dto::Verbs::CPO_COLLECTION_SUBSCRIBE, *request, *cpo, cpo_request_timeout())
+    .then([this, request](auto&& result) {
+        auto& [status, resp] = result;
+        if (!status.is2xxOK()) {
+            K2WARN("unable to subscribe to collection " << request->name << ": " << status);
+            // try again the next time we fetch the collection
+            _subscriptions.erase(request->name);
+            return;
+        }
+        auto it = collections.find(request->name);
+        if (it != collections.end() && it->second.collection.partitionMap.version < resp.version) {
+            // the map changed between our fetch and the subscription
+            _refreshCollection(request->name);
+        }
+    });
+}
+
+seastar::future<std::tuple<Status, dto::PartitionMapUpdateResponse>>
+CPOClient::_handlePartitionMapUpdate(dto::PartitionMapUpdateRequest&& update) {
+    auto it = collections.find(update.name);
+    if (it == collections.end()) {
+        return RPCResponse(Statuses::S404_Not_Found("collection not known"), dto::PartitionMapUpdateResponse());
+    }
+    auto& getter = it->second;
+    auto version = getter.collection.partitionMap.version;
+    if (version >= update.version) {
+        // we already have this change
+        return RPCResponse(Statuses::S200_OK("already up to date"), dto::PartitionMapUpdateResponse());
+    }
+    if (version != update.baseVersion) {
+        K2DEBUG("missed partition map updates for collection " << update.name << ", have version=" << version
+                << ", update baseVersion=" << update.baseVersion);
+        _refreshCollection(update.name);
+        return RPCResponse(Statuses::S200_OK("refreshing collection"), dto::PartitionMapUpdateResponse());
+    }
+
+    K2DEBUG("applying partition map update for collection " << update.name << " to version " << update.version);
+    dto::Collection collection = getter.collection;
+    for (auto& changed : update.partitions) {
+        auto& partitions = collection.partitionMap.partitions;
+        auto pit = std::find_if(partitions.begin(), partitions.end(),
+                                [&changed](const dto::Partition& p) { return p.pvid.id == changed.pvid.id; });
+        if (pit != partitions.end()) {
+            *pit = std::move(changed);
+        } else {
+            partitions.push_back(std::move(changed));
+        }
+    }
+    collection.partitionMap.version = update.version;
+    // the map node stays the same, so the collectionsById entry remains valid
+    getter = dto::PartitionGetter(std::move(collection));
+    _pruneEndpoints();
+    return RPCResponse(Statuses::S200_OK("partition map updated"), dto::PartitionMapUpdateResponse());
+}
+
+void CPOClient::_refreshCollection(const String& name) {
+    (void) GetAssignedPartitionWithRetry(Deadline<>(cpo_request_timeout()), name, dto::Key{.partitionKey = "", .rangeKey = ""}, 0)
+    .then([name](Status&& status) {
+        K2DEBUG("refreshed collection " << name << " with status " << status);
+        (void) status;
+    });
 }
 
 void CPOClient::FulfillWaiters(const String& name, const Status& status) {
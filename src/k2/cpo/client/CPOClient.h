@@ -24,13 +24,17 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <tuple>
 
 #include <seastar/core/future.hh>  // for future stuff
+#include <seastar/core/metrics.hh>
 #include <seastar/core/sleep.hh>
+#include <seastar/core/timer.hh>
 
 #include <k2/common/Chrono.h>
+#include <k2/common/LatencyTracker.h>
 #include <k2/config/Config.h>
 #include <k2/dto/Collection.h>
 #include <k2/transport/RPCDispatcher.h>
@@ -45,7 +49,10 @@ namespace k2 {
 class CPOClient {
 public:
     CPOClient(String cpo_url);
-    CPOClient() = default;
+    CPOClient();
+
+    // Stops receiving partition map updates from the CPO
+    seastar::future<> gracefulStop();
 
     // Creates a collection and waits for it to be assigned. If the collection already exisits,
     // the future is still completed successfully
@@ -112,8 +119,17 @@ public:
             bool retry = false;
             K2DEBUG("collection get response received with status: " << status << ", for name=["<< name << "]");
             if (status.is2xxOK()) {
-                collections[name] = dto::PartitionGetter(std::move(coll_response.collection));
-                dto::Partition* partition = collections[name].getPartitionForKey(key).partition;
+                auto& getter = collections[name];
+                // the collection may have been re-created under a new id
+                collectionsById.erase(getter.collection.metadata.id);
+                getter = dto::PartitionGetter(std::move(coll_response.collection));
+                // the map nodes are stable, so we can index the same getter by the collection id
+                collectionsById[getter.collection.metadata.id] = &getter;
+                _pruneEndpoints();
+                if (partition_map_subscribe()) {
+                    _subscribe(name);
+                }
+                dto::Partition* partition = getter.getPartitionForKey(key).partition;
                 FulfillWaiters(name, status);
                 if (!partition || partition->astate != dto::AssignmentState::Assigned) {
                     K2DEBUG("No partition or not assigned: " << partition);
@@ -158,50 +174,66 @@ public:
     // Gets the partition endpoint for request's key, executes the request, and refreshes the
     // partition map and retries if necessary. The caller must keep the request alive for the
     // duration of the future.
-    // RequestT must have a pvid field and a collectionName field
+    // RequestT must have a pvid field and a collectionId field. The collection is resolved by name, and the
+    // request's collectionId is filled in from the collection metadata. This should be used at the API boundary
+    // where users address collections by name.
+    template<class RequestT, typename ResponseT, Verb verb, typename ClockT=Clock>
+    seastar::future<std::tuple<Status, ResponseT>> PartitionRequest(Deadline<ClockT> deadline, RequestT& request, const String& collectionName, uint8_t retries=1) {
+        auto* getter = _findCollection(collectionName);
+        if (getter) {
+            request.collectionId = getter->collection.metadata.id;
+            return PartitionRequest<RequestT, ResponseT, verb>(deadline, request, retries);
+        }
+        K2DEBUG("Collection not found");
+        return GetAssignedPartitionWithRetry(deadline, collectionName, request.key)
+        .then([this, deadline, &request, collectionName, retries](Status&& status) {
+            auto* getter = _findCollection(collectionName);
+            if (!getter) {
+                // Failed to get collection, returning status from GetAssignedPartitionWithRetry
+                K2DEBUG("Failed to get collection: " << status);
+                return RPCResponse(std::move(status), ResponseT());
+            }
+            request.collectionId = getter->collection.metadata.id;
+            return PartitionRequest<RequestT, ResponseT, verb>(deadline, request, retries);
+        });
+    }
+
+    // Same as above, but routes on the request's collectionId. The collection must have been resolved by name
+    // already (see above) so that we know which collection to refresh from the CPO
     template<class RequestT, typename ResponseT, Verb verb, typename ClockT=Clock>
     seastar::future<std::tuple<Status, ResponseT>> PartitionRequest(Deadline<ClockT> deadline, RequestT& request, uint8_t retries=1) {
         K2DEBUG("making partition request with deadline=" << deadline.getRemaining());
-        // If collection is not in cache or partition is not assigned, get collection first
+        auto it = collectionsById.find(request.collectionId);
+        if (it == collectionsById.end()) {
+            K2DEBUG("Collection id not found: " << request.collectionId);
+            return RPCResponse(Statuses::S404_Not_Found("collection id not known"), ResponseT());
+        }
+        // If partition is not assigned, refresh the collection first
         seastar::future<Status> f = seastar::make_ready_future<Status>(Statuses::S200_OK("default cached response"));
-        auto it = collections.find(request.collectionName);
-        if (it == collections.end()) {
-            K2DEBUG("Collection not found");
-            f = GetAssignedPartitionWithRetry(deadline, request.collectionName, request.key);
-        } else {
-            K2DEBUG("Collection found");
-            dto::Partition* partition = collections[request.collectionName].getPartitionForKey(request.key).partition;
-            if (!partition || partition->astate != dto::AssignmentState::Assigned) {
-                K2DEBUG("Collection found but is in bad state");
-                f = GetAssignedPartitionWithRetry(deadline, request.collectionName, request.key);
-            }
+        dto::Partition* partition = it->second->getPartitionForKey(request.key).partition;
+        if (!partition || partition->astate != dto::AssignmentState::Assigned) {
+            K2DEBUG("Collection found but is in bad state");
+            f = GetAssignedPartitionWithRetry(deadline, it->second->collection.metadata.name, request.key);
         }
 
         return f.then([this, deadline, &request, retries](Status&& status) {
             K2DEBUG("Collection get completed with status: " << status << ", request="<< request);
-            auto it = collections.find(request.collectionName);
-
-            if (it == collections.end()) {
-                // Failed to get collection, returning status from GetAssignedPartitionWithRetry
-                K2DEBUG("Failed to get collection: " << status);
-                return RPCResponse(std::move(status), ResponseT());
-            }
-
+            (void) status;
             // Try to get partition info
-            auto& partition = collections[request.collectionName].getPartitionForKey(request.key);
+            auto& partition = collectionsById[request.collectionId]->getPartitionForKey(request.key);
             if (!partition.partition || partition.partition->astate != dto::AssignmentState::Assigned) {
                 // Partition is still not assigned after refresh attempts
                 K2DEBUG("Failed to get assigned partition");
                 return RPCResponse(Statuses::S503_Service_Unavailable("partition not assigned"), ResponseT());
             }
 
-            Duration timeout = std::min(deadline.getRemaining(), partition_request_timeout());
+            Duration timeout = std::min(deadline.getRemaining(), _partitionTimeout(partition.preferredEndpoint->getURL()));
             request.pvid = partition.partition->pvid;
             K2DEBUG("making partition call to " << partition.preferredEndpoint->getURL() << ", with timeout=" << timeout);
 
             // Attempt the request RPC
-            return RPC().callRPC<RequestT, ResponseT>(verb, request, *partition.preferredEndpoint, timeout).
-            then([this, &request, deadline, retries] (auto&& result) {
+            return _callPartition<RequestT, ResponseT>(verb, request, partition, timeout).
+            then([this, &request, deadline, retries, url=partition.preferredEndpoint->getURL()] (auto&& result) {
                 auto& [status, k2response] = result;
                 K2DEBUG("partition call completed with status " << status);
 
@@ -221,8 +253,25 @@ public:
                     return RPCResponse(Statuses::S408_Request_Timeout("partition retries exceeded"), ResponseT());
                 }
 
-                // S410_Gone (refresh partition map) or retryable error
-                return GetAssignedPartitionWithRetry(deadline, request.collectionName, request.key, 1)
+                if (status == Statuses::S410_Gone("") && _hasNewerPartition(request)) {
+                    // the partition map was already updated (e.g. pushed by the CPO) so there is no need to ask the CPO
+                    K2DEBUG("partition map already updated, retrying with pvid=" << request.pvid);
+                    return PartitionRequest<RequestT, ResponseT, verb>(deadline, request, retries-1);
+                }
+
+                if (status == Statuses::S410_Gone("")) {
+                    // the change was not pushed to us, e.g. the CPO restarted or our connection to it was closed,
+                    // so subscribe again when we fetch the collection
+                    _subscriptions.erase(collectionsById[request.collectionId]->collection.metadata.name);
+                }
+                // S410_Gone (refresh partition map) or retryable error. Back off for about one round trip
+                // to the endpoint before retrying so that a transient loss does not cost a full fixed timeout
+                Duration backoff = std::min(deadline.getRemaining(), _partitionBackoff(url));
+                auto f = backoff > Duration::zero() ? seastar::sleep(backoff) : seastar::make_ready_future<>();
+                return f.then([this, &request, deadline] {
+                    auto& name = collectionsById[request.collectionId]->collection.metadata.name;
+                    return GetAssignedPartitionWithRetry(deadline, name, request.key, 1);
+                })
                 .then([this, &request, deadline, retries] (Status&& status) {
                     K2DEBUG("retrying partition call after status " << status);
                     (void) status;
@@ -232,15 +281,191 @@ public:
         });
     }
 
+    // Hedging is only safe for operations which can be executed more than once
+    static constexpr bool isIdempotent(Verb verb) {
+        return verb == dto::Verbs::K23SI_READ || verb == dto::Verbs::K23SI_TXN_HEARTBEAT ||
+               verb == dto::Verbs::K23SI_TXN_FINALIZE;
+    }
+
     std::unique_ptr<TXEndpoint> cpo;
     std::unordered_map<String, dto::PartitionGetter> collections;
+    // the same getters as in collections, indexed by collection id
+    std::unordered_map<uint64_t, dto::PartitionGetter*> collectionsById;
 
     ConfigDuration partition_request_timeout{"partition_request_timeout", 100ms};
     ConfigDuration cpo_request_timeout{"cpo_request_timeout", 100ms};
     ConfigDuration cpo_request_backoff{"cpo_request_backoff", 500ms};
+    // send a duplicate of slow idempotent partition requests to an alternate endpoint of the partition
+    ConfigVar<bool> partition_request_hedging{"partition_request_hedging", false};
+    // derive the partition request timeout from the observed latency of the endpoint:
+    // multiplier x p99, clamped to [partition_request_min_timeout, partition_request_timeout]
+    ConfigVar<bool> partition_request_adaptive_timeout{"partition_request_adaptive_timeout", false};
+    ConfigVar<double> partition_request_timeout_multiplier{"partition_request_timeout_multiplier", 4.0};
+    ConfigDuration partition_request_min_timeout{"partition_request_min_timeout", 500us};
+    // subscribe to partition map changes of the collections we use, so that the CPO pushes them to us instead of us
+    // discovering them through failed requests. Only one client per core can receive the updates, and the client
+    // must not be moved once it has subscribed
+    ConfigVar<bool> partition_map_subscribe{"partition_map_subscribe", false};
+
 private:
+    // Counters for hedged requests. Shared with the registered metrics so that the client can be moved
+    struct HedgeStats {
+        // requests which could have been hedged
+        uint64_t hedgeable = 0;
+        // requests for which we sent a duplicate
+        uint64_t hedged = 0;
+        // hedged requests which were answered by the duplicate first
+        uint64_t hedgeWins = 0;
+    };
+
+    // The state of a hedged request, shared between the two attempts
+    template <typename ResponseT>
+    struct HedgeState : public seastar::enable_lw_shared_from_this<HedgeState<ResponseT>> {
+        seastar::promise<std::tuple<Status, ResponseT>> promise;
+        seastar::timer<> hedgeTimer;
+        // to cancel the losing attempt
+        RPCDispatcher::RequestHandle primary;
+        RPCDispatcher::RequestHandle hedge;
+        size_t outstanding = 1;
+        bool done = false;
+    };
+
+    // Sends the request to the partition's preferred endpoint. Idempotent requests are hedged if enabled: if there
+    // is no response after the p95 latency of the endpoint, a duplicate is sent to the alternate endpoint (another
+    // node which serves the partition) and whichever response arrives first is used. The other attempt is cancelled
+    template <typename RequestT, typename ResponseT>
+    seastar::future<std::tuple<Status, ResponseT>>
+    _callPartition(Verb verb, RequestT& request, dto::PartitionGetter::PartitionWithEndpoint& partition, Duration timeout) {
+        auto& latency = _getLatency(partition.preferredEndpoint->getURL());
+        // callRPC needs a mutable endpoint
+        auto call = [verb, &request, latencies=_latencies] (TXEndpoint& ep, Duration timeout, RPCDispatcher::RequestHandle* handle) {
+            auto start = Clock::now();
+            return RPC().callRPC<RequestT, ResponseT>(verb, request, ep, timeout, handle)
+            .then([latencies, start, timeout, url=ep.getURL()] (std::tuple<Status, ResponseT>&& result) {
+                // We only track the endpoints which are still in use (see _pruneEndpoints)
+                auto it = latencies->find(url);
+                if (it == latencies->end()) {
+                    return std::move(result);
+                }
+                auto elapsed = Clock::now() - start;
+                if (!std::get<0>(result).is5xxRetryable()) {
+                    it->second.record(elapsed);
+                }
+                else if (elapsed >= timeout) {
+                    // we timed out. Failures which come back early (e.g. a cancelled hedge) say nothing about latency
+                    it->second.recordTimeout(timeout);
+                }
+                return std::move(result);
+            });
+        };
+        if (!partition_request_hedging() || !isIdempotent(verb) || !partition.alternateEndpoint) {
+            return call(*partition.preferredEndpoint, timeout, nullptr);
+        }
+        _hedgeStats->hedgeable++;
+        auto delay = latency.percentile(95);
+        if (latency.count() < LatencyTracker::MIN_SAMPLES || delay >= timeout) {
+            return call(*partition.preferredEndpoint, timeout, nullptr);
+        }
+
+        auto state = seastar::make_lw_shared<HedgeState<ResponseT>>();
+        auto complete = [stats=_hedgeStats] (HedgeState<ResponseT>& st, bool isHedge, std::tuple<Status, ResponseT>&& result) {
+            st.outstanding--;
+            if (st.done) {
+                return;
+            }
+            if (std::get<0>(result).is5xxRetryable() && st.outstanding > 0) {
+                // the other attempt may still succeed
+                return;
+            }
+            st.done = true;
+            st.hedgeTimer.cancel();
+            // the loser's response is of no use to us. Its completion is ignored above
+            RPC().cancelRequest(isHedge ? st.primary : st.hedge);
+            if (isHedge) {
+                stats->hedgeWins++;
+            }
+            st.promise.set_value(std::move(result));
+        };
+        state->hedgeTimer.set_callback(
+            [st=state.get(), call, complete, stats=_hedgeStats, ep=TXEndpoint(*partition.alternateEndpoint), remaining=timeout - delay] () mutable {
+                // the timer is cancelled once the request completes, so the state is still alive here
+                K2DEBUG("hedging request to " << ep.getURL());
+                stats->hedged++;
+                st->outstanding++;
+                (void) call(ep, remaining, &st->hedge).then([state=st->shared_from_this(), complete] (auto&& result) {
+                    complete(*state, true, std::move(result));
+                });
+            });
+        state->hedgeTimer.arm(delay);
+        (void) call(*partition.preferredEndpoint, timeout, &state->primary).then([state, complete] (auto&& result) {
+            complete(*state, false, std::move(result));
+        });
+        return state->promise.get_future();
+    }
+
+    // Returns true if the partition which owns the request's key has changed since the request was made
+    template <typename RequestT>
+    bool _hasNewerPartition(RequestT& request) {
+        auto& partition = collectionsById[request.collectionId]->getPartitionForKey(request.key);
+        return partition.partition && partition.partition->astate == dto::AssignmentState::Assigned &&
+               partition.partition->pvid != request.pvid;
+    }
+
+    // Subscribes to the partition map changes of the given collection, unless we have subscribed already
+    void _subscribe(const String& name);
+    // the collections we have subscribed to
+    std::unordered_set<String> _subscriptions;
+
+    // Registers this client to receive the partition map updates on this core. Returns false if another client
+    // on this core already receives them
+    bool _registerUpdateObserver();
+
+    // Applies a partition map change pushed by the CPO
+    seastar::future<std::tuple<Status, dto::PartitionMapUpdateResponse>>
+    _handlePartitionMapUpdate(dto::PartitionMapUpdateRequest&& update);
+
+    // Fetches the collection from the CPO in the background, e.g. after we missed a partition map update
+    void _refreshCollection(const String& name);
+
+    // the latency estimate for the given endpoint. Registers the endpoint metrics when we first see it
+    LatencyTracker& _getLatency(const String& url);
+
+    // the timeout to use for a partition request to the given endpoint
+    Duration _partitionTimeout(const String& url);
+
+    // how long to wait before retrying a failed partition request to the given endpoint
+    Duration _partitionBackoff(const String& url);
+
+    // Returns the getter for the collection with the given name, or nullptr if we don't have the collection.
+    // The collection resolved last is remembered, so that the usual caller which addresses the same collection over
+    // and over doesn't hash the name on every request
+    dto::PartitionGetter* _findCollection(const String& name);
+
+    // Stops tracking the endpoints which are no longer used by any partition we know about, so that the latency
+    // estimates and their metrics don't grow without bound as partitions move around
+    void _pruneEndpoints();
+
+    void _registerMetrics();
+    void _registerEndpointMetrics(const String& url);
+
     void FulfillWaiters(const String& name, const Status& status);
     std::unordered_map<String, std::vector<seastar::promise<Status>>> requestWaiters;
+
+    // latency estimates for the partition endpoints we have talked to, by URL.
+    // Shared with the in-flight requests and the registered metrics so that the client can be moved
+    seastar::lw_shared_ptr<std::unordered_map<String, LatencyTracker>> _latencies =
+        seastar::make_lw_shared<std::unordered_map<String, LatencyTracker>>();
+
+    seastar::lw_shared_ptr<HedgeStats> _hedgeStats = seastar::make_lw_shared<HedgeStats>();
+    uint64_t _clientId = 0;
+    // the metrics of each tracked endpoint, so that they can be removed along with the endpoint
+    std::unordered_map<String, seastar::metrics::metric_groups> _endpointMetricGroups;
+    // see _findCollection(). The getters are never removed from collections, so the pointer stays valid
+    String _lastCollectionName;
+    dto::PartitionGetter* _lastCollection = nullptr;
+    // true if this client receives the partition map updates on this core
+    bool _receivesUpdates = false;
+    seastar::metrics::metric_groups _metricGroups;
 };
 
 } // ns k2
@@ -37,6 +37,26 @@ Copyright(c) 2020 Futurewei Cloud
 
 namespace k2 {
 
+namespace {
+// The format of the collection files written before collections had ids(see dto::CollectionMetadata::id)
+struct LegacyCollectionMetadata {
+    String name;
+    dto::HashScheme hashScheme;
+    dto::StorageDriver storageDriver;
+    dto::CollectionCapacity capacity;
+    Duration retentionPeriod{0};
+    Duration heartbeatDeadline{0};
+    K2_PAYLOAD_FIELDS(name, hashScheme, storageDriver, capacity, retentionPeriod, heartbeatDeadline);
+};
+
+struct LegacyCollection {
+    dto::PartitionMap partitionMap;
+    std::unordered_map<String, String> userMetadata;
+    LegacyCollectionMetadata metadata;
+    K2_PAYLOAD_FIELDS(partitionMap, userMetadata, metadata);
+};
+} // namespace
+
 CPOService::CPOService(DistGetter distGetter) : _dist(distGetter) {
     K2INFO("ctor");
 }
@@ -52,6 +72,12 @@ seastar::future<> CPOService::gracefulStop() {
         futs.push_back(std::move(v));
     }
     _assignments.clear();
+    futs.push_back(std::move(_pushes));
+    _pushes = seastar::make_ready_future<>();
+    _subscribers.clear();
+    // wait for the changes and writes in progress
+    futs.push_back(seastar::with_semaphore(_changeLock, 1, [] { return seastar::make_ready_future<>(); }));
+    futs.push_back(seastar::with_semaphore(_writeLock, 1, [] { return seastar::make_ready_future<>(); }));
     return seastar::when_all_succeed(futs.begin(), futs.end()).discard_result();
 }
 
@@ -61,15 +87,22 @@ seastar::future<> CPOService::start() {
         return _dist().invoke_on(0, &CPOService::handleCreate, std::move(request));
     });
 
+    // gets are served by the receiving core, from its snapshot of the collections
     RPC().registerRPCObserver<dto::CollectionGetRequest, dto::CollectionGetResponse>(dto::Verbs::CPO_COLLECTION_GET, [this](dto::CollectionGetRequest&& request) {
-        return _dist().invoke_on(0, &CPOService::handleGet, std::move(request));
+        return handleGet(std::move(request));
+    });
+
+    // subscriptions are kept by the receiving core, since we need the connection they arrived on to push the changes
+    RPC().registerMessageObserver(dto::Verbs::CPO_COLLECTION_SUBSCRIBE, [this](Request&& request) {
+        handleSubscribe(std::move(request));
     });
 
     if (seastar::engine().cpu_id() == 0) {
-        // only core 0 handles CPO business
+        // only core 0 handles CPO mutations
         if (!fileutil::makeDir(_dataDir())) {
             throw std::runtime_error("unable to create data directory");
         }
+        return _loadLastCollectionId();
     }
     return seastar::make_ready_future<>();
 }
@@ -77,10 +110,29 @@ seastar::future<> CPOService::start() {
 seastar::future<std::tuple<Status, dto::CollectionCreateResponse>>
 CPOService::handleCreate(dto::CollectionCreateRequest&& request) {
     K2INFO("Received collection create request for " << request.metadata.name);
-    auto cpath = _getCollectionPath(request.metadata.name);
-    if (fileutil::fileExists(cpath)) {
+    auto name = request.metadata.name;
+    if (_collections.count(name) || !_pendingCreates.insert(name).second) {
         return RPCResponse(Statuses::S403_Forbidden("collection already exists"), dto::CollectionCreateResponse());
     }
+    // the name stays reserved until the create completes, successfully or not
+    return _getCollection(name)
+    .then([this, request=std::move(request)](std::tuple<Status, dto::Collection>&& result) mutable {
+        auto& [status, existing] = result;
+        if (status.is2xxOK()) {
+            return RPCResponse(Statuses::S403_Forbidden("collection already exists"), dto::CollectionCreateResponse());
+        }
+        if (status != Statuses::S404_Not_Found("")) {
+            return RPCResponse(std::move(status), dto::CollectionCreateResponse());
+        }
+        return _createCollection(std::move(request));
+    })
+    .finally([this, name=std::move(name)] {
+        _pendingCreates.erase(name);
+    });
+}
+
+seastar::future<std::tuple<Status, dto::CollectionCreateResponse>>
+CPOService::_createCollection(dto::CollectionCreateRequest&& request) {
     request.metadata.heartbeatDeadline = _collectionHeartbeatDeadline();
     // create a collection from the incoming request
     dto::Collection collection;
@@ -107,26 +159,126 @@ CPOService::handleCreate(dto::CollectionCreateRequest&& request) {
         collection.partitionMap.partitions.push_back(std::move(part));
         collection.partitionMap.version++;
     }
-    auto status = _saveCollection(collection);
-    if (!status.is2xxOK()) {
-        return RPCResponse(std::move(status), dto::CollectionCreateResponse());
-    }
 
-    K2INFO("Created collection: " << cpath);
-    _assignCollection(collection);
-    return RPCResponse(std::move(status), dto::CollectionCreateResponse());
+    return _allocateCollectionId()
+    .then([this, collection=std::move(collection)](std::tuple<Status, uint64_t>&& idResult) mutable {
+        auto& [idStatus, id] = idResult;
+        if (!idStatus.is2xxOK()) {
+            return RPCResponse(std::move(idStatus), dto::CollectionCreateResponse());
+        }
+        collection.metadata.id = id;
+        return seastar::do_with(std::move(collection), [this](dto::Collection& collection) {
+            return _saveCollection(collection)
+            .then([this, &collection](Status&& status) {
+                if (!status.is2xxOK()) {
+                    return RPCResponse(std::move(status), dto::CollectionCreateResponse());
+                }
+
+                K2INFO("Created collection: " << _getCollectionPath(collection.metadata.name));
+                _assignCollection(collection);
+                // make sure every core can serve the new collection before we respond
+                return _replicate(collection).then([status=std::move(status)] () mutable {
+                    return RPCResponse(std::move(status), dto::CollectionCreateResponse());
+                });
+            });
+        });
+    });
 }
 
 seastar::future<std::tuple<Status, dto::CollectionGetResponse>>
 CPOService::handleGet(dto::CollectionGetRequest&& request) {
-    K2INFO("Received collection get request for " << request.name);
-    auto [status, collection] = _getCollection(request.name);
+    K2DEBUG("Received collection get request for " << request.name);
+    auto it = _collections.find(request.name);
+    if (it != _collections.end()) {
+        dto::CollectionGetResponse response;
+        response.collection = it->second;
+        return RPCResponse(Statuses::S200_OK("collection found"), std::move(response));
+    }
+    if (seastar::engine().cpu_id() != 0) {
+        // we don't have a snapshot of this collection yet. Ask core 0 and keep what it returns
+        return _dist().invoke_on(0, &CPOService::handleGet, std::move(request))
+        .then([this](std::tuple<Status, dto::CollectionGetResponse>&& result) {
+            auto& [status, resp] = result;
+            if (status.is2xxOK()) {
+                _cacheCollection(dto::Collection(resp.collection));
+            }
+            return seastar::make_ready_future<std::tuple<Status, dto::CollectionGetResponse>>(std::move(result));
+        });
+    }
+    return _getCollection(request.name)
+    .then([](std::tuple<Status, dto::Collection>&& result) {
+        auto& [status, collection] = result;
+        dto::CollectionGetResponse response;
+        if (status.is2xxOK()) {
+            response.collection = std::move(collection);
+        }
+        return RPCResponse(std::move(status), std::move(response));
+    });
+}
+
+void CPOService::handleSubscribe(Request&& request) {
+    dto::CollectionSubscribeRequest subscribe;
+    dto::CollectionSubscribeResponse response;
+    Status status;
+    if (!request.payload || !request.payload->read(subscribe)) {
+        status = Statuses::S400_Bad_Request("unable to parse subscribe request");
+    }
+    else {
+        K2INFO("Received subscription for collection " << subscribe.name << ", from " << request.endpoint.getURL());
+        // subscribers fetch the collection from this core before they subscribe, so we should have a snapshot
+        auto it = _collections.find(subscribe.name);
+        if (it == _collections.end()) {
+            status = Statuses::S404_Not_Found("collection not found");
+        }
+        else {
+            _subscribers[subscribe.name].insert(request.endpoint);
+            response.version = it->second.partitionMap.version;
+            status = Statuses::S200_OK("subscribed");
+        }
+    }
+    auto reply = request.endpoint.newPayload();
+    reply->setCompactEncoding(request.payload && request.payload->isCompactEncoding());
+    reply->write(status);
+    reply->write(response);
+    RPC().sendReply(std::move(reply), request);
+}
 
-    dto::CollectionGetResponse response;
-    if (status.is2xxOK()) {
-        response.collection = std::move(collection);
+void CPOService::_pushUpdate(dto::PartitionMapUpdateRequest&& update) {
+    auto it = _subscribers.find(update.name);
+    if (it == _subscribers.end() || it->second.empty()) {
+        return;
+    }
+    K2DEBUG("pushing partition map update for collection " << update.name << " to " << it->second.size() << " subscribers");
+    auto request = seastar::make_lw_shared<dto::PartitionMapUpdateRequest>(std::move(update));
+    std::vector<seastar::future<>> futs;
+    for (auto subscriber : it->second) {
+        futs.push_back(
+        RPC().callRPC<dto::PartitionMapUpdateRequest, dto::PartitionMapUpdateResponse>
+                (dto::Verbs::CPO_PARTITION_MAP_UPDATE, *request, subscriber, _assignTimeout())
+        .then([this, request, subscriber](auto&& result) {
+            auto& [status, resp] = result;
+            if (!status.is2xxOK()) {
+                // e.g. the subscriber's connection is gone. It will find out about changes the slow way (S410_Gone)
+                // and subscribe again
+                K2WARN("dropping subscriber " << subscriber.getURL() << " of collection " << request->name << ", due to: " << status);
+                _subscribers[request->name].erase(subscriber);
+            }
+            return seastar::make_ready_future();
+        })
+        );
     }
-    return RPCResponse(std::move(status), std::move(response));
+    _pushes = seastar::when_all_succeed(std::move(_pushes), seastar::when_all_succeed(futs.begin(), futs.end()))
+        .discard_result();
+}
+
+seastar::future<> CPOService::_publish(const dto::Collection& collection, const dto::PartitionMapUpdateRequest& update) {
+    _pushUpdate(dto::PartitionMapUpdateRequest(update));
+    // Each core installs the snapshot before it pushes the change. A subscription which arrives before that gets
+    // the old version and receives the push, and one which arrives after gets the new version
+    return _dist().invoke_on_others([collection, update](CPOService& svc) {
+        svc._cacheCollection(dto::Collection(collection));
+        svc._pushUpdate(dto::PartitionMapUpdateRequest(update));
+    });
 }
 
 String CPOService::_getCollectionPath(String name) {
@@ -161,7 +313,7 @@ void CPOService::_assignCollection(dto::Collection& collection) {
             auto& [status, resp] = result;
             if (status.is2xxOK()) {
                 K2INFO("assignment successful for collection " << name << ", for partition " << resp.assignedPartition);
-                _handleCompletedAssignment(name, std::move(resp));
+                return _handleCompletedAssignment(name, std::move(resp));
             }
             else {
                 // The node refused to accept the assignment. For now, just ignore this
@@ -178,12 +330,27 @@ void CPOService::_assignCollection(dto::Collection& collection) {
         }));
 }
 
-void CPOService::_handleCompletedAssignment(const String& cname, dto::AssignmentCreateResponse&& request) {
-    auto [status, haveCollection] = _getCollection(cname);
-    if (!status.is2xxOK()) {
+seastar::future<> CPOService::_handleCompletedAssignment(const String& cname, dto::AssignmentCreateResponse&& request) {
+    return _getCollection(cname)
+    .then([this, cname, request=std::move(request)](std::tuple<Status, dto::Collection>&& result) mutable {
+        if (!std::get<0>(result).is2xxOK()) {
+            K2ERROR("unable to find collection which reported assignment " << cname);
+            return seastar::make_ready_future();
+        }
+        return seastar::with_semaphore(_changeLock, 1, [this, cname, request=std::move(request)]() mutable {
+            return _applyCompletedAssignment(cname, std::move(request));
+        });
+    });
+}
+
+seastar::future<> CPOService::_applyCompletedAssignment(const String& cname, dto::AssignmentCreateResponse&& request) {
+    auto it = _collections.find(cname);
+    if (it == _collections.end()) {
         K2ERROR("unable to find collection which reported assignment " << cname);
-        return;
+        return seastar::make_ready_future();
     }
+    // work on the current in-memory collection, which holds every change saved before this one
+    dto::Collection haveCollection = it->second;
     for (auto& part: haveCollection.partitionMap.partitions) {
         if (part.startKey == request.assignedPartition.startKey &&
             part.endKey == request.assignedPartition.endKey &&
@@ -193,40 +360,185 @@ void CPOService::_handleCompletedAssignment(const String& cname, dto::Assignment
                 K2INFO("Assignment received for active partition " << request.assignedPartition);
                 part.astate = request.assignedPartition.astate;
                 part.endpoints = std::move(request.assignedPartition.endpoints);
-                _saveCollection(haveCollection);
-                return;
+                // every change to the partition map gets a new version so that subscribers can apply the changes in order
+                dto::PartitionMapUpdateRequest update{
+                    .name = cname,
+                    .baseVersion = haveCollection.partitionMap.version,
+                    .version = haveCollection.partitionMap.version + 1,
+                    .partitions = {part}
+                };
+                haveCollection.partitionMap.version = update.version;
+                return seastar::do_with(std::move(haveCollection), std::move(update),
+                    [this, cname](dto::Collection& haveCollection, dto::PartitionMapUpdateRequest& update) {
+                    return _saveCollection(haveCollection)
+                    .then([this, cname, &haveCollection, &update](Status&& status) {
+                        if (!status.is2xxOK()) {
+                            K2ERROR("unable to save assignment for collection " << cname << ": " << status);
+                            return seastar::make_ready_future();
+                        }
+                        return _publish(haveCollection, update);
+                    });
+                });
         }
     }
     K2ERROR("assignment completion does not match any stored partitions: " << request.assignedPartition);
+    return seastar::make_ready_future();
+}
+
+void CPOService::_cacheCollection(dto::Collection&& collection) {
+    auto it = _collections.find(collection.metadata.name);
+    if (it == _collections.end()) {
+        auto name = collection.metadata.name;
+        _collections.emplace(std::move(name), std::move(collection));
+    }
+    else if (it->second.partitionMap.version <= collection.partitionMap.version) {
+        // snapshots from core 0 may race with replicated ones. Never go back to an older version
+        it->second = std::move(collection);
+    }
 }
 
-std::tuple<Status, dto::Collection> CPOService::_getCollection(String name) {
+seastar::future<> CPOService::_replicate(const dto::Collection& collection) {
+    return _dist().invoke_on_others([collection](CPOService& svc) {
+        svc._cacheCollection(dto::Collection(collection));
+    });
+}
+
+seastar::future<std::tuple<Status, dto::Collection>> CPOService::_getCollection(String name) {
+    auto it = _collections.find(name);
+    if (it != _collections.end()) {
+        return seastar::make_ready_future<std::tuple<Status, dto::Collection>>(
+            std::make_tuple(Statuses::S200_OK("collection found"), it->second));
+    }
     auto cpath = _getCollectionPath(name);
-    std::tuple<Status, dto::Collection> result;
-    Payload p;
-    if (!fileutil::readFile(p, cpath)) {
-        std::get<0>(result) = Statuses::S404_Not_Found("collection not found");
-        return result;
-    }
-    if (!p.read(std::get<1>(result))) {
-        std::get<0>(result) = Statuses::S500_Internal_Server_Error("unable to read collection data");
-        return result;
-    };
-    K2INFO("Found collection in: " << cpath);
-    std::get<0>(result) = Statuses::S200_OK("collection found");
-    return result;
-}
-
-Status CPOService::_saveCollection(dto::Collection& collection) {
+    return seastar::do_with(Payload(), [this, cpath](Payload& p) {
+        return fileutil::readFileAsync(p, cpath)
+        .then([this, &p, cpath](bool success) {
+            std::tuple<Status, dto::Collection> result;
+            if (!success) {
+                std::get<0>(result) = Statuses::S404_Not_Found("collection not found");
+                return seastar::make_ready_future<std::tuple<Status, dto::Collection>>(std::move(result));
+            }
+            if (!p.read(std::get<1>(result))) {
+                // files written before collections had ids don't have the id field
+                p.seek(0);
+                LegacyCollection legacy;
+                if (!p.read(legacy)) {
+                    std::get<0>(result) = Statuses::S500_Internal_Server_Error("unable to read collection data");
+                    return seastar::make_ready_future<std::tuple<Status, dto::Collection>>(std::move(result));
+                }
+                K2INFO("Found collection without id in: " << cpath);
+                dto::Collection collection{
+                    .partitionMap = std::move(legacy.partitionMap),
+                    .userMetadata = std::move(legacy.userMetadata),
+                    .metadata{
+                        .name = std::move(legacy.metadata.name),
+                        .hashScheme = legacy.metadata.hashScheme,
+                        .storageDriver = legacy.metadata.storageDriver,
+                        .capacity = legacy.metadata.capacity,
+                        .retentionPeriod = legacy.metadata.retentionPeriod,
+                        .heartbeatDeadline = legacy.metadata.heartbeatDeadline
+                    }
+                };
+                return _migrateCollection(std::move(collection));
+            }
+            K2INFO("Found collection in: " << cpath);
+            std::get<0>(result) = Statuses::S200_OK("collection found");
+            _cacheCollection(dto::Collection(std::get<1>(result)));
+            return seastar::make_ready_future<std::tuple<Status, dto::Collection>>(std::move(result));
+        });
+    });
+}
+
+seastar::future<std::tuple<Status, dto::Collection>> CPOService::_migrateCollection(dto::Collection&& collection) {
+    return _allocateCollectionId()
+    .then([this, collection=std::move(collection)](std::tuple<Status, uint64_t>&& idResult) mutable {
+        auto& [idStatus, id] = idResult;
+        if (!idStatus.is2xxOK()) {
+            return seastar::make_ready_future<std::tuple<Status, dto::Collection>>(
+                std::make_tuple(std::move(idStatus), dto::Collection()));
+        }
+        return seastar::with_semaphore(_changeLock, 1, [this, id, collection=std::move(collection)]() mutable {
+            auto it = _collections.find(collection.metadata.name);
+            if (it != _collections.end()) {
+                // a concurrent load migrated the collection while we were allocating the id
+                return seastar::make_ready_future<std::tuple<Status, dto::Collection>>(
+                    std::make_tuple(Statuses::S200_OK("collection found"), it->second));
+            }
+            collection.metadata.id = id;
+            K2INFO("Migrating collection " << collection.metadata.name << " to id " << id);
+            return seastar::do_with(std::move(collection), [this](dto::Collection& collection) {
+                return _saveCollection(collection)
+                .then([&collection](Status&& status) {
+                    if (!status.is2xxOK()) {
+                        return std::make_tuple(std::move(status), dto::Collection());
+                    }
+                    return std::make_tuple(Statuses::S200_OK("collection found"), dto::Collection(collection));
+                });
+            });
+        });
+    });
+}
+
+seastar::future<> CPOService::_loadLastCollectionId() {
+    auto idpath = _getCollectionIdPath();
+    return fileutil::fileExistsAsync(idpath)
+    .then([this, idpath](bool exists) {
+        if (!exists) {
+            return seastar::make_ready_future<>();
+        }
+        return seastar::do_with(Payload(), [this, idpath](Payload& p) {
+            return fileutil::readFileAsync(p, idpath)
+            .then([this, &p](bool success) {
+                if (!success || !p.read(_lastCollectionId)) {
+                    return seastar::make_exception_future<>(std::runtime_error("unable to read last collection id"));
+                }
+                K2INFO("last allocated collection id is " << _lastCollectionId);
+                return seastar::make_ready_future<>();
+            });
+        });
+    });
+}
+
+seastar::future<std::tuple<Status, uint64_t>> CPOService::_allocateCollectionId() {
+    // the id is taken right away so that concurrent creates get different ids. The writes are serialized, so the
+    // file always ends up with the largest id
+    auto id = ++_lastCollectionId;
+    Payload p([] { return Binary(4096); });
+    p.write(id);
+    return _writeFile(std::move(p), _getCollectionIdPath())
+    .then([id](bool success) -> std::tuple<Status, uint64_t> {
+        if (!success) {
+            return {Statuses::S500_Internal_Server_Error("unable to write last collection id"), 0};
+        }
+        K2INFO("allocated collection id " << id);
+        return {Statuses::S200_OK("allocated collection id"), id};
+    });
+}
+
+seastar::future<Status> CPOService::_saveCollection(dto::Collection& collection) {
     auto cpath = _getCollectionPath(collection.metadata.name);
     Payload p([] { return Binary(4096); });
     p.write(collection);
-    if (!fileutil::writeFile(std::move(p), cpath)) {
-        return Statuses::S500_Internal_Server_Error("unable to write collection data");
-    }
+    return _writeFile(std::move(p), cpath)
+    .then([this, &collection, cpath](bool success) {
+        if (!success) {
+            return Statuses::S500_Internal_Server_Error("unable to write collection data");
+        }
+        // only serve what is on disk
+        _cacheCollection(dto::Collection(collection));
+        K2DEBUG("saved collection: " << cpath);
+        return Statuses::S201_Created("collection created");
+    });
+}
+
+seastar::future<bool> CPOService::_writeFile(Payload&& payload, String path) {
+    return seastar::with_semaphore(_writeLock, 1, [payload=std::move(payload), path]() mutable {
+        return fileutil::writeFileAtomicAsync(std::move(payload), path);
+    });
+}
 
-    K2DEBUG("saved collection: " << cpath);
-    return Statuses::S201_Created("collection created");
+String CPOService::_getCollectionIdPath() {
+    return _dataDir() + "/collection.id";
 }
 
 } // namespace k2
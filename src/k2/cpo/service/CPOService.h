@@ -23,14 +23,21 @@ Copyright(c) 2020 Futurewei Cloud
 
 #pragma once
 
+// stl
+#include <unordered_set>
+
 // third-party
 #include <seastar/core/distributed.hh>
 #include <seastar/core/future.hh>  // for future stuff
+#include <seastar/core/semaphore.hh>
 
 #include <k2/appbase/AppEssentials.h>
 #include <k2/dto/ControlPlaneOracle.h>
 #include <k2/dto/AssignmentManager.h>
+#include <k2/transport/Payload.h>
+#include <k2/transport/Request.h>
 #include <k2/transport/Status.h>
+#include <k2/transport/TXEndpoint.h>
 
 namespace k2 {
 
@@ -44,9 +51,56 @@ private:
     ConfigDuration _assignTimeout{"assignment_timeout", 10ms};
     ConfigDuration _collectionHeartbeatDeadline{"heartbeat_deadline", 100ms};
     std::unordered_map<String, seastar::future<>> _assignments;
-    std::tuple<Status, dto::Collection> _getCollection(String name);
-    Status _saveCollection(dto::Collection& collection);
-    void _handleCompletedAssignment(const String& cname, dto::AssignmentCreateResponse&& request);
+    // Read-only snapshots of the collections, by name, kept on every core so that gets can be served by the core
+    // which receives them. Core 0 owns the collections: it makes all changes, persists them, and replicates the
+    // new snapshots to the other cores. Other cores ask core 0 for collections they don't have yet
+    std::unordered_map<String, dto::Collection> _collections;
+    // installs the given snapshot, unless we already have a newer one
+    void _cacheCollection(dto::Collection&& collection);
+    // sends the given snapshot to all other cores
+    seastar::future<> _replicate(const dto::Collection& collection);
+    // core 0 only: returns the collection, loading it from disk if we don't have it in memory
+    seastar::future<std::tuple<Status, dto::Collection>> _getCollection(String name);
+    // core 0 only: gives a collection loaded from a file written before collections had ids a new id, and saves
+    // it in the current format
+    seastar::future<std::tuple<Status, dto::Collection>> _migrateCollection(dto::Collection&& collection);
+    // core 0 only: persists the collection, and updates the local snapshot once it is on disk. The collection must
+    // stay alive until the returned future completes. Use _replicate to update the other cores
+    seastar::future<Status> _saveCollection(dto::Collection& collection);
+    // core 0 only: serializes the changes which read the current collection and save a new version of it, so that
+    // each change builds on the last saved one even though the snapshot is only updated after the write
+    seastar::semaphore _changeLock{1};
+    // allocates the next collection id. The last allocated id is persisted so that ids are never reused
+    seastar::future<std::tuple<Status, uint64_t>> _allocateCollectionId();
+    seastar::future<> _loadLastCollectionId();
+    String _getCollectionIdPath();
+    uint64_t _lastCollectionId = 0;
+    // Persistence uses seastar's async file API so that the reactor which serves CPO requests never blocks on the
+    // disk. Files are replaced atomically(write a temp file, then rename), and the writes are serialized through
+    // this lock so that the last change always wins
+    seastar::semaphore _writeLock{1};
+    seastar::future<bool> _writeFile(Payload&& payload, String path);
+    seastar::future<std::tuple<Status, dto::CollectionCreateResponse>>
+    _createCollection(dto::CollectionCreateRequest&& request);
+    // core 0 only: the names of the collections which are being created. A name is reserved before the create
+    // suspends for the first time, so that a concurrent create of the same name fails instead of racing with it
+    std::unordered_set<String> _pendingCreates;
+    seastar::future<> _handleCompletedAssignment(const String& cname, dto::AssignmentCreateResponse&& request);
+    // the part of _handleCompletedAssignment which runs under _changeLock
+    seastar::future<> _applyCompletedAssignment(const String& cname, dto::AssignmentCreateResponse&& request);
+    // The subscribers to partition map changes which subscribed on this core, by collection name. Each subscriber
+    // is the endpoint of the connection its subscription arrived on, and the changes are pushed back over that
+    // connection, so subscribers don't need to accept connections. Only kept in memory: subscribers subscribe
+    // again when they find out about a change the slow way, which covers a CPO restart
+    std::unordered_map<String, std::unordered_set<TXEndpoint>> _subscribers;
+    // the partition map updates which are still being delivered to subscribers
+    seastar::future<> _pushes = seastar::make_ready_future<>();
+    // push the given update to the subscribers of the collection on this core. Subscribers which fail to receive
+    // it are dropped
+    void _pushUpdate(dto::PartitionMapUpdateRequest&& update);
+    // core 0 only: sends the changed collection to the other cores, and pushes the change to the subscribers of
+    // every core
+    seastar::future<> _publish(const dto::Collection& collection, const dto::PartitionMapUpdateRequest& update);
 
    public:  // application lifespan
     CPOService(DistGetter distGetter);
@@ -61,6 +115,9 @@ private:
 
     seastar::future<std::tuple<Status, dto::CollectionGetResponse>>
     handleGet(dto::CollectionGetRequest&& request);
+
+    // served by the receiving core, which keeps the subscription. Replies with a CollectionSubscribeResponse
+    void handleSubscribe(Request&& request);
 };  // class CPOService
 
 } // namespace k2
@@ -60,14 +60,39 @@ bool Key::operator==(const Key& o) const noexcept {
 size_t Key::hash() const noexcept {
     return std::hash<k2::String>()(partitionKey) + std::hash<k2::String>()(rangeKey);
 }
-size_t Key::partitionHash() const noexcept {
-    uint32_t c32c = crc32c::Crc32c(partitionKey.c_str(), partitionKey.size());
+static size_t _partitionHash(const char* partitionKey, size_t size) noexcept {
+    uint32_t c32c = crc32c::Crc32c(partitionKey, size);
     uint64_t hash = c32c;
     // shift the existing hash over to the high 32 bits and add it in to get a 64bit hash
     hash += hash << 32;
     return hash;
 }
 
+size_t Key::partitionHash() const noexcept {
+    return _partitionHash(partitionKey.c_str(), partitionKey.size());
+}
+
+int KeyView::compare(const Key& o) const noexcept {
+    auto pkcomp = partitionKey.view().compare(std::string_view(o.partitionKey.data(), o.partitionKey.size()));
+    if (pkcomp == 0) {
+        // if the partition keys are equal, return the comparison of the range keys
+        return rangeKey.view().compare(std::string_view(o.rangeKey.data(), o.rangeKey.size()));
+    }
+    return pkcomp;
+}
+
+bool KeyView::operator==(const Key& o) const noexcept {
+    return compare(o) == 0;
+}
+
+size_t KeyView::partitionHash() const noexcept {
+    return _partitionHash(partitionKey.data(), partitionKey.size());
+}
+
+Key KeyView::toKey() const {
+    return Key{.partitionKey = partitionKey.toString(), .rangeKey = rangeKey.toString()};
+}
+
 bool Partition::PVID::operator==(const Partition::PVID& o) const {
     return id == o.id && rangeVersion == o.rangeVersion && assignmentVersion == o.assignmentVersion;
 }
@@ -80,6 +105,19 @@ PartitionGetter::PartitionWithEndpoint PartitionGetter::GetPartitionWithEndpoint
     PartitionWithEndpoint partition{};
     partition.partition = p;
     partition.preferredEndpoint = Discovery::selectBestEndpoint(p->endpoints);
+    if (partition.preferredEndpoint) {
+        // A node lists one endpoint per transport, so another endpoint over the preferred transport is another node
+        // which serves the partition. Hedging to the preferred node over a different transport would not help
+        std::vector<String> others;
+        for (auto& url: p->endpoints) {
+            auto ep = RPC().getTXEndpoint(url);
+            if (ep && ep->getProtocol() == partition.preferredEndpoint->getProtocol() &&
+                    ep->getURL() != partition.preferredEndpoint->getURL()) {
+                others.push_back(url);
+            }
+        }
+        partition.alternateEndpoint = Discovery::selectBestEndpoint(others);
+    }
 
     return partition;
 }
@@ -112,6 +150,25 @@ PartitionGetter::PartitionGetter(Collection&& col) : collection(std::move(col))
     }
 }
 
+std::unordered_set<String> PartitionGetter::getEndpointURLs() const {
+    std::unordered_set<String> urls;
+    auto add = [&urls](const PartitionWithEndpoint& p) {
+        if (p.preferredEndpoint) {
+            urls.insert(p.preferredEndpoint->getURL());
+        }
+        if (p.alternateEndpoint) {
+            urls.insert(p.alternateEndpoint->getURL());
+        }
+    };
+    for (auto& e: _rangePartitionMap) {
+        add(e.partition);
+    }
+    for (auto& e: _hashPartitionMap) {
+        add(e.partition);
+    }
+    return urls;
+}
+
 PartitionGetter::PartitionWithEndpoint& PartitionGetter::getPartitionForKey(const Key& key) {
     switch (collection.metadata.hashScheme) {
         case HashScheme::Range:
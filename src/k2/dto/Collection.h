@@ -28,6 +28,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <set>
 #include <iostream>
 #include <unordered_map>
+#include <unordered_set>
 #include <functional>
 // Collection-related DTOs
 
@@ -63,6 +64,29 @@ struct Key {
     }
 };
 
+// Zero-copy view of a Key, with the same wire format as Key. A Key field of an incoming request can be read
+// as a KeyView to avoid copying the strings out of the request payload, e.g. for routing and lookups.
+// The views share the request payload buffers.
+struct KeyView {
+    PayloadStringView partitionKey;
+    PayloadStringView rangeKey;
+
+    int compare(const Key& o) const noexcept;
+    bool operator==(const Key& o) const noexcept;
+
+    // partitioning hash used in K2, same as Key::partitionHash()
+    size_t partitionHash() const noexcept;
+
+    // make an owned Key
+    Key toKey() const;
+
+    K2_PAYLOAD_FIELDS(partitionKey, rangeKey);
+
+    friend std::ostream& operator<<(std::ostream& os, const KeyView& key) {
+        return os << "{pkey=" << key.partitionKey << ", rkey=" << key.rangeKey << "}";
+    }
+};
+
 // the assignment state of a partition
 enum class AssignmentState: uint8_t {
     NotAssigned,
@@ -94,7 +118,9 @@ struct Partition {
         uint64_t rangeVersion = 0;
         // version incremented each time we assign the partition to different K2 node
         uint64_t assignmentVersion = 0;
-        K2_PAYLOAD_COPYABLE;
+        // serialized field-by-field(same 24 bytes as a copy in the fixed encoding) so that the compact encoding can
+        // shrink the versions
+        K2_PAYLOAD_FIELDS(id, rangeVersion, assignmentVersion);
 
         // operators
         bool operator==(const PVID& o) const;
@@ -198,7 +224,10 @@ struct CollectionMetadata {
     CollectionCapacity capacity;
     Duration retentionPeriod{0};
     Duration heartbeatDeadline{0}; // set by the CPO
-    K2_PAYLOAD_FIELDS(name, hashScheme, storageDriver, capacity, retentionPeriod, heartbeatDeadline);
+    // set by the CPO. Unique among the collections of the CPO, and never reused. The id identifies the collection
+    // in data requests so that we don't have to ship and compare the name on every request
+    uint64_t id = 0;
+    K2_PAYLOAD_FIELDS(name, hashScheme, storageDriver, capacity, retentionPeriod, heartbeatDeadline, id);
 };
 
 struct Collection {
@@ -214,6 +243,9 @@ public:
     struct PartitionWithEndpoint {
         Partition* partition;
         std::unique_ptr<TXEndpoint> preferredEndpoint;
+        // an endpoint of another node which serves the partition, over the same transport as the preferred
+        // endpoint, if there is one. Used for hedged requests
+        std::unique_ptr<TXEndpoint> alternateEndpoint;
     };
 
     PartitionGetter(Collection&& collection);
@@ -223,6 +255,9 @@ public:
     // Hashes key if hashScheme is not range
     PartitionWithEndpoint& getPartitionForKey(const Key& key);
 
+    // Returns the URLs of the preferred and alternate endpoints of all partitions
+    std::unordered_set<String> getEndpointURLs() const;
+
     Collection collection;
 
 private:
@@ -56,5 +56,38 @@ struct CollectionGetResponse {
     K2_PAYLOAD_FIELDS(collection);
 };
 
+// Request to be notified of changes to the partition map of a collection. The CPO pushes the changes as
+// PartitionMapUpdateRequests over the connection on which it received this request
+struct CollectionSubscribeRequest {
+    // The name of the collection
+    String name;
+    K2_PAYLOAD_FIELDS(name);
+};
+
+// Response to CollectionSubscribeRequest
+struct CollectionSubscribeResponse {
+    // The version of the partition map at the time of subscription
+    uint64_t version = 0;
+    K2_PAYLOAD_FIELDS(version);
+};
+
+// Pushed by the CPO to the subscribers of a collection when its partition map changes
+struct PartitionMapUpdateRequest {
+    // The name of the collection
+    String name;
+    // The version of the partition map to which this update applies
+    uint64_t baseVersion = 0;
+    // The version of the partition map after the update
+    uint64_t version = 0;
+    // The partitions which changed, identified by pvid.id
+    std::vector<Partition> partitions;
+    K2_PAYLOAD_FIELDS(name, baseVersion, version, partitions);
+};
+
+// Response to PartitionMapUpdateRequest
+struct PartitionMapUpdateResponse {
+    K2_PAYLOAD_EMPTY;
+};
+
 }  // namespace dto
 }  // namespace k2
@@ -72,13 +72,13 @@ extern const K23SI_MTR K23SI_MTR_ZERO;
 // The main READ DTO.
 struct K23SIReadRequest {
     Partition::PVID pvid; // the partition version ID. Should be coming from an up-to-date partition map
-    String collectionName; // the name of the collection
+    uint64_t collectionId = 0; // the CPO-assigned id of the collection (see CollectionMetadata::id)
     K23SI_MTR mtr; // the MTR for the issuing transaction
     // use the name "key" so that we can use common routing from CPO client
     Key key; // the key to read
-    K2_PAYLOAD_FIELDS(pvid, collectionName, mtr, key);
+    K2_PAYLOAD_FIELDS(pvid, collectionId, mtr, key);
     friend std::ostream& operator<<(std::ostream& os, const K23SIReadRequest& r) {
-        return os << "{" << "pvid=" << r.pvid << ", colName=" << r.collectionName
+        return os << "{" << "pvid=" << r.pvid << ", collId=" << r.collectionId
                   << ", mtr=" << r.mtr << ", key=" << r.key << "}";
     }
 };
@@ -104,7 +104,7 @@ struct K23SIStatus {
 template <typename ValueType>
 struct K23SIWriteRequest {
     Partition::PVID pvid; // the partition version ID. Should be coming from an up-to-date partition map
-    String collectionName; // the name of the collection
+    uint64_t collectionId = 0; // the CPO-assigned id of the collection (see CollectionMetadata::id)
     K23SI_MTR mtr; // the MTR for the issuing transaction
     // The TRH key is used to find the K2 node which owns a transaction. It should be set to the key of
     // the first write (the write for which designateTRH was set to true)
@@ -116,9 +116,9 @@ struct K23SIWriteRequest {
     // use the name "key" so that we can use common routing from CPO client
     Key key; // the key for the write
     SerializeAsPayload<ValueType> value; // the value of the write
-    K2_PAYLOAD_FIELDS(pvid, collectionName, mtr, trh, isDelete, designateTRH, key, value);
+    K2_PAYLOAD_FIELDS(pvid, collectionId, mtr, trh, isDelete, designateTRH, key, value);
     friend std::ostream& operator<<(std::ostream& os, const K23SIWriteRequest<ValueType>& r) {
-        return os << "{pvid=" << r.pvid << ", colName=" << r.collectionName
+        return os << "{pvid=" << r.pvid << ", collId=" << r.collectionId
                   << ", mtr=" << r.mtr << ", trh=" << r.trh << ", key=" << r.key << ", isDelete="
                   << r.isDelete << ", designate=" <<r.designateTRH << "}";
     }
@@ -131,17 +131,17 @@ struct K23SIWriteResponse {
 struct K23SITxnHeartbeatRequest {
     // the partition version ID for the TRH. Should be coming from an up-to-date partition map
     Partition::PVID pvid;
-    // the name of the collection
-    String collectionName;
+    // the CPO-assigned id of the collection (see CollectionMetadata::id)
+    uint64_t collectionId = 0;
     // trh of the transaction we want to heartbeat.
     // use the name "key" so that we can use common routing from CPO client
     Key key;
     // the MTR for the transaction we want to heartbeat
     K23SI_MTR mtr;
 
-    K2_PAYLOAD_FIELDS(pvid, collectionName, key, mtr);
+    K2_PAYLOAD_FIELDS(pvid, collectionId, key, mtr);
     friend std::ostream& operator<<(std::ostream& os, const K23SITxnHeartbeatRequest& r) {
-        return os << "{pvid=" << r.pvid << ", colName=" << r.collectionName
+        return os << "{pvid=" << r.pvid << ", collId=" << r.collectionId
                   << ", mtr=" << r.mtr << ", key=" << r.key << "}";
     }
 };
@@ -172,8 +172,8 @@ struct K23SI_PersistencePartialUpdate {
 struct K23SITxnPushRequest {
     // the partition version ID for the TRH. Should be coming from an up-to-date partition map
     Partition::PVID pvid;
-    // the name of the collection
-    String collectionName;
+    // the CPO-assigned id of the collection (see CollectionMetadata::id)
+    uint64_t collectionId = 0;
     // trh of the incumbent.
     // use the name "key" so that we can use common routing from CPO client
     Key key;
@@ -182,9 +182,9 @@ struct K23SITxnPushRequest {
     // the MTR for the challenger transaction
     K23SI_MTR challengerMTR;
 
-    K2_PAYLOAD_FIELDS(pvid, collectionName, key, incumbentMTR, challengerMTR);
+    K2_PAYLOAD_FIELDS(pvid, collectionId, key, incumbentMTR, challengerMTR);
     friend std::ostream& operator<<(std::ostream& os, const K23SITxnPushRequest& r) {
-        return os << "{pvid=" << r.pvid << ", colName=" << r.collectionName
+        return os << "{pvid=" << r.pvid << ", collId=" << r.collectionId
                   << ", Imtr=" << r.incumbentMTR << ", Cmtr=" << r.challengerMTR << ", key=" << r.key << "}";
     }
 };
@@ -217,8 +217,8 @@ inline std::ostream& operator<<(std::ostream& os, const EndAction& act) {
 struct K23SITxnEndRequest {
     // the partition version ID for the TRH. Should be coming from an up-to-date partition map
     Partition::PVID pvid;
-    // the name of the collection
-    String collectionName;
+    // the CPO-assigned id of the collection (see CollectionMetadata::id)
+    uint64_t collectionId = 0;
     // trh of the transaction to end.
     // use the name "key" so that we can use common routing from CPO client
     Key key;
@@ -236,9 +236,9 @@ struct K23SITxnEndRequest {
     // This flag does not impact correctness, just performance for certain workloads
     bool syncFinalize=false;
 
-    K2_PAYLOAD_FIELDS(pvid, collectionName, key, mtr, action, writeKeys, syncFinalize);
+    K2_PAYLOAD_FIELDS(pvid, collectionId, key, mtr, action, writeKeys, syncFinalize);
     friend std::ostream& operator<<(std::ostream& os, const K23SITxnEndRequest& r) {
-        os << "{pvid=" << r.pvid << ", colName=" << r.collectionName
+        os << "{pvid=" << r.pvid << ", collId=" << r.collectionId
                   << ", mtr=" << r.mtr << ", action=" << r.action << ", key=" << r.key << ", writeKeys=[";
         for (auto& k: r.writeKeys) {
             os << k << ",";
@@ -254,8 +254,8 @@ struct K23SITxnEndResponse {
 struct K23SITxnFinalizeRequest {
     // the partition version ID for the TRH. Should be coming from an up-to-date partition map
     Partition::PVID pvid;
-    // the name of the collection
-    String collectionName;
+    // the CPO-assigned id of the collection (see CollectionMetadata::id)
+    uint64_t collectionId = 0;
     // trh of the transaction
     Key trh;
     // the MTR for the transaction
@@ -265,9 +265,9 @@ struct K23SITxnFinalizeRequest {
     // should we abort or commit
     EndAction action;
 
-    K2_PAYLOAD_FIELDS(pvid, collectionName, trh, mtr, key, action);
+    K2_PAYLOAD_FIELDS(pvid, collectionId, trh, mtr, key, action);
     friend std::ostream& operator<<(std::ostream& os, const K23SITxnFinalizeRequest& r) {
-        return os << "{pvid=" << r.pvid << ", colName=" << r.collectionName
+        return os << "{pvid=" << r.pvid << ", collId=" << r.collectionId
                   << ", mtr=" << r.mtr << ", trh=" << r.trh << ", key=" << r.key << ", action=" << r.action << "}";
     }
 };
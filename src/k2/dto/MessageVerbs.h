@@ -34,6 +34,10 @@ enum Verbs : k2::Verb {
     CPO_COLLECTION_CREATE = 10,
     // ControlPlaneOracle: asked to return an existing collection
     CPO_COLLECTION_GET,
+    // ControlPlaneOracle: asked to push partition map changes of a collection to the requester
+    CPO_COLLECTION_SUBSCRIBE,
+    // ControlPlaneOracle pushes a partition map change to a subscriber
+    CPO_PARTITION_MAP_UPDATE,
 
     /************ Assignment *****************/
     // K2Assignment: CPO asks K2 to assign a partition
@@ -22,8 +22,10 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #pragma once
+#include <algorithm>
 #include <chrono>
 #include <exception>
+#include <limits>
 
 #include "k2/common/Log.h"
 #include "Timestamp.h"
@@ -34,33 +36,90 @@ namespace k2
 namespace dto
 {
 // timestampBatch between TSO client and TSO server
+// The wire format is versioned to stay compatible with peers which only know version 1, where TSCount is 8 bits and TTLNanoSec is 16 bits.
+// - The client puts the highest version it can read in the batch request, after the batch size. Version 1 clients don't, and version 1
+//   servers ignore it.
+// - The server writes the batch in the requested version (FormatVersion), or in version 1 if the request doesn't have one.
+// - Version 2+ starts with a zero uint64 followed by the explicit version. A version 1 batch starts with TBEBase, which is never zero, so
+//   a reader can tell the two apart no matter what else is in the payload.
 class TimestampBatch
 {
 public:
+    static constexpr uint8_t WireVersion = 2;
 
     uint64_t    TBEBase;        // Timestamp Batch uncertain window End time base, number of nanosecond ticks from TAI
     uint32_t    TSOId;          // TSOId
     uint16_t    TsDelta;        //  time difference between Ts and Te, in nanosecond unit
-    uint16_t    TTLNanoSec;     //  TTL of batch on the client side in nanoseconds
-    uint8_t     TSCount;        //  number of timestamp can be generated from this batch
+    uint32_t    TTLNanoSec;     //  TTL of batch on the client side in nanoseconds
+    uint16_t    TSCount;        //  number of timestamp can be generated from this batch, may span multiple microseconds
     uint8_t     TBENanoSecStep; //  step (number of nanoseconds) to skip between timestamp Te in the batch
+    uint8_t     FormatVersion{WireVersion}; // the wire format version the batch is written in, or was read in
 
 
     // static helper to get  Timestamp from batch
     // caller is responsible to verify usedCount < TSCount and to increment usedCount after call
-    static const Timestamp GenerateTimeStampFromBatch(const TimestampBatch& batch, uint8_t usedCount)
+    static const Timestamp GenerateTimeStampFromBatch(const TimestampBatch& batch, uint16_t usedCount)
     {
         K2ASSERT(usedCount < batch.TSCount, "requested timestamp count too large.");
 
-        uint16_t endingNanoSecAdjust = usedCount * batch.TBENanoSecStep;
+        uint32_t endingNanoSecAdjust = (uint32_t)usedCount * batch.TBENanoSecStep;
         // creat timestamp from batch. Note: tStart are the same for all timestamps in the batch
         Timestamp ts(batch.TBEBase + endingNanoSecAdjust, batch.TSOId, batch.TsDelta + endingNanoSecAdjust);
         return ts;
     }
 
     DEFAULT_COPY_MOVE_INIT(TimestampBatch);
-    K2_PAYLOAD_FIELDS(TBEBase, TSOId, TsDelta, TTLNanoSec, TSCount, TBENanoSecStep);
 
+    // custom serialization instead of K2_PAYLOAD_FIELDS for the versioned wire format described above
+    struct __K2PayloadSerializableTraitTag__ {};
+    void __writeFields(k2::Payload& payload) const {
+        if (FormatVersion < 2) {
+            // TSCount and TTLNanoSec are capped, which is always safe for a version 1 client to use(less timestamps and shorter TTL)
+            uint16_t ttlV1 = (uint16_t)std::min<uint32_t>(TTLNanoSec, std::numeric_limits<uint16_t>::max());
+            uint8_t countV1 = (uint8_t)std::min<uint16_t>(TSCount, std::numeric_limits<uint8_t>::max());
+            payload.writeMany(TBEBase, TSOId, TsDelta, ttlV1, countV1, TBENanoSecStep);
+            return;
+        }
+        payload.writeMany(VersionMarker, FormatVersion, TBEBase, TSOId, TsDelta, TTLNanoSec, TSCount, TBENanoSecStep);
+    }
+    bool __readFields(k2::Payload& payload) {
+        uint64_t first;
+        if (!payload.read(first)) {
+            return false;
+        }
+        if (first != VersionMarker) {
+            // version 1, which starts with TBEBase
+            uint16_t ttlV1;
+            uint8_t countV1;
+            if (!payload.readMany(TSOId, TsDelta, ttlV1, countV1, TBENanoSecStep)) {
+                return false;
+            }
+            TBEBase = first;
+            TTLNanoSec = ttlV1;
+            TSCount = countV1;
+            FormatVersion = 1;
+            return true;
+        }
+        // the server only writes versions we asked for
+        if (!payload.read(FormatVersion) || FormatVersion < 2 || FormatVersion > WireVersion) {
+            return false;
+        }
+        return payload.readMany(TBEBase, TSOId, TsDelta, TTLNanoSec, TSCount, TBENanoSecStep);
+    }
+    template <bool Compact = false>
+    size_t __getFieldsSize() const {
+        if (FormatVersion < 2) {
+            uint16_t ttlV1 = (uint16_t)std::min<uint32_t>(TTLNanoSec, std::numeric_limits<uint16_t>::max());
+            uint8_t countV1 = (uint8_t)std::min<uint16_t>(TSCount, std::numeric_limits<uint8_t>::max());
+            return k2::Payload::getSerializedSizeOfMany<Compact>(TBEBase, TSOId, TsDelta, ttlV1, countV1, TBENanoSecStep);
+        }
+        return k2::Payload::getSerializedSizeOfMany<Compact>(VersionMarker, FormatVersion, TBEBase, TSOId, TsDelta, TTLNanoSec, TSCount,
+                                                             TBENanoSecStep);
+    }
+
+private:
+    // a version 1 batch starts with TBEBase, which is never zero
+    static constexpr uint64_t VersionMarker = 0;
 };
 }  // dto
 }  // k2 
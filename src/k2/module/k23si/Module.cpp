@@ -56,34 +56,8 @@ K23SIPartitionModule::K23SIPartitionModule(dto::CollectionMetadata cmeta, dto::P
 
 seastar::future<> K23SIPartitionModule::start() {
     K2DEBUG("Starting for partition: " << _partition);
-    RPC().registerRPCObserver<dto::K23SIReadRequest, dto::K23SIReadResponse<Payload>>(dto::Verbs::K23SI_READ, [this](dto::K23SIReadRequest&& request) {
-        return handleRead(std::move(request), dto::K23SI_MTR_ZERO, FastDeadline(_config.readTimeout()));
-    });
-
-    RPC().registerRPCObserver<dto::K23SIWriteRequest<Payload>, dto::K23SIWriteResponse>(dto::Verbs::K23SI_WRITE, [this](dto::K23SIWriteRequest<Payload>&& request) {
-        return handleWrite(std::move(request), dto::K23SI_MTR_ZERO, FastDeadline(_config.writeTimeout()));
-    });
-
-    RPC().registerRPCObserver<dto::K23SITxnPushRequest, dto::K23SITxnPushResponse>
-    (dto::Verbs::K23SI_TXN_PUSH, [this](dto::K23SITxnPushRequest&& request) {
-        return handleTxnPush(std::move(request));
-    });
-
-    RPC().registerRPCObserver<dto::K23SITxnEndRequest, dto::K23SITxnEndResponse>
-    (dto::Verbs::K23SI_TXN_END, [this](dto::K23SITxnEndRequest&& request) {
-        return handleTxnEnd(std::move(request));
-    });
-
-    RPC().registerRPCObserver<dto::K23SITxnHeartbeatRequest, dto::K23SITxnHeartbeatResponse>
-    (dto::Verbs::K23SI_TXN_HEARTBEAT, [this](dto::K23SITxnHeartbeatRequest&& request) {
-        return handleTxnHeartbeat(std::move(request));
-    });
-
-    RPC().registerRPCObserver<dto::K23SITxnFinalizeRequest, dto::K23SITxnFinalizeResponse>
-    (dto::Verbs::K23SI_TXN_FINALIZE, [this](dto::K23SITxnFinalizeRequest&& request) {
-        return handleTxnFinalize(std::move(request));
-    });
-
+    // NB the RPC observers for our verbs are registered by the PartitionManager, which routes requests to the
+    // module on the core which owns the partition
     if (_cmeta.retentionPeriod < _config.minimumRetentionPeriod()) {
         K2WARN("Requested retention(" << _cmeta.retentionPeriod << ") is lower than minimum("
                                       << _config.minimumRetentionPeriod() << "). Extending retention to minimum");
@@ -171,7 +145,7 @@ K23SIPartitionModule::handleRead(dto::K23SIReadRequest&& request, dto::K23SI_MTR
     if (sitMTR == dto::K23SI_MTR_ZERO) {
         // this is a fresh read finding a WI. have to do a push
         sitMTR = viter->txnId.mtr;
-        return _doPush(request.collectionName, viter->txnId, request.mtr, deadline)
+        return _doPush(viter->txnId, request.mtr, deadline)
             .then([this, sitMTR, request=std::move(request), deadline](auto&& winnerMTR) mutable {
                 if (winnerMTR == sitMTR) {
                     // sitting transaction won. Abort the incoming request
@@ -283,7 +257,7 @@ K23SIPartitionModule::handleWrite(dto::K23SIWriteRequest<Payload>&& request, dto
             // deadline time.
             K2DEBUG("Partition: " << _partition << ", different WI found for key " << request.key);
             sitMTR = rec.txnId.mtr;
-            return _doPush(request.collectionName, rec.txnId, request.mtr, deadline)
+            return _doPush(rec.txnId, request.mtr, deadline)
                 .then([this, sitMTR, request = std::move(request), deadline](auto&& winnerMTR) mutable {
                     if (winnerMTR == sitMTR) {
                         // sitting transaction won. Abort the incoming request
@@ -426,15 +400,14 @@ K23SIPartitionModule::handleTxnHeartbeat(dto::K23SITxnHeartbeatRequest&& request
 }
 
 seastar::future<dto::K23SI_MTR>
-K23SIPartitionModule::_doPush(String collectionName, TxnId sitTxnId, dto::K23SI_MTR pushMTR, FastDeadline deadline) {
+K23SIPartitionModule::_doPush(TxnId sitTxnId, dto::K23SI_MTR pushMTR, FastDeadline deadline) {
     K2DEBUG("partition: " << _partition << ", executing push against txnid=" << sitTxnId << ", for mtr=" << pushMTR);
     dto::K23SITxnPushRequest request{};
-    request.collectionName = std::move(collectionName);
     request.incumbentMTR = std::move(sitTxnId.mtr);
     request.key = std::move(sitTxnId.trh);
     request.challengerMTR = std::move(pushMTR);
     return seastar::do_with(std::move(request), [this, deadline] (auto& request) {
-        return _cpo.PartitionRequest<dto::K23SITxnPushRequest, dto::K23SITxnPushResponse, dto::Verbs::K23SI_TXN_PUSH>(deadline, request)
+        return _cpo.PartitionRequest<dto::K23SITxnPushRequest, dto::K23SITxnPushResponse, dto::Verbs::K23SI_TXN_PUSH>(deadline, request, _cmeta.name)
         .then([this](auto&& responsePair) {
             auto& [status, response] = responsePair;
             K2DEBUG("Push request completed with status=" << status << ", and response=" << response);
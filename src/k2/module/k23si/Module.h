@@ -73,6 +73,9 @@ public: // lifecycle
     seastar::future<std::tuple<Status, dto::K23SITxnFinalizeResponse>>
     handleTxnFinalize(dto::K23SITxnFinalizeRequest&& request);
 
+    // the configuration of this module
+    const K23SIConfig& getConfig() const { return _config; }
+
 private: // methods
     // this method executes a push operation at the given TRH in order to
     // select a winner between the sitting transaction's mtr (sitMTR)
@@ -83,7 +86,7 @@ private: // methods
     // In cases where the pusing txn is to be aborted, whoever calls _doPush() has to signal
     // the client that they must issue an onEnd(Abort).
     seastar::future<dto::K23SI_MTR>
-    _doPush(String collectionName, TxnId sitTxnId, dto::K23SI_MTR pushMTR, FastDeadline deadline);
+    _doPush(TxnId sitTxnId, dto::K23SI_MTR pushMTR, FastDeadline deadline);
 
     // helper method used to clean up WI which have been removed
     void _queueWICleanup(DataRecord&& rec);
@@ -91,7 +94,7 @@ private: // methods
     // validate requests are coming to the correct partition. return true if request is valid
     template<typename RequestT>
     bool _validateRequestPartition(const RequestT& req) const {
-        auto result = req.collectionName == _cmeta.name && req.pvid == _partition().pvid && _partition.owns(req.key);
+        auto result = req.collectionId == _cmeta.id && req.pvid == _partition().pvid && _partition.owns(req.key);
         K2DEBUG("Partition: " << _partition << ", partition validation " << (result? "passed": "failed")
                 << ", for request=" << req);
         return result;
@@ -399,7 +399,6 @@ seastar::future<> TxnManager::_finalizeTransaction(TxnRecord& rec, FastDeadline
                 return seastar::parallel_for_each(start, end, [&rec, this, deadline](dto::Key& key) {
                     dto::K23SITxnFinalizeRequest request{};
                     request.key = key;
-                    request.collectionName = _collectionName;
                     request.mtr = rec.txnId.mtr;
                     request.trh = rec.txnId.trh;
                     request.action = rec.state == TxnRecord::State::Committed ? dto::EndAction::Commit : dto::EndAction::Abort;
@@ -408,7 +407,7 @@ seastar::future<> TxnManager::_finalizeTransaction(TxnRecord& rec, FastDeadline
                         return _cpo.PartitionRequest<dto::K23SITxnFinalizeRequest,
                                                     dto::K23SITxnFinalizeResponse,
                                                     dto::Verbs::K23SI_TXN_FINALIZE>
-                        (deadline, request, _config.finalizeRetries())
+                        (deadline, request, _collectionName, _config.finalizeRetries())
                         .then([&request](auto&& responsePair) {
                             auto& [status, response] = responsePair;
                             if (!status.is2xxOK()) {
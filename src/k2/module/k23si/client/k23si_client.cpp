@@ -55,14 +55,14 @@ void K2TxnHandle::makeHeartbeatTimer() {
 
         auto* request = new dto::K23SITxnHeartbeatRequest {
             dto::Partition::PVID(), // Will be filled in by PartitionRequest
-            _trh_collection,
+            0, // Will be filled in by PartitionRequest
             _trh_key,
             _mtr
         };
 
         K2DEBUG("send hb for " << _mtr);
 
-        return _cpo_client->PartitionRequest<dto::K23SITxnHeartbeatRequest, dto::K23SITxnHeartbeatResponse, dto::Verbs::K23SI_TXN_HEARTBEAT>(Deadline(_heartbeat_interval), *request)
+        return trhRequest<dto::K23SITxnHeartbeatRequest, dto::K23SITxnHeartbeatResponse, dto::Verbs::K23SI_TXN_HEARTBEAT>(Deadline(_heartbeat_interval), *request)
         .then([this] (auto&& response) {
             auto& [status, k2response] = response;
             checkResponseStatus(status);
@@ -84,7 +84,7 @@ seastar::future<EndResult> K2TxnHandle::end(bool shouldCommit) {
 
     auto* request  = new dto::K23SITxnEndRequest {
         dto::Partition::PVID(), // Will be filled in by PartitionRequest
-        _trh_collection,
+        0, // Will be filled in by PartitionRequest
         _trh_key,
         _mtr,
         shouldCommit && !_failed ? dto::EndAction::Commit : dto::EndAction::Abort,
@@ -95,7 +95,7 @@ seastar::future<EndResult> K2TxnHandle::end(bool shouldCommit) {
     K2DEBUG("Cancel hb for " << _mtr);
     _heartbeat_timer.cancel();
 
-    return _cpo_client->PartitionRequest
+    return trhRequest
         <dto::K23SITxnEndRequest, dto::K23SITxnEndResponse, dto::Verbs::K23SI_TXN_END>
         (Deadline<>(_txn_end_deadline), *request).
         then([this] (auto&& response) {
@@ -151,7 +151,7 @@ seastar::future<> K23SIClient::start() {
 }
 
 seastar::future<> K23SIClient::gracefulStop() {
-    return seastar::make_ready_future<>();
+    return _cpo_client.gracefulStop();
 }
 
 seastar::future<Status> K23SIClient::makeCollection(const String& collection) {
@@ -130,6 +130,16 @@ class K2TxnHandle {
 private:
     void makeHeartbeatTimer();
     void checkResponseStatus(Status& status);
+
+    // sends a request to the TRH partition. The collection is addressed by id once we know it
+    template <typename RequestT, typename ResponseT, Verb verb>
+    seastar::future<std::tuple<Status, ResponseT>> trhRequest(Deadline<> deadline, RequestT& request) {
+        if (_trh_collection_id != 0) {
+            request.collectionId = _trh_collection_id;
+            return _cpo_client->PartitionRequest<RequestT, ResponseT, verb>(deadline, request);
+        }
+        return _cpo_client->PartitionRequest<RequestT, ResponseT, verb>(deadline, request, _trh_collection);
+    }
 public:
     K2TxnHandle() = default;
     K2TxnHandle(K2TxnHandle&& o) noexcept = default;
@@ -150,14 +160,14 @@ public:
 
         auto* request = new dto::K23SIReadRequest{
             dto::Partition::PVID(), // Will be filled in by PartitionRequest
-            collection,
+            0, // Will be filled in by PartitionRequest
             _mtr,
             std::move(key)
         };
 
         return _cpo_client->PartitionRequest
             <dto::K23SIReadRequest, dto::K23SIReadResponse<ValueType>, dto::Verbs::K23SI_READ>
-            (_options.deadline, *request).
+            (_options.deadline, *request, collection).
             then([this] (auto&& response) {
                 auto& [status, k2response] = response;
                 checkResponseStatus(status);
@@ -186,7 +196,7 @@ public:
 
         auto* request = new dto::K23SIWriteRequest<ValueType>{
             dto::Partition::PVID(), // Will be filled in by PartitionRequest
-            collection,
+            0, // Will be filled in by PartitionRequest
             _mtr,
             _trh_key,
             erase,
@@ -197,7 +207,7 @@ public:
 
         return _cpo_client->PartitionRequest
             <dto::K23SIWriteRequest<ValueType>, dto::K23SIWriteResponse, dto::Verbs::K23SI_WRITE>
-            (_options.deadline, *request).
+            (_options.deadline, *request, collection).
             then([this] (auto&& response) {
                 auto& [status, k2response] = response;
                 checkResponseStatus(status);
@@ -205,7 +215,10 @@ public:
                 if (status.is2xxOK() && !_heartbeat_timer.isArmed()) {
                     K2ASSERT(_cpo_client->collections.find(_trh_collection) != _cpo_client->collections.end(), "collection not present after successful write");
                     K2DEBUG("Starting hb, mtr=" << _mtr << ", this=" << ((void*)this))
-                    _heartbeat_interval = _cpo_client->collections[_trh_collection].collection.metadata.heartbeatDeadline / 2;
+                    auto& trhCollection = _cpo_client->collections[_trh_collection].collection.metadata;
+                    _heartbeat_interval = trhCollection.heartbeatDeadline / 2;
+                    // heartbeats and the end request address the TRH collection by id from now on
+                    _trh_collection_id = trhCollection.id;
                     makeHeartbeatTimer();
                     _heartbeat_timer.armPeriodic(_heartbeat_interval);
                 }
@@ -238,6 +251,8 @@ private:
     std::vector<dto::Key> _write_set;
     dto::Key _trh_key;
     String _trh_collection;
+    // the id of _trh_collection, once we know it. 0 otherwise
+    uint64_t _trh_collection_id = 0;
 };
 
 } // namespace k2
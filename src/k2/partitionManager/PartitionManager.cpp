@@ -22,11 +22,16 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include "PartitionManager.h"
+#include <k2/appbase/Appbase.h>
 #include <k2/common/Log.h>
+#include <k2/dto/MessageVerbs.h>
 #include <k2/transport/RPCDispatcher.h>
 #include <k2/transport/RRDMARPCProtocol.h>
 #include <k2/transport/TCPRPCProtocol.h>
 
+// third-party
+#include <seastar/core/reactor.hh>  // for smp::submit_to
+
 namespace k2 {
 thread_local PartitionManager* __local_pmanager;
 
@@ -40,6 +45,8 @@ PartitionManager::~PartitionManager() {
 
 seastar::future<> PartitionManager::gracefulStop() {
     K2INFO("stop");
+    // stop forwarding requests to other cores
+    _localPartitions.clear();
     // signal the partition module that we're stopping
     if (_pmodule) {
         K2INFO("stopping module");
@@ -48,8 +55,107 @@ seastar::future<> PartitionManager::gracefulStop() {
     return seastar::make_ready_future<>();
 }
 
+// Payloads in requests and responses may share buffers with other payloads on the core which created them.
+// The serialized message is only read by the other core, which copies it into its own memory, and it is released on
+// the core which created it
+template <typename T>
+static seastar::foreign_ptr<std::unique_ptr<Payload>> _toForeignPayload(T& value) {
+    auto payload = std::make_unique<Payload>([] { return Binary(4096); });
+    payload->write(value);
+    return seastar::make_foreign(std::move(payload));
+}
+
+template <typename T>
+static T _fromForeignPayload(Payload& foreignPayload) {
+    T value;
+    auto payload = foreignPayload.copy();
+    if (!payload.read(value)) {
+        throw std::runtime_error("unable to read forwarded message");
+    }
+    return value;
+}
+
+template <typename RequestT, typename ResponseT, typename Func>
+void PartitionManager::_registerVerb(Verb verb, Func handler) {
+    RPC().registerRPCObserver<RequestT, ResponseT>(verb, [this, handler] (RequestT&& request) {
+        auto owner = _findOwner(request.collectionId, request.pvid);
+        if (owner && *owner != seastar::engine().cpu_id()) {
+            K2DEBUG("forwarding verb " << int(verb) << " to core " << *owner);
+            return _forward<RequestT, ResponseT>(*owner, std::move(request), handler);
+        }
+        if (_pmodule) {
+            // let the module decide. It will tell the client to refresh if it doesn't own the partition version
+            return handler(*_pmodule, std::move(request));
+        }
+        return RPCResponse(dto::K23SIStatus::RefreshCollection("partition not hosted on this node"), ResponseT{});
+    });
+}
+
+template <typename RequestT, typename ResponseT, typename Func>
+seastar::future<std::tuple<Status, ResponseT>>
+PartitionManager::_forward(unsigned core, RequestT&& request, Func handler) {
+    return seastar::smp::submit_to(core, [reqPayload=_toForeignPayload(request), handler] () mutable {
+        auto& pm = PManager();
+        if (!pm._pmodule) {
+            return seastar::make_ready_future<std::tuple<Status, ForeignPayload_t>>(
+                dto::K23SIStatus::RefreshCollection("partition is not hosted on this core"), ForeignPayload_t());
+        }
+        auto request = _fromForeignPayload<RequestT>(*reqPayload);
+        {
+            // we're done with the original. This releases it on its core
+            auto done = std::move(reqPayload);
+        }
+        return handler(*pm._pmodule, std::move(request))
+            .then([] (std::tuple<Status, ResponseT>&& result) {
+                auto& [status, response] = result;
+                return std::make_tuple(std::move(status), _toForeignPayload(response));
+            });
+    })
+    .then([] (std::tuple<Status, ForeignPayload_t>&& result) {
+        auto& [status, payload] = result;
+        if (!payload) {
+            return RPCResponse(std::move(status), ResponseT{});
+        }
+        return RPCResponse(std::move(status), _fromForeignPayload<ResponseT>(*payload));
+    });
+}
+
+std::optional<unsigned>
+PartitionManager::_findOwner(uint64_t collectionId, const dto::Partition::PVID& pvid) const {
+    for (auto& [core, lp]: _localPartitions) {
+        if (lp.collectionId == collectionId && lp.pvid == pvid) {
+            return core;
+        }
+    }
+    return std::nullopt;
+}
+
 seastar::future<> PartitionManager::start() {
     __local_pmanager = this;
+    _registerVerb<dto::K23SIReadRequest, dto::K23SIReadResponse<Payload>>(dto::Verbs::K23SI_READ,
+        [] (K23SIPartitionModule& module, dto::K23SIReadRequest&& request) {
+            return module.handleRead(std::move(request), dto::K23SI_MTR_ZERO, FastDeadline(module.getConfig().readTimeout()));
+        });
+    _registerVerb<dto::K23SIWriteRequest<Payload>, dto::K23SIWriteResponse>(dto::Verbs::K23SI_WRITE,
+        [] (K23SIPartitionModule& module, dto::K23SIWriteRequest<Payload>&& request) {
+            return module.handleWrite(std::move(request), dto::K23SI_MTR_ZERO, FastDeadline(module.getConfig().writeTimeout()));
+        });
+    _registerVerb<dto::K23SITxnPushRequest, dto::K23SITxnPushResponse>(dto::Verbs::K23SI_TXN_PUSH,
+        [] (K23SIPartitionModule& module, dto::K23SITxnPushRequest&& request) {
+            return module.handleTxnPush(std::move(request));
+        });
+    _registerVerb<dto::K23SITxnEndRequest, dto::K23SITxnEndResponse>(dto::Verbs::K23SI_TXN_END,
+        [] (K23SIPartitionModule& module, dto::K23SITxnEndRequest&& request) {
+            return module.handleTxnEnd(std::move(request));
+        });
+    _registerVerb<dto::K23SITxnHeartbeatRequest, dto::K23SITxnHeartbeatResponse>(dto::Verbs::K23SI_TXN_HEARTBEAT,
+        [] (K23SIPartitionModule& module, dto::K23SITxnHeartbeatRequest&& request) {
+            return module.handleTxnHeartbeat(std::move(request));
+        });
+    _registerVerb<dto::K23SITxnFinalizeRequest, dto::K23SITxnFinalizeResponse>(dto::Verbs::K23SI_TXN_FINALIZE,
+        [] (K23SIPartitionModule& module, dto::K23SITxnFinalizeRequest&& request) {
+            return module.handleTxnFinalize(std::move(request));
+        });
     return seastar::make_ready_future<>();
 }
 
@@ -74,17 +180,25 @@ PartitionManager::assignPartition(dto::CollectionMetadata meta, dto::Partition p
             partition.endpoints.insert(rdma_ep->getURL());
         }
 
+        auto collectionId = meta.id;
         _pmodule = std::make_unique<K23SIPartitionModule>(std::move(meta), partition);
-        return _pmodule->start().then([partition = std::move(partition)] () mutable {
-            if (partition.endpoints.size() > 0) {
-                partition.astate = dto::AssignmentState::Assigned;
-                K2INFO("Assigned partition for driver k23si");
-            }
-            else {
+        return _pmodule->start().then([partition = std::move(partition), collectionId] () mutable {
+            if (partition.endpoints.size() == 0) {
                 K2ERROR("Server not configured correctly. there were no listening protocols configured");
                 partition.astate = dto::AssignmentState::FailedAssignment;
+                return seastar::make_ready_future<dto::Partition>(std::move(partition));
             }
-            return seastar::make_ready_future<dto::Partition>(std::move(partition));
+            partition.astate = dto::AssignmentState::Assigned;
+            K2INFO("Assigned partition for driver k23si");
+            // let all cores on this node know that we own this partition
+            auto core = seastar::engine().cpu_id();
+            return AppBase().getDist<PartitionManager>().invoke_on_all(
+                [pvid=partition.pvid, collectionId, core] (PartitionManager& pm) {
+                    pm._localPartitions[core] = LocalPartition{collectionId, pvid};
+                })
+                .then([partition=std::move(partition)] () mutable {
+                    return seastar::make_ready_future<dto::Partition>(std::move(partition));
+                });
         });
     }
 
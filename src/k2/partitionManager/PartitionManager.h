@@ -29,9 +29,18 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/module/k23si/Module.h>
 #include <seastar/core/distributed.hh>  // for dist stuff
 #include <seastar/core/future.hh>       // for future stuff
+#include <seastar/core/sharded.hh>      // for foreign_ptr
+
+// stl
+#include <optional>
+#include <unordered_map>
 
 namespace k2 {
 
+// The PartitionManager hosts the partition assigned to its core, and routes incoming K23SI requests to it.
+// Requests for a partition owned by another core on this node are forwarded to that core, so that clients
+// which reach the wrong core of the right node don't have to refresh their collection. The partition version in the
+// request is forwarded unchanged, so the owner still tells clients with a stale version to refresh
 class PartitionManager {
 public: // application lifespan
     PartitionManager();
@@ -42,8 +51,35 @@ public: // application lifespan
     seastar::future<> gracefulStop();
     seastar::future<> start();
 
-private:
+private: // types
+    // A partition hosted on this node
+    struct LocalPartition {
+        uint64_t collectionId;
+        dto::Partition::PVID pvid;
+    };
+
+    // a payload which is released on the core which created it
+    typedef seastar::foreign_ptr<std::unique_ptr<Payload>> ForeignPayload_t;
+
+private: // methods
+    // registers the RPC observer for the given K23SI verb. The handler is called with the module which owns the
+    // request's key, on the module's core
+    template <typename RequestT, typename ResponseT, typename Func>
+    void _registerVerb(Verb verb, Func handler);
+
+    // runs the given request with the given handler on the given core, and returns the response here
+    template <typename RequestT, typename ResponseT, typename Func>
+    static seastar::future<std::tuple<Status, ResponseT>> _forward(unsigned core, RequestT&& request, Func handler);
+
+    // find the core on this node which owns the given partition version, if any
+    std::optional<unsigned> _findOwner(uint64_t collectionId, const dto::Partition::PVID& pvid) const;
+
+private: // fields
     std::unique_ptr<K23SIPartitionModule> _pmodule;
+
+    // the partitions hosted by all cores on this node, by core. Each core keeps its own copy. A core hosts at most
+    // one partition, so its entry is replaced when it is assigned a new one
+    std::unordered_map<unsigned, LocalPartition> _localPartitions;
 }; // class PartitionManager
 
 // per-thread/reactor instance of the partition manager
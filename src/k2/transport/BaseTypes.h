@@ -41,9 +41,9 @@ namespace k2 {
 typedef seastar::socket_address SocketAddress;
 
 // The type for Message observers
-// TODO See if we can use something faster than std::function.
-// Benchmark indicates 20ns penalty per runtime call
+// Benchmark indicates 20ns penalty per runtime call of std::function
 // See https://www.boost.org/doc/libs/1_69_0/doc/html/function/faq.html
+// The RPCDispatcher stores the observers it dispatches to in an InlineFunction
 typedef std::function<void(Request&& request)> RequestObserver_t;
 
 // The type for RPC request observers. This is meant to be used with the RPC* API of RPCDispatcher
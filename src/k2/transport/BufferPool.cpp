@@ -0,0 +1,129 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "BufferPool.h"
+
+// stl
+#include <cstdlib>
+#include <new>
+
+// k2
+#include <k2/common/Log.h>
+
+namespace k2 {
+
+// the pool of the calling thread. Pools are never destroyed, since pooled buffers may be dropped at any time,
+// including during thread shutdown
+static thread_local BufferPool* _localPool = nullptr;
+
+BufferPool& BufferPool::local() {
+    if (!_localPool) {
+        _localPool = new BufferPool();
+    }
+    return *_localPool;
+}
+
+BufferPool::PooledBuffer::PooledBuffer() : seastar::deleter::impl(seastar::deleter()) {
+}
+
+void BufferPool::PooledBuffer::operator delete(void* ptr) {
+    auto block = static_cast<char*>(ptr) - INFO_SIZE;
+    auto info = reinterpret_cast<BlockInfo*>(block);
+    if (info->pool == _localPool) {
+        info->pool->_recycle(block, info->sizeClass);
+    }
+    else {
+        std::free(block);
+    }
+}
+
+Binary BufferPool::allocate(size_t size) {
+    uint8_t sizeClass = 0;
+    while (sizeClass < NUM_CLASSES && (size_t(1) << (MIN_CLASS_BITS + sizeClass)) < size) {
+        ++sizeClass;
+    }
+    if (sizeClass == NUM_CLASSES) {
+        return Binary(size);
+    }
+
+    auto& freeList = _freeLists[sizeClass];
+    char* block = nullptr;
+    if (!freeList.empty()) {
+        _hits++;
+        block = freeList.back();
+        freeList.pop_back();
+        _bytesHeld -= size_t(1) << (MIN_CLASS_BITS + sizeClass);
+    }
+    else {
+        _misses++;
+        block = static_cast<char*>(std::malloc(HEADER_SIZE + (size_t(1) << (MIN_CLASS_BITS + sizeClass))));
+        if (!block) {
+            throw std::bad_alloc();
+        }
+    }
+    new (block) BlockInfo{this, sizeClass};
+    auto header = new (block + INFO_SIZE) PooledBuffer();
+    return Binary(block + HEADER_SIZE, size, seastar::deleter(header));
+}
+
+void BufferPool::_recycle(char* block, uint8_t sizeClass) {
+    auto classSize = size_t(1) << (MIN_CLASS_BITS + sizeClass);
+    if (_bytesHeld + classSize > _maxBytes) {
+        std::free(block);
+        return;
+    }
+    _freeLists[sizeClass].push_back(block);
+    _bytesHeld += classSize;
+}
+
+size_t BufferPool::shrink(size_t bytes) {
+    size_t released = 0;
+    // release the largest buffers first
+    for (size_t i = NUM_CLASSES; i > 0 && released < bytes; --i) {
+        auto& freeList = _freeLists[i - 1];
+        auto classSize = size_t(1) << (MIN_CLASS_BITS + i - 1);
+        while (!freeList.empty() && released < bytes) {
+            std::free(freeList.back());
+            freeList.pop_back();
+            released += classSize;
+        }
+    }
+    _bytesHeld -= released;
+    K2DEBUG("released " << released << " bytes, holding " << _bytesHeld);
+    return released;
+}
+
+void BufferPool::setMaxBytes(size_t maxBytes) {
+    _maxBytes = maxBytes;
+    if (_bytesHeld > _maxBytes) {
+        shrink(_bytesHeld - _maxBytes);
+    }
+}
+
+uint64_t BufferPool::hits() const { return _hits; }
+
+uint64_t BufferPool::misses() const { return _misses; }
+
+size_t BufferPool::bytesHeld() const { return _bytesHeld; }
+
+} // namespace k2
@@ -0,0 +1,103 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// stl
+#include <array>
+#include <vector>
+
+// third-party
+#include <seastar/core/deleter.hh>
+
+// k2
+#include <k2/common/Common.h>
+
+namespace k2 {
+
+// Per-core free-list pool for transport buffers. Buffers are grouped in power-of-2 size classes, and a buffer is
+// recycled into the free list of its class when the last Binary which refers to it is dropped.
+// Buffers dropped on a different core(thread) than the one which allocated them are freed instead.
+// Requests larger than the largest size class are not pooled.
+class BufferPool {
+public:
+    // smallest and largest size classes, as powers of 2
+    static constexpr size_t MIN_CLASS_BITS = 9;   // 512B
+    static constexpr size_t MAX_CLASS_BITS = 16;  // 64KB
+    static constexpr size_t NUM_CLASSES = MAX_CLASS_BITS - MIN_CLASS_BITS + 1;
+
+    // the pool for the calling core
+    static BufferPool& local();
+
+    // Returns a buffer of the given size, recycling a free buffer of the matching size class if possible
+    Binary allocate(size_t size);
+
+    // Frees buffers from the free lists until at least the given number of bytes are released, or there are no
+    // more free buffers. Returns the number of bytes released
+    size_t shrink(size_t bytes);
+
+    // The maximum number of bytes the free lists may hold. Buffers which don't fit are freed on release
+    void setMaxBytes(size_t maxBytes);
+
+    // number of allocations satisfied from the free lists
+    uint64_t hits() const;
+
+    // number of allocations which needed new memory
+    uint64_t misses() const;
+
+    // number of bytes held in the free lists
+    size_t bytesHeld() const;
+
+private:
+    // Blocks start with this info, followed by the deleter of the Binary which uses the block and the data of the
+    // size class. Embedding the deleter means that handing out a pooled buffer doesn't require any allocation
+    struct BlockInfo {
+        BufferPool* pool;
+        uint8_t sizeClass;
+    };
+
+    // The deleter of pooled buffers. Its storage is part of the block, which is recycled (or freed) once
+    // the deleter is destroyed (see operator delete)
+    struct PooledBuffer final : seastar::deleter::impl {
+        PooledBuffer();
+        static void operator delete(void* ptr);
+    };
+
+    static constexpr size_t INFO_SIZE = (sizeof(BlockInfo) + 15) & ~size_t(15);
+    static constexpr size_t HEADER_SIZE = INFO_SIZE + ((sizeof(PooledBuffer) + 15) & ~size_t(15));
+
+    BufferPool() = default;
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // puts the given block back in the free list of its class, or frees it if the pool is full
+    void _recycle(char* block, uint8_t sizeClass);
+
+    std::array<std::vector<char*>, NUM_CLASSES> _freeLists;
+    size_t _maxBytes = 0;
+    size_t _bytesHeld = 0;
+    uint64_t _hits = 0;
+    uint64_t _misses = 0;
+};
+
+} // namespace k2
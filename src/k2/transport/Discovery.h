@@ -33,6 +33,8 @@ Copyright(c) 2020 Futurewei Cloud
 #include "RPCDispatcher.h"  // for RPC
 #include "RPCTypes.h"
 #include "RRDMARPCProtocol.h"
+#include "ShmRPCProtocol.h"
+#include "UnixRPCProtocol.h"
 
 namespace k2 {
 class Discovery {
@@ -51,6 +53,20 @@ public :  // application lifespan
                 eps.push_back(std::move(ep));
             }
         }
+        // look for shared memory. The shm protocol only vends endpoints for processes on this host
+        for (auto& ep: eps) {
+            if (ep->getProtocol() == ShmRPCProtocol::proto) {
+                return std::move(ep);
+            }
+        }
+
+        // look for unix sockets. The unix protocol only vends endpoints for sockets on this host
+        for (auto& ep: eps) {
+            if (ep->getProtocol() == UnixRPCProtocol::proto) {
+                return std::move(ep);
+            }
+        }
+
         // look for rdma
         if (seastar::engine()._rdma_stack) {
             for (auto& ep: eps) {
@@ -0,0 +1,131 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// stl
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <vector>
+
+namespace k2 {
+
+// A slab of reusable slots, addressed by 32-bit ids. The id of a slot is its index(low INDEX_BITS) and the
+// generation of the slot(high bits). The generation changes every time the slot is reused, so that an id which
+// outlived its slot(e.g. a response which arrives after its request timed out) doesn't find the new occupant.
+// Released slots are reused in FIFO order, which makes it unlikely that a stale id meets the same generation again
+template <class T>
+class GenerationSlab {
+public:
+    static constexpr uint32_t INDEX_BITS = 18;
+    static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+    static constexpr size_t MAX_SIZE = INDEX_MASK + 1;
+
+    // true if all MAX_SIZE slots are in use
+    bool full() const {
+        return _free.empty() && _slots.size() >= MAX_SIZE;
+    }
+
+    // the number of slots in use
+    size_t size() const {
+        return _active;
+    }
+
+    // puts the value in a free slot and returns its id. Check full() before calling this
+    uint32_t add(T value) {
+        uint32_t index;
+        if (_free.empty()) {
+            index = uint32_t(_slots.size());
+            _slots.emplace_back();
+            // start from a random generation so that ids from a previous incarnation of the process are not found
+            _slots.back().generation = uint32_t(std::rand());
+        }
+        else {
+            index = _free.front();
+            _free.pop_front();
+        }
+        auto& slot = _slots[index];
+        slot.generation = (slot.generation + 1) & (UINT32_MAX >> INDEX_BITS);
+        slot.value = std::move(value);
+        slot.active = true;
+        _active++;
+        return (slot.generation << INDEX_BITS) | index;
+    }
+
+    // returns the value with the given id, or nullptr if the id is not in use
+    T* find(uint32_t id) {
+        auto index = id & INDEX_MASK;
+        if (index >= _slots.size()) {
+            return nullptr;
+        }
+        auto& slot = _slots[index];
+        if (!slot.active || slot.generation != (id >> INDEX_BITS)) {
+            return nullptr;
+        }
+        return &slot.value;
+    }
+
+    // frees the slot with the given id and returns its value. The id must be in use
+    T release(uint32_t id) {
+        auto index = id & INDEX_MASK;
+        auto& slot = _slots[index];
+        slot.active = false;
+        _free.push_back(index);
+        _active--;
+        return std::move(slot.value);
+    }
+
+    // calls func(T&) for each slot in use
+    template <class Func>
+    void forEach(Func&& func) {
+        for (auto& slot: _slots) {
+            if (slot.active) {
+                func(slot.value);
+            }
+        }
+    }
+
+    // frees all slots
+    void clear() {
+        _slots.clear();
+        _free.clear();
+        _active = 0;
+    }
+
+private:
+    struct Slot {
+        T value;
+        uint32_t generation = 0;
+        bool active = false;
+    };
+
+    std::vector<Slot> _slots;
+
+    // indexes of the free slots, least recently released first
+    std::deque<uint32_t> _free;
+
+    size_t _active = 0;
+};
+
+} // namespace k2
@@ -0,0 +1,54 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "HostIdentity.h"
+
+// stl
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+
+//k2
+#include <k2/common/Log.h>
+
+namespace k2 {
+
+static String _readHostBootId() {
+    // the kernel generates a random uuid on each boot
+    std::ifstream file("/proc/sys/kernel/random/boot_id");
+    std::string id;
+    if (!file || !std::getline(file, id)) {
+        K2WARN("Unable to read the host boot id. Host-local endpoints will not be recognized");
+        return String();
+    }
+    // keep only the hex digits so that the id can be embedded in an url without escaping
+    id.erase(std::remove_if(id.begin(), id.end(), [](unsigned char c) { return !std::isxdigit(c); }), id.end());
+    return String(id.data(), id.size());
+}
+
+const String& getHostBootId() {
+    static const String hostBootId = _readHostBootId();
+    return hostBootId;
+}
+
+} // namespace k2
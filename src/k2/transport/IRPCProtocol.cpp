@@ -81,4 +81,8 @@ void IRPCProtocol::setLowTransportMemoryObserver(LowTransportMemoryObserver_t ob
     }
 }
 
+bool IRPCProtocol::isCompactPeer(const TXEndpoint&) {
+    return false;
+}
+
 } // namespace k2
@@ -104,6 +104,11 @@ public: // API
     // Returns the endpoint where this protocol accepts incoming connections.
     virtual seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint() = 0;
 
+    // Returns true if the peer at the given endpoint has told us that it can parse compact payloads. The capability
+    // is kept with the connection to the peer, so it is forgotten when the connection goes away.
+    // Protocols which don't track it never report compact peers
+    virtual bool isCompactPeer(const TXEndpoint& endpoint);
+
 public: // distributed<> interface.
     // called by seastar's distributed mechanism when stop() is invoked on the distributed container.
     virtual seastar::future<> stop() = 0;
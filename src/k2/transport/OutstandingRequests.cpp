@@ -0,0 +1,63 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "OutstandingRequests.h"
+
+namespace k2 {
+
+void OutstandingRequests::add(uint32_t requestID, TimePoint sentAt) {
+    _pending[requestID] = sentAt;
+    _bySendTime.emplace_back(requestID, sentAt);
+}
+
+bool OutstandingRequests::remove(uint32_t requestID) {
+    if (_pending.erase(requestID) == 0) {
+        return false;
+    }
+    // drop the answered requests at the front so that the queue doesn't hold on to them
+    while (!_bySendTime.empty() && !_isPending(_bySendTime.front())) {
+        _bySendTime.pop_front();
+    }
+    return true;
+}
+
+void OutstandingRequests::expire(TimePoint sentBefore) {
+    while (!_bySendTime.empty() && _bySendTime.front().second < sentBefore) {
+        if (_isPending(_bySendTime.front())) {
+            _pending.erase(_bySendTime.front().first);
+        }
+        _bySendTime.pop_front();
+    }
+}
+
+size_t OutstandingRequests::size() const {
+    return _pending.size();
+}
+
+bool OutstandingRequests::_isPending(const std::pair<uint32_t, TimePoint>& entry) const {
+    // the ID may have been reused for a newer request, which has its own entry in the queue
+    auto iter = _pending.find(entry.first);
+    return iter != _pending.end() && iter->second == entry.second;
+}
+
+} // namespace k2
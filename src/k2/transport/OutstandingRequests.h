@@ -0,0 +1,65 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// stl
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <utility>
+
+// k2
+#include <k2/common/Chrono.h>
+
+namespace k2 {
+
+// Tracks the requests sent over a channel for which we haven't seen a response yet. Some requests never get a
+// response(e.g. the caller timed out, or the peer dropped the request), so requests are forgotten once they are
+// older than the expiry we're given. Otherwise they'd count towards the load of the channel forever.
+class OutstandingRequests {
+public:
+    // record a request sent at the given time
+    void add(uint32_t requestID, TimePoint sentAt);
+
+    // record the response for the given request. Returns false if the request isn't outstanding(e.g. it expired)
+    bool remove(uint32_t requestID);
+
+    // forget the requests sent before the given time
+    void expire(TimePoint sentBefore);
+
+    // the number of outstanding requests
+    size_t size() const;
+
+private:
+    // true if the given queue entry still describes an outstanding request
+    bool _isPending(const std::pair<uint32_t, TimePoint>& entry) const;
+
+    // the requests in the order they were sent. Entries whose request got a response are dropped lazily
+    std::deque<std::pair<uint32_t, TimePoint>> _bySendTime;
+
+    // the outstanding requests and the time they were sent
+    std::unordered_map<uint32_t, TimePoint> _pending;
+};
+
+} // namespace k2
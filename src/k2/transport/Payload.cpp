@@ -170,13 +170,83 @@ bool Payload::read(char& b) {
 bool Payload::read(String& value) {
     _Size size;
     if (!read(size)) return false;
+    if (_compact) {
+        // compact strings don't carry the '\0'
+        value.resize(size);
+        return read((void*)value.data(), size);
+    }
     value.resize(size - 1);  // the resulting string's size will be one less than what we read since '\0' doesn't count
     return read((void*)value.data(), size);
 }
 
+bool Payload::read(std::string_view& value) {
+    auto pos = getCurrentPosition();
+    _Size size;
+    // the size includes the '\0' in the fixed encoding, see write(String)
+    if (!read(size) || (!_compact && size == 0) || getDataRemaining() < size) {
+        seek(pos);
+        return false;
+    }
+    _Size strSize = _compact ? size : size - 1;
+    if (size == 0) {
+        value = std::string_view();
+        return true;
+    }
+
+    const Binary& buffer = _buffers[_currentPosition.bufferIndex];
+    if (buffer.size() - _currentPosition.bufferOffset < size) {
+        // spans multiple buffers
+        seek(pos);
+        return false;
+    }
+
+    value = std::string_view(buffer.get() + _currentPosition.bufferOffset, strSize);
+    _advancePosition(size);
+    return true;
+}
+
+bool Payload::read(PayloadStringView& value) {
+    auto pos = getCurrentPosition();
+    _Size size;
+    if (!read(size) || (!_compact && size == 0) || getDataRemaining() < size) {
+        seek(pos);
+        return false;
+    }
+    _Size strSize = _compact ? size : size - 1;
+    if (size == 0) {
+        value = PayloadStringView();
+        return true;
+    }
+
+    Binary& buffer = _buffers[_currentPosition.bufferIndex];
+    if (buffer.size() - _currentPosition.bufferOffset >= size) {
+        // the string is inside a single binary - we can just share in no-copy way
+        value = PayloadStringView(buffer.share(_currentPosition.bufferOffset, strSize));
+        _advancePosition(size);
+        return true;
+    }
+
+    // spans multiple buffers - copy into a single new buffer
+    Binary copied(size);
+    read(copied.get_write(), size);
+    copied.trim(strSize);
+    value = PayloadStringView(std::move(copied));
+    return true;
+}
+
 bool Payload::read(Payload& other) {
+    auto pos = getCurrentPosition();
     size_t size;
-    if (!read(size) || getDataRemaining() < size) return false;
+    if (!read(size)) return false;
+    if (!readSlice(other, size)) {
+        seek(pos);
+        return false;
+    }
+    return true;
+}
+
+bool Payload::readSlice(Payload& other, size_t size) {
+    if (getDataRemaining() < size) return false;
     other.clear();
     other._size = size;
     other._capacity = size;
@@ -233,10 +303,16 @@ void Payload::truncateToCurrent() {
 
     // make the current position the end, and place our cursor just past the end
 
-    // drop any extra buffers we might have
-    _buffers.resize(_currentPosition.bufferIndex + 1);
     // we want our capacity to be now exactly the same as our size
     _capacity = _size;
+    if (_currentPosition.bufferOffset == 0) {
+        // the current buffer is empty (e.g. pre-allocated via ensureCapacity). Drop it so that we don't
+        // leave an empty buffer in the middle of the payload
+        _buffers.resize(_currentPosition.bufferIndex);
+        return;
+    }
+    // drop any extra buffers we might have
+    _buffers.resize(_currentPosition.bufferIndex + 1);
     // trim the last buffer to contain exactly the data we have so far
     _buffers[_currentPosition.bufferIndex].trim(_currentPosition.bufferOffset);
     // finally, adjust our cursor so that it points correctly past the end of the payload
@@ -266,11 +342,28 @@ void Payload::write(const void* data, size_t size) {
 }
 
 void Payload::write(const String& value) {
+    if (_compact) {
+        write((_Size)value.size());
+        write(value.data(), value.size());
+        return;
+    }
     _Size size = value.size() + 1; // count the null character too
     write(size);
     write(value.data(), size);
 }
 
+void Payload::write(const PayloadStringView& value) {
+    if (_compact) {
+        write((_Size)value.size());
+        write(value.data(), value.size());
+        return;
+    }
+    _Size size = value.size() + 1; // count the null character too
+    write(size);
+    write(value.data(), value.size());
+    write('\0');
+}
+
 void Payload::write(const Payload& other) {
     // we only support this write at the end of an existing payload (append)
     K2ASSERT(getDataRemaining() == 0, "cannot write a payload in the middle of another payload");
@@ -297,6 +390,60 @@ void Payload::writeMany() {
     // this is needed for the base case of the recursive template version
 }
 
+void Payload::setCompactEncoding(bool compact) {
+    _compact = compact;
+}
+
+bool Payload::isCompactEncoding() const {
+    return _compact;
+}
+
+void Payload::_writeVarint(uint64_t value) {
+    char data[10];  // 64 bits need at most 10 groups of 7 bits
+    size_t size = 0;
+    while (value >= 0x80) {
+        data[size++] = char((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    data[size++] = char(value);
+    write(data, size);
+}
+
+bool Payload::_readVarint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        char b;
+        if (!read(b)) return false;
+        value |= uint64_t(uint8_t(b) & 0x7F) << shift;
+        if ((uint8_t(b) & 0x80) == 0) return true;
+    }
+    return false;  // malformed: too many bytes
+}
+
+char* Payload::_contiguousWritePtr(size_t size) {
+    ensureCapacity(_currentPosition.offset + size);
+    Binary& buffer = _buffers[_currentPosition.bufferIndex];
+    if (buffer.size() - _currentPosition.bufferOffset < size) {
+        return nullptr;
+    }
+    char* result = buffer.get_write() + _currentPosition.bufferOffset;
+    _advancePosition(size);
+    return result;
+}
+
+const char* Payload::_contiguousReadPtr(size_t size) {
+    if (getDataRemaining() < size) {
+        return nullptr;
+    }
+    const Binary& buffer = _buffers[_currentPosition.bufferIndex];
+    if (buffer.size() - _currentPosition.bufferOffset < size) {
+        return nullptr;
+    }
+    const char* result = buffer.get() + _currentPosition.bufferOffset;
+    _advancePosition(size);
+    return result;
+}
+
 bool Payload::_allocateBuffer() {
     K2ASSERT(_allocator, "cannot allocate buffer without allocator");
     Binary buf = _allocator();
@@ -366,6 +513,7 @@ uint32_t Payload::computeCrc32c() {
 
 Payload Payload::share() {
     Payload shared(_allocator);
+    shared._compact = _compact;
     shared._size = _size;
     shared._capacity = _size; // the capacity of the new payload stops with the current data written
 
@@ -402,6 +550,7 @@ Payload Payload::copy() {
         curBufIndex++;
     }
     copied.appendBinary(std::move(b));
+    copied._compact = _compact;
     return copied;
 }
 
@@ -28,6 +28,8 @@ Copyright(c) 2020 Futurewei Cloud
 #include <unordered_set>
 #include <set>
 #include <limits>
+#include <stdexcept>
+#include <string_view>
 
 #include <k2/common/Common.h>
 #include <k2/common/Log.h>
@@ -42,6 +44,36 @@ struct SerializeAsPayload {
     T val;
 };
 
+// Zero-copy view of a String serialized in a Payload. Reading it shares(ref-counts) the payload buffer
+// which holds the string instead of copying it out, so the view stays valid even after the Payload is gone.
+// If the string spans multiple payload buffers, it is copied into a single new buffer.
+// It has the same wire format as String, so a String field can be read as a PayloadStringView.
+class PayloadStringView {
+public:
+    PayloadStringView() {}
+    explicit PayloadStringView(Binary&& data) : _data(std::move(data)) {}
+
+    const char* data() const { return _data.get(); }
+    size_t size() const { return _data.size(); }
+    bool empty() const { return _data.size() == 0; }
+
+    std::string_view view() const { return std::string_view(_data.get(), _data.size()); }
+    operator std::string_view() const { return view(); }
+
+    // make an owned copy
+    String toString() const { return String(_data.get(), _data.size()); }
+
+    bool operator==(const PayloadStringView& o) const { return view() == o.view(); }
+    bool operator==(std::string_view o) const { return view() == o; }
+
+    friend std::ostream& operator<<(std::ostream& os, const PayloadStringView& v) {
+        return os << v.view();
+    }
+
+private:
+    Binary _data;  // the string content, without the trailing '\0'
+};
+
 //
 //  Serialization traits
 //
@@ -69,6 +101,20 @@ constexpr bool isPayloadCopyableType() { return IsPayloadCopyableTypeTrait<T>::v
 template <typename T>  //  Type that need custom serialization to convert to/from payload
 constexpr bool isPayloadSerializableType() { return IsPayloadSerializableTypeTrait<T>::value; }
 
+template <typename T>  //  Type with fixed serialized size, written with a single copy of sizeof(T) bytes
+constexpr bool isFixedSizeType() { return isNumericType<T>() || isPayloadCopyableType<T>(); }
+
+template <typename T>  //  Integer/enum type which is written as a varint in the compact encoding
+constexpr bool isVarintType() {
+    using U = std::remove_cv_t<T>;
+    if constexpr (std::is_enum<U>::value) {
+        return isVarintType<std::underlying_type_t<U>>();
+    }
+    else {
+        return std::is_integral<U>::value && !std::is_same<U, bool>::value && sizeof(U) > 1;
+    }
+}
+
 //  Payload is abstraction representing message content. It allows for very efficient network
 // transportation of bytes, and it allows for allocating the underlying memory in a network-aware way.
 // For that reason, normally payloads are produced by the k2 transport, either when a new message comes in
@@ -125,6 +171,13 @@ public: // memory management
     // clear this payload
     void clear();
 
+    // Selects the compact wire encoding for this payload: integers(and enums) wider than a byte are written as
+    // LEB128 varints(zigzag for signed types), and string/container lengths are varints, with no trailing '\0'
+    // for strings. This must be set before any data is written/read, and both sides must agree on it. The RPC
+    // layer signals it in the message header (see MessageMetadata::setCompactEncoding())
+    void setCompactEncoding(bool compact);
+    bool isCompactEncoding() const;
+
 public: // read-only API. Used to wrap an external list of buffers into a Payload
     // Wrap the given buffers into the Payload interface. No further allocation will be possible
     Payload(std::vector<Binary>&& externallyAllocatedBuffers, size_t containedDataSize);
@@ -170,9 +223,21 @@ public:  // Read API
     // read a string
     bool read(String& value);
 
+    // read a string as a non-owning view into this payload, valid only while this payload's buffers are alive.
+    // This only succeeds if the string is contiguous in a single buffer. Otherwise, it returns false and the
+    // position is left unmodified, and the caller can fall back to reading a String or a PayloadStringView.
+    bool read(std::string_view& value);
+
+    // read a string as a zero-copy view which shares the payload buffer
+    bool read(PayloadStringView& value);
+
     // read into a payload
     bool read(Payload& other);
 
+    // read the next size bytes as a read-only Payload which shares this payload's buffers, without copy.
+    // The slice may span multiple buffers. If there isn't enough data, returns false and the position is left unmodified
+    bool readSlice(Payload& slice, size_t size);
+
     // read a duration value
     bool read(Duration& dur);
 
@@ -295,6 +360,11 @@ public:  // Read API
     // primitive type read
     template <typename T>
     std::enable_if_t<isPayloadCopyableType<T>() || isNumericType<T>(), bool> read(T& value) {
+        if constexpr (isVarintType<T>()) {
+            if (_compact) {
+                return _readVarintValue(value);
+            }
+        }
         return read((void*)&value, sizeof(value));
     }
 
@@ -305,8 +375,19 @@ public:  // Read API
     }
 
     // read many values in series
+    // A run of adjacent fixed size values is read with one bounds check if it is contiguous in the current buffer
     template <typename T, typename... ArgsT>
     bool readMany(T& value, ArgsT&... args) {
+        if constexpr (isFixedSizeType<T>()) {
+            if (_compact) {
+                return read(value) && readMany(args...);
+            }
+            constexpr size_t runSize = _fixedRunSize<T, ArgsT...>();
+            const char* src = _contiguousReadPtr(runSize);
+            if (src) {
+                return _readFixedRun(src, value, args...);
+            }
+        }
         return read(value) && readMany(args...);
     }
 
@@ -332,6 +413,9 @@ public: // Write API
     // write a string
     void write(const String& value);
 
+    // write a string view, in the same format as String
+    void write(const PayloadStringView& value);
+
     // write another Payload
     void write(const Payload& other);
 
@@ -398,31 +482,34 @@ public: // Write API
     template<typename T>
     void write(const SerializeAsPayload<T>& value) {
         // if the embedded type is a Payload, then just use the payload write to write it directly
-        if (std::is_same<T, Payload>::value || std::is_same<T, const Payload>::value) {
+        if constexpr (std::is_same<T, Payload>::value || std::is_same<T, const Payload>::value) {
             write(value.val);
-            return;
         }
-        // 1. write out a dummy size now
-        auto sizePos = getCurrentPosition();
-        uint64_t size = 0;
-        write(size);
-
-        // 2. write the actual value
-        auto valPos = getCurrentPosition();
-        write(value.val);
-
-        // 3. calculate how much data we wrote and update the size we wrote in step1
-        auto nowPos = getCurrentPosition();
-        size = nowPos.offset - valPos.offset;
-        seek(sizePos);
-        write(size);
-        // make sure to place the cursor at end of all the written data
-        seek(nowPos);
+        else {
+            // the size is computed upfront so we don't need to seek back and patch it after writing the value
+            uint64_t size = _compact ? getSerializedSizeOf<true>(value.val) : getSerializedSizeOf<false>(value.val);
+            write(size);
+            auto valOffset = _currentPosition.offset;
+            write(value.val);
+            auto written = _currentPosition.offset - valOffset;
+            if (written != size) {
+                // the type's __getFieldsSize() doesn't match what it writes. The size prefix is already out so a
+                // reader would misparse the rest of the message. Fail in all builds instead of sending it
+                K2ERROR("serialized size mismatch: expected=" << size << ", written=" << written);
+                throw std::runtime_error("serialized size mismatch");
+            }
+        }
     }
 
     // write for primitive types by copy
     template <typename T>
     std::enable_if_t<isNumericType<T>(), void> write(const T value) {
+        if constexpr (isVarintType<T>()) {
+            if (_compact) {
+                _writeVarint(_encodeVarint(value));
+                return;
+            }
+        }
         write((const void*)&value, sizeof(value));
     }
 
@@ -439,8 +526,22 @@ public: // Write API
     }
 
     // write out many fields at once
+    // A run of adjacent fixed size values is written with one capacity check if it fits in the current buffer
     template <typename T, typename... ArgsT>
     void writeMany(T& value, ArgsT&... args) {
+        if constexpr (isFixedSizeType<T>()) {
+            if (_compact) {
+                write(value);
+                writeMany(args...);
+                return;
+            }
+            constexpr size_t runSize = _fixedRunSize<T, ArgsT...>();
+            char* dst = _contiguousWritePtr(runSize);
+            if (dst) {
+                _writeFixedRun(dst, value, args...);
+                return;
+            }
+        }
         write(value);
         writeMany(args...);
     }
@@ -448,6 +549,99 @@ public: // Write API
     // no-arg version to satisfy the template expansion above in the terminal case
     void writeMany();
 
+    // make sure there is enough capacity to write the given values from the current position, so that
+    // writing them doesn't need to allocate buffer one at a time.
+    template <typename... ArgsT>
+    void reserveFor(const ArgsT&... args) {
+        ensureCapacity(_currentPosition.offset +
+            (_compact ? getSerializedSizeOfMany<true>(args...) : getSerializedSizeOfMany<false>(args...)));
+    }
+
+public: // serialized size API. The size is exactly what the write() of the value would take in a payload
+    // which uses the fixed (Compact=false) or compact (Compact=true) encoding
+    template <bool Compact = false>
+    static size_t getSerializedSizeOf(const String& value) {
+        return Compact ? _varintSize(value.size()) + value.size() : sizeof(_Size) + value.size() + 1;
+    }
+
+    template <bool Compact = false>
+    static size_t getSerializedSizeOf(const PayloadStringView& value) {
+        return Compact ? _varintSize(value.size()) + value.size() : sizeof(_Size) + value.size() + 1;
+    }
+
+    template <bool Compact = false>
+    static size_t getSerializedSizeOf(const Payload& value) {
+        return (Compact ? _varintSize(value.getSize()) : sizeof(size_t)) + value.getSize();
+    }
+
+    template <bool Compact = false>
+    static size_t getSerializedSizeOf(const Duration& dur) {
+        return getSerializedSizeOf<Compact>(dur.count());
+    }
+
+    template <bool Compact = false, typename T>
+    static size_t getSerializedSizeOf(const SerializeAsPayload<T>& value) {
+        if constexpr (std::is_same<T, Payload>::value || std::is_same<T, const Payload>::value) {
+            return getSerializedSizeOf<Compact>(value.val);
+        }
+        else {
+            size_t size = getSerializedSizeOf<Compact>(value.val);
+            return (Compact ? _varintSize(size) : sizeof(uint64_t)) + size;
+        }
+    }
+
+    template <bool Compact = false, typename KeyT, typename ValueT>
+    static size_t getSerializedSizeOf(const std::map<KeyT, ValueT>& m) {
+        return _getSerializedSizeOfRange<Compact>(m);
+    }
+
+    template <bool Compact = false, typename KeyT, typename ValueT>
+    static size_t getSerializedSizeOf(const std::unordered_map<KeyT, ValueT>& m) {
+        return _getSerializedSizeOfRange<Compact>(m);
+    }
+
+    template <bool Compact = false, typename ValueT>
+    static size_t getSerializedSizeOf(const std::vector<ValueT>& vec) {
+        return _getSerializedSizeOfRange<Compact>(vec);
+    }
+
+    template <bool Compact = false, typename T>
+    static size_t getSerializedSizeOf(const std::set<T>& s) {
+        return _getSerializedSizeOfRange<Compact>(s);
+    }
+
+    template <bool Compact = false, typename T>
+    static size_t getSerializedSizeOf(const std::unordered_set<T>& s) {
+        return _getSerializedSizeOfRange<Compact>(s);
+    }
+
+    template <bool Compact = false, typename KeyT, typename ValueT>
+    static size_t getSerializedSizeOf(const std::pair<KeyT, ValueT>& kvp) {
+        return getSerializedSizeOf<Compact>(kvp.first) + getSerializedSizeOf<Compact>(kvp.second);
+    }
+
+    template <bool Compact = false, typename T>
+    static std::enable_if_t<isFixedSizeType<T>(), size_t> getSerializedSizeOf(const T& value) {
+        if constexpr (Compact && isVarintType<T>()) {
+            return _varintSize(_encodeVarint(value));
+        }
+        else {
+            (void)value;
+            return sizeof(T);
+        }
+    }
+
+    // serializable types provide their size through K2_PAYLOAD_FIELDS
+    template <bool Compact = false, typename T>
+    static std::enable_if_t<isPayloadSerializableType<T>(), size_t> getSerializedSizeOf(const T& value) {
+        return value.template __getFieldsSize<Compact>();
+    }
+
+    template <bool Compact = false, typename... ArgsT>
+    static size_t getSerializedSizeOfMany(const ArgsT&... args) {
+        return (getSerializedSizeOf<Compact>(args) + ... + 0);
+    }
+
 private:  // types and fields
 
     std::vector<Binary> _buffers;
@@ -455,6 +649,7 @@ private:  // types and fields
     size_t _capacity; // total bytes allocated in the buffers.
     BinaryAllocatorFunctor _allocator;
     PayloadPosition _currentPosition;
+    bool _compact = false; // use the compact encoding. See setCompactEncoding()
 
 private: // helper methods
     // used to allocate additional space
@@ -463,6 +658,127 @@ private: // helper methods
     // advances the current position by the given number
     void _advancePosition(size_t advance);
 
+    // total size of the leading fixed size types
+    template <typename T, typename... ArgsT>
+    static constexpr size_t _fixedRunSize() {
+        if constexpr (!isFixedSizeType<T>()) {
+            return 0;
+        }
+        else if constexpr (sizeof...(ArgsT) == 0) {
+            return sizeof(T);
+        }
+        else {
+            return sizeof(T) + _fixedRunSize<ArgsT...>();
+        }
+    }
+
+    // if the next size bytes are in the current buffer, returns the pointer to them and advances the position.
+    // Otherwise returns nullptr and the position is not modified
+    char* _contiguousWritePtr(size_t size);
+    const char* _contiguousReadPtr(size_t size);
+
+    // copy the leading fixed size values to/from the given memory and process the rest with writeMany/readMany
+    template <typename T, typename... ArgsT>
+    void _writeFixedRun(char* dst, T& value, ArgsT&... args) {
+        if constexpr (isFixedSizeType<T>()) {
+            std::memcpy(dst, (const void*)&value, sizeof(T));
+            _writeFixedRun(dst + sizeof(T), args...);
+        }
+        else {
+            writeMany(value, args...);
+        }
+    }
+    void _writeFixedRun(char*) {}
+
+    template <typename T, typename... ArgsT>
+    bool _readFixedRun(const char* src, T& value, ArgsT&... args) {
+        if constexpr (isFixedSizeType<T>()) {
+            std::memcpy((void*)&value, src, sizeof(T));
+            return _readFixedRun(src + sizeof(T), args...);
+        }
+        else {
+            return readMany(value, args...);
+        }
+    }
+    bool _readFixedRun(const char*) { return true; }
+
+    template <bool Compact, typename RangeT>
+    static size_t _getSerializedSizeOfRange(const RangeT& range) {
+        using ValueT = typename RangeT::value_type;
+        size_t result = Compact ? _varintSize(range.size()) : sizeof(_Size);
+        if constexpr (isFixedSizeType<ValueT>() && !(Compact && isVarintType<ValueT>())) {
+            return result + range.size() * sizeof(ValueT);
+        }
+        else {
+            for (auto& value : range) {
+                result += getSerializedSizeOf<Compact>(value);
+            }
+            return result;
+        }
+    }
+
+    // LEB128 varint helpers for the compact encoding. Signed integers are zigzag-encoded so that small
+    // negative values stay small
+    static constexpr size_t _varintSize(uint64_t value) {
+        size_t result = 1;
+        while (value >= 0x80) {
+            value >>= 7;
+            ++result;
+        }
+        return result;
+    }
+
+    template <typename T>
+    static uint64_t _encodeVarint(T value) {
+        using U = std::remove_cv_t<T>;
+        if constexpr (std::is_enum<U>::value) {
+            return _encodeVarint(static_cast<std::underlying_type_t<U>>(value));
+        }
+        else if constexpr (std::is_signed<U>::value) {
+            int64_t v = value;
+            return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+        }
+        else {
+            return value;
+        }
+    }
+
+    // returns false if the decoded value doesn't fit in T
+    template <typename T>
+    static bool _decodeVarint(uint64_t raw, T& value) {
+        if constexpr (std::is_enum<T>::value) {
+            std::underlying_type_t<T> underlying;
+            if (!_decodeVarint(raw, underlying)) return false;
+            value = static_cast<T>(underlying);
+            return true;
+        }
+        else if constexpr (std::is_signed<T>::value) {
+            int64_t v = int64_t(raw >> 1) ^ -int64_t(raw & 1);
+            if (v < std::numeric_limits<T>::min() || v > std::numeric_limits<T>::max()) return false;
+            value = T(v);
+            return true;
+        }
+        else {
+            if (raw > std::numeric_limits<T>::max()) return false;
+            value = T(raw);
+            return true;
+        }
+    }
+
+    void _writeVarint(uint64_t value);
+    bool _readVarint(uint64_t& value);
+
+    template <typename T>
+    bool _readVarintValue(T& value) {
+        auto pos = getCurrentPosition();
+        uint64_t raw = 0;
+        if (!_readVarint(raw) || !_decodeVarint(raw, value)) {
+            seek(pos);
+            return false;
+        }
+        return true;
+    }
+
 private: // deleted
     Payload(const Payload&) = delete;
     Payload& operator=(const Payload&) = delete;
@@ -23,6 +23,12 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include "PayloadFileUtil.h"
 
+#include <seastar/core/align.hh>
+#include <seastar/core/file.hh>
+#include <seastar/core/seastar.hh>
+
+#include <atomic>
+
 namespace k2 {
 
 // create a directory if it doesn't exist already
@@ -91,7 +97,7 @@ bool fileutil::writeFile(Payload&& payload, String path) {
     payload.truncateToCurrent();
     auto leftBytes = payload.getSize();
 
-    int fd = ::open(path.c_str(), O_CREAT | O_WRONLY);
+    int fd = ::open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0666);
     if (fd < 0) {
         K2ERROR("Unable to open file for writing: name=" << path << ", err=" << strerror(errno));
         return false;
@@ -113,4 +119,96 @@ bool fileutil::writeFile(Payload&& payload, String path) {
     return true;
 }
 
+seastar::future<bool> fileutil::fileExistsAsync(String path) {
+    return seastar::file_exists(path)
+    .handle_exception([path](auto exc) {
+        K2ERROR_EXC("problem checking file: name=" << path, exc);
+        return false;
+    });
+}
+
+seastar::future<bool> fileutil::readFileAsync(Payload& payload, String path) {
+    payload.clear();
+    return fileExistsAsync(path)
+    .then([&payload, path](bool exists) {
+        if (!exists) return seastar::make_ready_future<bool>(false);
+        return seastar::open_file_dma(path, seastar::open_flags::ro)
+        .then([&payload](seastar::file f) {
+            return f.size()
+            .then([f, &payload](uint64_t size) mutable {
+                if (size == 0) return seastar::make_ready_future<bool>(true);
+                return f.dma_read_bulk<char>(0, size)
+                .then([&payload, size](Binary&& buf) {
+                    if (buf.size() != size) {
+                        K2ERROR("short read: expected=" << size << ", got=" << buf.size());
+                        return false;
+                    }
+                    payload.appendBinary(std::move(buf));
+                    return true;
+                });
+            })
+            .finally([f]() mutable { return f.close(); });
+        })
+        .handle_exception([&payload, path](auto exc) {
+            K2ERROR_EXC("problem reading file: name=" << path, exc);
+            payload.clear();
+            return false;
+        });
+    });
+}
+
+seastar::future<bool> fileutil::writeFileAtomicAsync(Payload&& payload, String path) {
+    payload.truncateToCurrent();
+    auto size = payload.getSize();
+    // every write gets its own temp file(unique by process and by write), so that concurrent writers never write into
+    // the same file, and a writer never renames a temp file which another writer is still filling
+    static std::atomic<uint64_t> tmpCounter{0};
+    auto tmpPath = path + ".tmp." + seastar::to_sstring(::getpid()) + "." + seastar::to_sstring(tmpCounter.fetch_add(1));
+    auto slash = path.find_last_of('/');
+    String dir = slash == String::npos ? String(".") : path.substr(0, slash);
+
+    return seastar::open_file_dma(tmpPath, seastar::open_flags::wo | seastar::open_flags::create | seastar::open_flags::truncate)
+    .then([payload=std::move(payload), size](seastar::file f) mutable {
+        // DMA writes must be aligned, so copy the payload into an aligned buffer and trim the padding afterwards
+        auto alignment = f.disk_write_dma_alignment();
+        auto buf = Binary::aligned(alignment, seastar::align_up<size_t>(std::max<size_t>(size, 1), alignment));
+        std::memset(buf.get_write(), 0, buf.size());
+        size_t offset = 0;
+        for (auto& part : payload.release()) {
+            auto tocopy = std::min(part.size(), size - offset);
+            std::memcpy(buf.get_write() + offset, part.get(), tocopy);
+            offset += tocopy;
+            if (offset == size) break;
+        }
+        return seastar::do_with(std::move(buf), [f, size](Binary& buf) mutable {
+            return f.dma_write<char>(0, buf.get(), buf.size())
+            .then([f, size, &buf](size_t written) mutable {
+                if (written != buf.size()) {
+                    return seastar::make_exception_future<>(std::runtime_error("short write"));
+                }
+                return f.truncate(size);
+            })
+            .then([f]() mutable { return f.flush(); });
+        })
+        .finally([f]() mutable { return f.close(); });
+    })
+    .then([tmpPath, path] {
+        return seastar::rename_file(tmpPath, path);
+    })
+    .then([dir] {
+        // make the rename itself durable
+        return seastar::sync_directory(dir);
+    })
+    .then([] {
+        return true;
+    })
+    .handle_exception([path, tmpPath](auto exc) {
+        K2ERROR_EXC("Unable to write file: name=" << path, exc);
+        // don't leave the temp file behind. It may not exist, depending on where the write failed
+        return seastar::remove_file(tmpPath)
+        .handle_exception([](auto) {})
+        .then([] { return false; });
+    });
+}
+
 } // ns k2
@@ -28,6 +28,8 @@ Copyright(c) 2020 Futurewei Cloud
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <seastar/core/future.hh>
+
 #include "Payload.h"
 
 #include <k2/common/Defer.h>
@@ -47,5 +49,20 @@ static bool readFile(Payload& payload, String path);
 // write an entire payload into the given file
 static bool writeFile(Payload&& payload, String path);
 
+// The functions above block the calling thread on the filesystem. The ones below use seastar's async file API instead
+// and so they are safe to use from a reactor which serves requests.
+
+// check to see if a file exists
+static seastar::future<bool> fileExistsAsync(String path);
+
+// read an entire file into a payload. The payload must stay alive until the returned future completes
+static seastar::future<bool> readFileAsync(Payload& payload, String path);
+
+// Atomically replace the contents of the given file with the payload. The payload is written to a temporary file in the
+// same directory, flushed to disk, and renamed over the target, so that after a crash the file has either the old
+// or the new contents. Each write uses its own temporary file, so concurrent writes to the same file are safe, but
+// which one ends up in the file is unspecified. Callers which need the last write to win must serialize them
+static seastar::future<bool> writeFileAtomicAsync(Payload&& payload, String path);
+
 }; // struct fileutil
 } // ns k2
@@ -28,7 +28,10 @@ Copyright(c) 2020 Futurewei Cloud
 // General purpose macro for creating serializable structures of any field types.
 // You have to pass your fields here in order for them to be (de)serialized. This macro works for any
 // field types (both primitive/simple as well as nested/complex) but it does the (de)serialization
-// on a field-by-field basis so it may be less efficient than the one-shot macro below
+// on a field-by-field basis so it may be less efficient than the one-shot macro below.
+// In the fixed encoding, adjacent fixed size fields (numerics, enums and K2_PAYLOAD_COPYABLE types) are copied
+// in a single run.
+// Types with custom __writeFields/__readFields must also provide __getFieldsSize() matching what they write.
 #define K2_PAYLOAD_FIELDS(...)                     \
     struct __K2PayloadSerializableTraitTag__ {};   \
     void __writeFields(k2::Payload& payload) const {   \
@@ -36,6 +39,10 @@ Copyright(c) 2020 Futurewei Cloud
     }                                              \
     bool __readFields(k2::Payload& payload) {          \
         return payload.readMany(__VA_ARGS__);      \
+    }                                              \
+    template <bool Compact = false>                \
+    size_t __getFieldsSize() const {               \
+        return k2::Payload::getSerializedSizeOfMany<Compact>(__VA_ARGS__); \
     }
 
 // This is a macro which can be put on structures which are directly copyable
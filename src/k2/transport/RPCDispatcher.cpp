@@ -23,8 +23,10 @@ Copyright(c) 2020 Futurewei Cloud
 
 #include <cstdlib>
 #include <seastar/core/sleep.hh>
+#include <boost/range/irange.hpp>
 
 #include <k2/common/Log.h>
+#include "BufferPool.h"
 #include "RPCDispatcher.h"
 #include "TXEndpoint.h"
 
@@ -32,9 +34,13 @@ namespace k2{
 
 RPCDispatcher::Dist_t ___RPC___;
 
-RPCDispatcher::RPCDispatcher() : _msgSequenceID(uint32_t(std::rand())) {
+RPCDispatcher::RPCDispatcher() : _streamNonce(uint32_t(std::rand())) {
     K2DEBUG("ctor");
     registerLowTransportMemoryObserver(nullptr);
+    _wheelTimer.set_callback([this] { _onWheelTick(); });
+    // stream control messages are handled internally
+    _observers[InternalVerbs::STREAM_CREDIT] = [this](Request&& request) { _handleStreamControl(std::move(request)); };
+    _observers[InternalVerbs::STREAM_CANCEL] = [this](Request&& request) { _handleStreamControl(std::move(request)); };
 }
 
 RPCDispatcher::~RPCDispatcher() {
@@ -67,34 +73,68 @@ RPCDispatcher::registerProtocol(seastar::reference_wrapper<RPCProtocolFactory::D
     [shptr=seastar::make_lw_shared<>(weak_from_this())] (const String& protoname, size_t requiredBytes) {
         K2DEBUG("lowmem notification from proto="<< protoname <<", requiredBytes="<< requiredBytes);
         seastar::weak_ptr<RPCDispatcher>& weakP = *shptr.get(); // the weak_ptr inside the lw_shared_ptr
-        if (weakP) {
-            weakP->_lowMemObserver(protoname, requiredBytes);
+        // give back the free transport buffers first, and only involve the application if that isn't enough
+        auto released = BufferPool::local().shrink(requiredBytes);
+        if (weakP && released < requiredBytes) {
+            weakP->_lowMemObserver(protoname, requiredBytes - released);
         }
     });
 
     return seastar::make_ready_future<>();
 }
 
-void RPCDispatcher::registerMessageObserver(Verb verb, RequestObserver_t observer) {
-    K2DEBUG("registering message observer for verb: " << int(verb));
-    if (observer == nullptr) {
-        _observers.erase(verb);
-        K2DEBUG("Removing message observer for verb: " << int(verb));
-        return;
-    }
+void RPCDispatcher::registerMessageObserver(Verb verb, std::nullptr_t) {
+    K2DEBUG("Removing message observer for verb: " << int(verb));
+    _observers[verb] = nullptr;
+    _loopbackObservers.erase(verb);
+}
+
+void RPCDispatcher::_registerHandler(Verb verb, RequestHandler_t&& handler) {
     if (verb >= InternalVerbs::MAX_VERB) {
         // can't allow registration of the NIL verb
         throw SystemVerbRegistrationNotAllowedException();
     }
     // we don't allow replacing verb observers. Raise an exception if there is an observer already
-    auto emplace_pair = _observers.try_emplace(verb, observer);
-    if (!emplace_pair.second) {
+    if (_observers[verb]) {
         throw DuplicateRegistrationException();
     }
+    _observers[verb] = std::move(handler);
 }
 
-void RPCDispatcher::start() {
+seastar::future<> RPCDispatcher::start() {
     K2DEBUG("start");
+    if (!_loopback()) {
+        return seastar::make_ready_future();
+    }
+    // find out which core serves each of the server endpoints in this process
+    return seastar::parallel_for_each(boost::irange(0u, seastar::smp::count), [this](unsigned core) {
+        return container().invoke_on(core, [](RPCDispatcher& disp) { return disp._getServerURLs(); })
+            .then([this, core](std::vector<String>&& urls) {
+                for (auto& url: urls) {
+                    K2DEBUG("loopback endpoint " << url << " on core " << core);
+                    _loopbackCores[std::move(url)] = core;
+                }
+            });
+    });
+}
+
+std::vector<String> RPCDispatcher::_getServerURLs() const {
+    std::vector<String> result;
+    for (auto& ep: getServerEndpoints()) {
+        result.push_back(ep->getURL());
+    }
+    return result;
+}
+
+std::optional<unsigned> RPCDispatcher::_getLoopbackCore(const TXEndpoint& endpoint) const {
+    if (!_loopback()) {
+        return std::nullopt;
+    }
+    auto iter = _loopbackCores.find(endpoint.getURL());
+    if (iter == _loopbackCores.end()) {
+        return std::nullopt;
+    }
+    return iter->second;
 }
 
 seastar::future<> RPCDispatcher::stop() {
@@ -105,12 +145,26 @@ seastar::future<> RPCDispatcher::stop() {
         proto.second->setMessageObserver(nullptr);
     }
     _protocols.clear();
+    _loopbackCores.clear();
+    _loopbackObservers.clear();
 
     // complete all promises
-    for(auto&& promise: _rrPromises) {
-        promise.second.promise.set_exception(DispatcherShutdown());
+    _wheelTimer.cancel();
+    _trackers.forEach([](ResponseTracker& tracker) {
+        tracker.promise.set_exception(DispatcherShutdown());
+    });
+    _trackers.clear();
+    for (auto& [id, stream]: _clientStreams) {
+        stream->_disp = nullptr;
+        stream->_finish(Statuses::S503_Service_Unavailable("dispatcher has shut down"));
+    }
+    _clientStreams.clear();
+    for (auto& [token, stream]: _serverStreams) {
+        stream->_disp = nullptr;
+        stream->_cancel();
     }
-    _rrPromises.clear();
+    _serverStreams.clear();
+    _wheel.clear();
     return seastar::make_ready_future<>();
 }
 
@@ -119,25 +173,26 @@ void RPCDispatcher::_handleNewMessage(Request&& request) {
     K2DEBUG("handling request for verb="<< int(request.verb) <<", from ep="<< request.endpoint.getURL());
     // see if this is a response
     if (request.metadata.isResponseIDSet()) {
+        if (request.verb == InternalVerbs::STREAM_DATA || request.verb == InternalVerbs::STREAM_END) {
+            _handleStreamResponse(std::move(request));
+            return;
+        }
         // process as a response
-        auto nodei = _rrPromises.find(request.metadata.responseID);
-        if (nodei == _rrPromises.end()) {
+        if (!_trackers.find(request.metadata.responseID)) {
             K2DEBUG("no handler for response for msgid: " << request.metadata.responseID )
             // TODO emit metric for RR without msid
             return;
         }
-        // we have a response
-        nodei->second.timer.cancel();
-        nodei->second.promise.set_value(std::move(request.payload));
-        _rrPromises.erase(nodei);
+        // we have a response. The timer wheel will skip the request since its tracker is released
+        _trackers.release(request.metadata.responseID).promise.set_value(std::move(request.payload));
         return;
     }
-    auto iter = _observers.find(request.verb);
-    if (iter != _observers.end()) {
+    auto& handler = _observers[request.verb];
+    if (handler) {
         K2DEBUG("Dispatching request for verb="<< int(request.verb) <<", from ep="<< request.endpoint.getURL());
         // TODO emit verb-dimension metric for duration of handling
         try {
-            iter->second(std::move(request));
+            handler(std::move(request));
         } catch (std::exception& exc) {
             K2ERROR("Caught exception while dispatching request: " << exc.what());
         } catch (...) {
@@ -151,6 +206,11 @@ void RPCDispatcher::_handleNewMessage(Request&& request) {
 }
 
 void RPCDispatcher::_send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata meta) {
+    // we can always parse compact payloads. Let the peer know so that it can negotiate compact encoding with us
+    meta.setCompactCapable();
+    if (payload->isCompactEncoding()) {
+        meta.setCompactEncoding();
+    }
 
     auto protoi = _protocols.find(endpoint.getProtocol());
     if (protoi == _protocols.end()) {
@@ -176,6 +236,67 @@ void RPCDispatcher::_send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoin
     protoi->second->send(verb, std::move(payload), endpoint, std::move(meta));
 }
 
+void RPCDispatcher::_handleStreamResponse(Request&& request) {
+    auto iter = _clientStreams.find(request.metadata.responseID);
+    if (iter == _clientStreams.end()) {
+        K2DEBUG("no stream for response id: " << request.metadata.responseID);
+        if (request.verb == InternalVerbs::STREAM_DATA) {
+            // the server is still sending. Tell it to stop
+            uint64_t token = (uint64_t(_streamNonce) << 32) | request.metadata.responseID;
+            _sendStreamControl(InternalVerbs::STREAM_CANCEL, request.endpoint, token, 0);
+        }
+        return;
+    }
+    auto stream = iter->second;
+    if (request.verb == InternalVerbs::STREAM_DATA) {
+        stream->_onFrame(std::move(request.payload));
+        return;
+    }
+    Status status;
+    if (!request.payload->read(status)) {
+        status = Statuses::S500_Internal_Server_Error("unable to parse status from stream response");
+    }
+    _clientStreams.erase(iter);
+    stream->_disp = nullptr;
+    stream->_finish(std::move(status));
+}
+
+void RPCDispatcher::_handleStreamControl(Request&& request) {
+    uint64_t token = 0;
+    uint32_t credits = 0;
+    if (!request.payload->read(token) || !request.payload->read(credits)) {
+        K2WARN("unable to parse stream control message from " << request.endpoint.getURL());
+        return;
+    }
+    auto iter = _serverStreams.find(token);
+    if (iter == _serverStreams.end()) {
+        K2DEBUG("no stream for token: " << token);
+        return;
+    }
+    if (request.verb == InternalVerbs::STREAM_CREDIT) {
+        iter->second->_grant(credits);
+    }
+    else {
+        iter->second->_cancel();
+    }
+}
+
+void RPCDispatcher::_sendStreamControl(Verb verb, TXEndpoint& endpoint, uint64_t token, uint32_t credits) {
+    auto payload = endpoint.newPayload();
+    payload->write(token);
+    payload->write(credits);
+    _send(verb, std::move(payload), endpoint, MessageMetadata());
+}
+
+bool RPCDispatcher::_isCompactPeer(const TXEndpoint& endpoint) const {
+    if (!_compactEncoding()) {
+        return false;
+    }
+    // the capability is tracked by the connection to the peer, so that it goes away with the connection
+    auto protoi = _protocols.find(endpoint.getProtocol());
+    return protoi != _protocols.end() && protoi->second->isCompactPeer(endpoint);
+}
+
 void RPCDispatcher::send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint) {
     K2DEBUG("Plain send");
     MessageMetadata metadata;
@@ -190,33 +311,77 @@ void RPCDispatcher::sendReply(std::unique_ptr<Payload> payload, Request& forRequ
 }
 
 seastar::future<std::unique_ptr<Payload>>
-RPCDispatcher::sendRequest(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, Duration timeout) {
-    uint64_t msgid = _msgSequenceID++;
+RPCDispatcher::sendRequest(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, Duration timeout,
+                           RequestHandle* handle) {
+    if (_trackers.full()) {
+        K2WARN("Too many pending requests. Failing request for verb=" << int(verb) << ", ep=" << endpoint.getURL());
+        return seastar::make_exception_future<std::unique_ptr<Payload>>(TooManyPendingRequestsException());
+    }
+    // record the promise so that we can fulfil it if we get a response
+    // the promise gets fulfilled when prom for this msgid comes back.
+    auto msgid = _addTracker(Clock::now() + timeout);
     K2DEBUG("Request send with msgid=" << msgid << ", timeout=" << timeout << ", ep=" << endpoint.getURL());
+    auto fut = _trackers.find(msgid)->promise.get_future();
+    if (handle) {
+        handle->requestId = msgid;
+    }
 
-    // the promise gets fulfilled when prom for this msgid comes back.
-    PayloadPromise prom;
-    // record the promise so that we can fulfil it if we get a response
     MessageMetadata metadata;
     metadata.setRequestID(msgid);
-
     _send(verb, std::move(payload), endpoint, std::move(metadata));
 
-    seastar::timer<> timer([this, msgid] {
+    return fut;
+}
+
+void RPCDispatcher::cancelRequest(RequestHandle& handle) {
+    if (!handle.requestId) {
+        return;
+    }
+    auto msgid = *handle.requestId;
+    handle.requestId.reset();
+    // the tracker is gone if the request has completed. Its wheel entry is dropped when its bucket comes due
+    if (_trackers.find(msgid)) {
+        K2DEBUG("cancelling request with msgid=" << msgid);
+        _trackers.release(msgid).promise.set_exception(RequestCancelledException());
+    }
+}
+
+uint32_t RPCDispatcher::_addTracker(TimePoint deadline) {
+    auto msgid = _trackers.add(ResponseTracker{PayloadPromise(), deadline});
+    auto due = _wheel.add(msgid, deadline, Clock::now());
+    if (!_wheelTimer.armed() || due < _wheelTimer.get_timeout()) {
+        _wheelTimer.rearm(due);
+    }
+    return msgid;
+}
+
+void RPCDispatcher::_onWheelTick() {
+    auto now = Clock::now();
+    _wheel.expire(now, [this, now](uint32_t msgid) {
+        auto tracker = _trackers.find(msgid);
+        if (!tracker) {
+            // the request has completed already
+            return false;
+        }
+        if (tracker->deadline > now) {
+            // the request is due on a later rotation of the wheel
+            return true;
+        }
         // raise an exception in the promise for this request.
         K2DEBUG("send request timed out for msgid=" << msgid);
         // TODO emit metric for timeout
-        auto iter = this->_rrPromises.find(msgid);
-        assert(iter != this->_rrPromises.end());
-        iter->second.promise.set_exception(RequestTimeoutException());
-        this->_rrPromises.erase(iter);
+        _trackers.release(msgid).promise.set_exception(RequestTimeoutException());
+        return false;
     });
-    timer.arm(timeout);
-
-    auto fut = prom.get_future();
-    _rrPromises.emplace(msgid, ResponseTracker{std::move(prom), std::move(timer)});
-
-    return fut;
+    if (_trackers.size() == 0) {
+        // nothing is pending. Leave the timer off until the next request
+        _wheel.clear();
+        return;
+    }
+    auto due = _wheel.nextDue();
+    if (due) {
+        _wheelTimer.arm(*due);
+    }
 }
 
 void RPCDispatcher::registerLowTransportMemoryObserver(LowTransportMemoryObserver_t observer) {
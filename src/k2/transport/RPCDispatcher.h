@@ -24,25 +24,46 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 
 // stl
+#include <array>
+#include <deque>
 #include <functional>
 #include <unordered_map>
 #include <exception>
+#include <optional>
+#include <type_traits>
 
 // third party
 #include <seastar/core/distributed.hh>
+#include <seastar/core/future-util.hh> // for with_timeout
 #include <seastar/core/shared_ptr.hh>
 #include <seastar/core/weak_ptr.hh>
 #include <seastar/util/reference_wrapper.hh> // for seastar::ref
 
 // k2
 #include <k2/common/Common.h>
+#include <k2/common/InlineFunction.h>
 #include <k2/config/Config.h>
+#include "GenerationSlab.h"
 #include "RPCProtocolFactory.h"
 #include "Request.h"
+#include "RPCStream.h"
 #include "Status.h"
+#include "TimerWheel.h"
 
 namespace k2 {
 
+// Put this macro on RPC request/response types which may be delivered in-process(see RPCDispatcher::callRPC).
+// The objects are copied on the calling core and moved to the serving core, so only put it on types which own all of
+// their memory and don't share it with other objects: no Payloads, views (e.g. KeyView), shared pointers or
+// seastar buffers, at any level of nesting.
+#define K2_RPC_LOOPBACK_SAFE struct __K2RPCLoopbackSafeTraitTag__ {};
+
+template <typename T, typename = void>
+struct IsRPCLoopbackSafeTypeTrait : std::false_type {};
+
+template <typename T>
+struct IsRPCLoopbackSafeTypeTrait<T, typename enable_if_type<typename T::__K2RPCLoopbackSafeTraitTag__>::type> : std::true_type {};
+
 // Utility function which helps RPC users create responses without spelling out nested template arguments
 template <typename T>
 inline seastar::future<std::tuple<Status, T>> RPCResponse(Status&& s, T&& r) {
@@ -53,7 +74,9 @@ inline seastar::future<std::tuple<Status, T>> RPCResponse(Status&& s, T&& r) {
 // It dispatches incoming RPC messages to message observers, and provides RPC channels for sending
 // outgoing messages.
 // This class should be used as a distributed<> container
-class RPCDispatcher: public seastar::weakly_referencable<RPCDispatcher> {
+// RPCs to endpoints which are served by this process can be delivered in-process(see callRPC)
+class RPCDispatcher: public seastar::weakly_referencable<RPCDispatcher>,
+                     public seastar::peering_sharded_service<RPCDispatcher> {
 public: // types
     // distributed<> version of the class
     typedef seastar::distributed<RPCDispatcher> Dist_t;
@@ -81,6 +104,22 @@ public: // types
         virtual const char* what() const noexcept override{ return "request timed out";}
     };
 
+    // delivered to sendRequest callers when there are too many pending requests on the core
+    struct TooManyPendingRequestsException : public std::exception {
+        virtual const char* what() const noexcept override{ return "too many pending requests";}
+    };
+
+    // delivered to sendRequest callers when their request is cancelled via cancelRequest()
+    struct RequestCancelledException : public std::exception {
+        virtual const char* what() const noexcept override{ return "request cancelled";}
+    };
+
+    // Identifies a pending request so that the caller can cancel it (see cancelRequest()).
+    // In-process (loopback) calls are not cancellable and leave the handle empty
+    struct RequestHandle {
+        std::optional<uint32_t> requestId;
+    };
+
 public:
     // Construct an RPC dispatcher
     RPCDispatcher();
@@ -92,8 +131,9 @@ public: // distributed<> interface
     // iface: called by seastar's distributed mechanism when stop() is invoked on the distributed container.
     seastar::future<> stop();
 
-    // Should be called by user when all distributed objects have been created
-    void start();
+    // Should be called by user when all distributed objects have been created and the protocols have been
+    // registered. Here we discover the server endpoints of all cores so that we can deliver RPCs to them in-process
+    seastar::future<> start();
 
 public: // message-oriented API
     // This method is used to register protocols with the dispatcher.
@@ -105,7 +145,21 @@ public: // message-oriented API
     // registerMessageObserver allows you to register an observer function for a given RPC verb.
     // You can have at most one observer per verb. a DuplicateRegistrationException will be
     // thrown if there is an observer already installed for this verb
-    void registerMessageObserver(Verb verb, RequestObserver_t observer);
+    // The observer can be any callable which takes a Request&&. It is stored inline in the dispatch table, unless it
+    // is too large to fit, in which case it is moved to the heap.
+    template <class Func>
+    void registerMessageObserver(Verb verb, Func&& observer) {
+        if constexpr (std::is_same_v<std::decay_t<Func>, RequestObserver_t>) {
+            if (!observer) {
+                registerMessageObserver(verb, nullptr);
+                return;
+            }
+        }
+        _registerHandler(verb, _makeHandler(std::forward<Func>(observer)));
+    }
+
+    // removes the observer for the given verb
+    void registerMessageObserver(Verb verb, std::nullptr_t);
 
     // registerLowTransportMemoryObserver allows the user to register an observer which will be called when
     // a transport becomes low on memory.
@@ -118,6 +172,8 @@ public: // message-oriented API
     // the requiredNumberOfBytes parameter in their callback.
     // Since we're dealing with multiple transports, the callback also indicates which transport protocol
     // required release. The user can then release Payloads whose transport protocol matches.
+    // Before calling the observer, we release the free buffers held in the transport BufferPool, and the observer
+    // is only asked for the remainder.
     void registerLowTransportMemoryObserver(LowTransportMemoryObserver_t observer);
 
     // This method creates an endpoint for a given URL. The endpoint is needed in order to
@@ -143,8 +199,17 @@ public: // message-oriented API
     // The method provides a future<> based callback support via the return value.
     // The future will complete with exception if the given timeout is reached before we receive a response.
     // if we receive a response after the timeout is reached, we will ignore it internally.
+    // If a handle is given, it can be used to cancel the request while it is pending.
     seastar::future<std::unique_ptr<Payload>>
-    sendRequest(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, Duration timeout);
+    sendRequest(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, Duration timeout,
+                RequestHandle* handle=nullptr);
+
+    // Fails the pending request with RequestCancelledException. The response, if it arrives later, is ignored.
+    // This does nothing if the request has already completed
+    void cancelRequest(RequestHandle& handle);
+
+    // the number of requests on this core which are waiting for a response
+    size_t pendingRequests() const { return _trackers.size(); }
 
     // Use this method to reply to a given Request, with the given payload. This method should be normally used
     // in message observers to respond to clients.
@@ -152,13 +217,309 @@ public: // message-oriented API
 
 public: // RPC-oriented interface. Small convenience so that users don't have to deal with Payloads directly
     // Same as sendRequest but for RPC types, not raw payloads
+    // If rpc_loopback is enabled and the endpoint is served by this process, the request is delivered to the RPC
+    // observer on the serving core without serialization. This is only done for request/response types which are
+    // marked with K2_RPC_LOOPBACK_SAFE, as the objects are moved across cores.
     template<class Request_t, class Response_t>
-    seastar::future<std::tuple<Status, Response_t>> callRPC(Verb verb, Request_t& request, TXEndpoint& endpoint, Duration timeout) {
+    seastar::future<std::tuple<Status, Response_t>> callRPC(Verb verb, Request_t& request, TXEndpoint& endpoint, Duration timeout,
+                                                            RequestHandle* handle=nullptr) {
+        if constexpr (_isLoopbackSafe<Request_t, Response_t>()) {
+            auto core = _getLoopbackCore(endpoint);
+            if (core) {
+                return _callLoopbackRPC<Request_t, Response_t>(*core, verb, request, endpoint, timeout);
+            }
+        }
+        return _callRemoteRPC<Request_t, Response_t>(verb, request, endpoint, timeout, handle);
+    }
+
+    // Register a handler for requests of type Request_t. You are required to respond with an object of type Response_t
+    // and a Status for your request
+    // The observer can be any copyable callable which takes a Request_t&&. The request stays alive until the future
+    // returned by the observer resolves, so the observer can refer to it from its continuations.
+    template <class Request_t, class Response_t, class Func>
+    void registerRPCObserver(Verb verb, Func&& observer) {
+        using Observer_t = std::decay_t<Func>;
+        if constexpr (_isLoopbackSafe<Request_t, Response_t>()) {
+            // the observer is shared by the dispatch table and the in-process path
+            auto obs = seastar::make_lw_shared<Observer_t>(std::forward<Func>(observer));
+            _registerHandler(verb, _makeHandler(_makeRPCHandler<Request_t, Response_t>(
+                [obs](Request_t&& request) { return (*obs)(std::move(request)); })));
+            _loopbackObservers[verb] = std::make_unique<LoopbackObserver<Request_t, Response_t, Observer_t>>(std::move(obs));
+        }
+        else {
+            _registerHandler(verb, _makeHandler(_makeRPCHandler<Request_t, Response_t>(std::forward<Func>(observer))));
+        }
+    }
+
+public: // streaming RPC interface
+    // Starts a streaming call: the server responds to the request with any number of frames of type Frame_t,
+    // followed by a final status. Use the returned reader to consume the frames. We allow at most `credits` frames to
+    // be in flight or waiting to be consumed. The stream is cancelled if no frame is received or consumed within
+    // `timeout`, and when the returned reader is dropped
+    template<class Request_t, class Frame_t>
+    RPCStreamReader<Frame_t> callStreamRPC(Verb verb, Request_t& request, TXEndpoint& endpoint, Duration timeout, uint32_t credits=16) {
+        uint64_t token = (uint64_t(_streamNonce) << 32) | _streamSequenceID++;
+        auto stream = seastar::make_lw_shared<RPCClientStream>(this, endpoint, token, credits, timeout);
+        _clientStreams[uint32_t(token)] = stream;
+
         auto payload = endpoint.newPayload();
+        payload->setCompactEncoding(_isCompactPeer(endpoint));
+        payload->reserveFor(token, credits, request);
+        payload->write(token);
+        payload->write(credits);
+        payload->write(request);
+        K2DEBUG("RPC stream call to endpoint: " << endpoint.getURL() << ", token=" << token);
+
+        MessageMetadata metadata;
+        metadata.setRequestID(uint32_t(token));
+        _send(verb, std::move(payload), endpoint, std::move(metadata));
+        return RPCStreamReader<Frame_t>(std::move(stream));
+    }
+
+    // Register a handler for streaming calls with requests of type Request_t. The handler is given a writer, which it
+    // should use to send any number of frames of type Frame_t. The Status the handler returns is sent to the client
+    // as the final status of the call
+    template <class Request_t, class Frame_t, class Func>
+    void registerStreamRPCObserver(Verb verb, Func&& observer) {
+        _registerHandler(verb, [this, observer=std::forward<Func>(observer)](Request&& request) mutable {
+            uint64_t token = 0;
+            uint32_t credits = 0;
+            Request_t rpcRequest{};
+            if (!request.metadata.isRequestIDSet() || !request.payload->read(token) ||
+                !request.payload->read(credits) || !request.payload->read(rpcRequest)) {
+                auto reply = request.endpoint.newPayload();
+                reply->setCompactEncoding(request.payload->isCompactEncoding());
+                reply->write(Statuses::S400_Bad_Request("unable to parse incoming request"));
+                MessageMetadata metadata;
+                metadata.setResponseID(request.metadata.requestID);
+                _send(InternalVerbs::STREAM_END, std::move(reply), request.endpoint, std::move(metadata));
+                return;
+            }
+            auto stream = seastar::make_lw_shared<RPCServerStream>(this, request.endpoint, request.metadata.requestID,
+                token, credits, request.payload->isCompactEncoding(), _streamCreditTimeout());
+            _serverStreams[token] = stream;
+
+            seastar::future<Status> fut = seastar::make_ready_future<Status>();
+            try {
+                fut = observer(std::move(rpcRequest), RPCStreamWriter<Frame_t>(stream));
+            } catch (...) {
+                fut = seastar::make_exception_future<Status>(std::current_exception());
+            }
+            (void)fut.then_wrapped([stream](auto&& fut) {
+                if (fut.failed()) {
+                    stream->_fail(fut.get_exception());
+                }
+                else {
+                    stream->_finish(fut.get0());
+                }
+            });
+        });
+    }
+
+private:  // types
+    friend class RPCClientStream;
+    friend class RPCServerStream;
+
+    // The handlers for incoming messages. These are stored inline in the dispatch table
+    typedef InlineFunction<void(Request&& request)> RequestHandler_t;
+
+private:  // methods
+    // Process new messages received from protocols
+    void _handleNewMessage(Request&& request);
+
+    // stores the callable inline in a handler, or on the heap if it is too large to fit
+    template <class Func>
+    static RequestHandler_t _makeHandler(Func&& func) {
+        using Func_t = std::decay_t<Func>;
+        if constexpr (sizeof(Func_t) <= RequestHandler_t::capacity) {
+            return RequestHandler_t(std::forward<Func>(func));
+        }
+        else {
+            auto f = std::make_unique<Func_t>(std::forward<Func>(func));
+            return RequestHandler_t([f=std::move(f)](Request&& request) { (*f)(std::move(request)); });
+        }
+    }
+
+    // An incoming RPC request and its parsed form. These have to stay alive until the observer's future resolves
+    template <class Request_t>
+    struct RPCRequestState {
+        RPCRequestState(Request&& req): request(std::move(req)) {}
+        Request request;
+        Request_t rpcRequest;
+    };
+
+    // wraps an RPC observer into a message handler, which parses the request and sends back the observer's response
+    template <class Request_t, class Response_t, class Observer>
+    auto _makeRPCHandler(Observer&& observer) {
+        return [this, observer=std::forward<Observer>(observer)](Request&& request) mutable {
+            auto state = std::make_unique<RPCRequestState<Request_t>>(std::move(request));
+            if (!state->request.payload->read(state->rpcRequest)) {
+                auto reply = state->request.endpoint.newPayload();
+                reply->setCompactEncoding(state->request.payload->isCompactEncoding());
+                reply->write(Statuses::S400_Bad_Request("unable to parse incoming request"));
+                sendReply(std::move(reply), state->request);
+                return;
+            }
+            auto fut = observer(std::move(state->rpcRequest));
+            if (fut.available()) {
+                // the observer responded synchronously. We're still in the dispatcher so we can reply right away
+                _sendRPCReply<Response_t>(std::move(fut), state->request);
+                return;
+            }
+            // we're ignoring the returned future here so we can't wait for it before the rpc dispatcher exits
+            // to guard against segv on shutdown, the continuation holds a weak pointer
+            (void)fut.then_wrapped([disp=weak_from_this(), state=std::move(state)](auto&& fut) {
+                if (!disp) {
+                    K2WARN("dispatcher is going down: unable to send response to " << state->request.endpoint.getURL());
+                    fut.ignore_ready_future();
+                    return;
+                }
+                disp->template _sendRPCReply<Response_t>(std::move(fut), state->request);
+            });
+        };
+    }
+
+    // sends the result of an RPC observer as the reply to the given request
+    template <class Response_t, class Future_t>
+    void _sendRPCReply(Future_t&& fut, Request& request) {
+        // reply in the same encoding as the request
+        auto reply = request.endpoint.newPayload();
+        reply->setCompactEncoding(request.payload->isCompactEncoding());
+        if (fut.failed()) {
+            K2ERROR_EXC("RPC handler failed with uncaught exception", fut.get_exception());
+            reply->write(Statuses::S500_Internal_Server_Error("server caught exception processing request"));
+            reply->write(Response_t{});
+            sendReply(std::move(reply), request);
+            return;
+        }
+        auto result = fut.get0();
+        auto& [status, response] = result;
+        // write out the status first
+        reply->reserveFor(status, response);
+        reply->write(status);
+        // write out the Response_t
+        reply->write(response);
+        sendReply(std::move(reply), request);
+    }
+
+    // installs the handler for the given verb. Throws if the verb is reserved or if it already has a handler
+    void _registerHandler(Verb verb, RequestHandler_t&& handler);
+
+    // route a stream frame or final status to its client stream
+    void _handleStreamResponse(Request&& request);
+
+    // process a credit grant or a cancel from the client of a stream we're serving
+    void _handleStreamControl(Request&& request);
+
+    // sends a stream credit grant or cancel message
+    void _sendStreamControl(Verb verb, TXEndpoint& endpoint, uint64_t token, uint32_t credits);
+
+    // Helper method useds to send messages
+    void _send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata meta);
+
+    // true if compact encoding is enabled and the given endpoint is known to be able to parse it
+    bool _isCompactPeer(const TXEndpoint& endpoint) const;
+
+    // allocates a tracker for a new request which times out at the given deadline. Returns the request ID
+    uint32_t _addTracker(TimePoint deadline);
+
+    // called by the wheel timer. Fails the requests which have timed out since the last time we were called
+    void _onWheelTick();
+
+    // returns the core which serves the given endpoint if it is served by this process and loopback is enabled
+    std::optional<unsigned> _getLoopbackCore(const TXEndpoint& endpoint) const;
+
+    // true if RPCs with the given types may be delivered in-process(see K2_RPC_LOOPBACK_SAFE)
+    template <class Request_t, class Response_t>
+    static constexpr bool _isLoopbackSafe() {
+        return IsRPCLoopbackSafeTypeTrait<Request_t>::value && IsRPCLoopbackSafeTypeTrait<Response_t>::value &&
+               std::is_copy_constructible_v<Request_t>;
+    }
+
+    // the URLs of the server endpoints on this core
+    std::vector<String> _getServerURLs() const;
+
+    // The result of an in-process RPC. If the serving core didn't have a matching typed observer,
+    // the response is empty and the request is handed back so that we can send it the regular way
+    template <class Request_t, class Response_t>
+    struct LoopbackResult {
+        std::optional<std::tuple<Status, Response_t>> response;
+        Request_t request;
+    };
+
+    // type-erased holder of RPC observers, used for in-process RPCs
+    struct LoopbackObserverBase {
+        virtual ~LoopbackObserverBase() {}
+    };
+    template <class Request_t, class Response_t>
+    struct TypedLoopbackObserver : public LoopbackObserverBase {
+        virtual seastar::future<std::tuple<Status, Response_t>> call(Request_t&& request) = 0;
+    };
+    // shares the observer with the handler in the dispatch table
+    template <class Request_t, class Response_t, class Observer_t>
+    struct LoopbackObserver : public TypedLoopbackObserver<Request_t, Response_t> {
+        LoopbackObserver(seastar::lw_shared_ptr<Observer_t> obs) : observer(std::move(obs)) {}
+        seastar::future<std::tuple<Status, Response_t>> call(Request_t&& request) override {
+            return (*observer)(std::move(request));
+        }
+        seastar::lw_shared_ptr<Observer_t> observer;
+    };
+
+    // deliver the RPC to the dispatcher on the given core, without serializing the request and response
+    template<class Request_t, class Response_t>
+    seastar::future<std::tuple<Status, Response_t>>
+    _callLoopbackRPC(unsigned core, Verb verb, Request_t& request, TXEndpoint& endpoint, Duration timeout) {
+        K2DEBUG("RPC loopback call to core " << core << " for endpoint: " << endpoint.getURL());
+        auto fut = container().invoke_on(core, [verb, request=Request_t(request)](RPCDispatcher& disp) mutable {
+            return disp._handleLoopbackRPC<Request_t, Response_t>(verb, std::move(request));
+        });
+        return seastar::with_timeout<RequestTimeoutExceptionFactory>(Clock::now() + timeout, std::move(fut))
+            .then([this, verb, endpoint, timeout](LoopbackResult<Request_t, Response_t>&& result) mutable {
+                if (result.response) {
+                    return seastar::make_ready_future<std::tuple<Status, Response_t>>(std::move(*result.response));
+                }
+                K2DEBUG("no loopback observer for verb " << int(verb) << ". Sending to endpoint: " << endpoint.getURL());
+                return _callRemoteRPC<Request_t, Response_t>(verb, result.request, endpoint, timeout);
+            })
+            .handle_exception([](auto exc) {
+                return _handleRPCException<Response_t>(exc);
+            });
+    }
+
+    // runs on the serving core for in-process RPCs
+    template<class Request_t, class Response_t>
+    seastar::future<LoopbackResult<Request_t, Response_t>> _handleLoopbackRPC(Verb verb, Request_t&& request) {
+        LoopbackResult<Request_t, Response_t> result;
+        auto iter = _loopbackObservers.find(verb);
+        auto* lobs = iter == _loopbackObservers.end() ? nullptr :
+                     dynamic_cast<TypedLoopbackObserver<Request_t, Response_t>*>(iter->second.get());
+        if (!lobs) {
+            // no observer for these types. Let the caller send the request the regular way
+            result.request = std::move(request);
+            return seastar::make_ready_future<LoopbackResult<Request_t, Response_t>>(std::move(result));
+        }
+        return lobs->call(std::move(request))
+            .handle_exception([](auto exc) {
+                K2ERROR_EXC("RPC handler failed with uncaught exception", exc);
+                return std::make_tuple<Status, Response_t>(Statuses::S500_Internal_Server_Error("server caught exception processing request"), Response_t());
+            })
+            .then([result=std::move(result)](auto&& response) mutable {
+                result.response = std::move(response);
+                return std::move(result);
+            });
+    }
+
+    // serialize the request and send it to the endpoint via the protocol for the endpoint
+    template<class Request_t, class Response_t>
+    seastar::future<std::tuple<Status, Response_t>> _callRemoteRPC(Verb verb, Request_t& request, TXEndpoint& endpoint, Duration timeout,
+                                                                   RequestHandle* handle=nullptr) {
+        auto payload = endpoint.newPayload();
+        payload->setCompactEncoding(_isCompactPeer(endpoint));
+        payload->reserveFor(request);
         payload->write(request);
         K2DEBUG("RPC Request call to endpoint: " << endpoint.getURL());
 
-        return sendRequest(verb, std::move(payload), endpoint, timeout)
+        return sendRequest(verb, std::move(payload), endpoint, timeout, handle)
             .then([](std::unique_ptr<Payload>&& responsePayload) {
                 // parse status
                 auto result = std::make_tuple<Status, Response_t>(Status(), Response_t());
@@ -174,100 +535,98 @@ public: // RPC-oriented interface. Small convenience so that users don't have to
                 return result;
             })
             .handle_exception([](auto exc) {
-                try {
-                    std::rethrow_exception(exc);
-                }
-                catch (const RPCDispatcher::RequestTimeoutException&) {
-                    return std::make_tuple<Status, Response_t>(Statuses::S503_Service_Unavailable("client timed out"), Response_t());
-                }
-                catch (const std::exception &e) {
-                    K2ERROR("RPC send failed with uncaught exception: " << e.what());
-                }
-                catch (...) {
-                    K2ERROR("RPC send failed with unknown exception");
-                }
-
-                return std::make_tuple<Status, Response_t>(Statuses::S500_Internal_Server_Error("unknown exception while sending request"), Response_t());
+                return _handleRPCException<Response_t>(exc);
             });
     }
 
-    // Register a handler for requests of type Request_t. You are required to respond with an object of type Response_t
-    // and a Status for your request
-    template <class Request_t, class Response_t>
-    void registerRPCObserver(Verb verb, RPCRequestObserver_t<Request_t, Response_t> observer) {
-        // wrap the RPC observer into a message observer
-        registerMessageObserver(verb, [this, observer=std::move(observer)](Request&& request) mutable {
-            // we're ignoring the returned future here so we can't wait for it before the rpc dispatcher exits
-            // to guard against segv on shutdown, obtain a weak pointer
-            (void)seastar::do_with(std::move(request), Request_t{}, weak_from_this(),
-                [&observer](auto& request, auto& rpcRequest, auto& disp) {
-                    if (!disp) return seastar::make_ready_future();
-
-                    if (!request.payload->read(rpcRequest)) {
-                        auto reply = request.endpoint.newPayload();
-                        reply->write(Statuses::S400_Bad_Request("unable to parse incoming request"));
-                        disp->sendReply(std::move(reply), request);
-                        return seastar::make_ready_future();
-                    }
-                    // if disp was still alive, it's safe to call observer
-                    return observer(std::move(rpcRequest))
-                        .then([&](auto&& result) mutable {
-                            if (!disp) {
-                                K2WARN("dispatcher is going down: unable to send response to " << request.endpoint.getURL());
-                                return;
-                            }
-
-                            auto& [status, response] = result;
-                            // write out the status first
-                            auto reply = request.endpoint.newPayload();
-                            reply->write(status);
-                            // write out the Response_t
-                            reply->write(response);
-                            disp->sendReply(std::move(reply), request);
-                        })
-                        .handle_exception([&](auto exc) mutable {
-                            K2ERROR_EXC("RPC handler failed with uncaught exception", exc);
-                            if (disp) {
-                                auto reply = request.endpoint.newPayload();
-                                reply->write(Statuses::S500_Internal_Server_Error("server caught exception processing request"));
-                                reply->write(Response_t{});
-                                disp->sendReply(std::move(reply), request);
-                            }
-                        });
-               });
-        });
+    // converts exceptions from sending an RPC into a status for the caller
+    template<class Response_t>
+    static std::tuple<Status, Response_t> _handleRPCException(std::exception_ptr exc) {
+        try {
+            std::rethrow_exception(exc);
+        }
+        catch (const RPCDispatcher::RequestTimeoutException&) {
+            return std::make_tuple<Status, Response_t>(Statuses::S503_Service_Unavailable("client timed out"), Response_t());
+        }
+        catch (const RPCDispatcher::RequestCancelledException&) {
+            return std::make_tuple<Status, Response_t>(Statuses::S503_Service_Unavailable("request cancelled"), Response_t());
+        }
+        catch (const std::exception &e) {
+            K2ERROR("RPC send failed with uncaught exception: " << e.what());
+        }
+        catch (...) {
+            K2ERROR("RPC send failed with unknown exception");
+        }
+
+        return std::make_tuple<Status, Response_t>(Statuses::S500_Internal_Server_Error("unknown exception while sending request"), Response_t());
     }
 
-private:  // methods
-    // Process new messages received from protocols
-    void _handleNewMessage(Request&& request);
-
-    // Helper method useds to send messages
-    void _send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata meta);
+    // used with seastar::with_timeout to fail in-process RPCs the same way as remote RPCs
+    struct RequestTimeoutExceptionFactory {
+        static auto timeout() { return RequestTimeoutException(); }
+    };
 
 private: // fields
     // the protocols this dispatcher will be able to support
     std::unordered_map<String, seastar::shared_ptr<IRPCProtocol>> _protocols;
 
-    // the message observers
-    std::unordered_map<Verb, RequestObserver_t> _observers;
+    // the message handlers, indexed by verb
+    std::array<RequestHandler_t, 256> _observers;
 
     // to track the request-reply promises and timeouts
     typedef seastar::promise<std::unique_ptr<Payload>> PayloadPromise;
     struct ResponseTracker {
         PayloadPromise promise;
-        seastar::timer<> timer;
+        TimePoint deadline;
     };
 
-    // map of all pending request-reply
-    std::unordered_map<uint64_t, ResponseTracker> _rrPromises;
+    // the number of buckets in the timer wheel
+    static constexpr size_t WHEEL_SIZE = 4096;
+
+    // The request-reply trackers. The request ID we send is the ID of the request's tracker in the slab, so that we
+    // can ignore responses which arrive after their request has timed out
+    GenerationSlab<ResponseTracker> _trackers;
+
+    // the resolution of request timeouts. It is fine enough for sub-millisecond timeouts, and the wheel timer only
+    // wakes up for ticks in which some request is due
+    ConfigDuration _wheelTickDuration{"rpc_timer_wheel_tick", 20us};
+
+    // The timeouts of the pending requests. Completed requests are not removed from the wheel. We skip them when
+    // their bucket comes due
+    TimerWheel _wheel{_wheelTickDuration(), WHEEL_SIZE};
+
+    // the only reactor timer we use for request timeouts. It is armed for the next wheel bucket which has requests
+    seastar::timer<> _wheelTimer;
 
     // our observer for low memory events
     LowTransportMemoryObserver_t _lowMemObserver;
 
-    // sequence id used for request-reply
-    // TODO use something a bit stronger than simple increment integer
-    uint32_t _msgSequenceID;
+    // send RPC requests with the compact payload encoding to peers which support it. On by default: it is negotiated
+    // per connection, so peers which don't advertise it still get the fixed encoding
+    ConfigVar<bool> _compactEncoding{"rpc_compact_encoding", true};
+
+    // deliver RPCs to endpoints served by this process in-process, without serialization
+    ConfigVar<bool> _loopback{"rpc_loopback", false};
+
+    // the cores serving each of the server endpoint URLs of this process
+    std::unordered_map<String, unsigned> _loopbackCores;
+
+    // the typed RPC observers, used for in-process RPCs
+    std::unordered_map<Verb, std::unique_ptr<LoopbackObserverBase>> _loopbackObservers;
+
+    // the streams we're consuming, by request ID
+    std::unordered_map<uint32_t, seastar::lw_shared_ptr<RPCClientStream>> _clientStreams;
+
+    // the streams we're serving, by stream token
+    std::unordered_map<uint64_t, seastar::lw_shared_ptr<RPCServerStream>> _serverStreams;
+
+    // Stream tokens are made of a random nonce(high 32 bits) and a sequence number(low 32 bits), which is also used
+    // as the request ID. The nonce makes the tokens unique across clients
+    uint32_t _streamNonce;
+    uint32_t _streamSequenceID = 0;
+
+    // how long a stream server waits for the client to grant credits before it gives up on the stream
+    ConfigDuration _streamCreditTimeout{"rpc_stream_credit_timeout", 10s};
 
 private: // don't need
     RPCDispatcher(const RPCDispatcher& o) = delete;
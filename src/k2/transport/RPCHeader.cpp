@@ -71,11 +71,46 @@ bool MessageMetadata::isChecksumSet() const {
     return this->features & (1 << 3);  // bit3
 }
 
+void MessageMetadata::setCompactEncoding() {
+    this->features |= (1 << 4);  // bit4
+}
+
+bool MessageMetadata::isCompactEncodingSet() const {
+    return this->features & (1 << 4);  // bit4
+}
+
+void MessageMetadata::setCompactCapable() {
+    this->features |= (1 << 5);  // bit5
+}
+
+bool MessageMetadata::isCompactCapableSet() const {
+    return this->features & (1 << 5);  // bit5
+}
+
+void MessageMetadata::setCompressed(uint32_t uncompressedSize) {
+    K2DEBUG("Set uncompressed size=" << uncompressedSize);
+    this->uncompressedSize = uncompressedSize;
+    this->features |= (1 << 6);  // bit6
+}
+
+bool MessageMetadata::isCompressedSet() const {
+    return this->features & (1 << 6);  // bit6
+}
+
+void MessageMetadata::setCompressCapable() {
+    this->features |= (1 << 7);  // bit7
+}
+
+bool MessageMetadata::isCompressCapableSet() const {
+    return this->features & (1 << 7);  // bit7
+}
+
 size_t MessageMetadata::wireByteCount() {
     return isPayloadSizeSet() * sizeof(payloadSize) +
             isRequestIDSet() * sizeof(requestID) +
             isResponseIDSet() * sizeof(responseID) +
-            isChecksumSet() * sizeof(checksum);
+            isChecksumSet() * sizeof(checksum) +
+            isCompressedSet() * sizeof(uncompressedSize);
 }
 
 } // namespace k2
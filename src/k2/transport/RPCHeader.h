@@ -57,6 +57,14 @@ static const uint8_t MAX_HEADER_SIZE = 128;
 // | 4          | RequestID       | The request message ID - short-term unique number
 // | 4          | ResponseID      | The response message ID - repeat from a previous msg.RequestID
 // | 4          | Checksum        | The optional checksum for the message
+// | 4          | UncompressedSize| Set when the payload is compressed. The size of the payload after decompression
+//
+// flag-only features, which don't carry any bytes:
+// - bit4: CompactEncoding. The payload is serialized with the compact encoding (see Payload::setCompactEncoding())
+// - bit5: CompactCapable. The sender can parse payloads in the compact encoding. Used by senders to discover
+//         which peers they can send compact payloads to.
+// - bit7: CompressCapable. The sender can decompress payloads. Compressed payloads (bit6, see UncompressedSize above)
+//         are only sent over channels on which the peer has advertised this feature.
 //
 // Note that since the message is likely to be binaried, the payload will be stored and presented as
 // a Payload, which is basically an iovec which exposes the binaries for the payload.
@@ -92,6 +100,22 @@ public: // API
     void setChecksum(uint32_t checksum);
     bool isChecksumSet() const;
 
+    // compact payload encoding at position 4. No wire bytes
+    void setCompactEncoding();
+    bool isCompactEncodingSet() const;
+
+    // sender can parse compact payloads at position 5. No wire bytes
+    void setCompactCapable();
+    bool isCompactCapableSet() const;
+
+    // payload compression at position 6. The payloadSize and checksum describe the compressed bytes
+    void setCompressed(uint32_t uncompressedSize);
+    bool isCompressedSet() const;
+
+    // sender can decompress payloads at position 7. No wire bytes
+    void setCompressCapable();
+    bool isCompressCapableSet() const;
+
     // this method is used to determine how many wire bytes are needed given the set features
     size_t wireByteCount();
 
@@ -101,6 +125,7 @@ public: // fields
     uint32_t requestID = 0;
     uint32_t responseID = 0;
     uint32_t checksum = 0;
+    uint32_t uncompressedSize = 0;
     // MAYBE TODO  crypto, sender endpoint
 };
 } // k2
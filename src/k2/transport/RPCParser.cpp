@@ -22,8 +22,35 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include "RPCParser.h"
+
+// third-party
+#include <lz4.h>
+
 namespace k2 {
 
+// Returns a pointer to the first size bytes of data, starting at the given offset in the given buffers.
+// The data is copied into the scratch binary only if it isn't contiguous already
+static const char* _linearize(const std::vector<Binary>& buffers, size_t offset, size_t size, Binary& scratch) {
+    size_t bufIdx = 0;
+    while (bufIdx < buffers.size() && offset >= buffers[bufIdx].size()) {
+        offset -= buffers[bufIdx].size();
+        ++bufIdx;
+    }
+    if (bufIdx < buffers.size() && buffers[bufIdx].size() - offset >= size) {
+        return buffers[bufIdx].get() + offset;
+    }
+    scratch = Binary(size);
+    size_t copied = 0;
+    for (; bufIdx < buffers.size() && copied < size; ++bufIdx) {
+        auto bytes = std::min(buffers[bufIdx].size() - offset, size - copied);
+        std::memcpy(scratch.get_write() + copied, buffers[bufIdx].get() + offset, bytes);
+        copied += bytes;
+        offset = 0;
+    }
+    assert(copied == size);
+    return scratch.get();
+}
+
 bool RPCParser::append(Binary& binary, size_t& writeOffset, const void* data, size_t size) {
     if (binary.size() < writeOffset + size)
         return false;
@@ -34,14 +61,19 @@ bool RPCParser::append(Binary& binary, size_t& writeOffset, const void* data, si
 
 bool RPCParser::canDispatch() { return _shouldParse; }
 
+bool RPCParser::isPeerCompactCapable() const { return _peerCompactCapable; }
+
 void RPCParser::_setParserFailure(std::exception&& exc) {
     _pState = ParseState::FAILED_STREAM;
     _parserFailureException = std::move(exc);
 }
 
-RPCParser::RPCParser(std::function<bool()> preemptor, bool useChecksum) :
+RPCParser::RPCParser(std::function<bool()> preemptor, bool useChecksum, bool useCompression) :
         _shouldParse(false),
         _useChecksum(useChecksum),
+        _useCompression(useCompression),
+        _peerCanDecompress(false),
+        _peerCompactCapable(false),
         _pState(ParseState::WAIT_FOR_FIXED_HEADER),
         _preemptor(preemptor) {
     K2DEBUG("ctor");
@@ -104,6 +136,11 @@ bool RPCParser::writeHeader(Binary& binary, Verb verb, MessageMetadata meta) {
         if (!appendRaw(binary, writeOffset, meta.checksum))
             return false;
     }
+    if (meta.isCompressedSet()) {
+        K2DEBUG("have uncompressed size=" << meta.uncompressedSize);
+        if (!appendRaw(binary, writeOffset, meta.uncompressedSize))
+            return false;
+    }
     // all done.
     K2DEBUG("Write offset after writing header: " << writeOffset);
 
@@ -323,6 +360,11 @@ void RPCParser::_stWAIT_FOR_VARIABLE_HEADER() {
         K2DEBUG("wait_for_var_header: have checksum: " << _metadata.checksum);
         _currentBinary.trim_front(sizeof(_metadata.checksum));
     }
+    if (_metadata.isCompressedSet()) {
+        std::memcpy((char*)&_metadata.uncompressedSize, _currentBinary.get_write(), sizeof(_metadata.uncompressedSize));
+        K2DEBUG("wait_for_var_header: have uncompressed size: " << _metadata.uncompressedSize);
+        _currentBinary.trim_front(sizeof(_metadata.uncompressedSize));
+    }
     _pState = ParseState::WAIT_FOR_PAYLOAD;  // onto getting the payload
     K2DEBUG("wait_for_var_header: parsed");
 }
@@ -382,6 +424,11 @@ void RPCParser::_stIN_PARTIAL_VARIABLE_HEADER() {
         K2DEBUG("partial_var_header: have checksum: " << _metadata.checksum);
         data += sizeof(_metadata.checksum);
     }
+    if (_metadata.isCompressedSet()) {
+        std::memcpy((char*)&_metadata.uncompressedSize, data, sizeof(_metadata.uncompressedSize));
+        K2DEBUG("partial_var_header: have uncompressed size: " << _metadata.uncompressedSize);
+        data += sizeof(_metadata.uncompressedSize);
+    }
     _pState = ParseState::WAIT_FOR_PAYLOAD;  // onto getting the payload
     K2DEBUG("partial_var_header: parsed");
 }
@@ -440,6 +487,20 @@ void RPCParser::_stREADY_TO_DISPATCH() {
             return;
         }
     }
+    if (_metadata.isCompressCapableSet()) {
+        _peerCanDecompress = true;
+    }
+    if (_metadata.isCompactCapableSet()) {
+        _peerCompactCapable = true;
+    }
+    if (_payload && _metadata.isCompressedSet() && !_decompress()) {
+        K2DEBUG("unable to decompress payload of size=" << _metadata.payloadSize);
+        _setParserFailure(DecompressionException());
+        return;
+    }
+    if (_payload) {
+        _payload->setCompactEncoding(_metadata.isCompactEncodingSet());
+    }
     _messageObserver(_fixedHeader.verb, std::move(_metadata), std::move(_payload));
 
     // only now we're ready to process the next message
@@ -477,6 +538,13 @@ RPCParser::serializeMessage(Payload&& message, Verb verb, MessageMetadata metada
 std::vector<Binary>
 RPCParser::prepareForSend(Verb verb, std::unique_ptr<Payload> payload, MessageMetadata metadata) {
     assert(payload->getSize() >= txconstants::MAX_HEADER_SIZE);
+    if (_useCompression) {
+        metadata.setCompressCapable();
+        auto dataSize = payload->getSize() - txconstants::MAX_HEADER_SIZE;
+        if (_peerCanDecompress && dataSize >= _compressionThreshold() && dataSize <= _maxCompressionSize()) {
+            payload = _compress(std::move(payload), metadata);
+        }
+    }
     auto dataSize = payload->getSize() - txconstants::MAX_HEADER_SIZE;
     metadata.setPayloadSize(dataSize);
     K2DEBUG("send: verb=" << int(verb) << ", payloadSize=" << dataSize);
@@ -506,4 +574,54 @@ RPCParser::prepareForSend(Verb verb, std::unique_ptr<Payload> payload, MessageMe
     return std::move(buffers);
 }
 
+std::unique_ptr<Payload>
+RPCParser::_compress(std::unique_ptr<Payload> payload, MessageMetadata& metadata) {
+    auto dataSize = payload->getSize() - txconstants::MAX_HEADER_SIZE;
+    auto buffers = payload->release();
+    // lz4 needs contiguous input
+    Binary scratch;
+    auto input = _linearize(buffers, txconstants::MAX_HEADER_SIZE, dataSize, scratch);
+
+    // leave the same headroom for the header in the compressed payload
+    Binary output(txconstants::MAX_HEADER_SIZE + LZ4_compressBound(dataSize));
+    auto compressedSize = LZ4_compress_default(input, output.get_write() + txconstants::MAX_HEADER_SIZE,
+                                               dataSize, output.size() - txconstants::MAX_HEADER_SIZE);
+    K2DEBUG("compressed payload: size=" << dataSize << ", compressed=" << compressedSize);
+    if (compressedSize <= 0 || size_t(compressedSize) >= dataSize) {
+        // not worth it. Send the original data
+        return std::make_unique<Payload>(std::move(buffers), txconstants::MAX_HEADER_SIZE + dataSize);
+    }
+    metadata.setCompressed(dataSize);
+    output.trim(txconstants::MAX_HEADER_SIZE + compressedSize);
+    std::vector<Binary> compressed;
+    compressed.push_back(std::move(output));
+    return std::make_unique<Payload>(std::move(compressed), txconstants::MAX_HEADER_SIZE + compressedSize);
+}
+
+bool RPCParser::_decompress() {
+    auto compressedSize = _payload->getSize();
+    // the uncompressed size comes from the wire. Check it before we allocate a buffer of that size
+    if (_metadata.uncompressedSize > _maxDecompressedSize() ||
+        _metadata.uncompressedSize > compressedSize * LZ4_MAX_COMPRESSION_RATIO) {
+        K2WARN("rejecting compressed payload: compressed=" << compressedSize
+               << ", uncompressed=" << _metadata.uncompressedSize << ", max=" << _maxDecompressedSize());
+        return false;
+    }
+    auto buffers = _payload->release();
+    Binary scratch;
+    auto input = _linearize(buffers, 0, compressedSize, scratch);
+
+    Binary output(_metadata.uncompressedSize);
+    auto size = LZ4_decompress_safe(input, output.get_write(), compressedSize, output.size());
+    K2DEBUG("decompressed payload: compressed=" << compressedSize << ", size=" << size);
+    if (size < 0 || uint32_t(size) != _metadata.uncompressedSize) {
+        return false;
+    }
+    std::vector<Binary> decompressed;
+    decompressed.push_back(std::move(output));
+    _payload = std::make_unique<Payload>(std::move(decompressed), size);
+    _metadata.payloadSize = size;
+    return true;
+}
+
 } // namespace
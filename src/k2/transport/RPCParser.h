@@ -31,6 +31,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include "RPCHeader.h"
 #include <k2/common/Common.h>
 #include <k2/common/Log.h>
+#include <k2/config/Config.h>
 #include "Payload.h"
 #include "Status.h"
 
@@ -55,10 +56,16 @@ public: // types
     // the segment we received did not have enough data.
     class NonContinuationSegmentException : public std::exception {};
 
+    // indicates that a compressed payload could not be decompressed
+    class DecompressionException : public std::exception {};
+
    public:
     // creates an RPC parser with the given preemptor function. Users can request that we validate/generate checksums
-    // at the expense of extra read pass over the data
-    RPCParser(std::function<bool()> preemptor, bool useChecksum);
+    // at the expense of extra read pass over the data.
+    // Users can also request payload compression. We then advertise to the peer that we can decompress, and once
+    // the peer has advertised the same, we compress outgoing payloads which are larger than tx_compression_threshold
+    // and not larger than tx_compression_max_size
+    RPCParser(std::function<bool()> preemptor, bool useChecksum, bool useCompression=false);
 
     // destructor. Any incomplete messages are dropped
     ~RPCParser();
@@ -108,6 +115,9 @@ public: // types
     // Call this method with a callback to observe parsing failure
     void registerParserFailureObserver(ParserFailureObserver_t parserFailureObserver);
 
+    // true once the peer has advertised that it can parse compact payloads(see MessageMetadata::setCompactCapable())
+    bool isPeerCompactCapable() const;
+
 private: // types
     enum ParseState: uint8_t {
         WAIT_FOR_FIXED_HEADER, // we're waiting for a header for a new message
@@ -134,6 +144,14 @@ private: // methods
 
     void _setParserFailure(std::exception&& exc);
 
+    // compresses the data in the given payload(past the header headroom). Returns a new payload with the compressed
+    // data and sets the metadata accordingly, or the original payload if the data doesn't compress well
+    std::unique_ptr<Payload> _compress(std::unique_ptr<Payload> payload, MessageMetadata& metadata);
+
+    // replaces the current (compressed) payload with its decompressed version. Returns false if the data is corrupt
+    // or if the advertised uncompressed size is larger than we're willing to allocate
+    bool _decompress();
+
     static bool append(Binary& binary, size_t& writeOffset, const void* data, size_t size);
 
     template <typename T>
@@ -159,6 +177,28 @@ private: // methods
     // flag used to determine if we should compute/validate checksums
     bool _useChecksum;
 
+    // flag used to determine if we should advertise decompression and compress payloads
+    bool _useCompression;
+
+    // set once the peer has advertised that it can decompress payloads (see MessageMetadata::setCompressCapable())
+    bool _peerCanDecompress;
+
+    // see isPeerCompactCapable()
+    bool _peerCompactCapable;
+
+    // payloads smaller than this are not worth compressing
+    ConfigVar<uint32_t> _compressionThreshold{"tx_compression_threshold", 4096};
+
+    // payloads larger than this are sent uncompressed. Compression runs on the reactor without yielding, so this
+    // bounds how long a single send can stall the core
+    ConfigVar<uint32_t> _maxCompressionSize{"tx_compression_max_size", 256*1024};
+
+    // the largest uncompressed size we accept for a compressed payload
+    ConfigVar<uint32_t> _maxDecompressedSize{"tx_max_decompressed_size", 64*1024*1024};
+
+    // LZ4 can't compress data by more than this, so a larger uncompressed size means the header is bogus
+    static constexpr uint64_t LZ4_MAX_COMPRESSION_RATIO = 255;
+
     // the parser state
     ParseState _pState;
 
@@ -0,0 +1,251 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "RPCStream.h"
+
+// stl
+#include <algorithm>
+#include <stdexcept>
+
+#include <k2/common/Log.h>
+#include "RPCDispatcher.h"
+
+namespace k2 {
+
+RPCClientStream::RPCClientStream(RPCDispatcher* disp, TXEndpoint endpoint, uint64_t token, uint32_t credits, Duration timeout):
+    _disp(disp),
+    _endpoint(std::move(endpoint)),
+    _token(token),
+    _credits(std::max(credits, 1u)),
+    _timeout(timeout) {
+    _timer.set_callback([this] {
+        K2DEBUG("stream " << _token << " has been idle for " << _timeout);
+        cancel(Statuses::S503_Service_Unavailable("stream timed out"));
+    });
+    _timer.arm(_timeout);
+}
+
+RPCClientStream::~RPCClientStream() {
+    K2DEBUG("dtor");
+}
+
+seastar::future<std::unique_ptr<Payload>> RPCClientStream::next() {
+    if (!_frames.empty()) {
+        auto frame = std::move(_frames.front());
+        _frames.pop_front();
+        _touch();
+        _consume();
+        return seastar::make_ready_future<std::unique_ptr<Payload>>(std::move(frame));
+    }
+    if (_done) {
+        return seastar::make_ready_future<std::unique_ptr<Payload>>(nullptr);
+    }
+    if (_waiter) {
+        return seastar::make_exception_future<std::unique_ptr<Payload>>(std::logic_error("concurrent stream reads are not allowed"));
+    }
+    _waiter.emplace();
+    return _waiter->get_future();
+}
+
+const Status& RPCClientStream::getStatus() const {
+    return _status;
+}
+
+void RPCClientStream::cancel(Status status) {
+    if (_done) {
+        return;
+    }
+    // the dispatcher may be holding the last reference to us
+    auto self = shared_from_this();
+    if (_disp) {
+        _disp->_sendStreamControl(InternalVerbs::STREAM_CANCEL, _endpoint, _token, 0);
+        _disp->_clientStreams.erase(uint32_t(_token));
+        _disp = nullptr;
+    }
+    _frames.clear();
+    _finish(std::move(status));
+}
+
+void RPCClientStream::_onFrame(std::unique_ptr<Payload> frame) {
+    if (_done) {
+        return;
+    }
+    _touch();
+    if (_waiter) {
+        auto waiter = std::move(*_waiter);
+        _waiter.reset();
+        _consume();
+        waiter.set_value(std::move(frame));
+        return;
+    }
+    _frames.push_back(std::move(frame));
+}
+
+void RPCClientStream::_finish(Status status) {
+    if (_done) {
+        return;
+    }
+    K2DEBUG("stream " << _token << " finished with status " << status);
+    _done = true;
+    _status = std::move(status);
+    _timer.cancel();
+    if (_waiter) {
+        auto waiter = std::move(*_waiter);
+        _waiter.reset();
+        waiter.set_value(nullptr);
+    }
+}
+
+void RPCClientStream::_consume() {
+    if (++_consumedSinceGrant < std::max(_credits / 2, 1u) || _done || !_disp) {
+        return;
+    }
+    _disp->_sendStreamControl(InternalVerbs::STREAM_CREDIT, _endpoint, _token, _consumedSinceGrant);
+    _consumedSinceGrant = 0;
+}
+
+void RPCClientStream::_touch() {
+    if (_done) {
+        return;
+    }
+    _timer.cancel();
+    _timer.arm(_timeout);
+}
+
+RPCServerStream::RPCServerStream(RPCDispatcher* disp, TXEndpoint endpoint, uint32_t requestID, uint64_t token,
+                                 uint32_t credits, bool compact, Duration creditTimeout):
+    _disp(disp),
+    _endpoint(std::move(endpoint)),
+    _requestID(requestID),
+    _token(token),
+    _credits(credits),
+    _compact(compact),
+    _creditTimeout(creditTimeout) {
+    _timer.set_callback([this] {
+        K2WARN("stream client " << _endpoint.getURL() << " hasn't granted credits in " << _creditTimeout);
+        // we're waiting for credits, so the only references to us may be in our own promise's continuations
+        auto self = shared_from_this();
+        // let the client know, in case it's still around
+        _finish(Statuses::S408_Request_Timeout("client did not grant credits"));
+        _cancel();
+    });
+}
+
+RPCServerStream::~RPCServerStream() {
+    K2DEBUG("dtor");
+}
+
+std::unique_ptr<Payload> RPCServerStream::newFrame() {
+    auto frame = _endpoint.newPayload();
+    frame->setCompactEncoding(_compact);
+    return frame;
+}
+
+seastar::future<> RPCServerStream::write(std::unique_ptr<Payload> frame) {
+    if (_cancelled || !_disp) {
+        return seastar::make_exception_future<>(StreamCancelledException());
+    }
+    if (_creditWaiter) {
+        return seastar::make_exception_future<>(std::logic_error("concurrent stream writes are not allowed"));
+    }
+    if (_credits > 0) {
+        _credits--;
+        MessageMetadata metadata;
+        metadata.setResponseID(_requestID);
+        _disp->_send(InternalVerbs::STREAM_DATA, std::move(frame), _endpoint, std::move(metadata));
+        return seastar::make_ready_future<>();
+    }
+    K2DEBUG("stream " << _token << " is out of credits");
+    _creditWaiter.emplace();
+    _timer.arm(_creditTimeout);
+    return _creditWaiter->get_future().then([self=shared_from_this(), frame=std::move(frame)] () mutable {
+        return self->write(std::move(frame));
+    });
+}
+
+bool RPCServerStream::isCancelled() const {
+    return _cancelled;
+}
+
+void RPCServerStream::_grant(uint32_t credits) {
+    _credits += credits;
+    if (_creditWaiter) {
+        _timer.cancel();
+        auto waiter = std::move(*_creditWaiter);
+        _creditWaiter.reset();
+        waiter.set_value();
+    }
+}
+
+void RPCServerStream::_cancel() {
+    K2DEBUG("stream " << _token << " cancelled");
+    _cancelled = true;
+    _timer.cancel();
+    if (_creditWaiter) {
+        auto waiter = std::move(*_creditWaiter);
+        _creditWaiter.reset();
+        waiter.set_exception(StreamCancelledException());
+    }
+}
+
+void RPCServerStream::_finish(Status status) {
+    if (_disp && !_cancelled) {
+        _cancelled = true;
+        auto payload = newFrame();
+        payload->write(status);
+        MessageMetadata metadata;
+        metadata.setResponseID(_requestID);
+        _disp->_send(InternalVerbs::STREAM_END, std::move(payload), _endpoint, std::move(metadata));
+    }
+    _detach();
+}
+
+void RPCServerStream::_fail(std::exception_ptr exc) {
+    try {
+        std::rethrow_exception(exc);
+    }
+    catch (const StreamCancelledException&) {
+        // the client is not listening anymore
+        _detach();
+        return;
+    }
+    catch (const std::exception& e) {
+        K2ERROR("stream handler failed with uncaught exception: " << e.what());
+    }
+    catch (...) {
+        K2ERROR("stream handler failed with unknown exception");
+    }
+    _finish(Statuses::S500_Internal_Server_Error("server caught exception processing request"));
+}
+
+void RPCServerStream::_detach() {
+    _timer.cancel();
+    if (_disp) {
+        auto disp = _disp;
+        _disp = nullptr;
+        // this may release the last reference to us
+        disp->_serverStreams.erase(_token);
+    }
+}
+
+} // namespace k2
@@ -0,0 +1,229 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// stl
+#include <deque>
+#include <exception>
+#include <optional>
+
+// third-party
+#include <seastar/core/future.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/core/timer.hh>
+
+// k2
+#include <k2/common/Common.h>
+#include "Payload.h"
+#include "Status.h"
+#include "TXEndpoint.h"
+
+namespace k2 {
+
+class RPCDispatcher;
+
+// Delivered to stream writers when the client has cancelled the stream, or when the client hasn't granted us
+// credits to send more frames within the credit timeout
+struct StreamCancelledException : public std::exception {
+    virtual const char* what() const noexcept override { return "stream cancelled"; }
+};
+
+// The client side of a streaming RPC (see RPCDispatcher::callStreamRPC).
+// The server sends any number of response frames for the request, followed by a final status. We grant the server
+// credits as frames are consumed, so that there are at most `credits` frames in flight or buffered at any time.
+// The stream is cancelled if it sees no activity (a frame received or consumed) for `timeout`. This covers a server
+// which went away as well as a reader which stopped reading.
+class RPCClientStream : public seastar::enable_lw_shared_from_this<RPCClientStream> {
+public: // lifecycle
+    RPCClientStream(RPCDispatcher* disp, TXEndpoint endpoint, uint64_t token, uint32_t credits, Duration timeout);
+    ~RPCClientStream();
+
+public: // API
+    // Returns the next response frame, or nullptr once the stream is over. getStatus() has the final status then.
+    // Only one call can be outstanding at a time
+    seastar::future<std::unique_ptr<Payload>> next();
+
+    // The final status of the call. Only valid after next() has returned nullptr
+    const Status& getStatus() const;
+
+    // Tells the server to stop sending, and ends the stream with the given status
+    void cancel(Status status=Statuses::S499_Client_Closed_Request("stream cancelled by client"));
+
+private: // methods
+    friend class RPCDispatcher;
+
+    // called by the dispatcher for each frame we receive
+    void _onFrame(std::unique_ptr<Payload> frame);
+
+    // ends the stream with the given status
+    void _finish(Status status);
+
+    // called for each frame we hand to the user. Grants the server more credits every half window
+    void _consume();
+
+    // restarts the idle timer
+    void _touch();
+
+private: // fields
+    // the dispatcher. Reset when the dispatcher is done with this stream
+    RPCDispatcher* _disp;
+    TXEndpoint _endpoint;
+    // unique id of the stream. The low 32 bits are the request ID, which the server uses in its responses
+    uint64_t _token;
+    uint32_t _credits;
+    uint32_t _consumedSinceGrant = 0;
+    // how long the stream can be idle before we cancel it
+    Duration _timeout;
+    // frames which have arrived but haven't been consumed yet
+    std::deque<std::unique_ptr<Payload>> _frames;
+    // set while the user is waiting for a frame
+    std::optional<seastar::promise<std::unique_ptr<Payload>>> _waiter;
+    seastar::timer<> _timer;
+    Status _status;
+    bool _done = false;
+};
+
+// The server side of a streaming RPC (see RPCDispatcher::registerStreamRPCObserver)
+class RPCServerStream : public seastar::enable_lw_shared_from_this<RPCServerStream> {
+public: // lifecycle
+    RPCServerStream(RPCDispatcher* disp, TXEndpoint endpoint, uint32_t requestID, uint64_t token, uint32_t credits,
+                    bool compact, Duration creditTimeout);
+    ~RPCServerStream();
+
+public: // API
+    // Creates a payload for a frame, in the encoding of the request
+    std::unique_ptr<Payload> newFrame();
+
+    // Sends the given frame. If the client hasn't granted us credits, the returned future completes once it does.
+    // The future fails with StreamCancelledException if the stream is cancelled. Wait for the returned future before
+    // writing the next frame
+    seastar::future<> write(std::unique_ptr<Payload> frame);
+
+    // true if the client has cancelled the stream
+    bool isCancelled() const;
+
+private: // methods
+    friend class RPCDispatcher;
+
+    // the client has granted us more credits
+    void _grant(uint32_t credits);
+
+    // the stream has been cancelled. Fails any write which is waiting for credits
+    void _cancel();
+
+    // the stream handler has completed. Sends the final status to the client
+    void _finish(Status status);
+
+    // the stream handler has failed
+    void _fail(std::exception_ptr exc);
+
+    // the dispatcher is done with this stream
+    void _detach();
+
+private: // fields
+    RPCDispatcher* _disp;
+    TXEndpoint _endpoint;
+    // the ID of the request which started the stream. Our frames are responses to it
+    uint32_t _requestID;
+    // the id the client uses for the stream in credit and cancel messages
+    uint64_t _token;
+    uint32_t _credits;
+    bool _compact;
+    Duration _creditTimeout;
+    // set while a write is waiting for credits
+    std::optional<seastar::promise<>> _creditWaiter;
+    seastar::timer<> _timer;
+    bool _cancelled = false;
+};
+
+// Typed wrapper for the client side of a stream, which parses the frames into objects of type Frame_t.
+// The reader owns the stream: dropping it cancels the stream if it hasn't ended yet
+template <class Frame_t>
+class RPCStreamReader {
+public:
+    RPCStreamReader(seastar::lw_shared_ptr<RPCClientStream> stream) : _stream(std::move(stream)) {}
+    RPCStreamReader(RPCStreamReader&&) = default;
+    RPCStreamReader& operator=(RPCStreamReader&& o) {
+        if (this != &o) {
+            cancel();
+            _stream = std::move(o._stream);
+        }
+        return *this;
+    }
+    RPCStreamReader(const RPCStreamReader&) = delete;
+    RPCStreamReader& operator=(const RPCStreamReader&) = delete;
+    ~RPCStreamReader() { cancel(); }
+
+    // Returns the next frame, or an empty optional once the stream is over. getStatus() has the final status then.
+    // Only one call can be outstanding at a time
+    seastar::future<std::optional<Frame_t>> next() {
+        return _stream->next().then([stream = _stream](std::unique_ptr<Payload>&& payload) {
+            std::optional<Frame_t> frame;
+            if (payload) {
+                frame.emplace();
+                if (!payload->read(*frame)) {
+                    stream->cancel(Statuses::S500_Internal_Server_Error("unable to parse stream frame"));
+                    frame.reset();
+                }
+            }
+            return frame;
+        });
+    }
+
+    // The final status of the call. Only valid after next() has returned an empty optional
+    const Status& getStatus() const { return _stream->getStatus(); }
+
+    // Tells the server to stop sending. Does nothing if the stream has already ended
+    void cancel() {
+        if (_stream) {
+            _stream->cancel();
+        }
+    }
+
+private:
+    seastar::lw_shared_ptr<RPCClientStream> _stream;
+};
+
+// Typed wrapper for the server side of a stream, which sends objects of type Frame_t
+template <class Frame_t>
+class RPCStreamWriter {
+public:
+    RPCStreamWriter(seastar::lw_shared_ptr<RPCServerStream> stream) : _stream(std::move(stream)) {}
+
+    // Sends the given frame. See RPCServerStream::write()
+    seastar::future<> write(const Frame_t& frame) {
+        auto payload = _stream->newFrame();
+        payload->reserveFor(frame);
+        payload->write(frame);
+        return _stream->write(std::move(payload));
+    }
+
+    // true if the client has cancelled the stream
+    bool isCancelled() const { return _stream->isCancelled(); }
+
+private:
+    seastar::lw_shared_ptr<RPCServerStream> _stream;
+};
+
+} // namespace k2
@@ -39,7 +39,11 @@ typedef uint8_t Verb;
 enum InternalVerbs : k2::Verb {
     LIST_ENDPOINTS = 249,  // used to discover the endpoints of a node
     MAX_VERB = 250,  // something we can use to prevent override of internal verbs.
-    NIL              // used for messages where the verb doesn't matter
+    NIL,             // used for messages where the verb doesn't matter
+    STREAM_DATA,     // a response frame of a streaming RPC
+    STREAM_END,      // the final response of a streaming RPC, which carries the status of the call
+    STREAM_CREDIT,   // sent by stream clients to allow the server to send more frames
+    STREAM_CANCEL    // sent by stream clients to stop the stream
 };
 
 } // namespace k2
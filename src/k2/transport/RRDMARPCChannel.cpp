@@ -29,7 +29,8 @@ namespace k2 {
 
 RRDMARPCChannel::RRDMARPCChannel(std::unique_ptr<seastar::rdma::RDMAConnection> rconn, TXEndpoint endpoint,
                   RequestObserver_t requestObserver, FailureObserver_t failureObserver):
-    _rpcParser([]{return seastar::need_preempt();}, Config()["enable_tx_checksum"].as<bool>()),
+    _rpcParser([]{return seastar::need_preempt();}, Config()["enable_tx_checksum"].as<bool>(),
+               Config()["enable_tx_compression"].as<bool>()),
     _endpoint(std::move(endpoint)),
     _rconn(std::move(rconn)),
     _closingInProgress(false),
@@ -155,4 +156,6 @@ void RRDMARPCChannel::_closeRconn() {
 
 TXEndpoint& RRDMARPCChannel::getTXEndpoint() { return _endpoint; }
 
+bool RRDMARPCChannel::isPeerCompactCapable() const { return _rpcParser.isPeerCompactCapable(); }
+
 } // k2
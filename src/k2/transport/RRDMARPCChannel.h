@@ -70,6 +70,9 @@ public: // API
     // Obtain the endpoint for this channel
     TXEndpoint& getTXEndpoint();
 
+    // true if the peer has told us over this channel that it can parse compact payloads
+    bool isPeerCompactCapable() const;
+
     // This method needs to be called so that the channel can begin processing messages
     void run();
 
@@ -144,6 +144,11 @@ seastar::lw_shared_ptr<TXEndpoint> RRDMARPCProtocol::getServerEndpoint() {
     return _svrEndpoint;
 }
 
+bool RRDMARPCProtocol::isCompactPeer(const TXEndpoint& endpoint) {
+    auto iter = _channels.find(endpoint);
+    return iter != _channels.end() && iter->second->isPeerCompactCapable();
+}
+
 void RRDMARPCProtocol::send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) {
     if (_stopped) {
         K2WARN("Dropping message since we're stopped: verb=" << int(verb) << ", url=" << endpoint.getURL());
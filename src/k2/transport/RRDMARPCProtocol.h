@@ -71,6 +71,9 @@ public: // API
     // Returns the endpoint where this protocol accepts incoming connections.
     seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint() override;
 
+    // Returns true if any of our connections to the endpoint has seen the peer advertise compact payloads
+    bool isCompactPeer(const TXEndpoint& endpoint) override;
+
 public: // distributed<> interface
     // iface: called by seastar's distributed mechanism when stop() is invoked on the distributed container.
     // The method's returned future completes once all channels had a chance to complete a graceful shutdown
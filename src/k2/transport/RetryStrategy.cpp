@@ -30,7 +30,10 @@ ExponentialBackoffStrategy::ExponentialBackoffStrategy() : _retries(3),
                                                            _rate(5),
                                                            _currentTimeout(1us),
                                                            _success(false),
-                                                           _used(false) {
+                                                           _used(false),
+                                                           _latency(nullptr),
+                                                           _latencyMultiplier(1),
+                                                           _minTimeout(0) {
     K2DEBUG("ctor retries " << _retries << ", rate " << _rate << ", startTimeout "
                             << k2::usec(_currentTimeout).count() << "ms");
 }
@@ -61,4 +64,13 @@ ExponentialBackoffStrategy& ExponentialBackoffStrategy::withStartTimeout(Duratio
     return *this;
 }
 
+// Derive the starting value from observed latency
+ExponentialBackoffStrategy& ExponentialBackoffStrategy::withLatencyTracker(LatencyTracker& tracker, double multiplier, Duration minTimeout) {
+    K2DEBUG("latency multiplier: " << multiplier << ", minTimeout: " << k2::usec(minTimeout).count() << "us");
+    _latency = &tracker;
+    _latencyMultiplier = multiplier;
+    _minTimeout = minTimeout;
+    return *this;
+}
+
 }  // namespace k2
@@ -31,6 +31,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/common/Common.h>
 #include <k2/common/Log.h>
 #include <k2/common/Chrono.h>
+#include <k2/common/LatencyTracker.h>
 #include "RPCDispatcher.h"
 
 namespace k2 {
@@ -41,6 +42,8 @@ namespace k2 {
 // the remaining retries and the timeoutValue it should use.
 // the timeoutvalue is calculated based on exponential increase:
 // timeoutValue = startTimeout * ((rate)**retryIndex)
+// If a latency tracker is given, the first timeout is derived from the observed latency instead (multiplier x p99),
+// using the startTimeout as a cap. This keeps retries fast on low-latency paths while still growing exponentially.
 class ExponentialBackoffStrategy {
 public: // types
     // this is returned in an exceptional future if you attempt to call Do() more than once
@@ -62,6 +65,11 @@ public: // lifecycle
     // Set the desired starting value
     ExponentialBackoffStrategy& withStartTimeout(Duration startTimeout);
 
+    // Derive the starting value from the latency observed by the given tracker, once it has enough samples.
+    // The tracker is only read: the caller is responsible for recording latencies and for keeping it alive
+    // while the strategy runs
+    ExponentialBackoffStrategy& withLatencyTracker(LatencyTracker& tracker, double multiplier, Duration minTimeout);
+
 public: // API
     // Execute the given function until it either succeeds or we exhaust the retries. If the retries are
     // exhausted, then we return the exception tossed from the last run.
@@ -79,6 +87,9 @@ public: // API
             [this] { return _success || this->_try >= this->_retries; },
             [this, func=std::move(func), resultPtr] ()mutable{
                 this->_try++;
+                if (this->_try == 1 && this->_latency) {
+                    this->_currentTimeout = this->_latency->timeout(_latencyMultiplier, _minTimeout, this->_currentTimeout);
+                }
                 this->_currentTimeout*=this->_try;
                 K2DEBUG("running try " << this->_try << ", with timeout "
                     << k2::msec(_currentTimeout).count() << "ms");
@@ -117,6 +128,11 @@ private: // fields
     bool _success;
     // indicate if this strategy has been used already so that we can reject duplicate attempts to use it
     bool _used;
+    // optional latency estimate used to derive the starting timeout
+    LatencyTracker* _latency;
+    // the starting timeout is _latencyMultiplier x p99 latency, but no less than _minTimeout
+    double _latencyMultiplier;
+    Duration _minTimeout;
 }; // ExponentialBackoffStrategy
 
 } // k2
@@ -0,0 +1,209 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "ShmRPCChannel.h"
+
+// third-party
+#include <signal.h>
+#include <seastar/core/reactor.hh>
+
+#include <k2/config/Config.h>
+
+namespace k2 {
+
+ShmRPCChannel::ShmRPCChannel(std::unique_ptr<ShmMapping> segment, bool isClient, TXEndpoint endpoint,
+                  RequestObserver_t requestObserver, FailureObserver_t failureObserver):
+    _rpcParser([]{return seastar::need_preempt();}, Config()["enable_tx_checksum"].as<bool>()),
+    _endpoint(std::move(endpoint)),
+    _segment(std::move(segment)),
+    _header(static_cast<ShmSegmentHeader*>(_segment->data())),
+    _isClient(isClient),
+    _peerPid(0) {
+    K2DEBUG("new channel: " << _endpoint.getURL() << ", client=" << _isClient);
+    if (_segment->size() < sizeof(ShmSegmentHeader) || _header->magic != ShmSegmentHeader::MAGIC ||
+        _segment->size() != ShmSegmentHeader::segmentSize(_header->ringCapacity)) {
+        throw std::invalid_argument("invalid shm segment");
+    }
+    auto c2s = _header->clientToServer(false);
+    auto s2c = _header->serverToClient(false);
+    _out = _isClient ? c2s : s2c;
+    _in = _isClient ? s2c : c2s;
+    if (!_isClient) {
+        _peerPid = _header->clientPid;
+        _header->serverPid.store(::getpid(), std::memory_order_release);
+    }
+
+    registerMessageObserver(requestObserver);
+    registerFailureObserver(failureObserver);
+    _rpcParser.registerMessageObserver(
+        [this](Verb verb, MessageMetadata metadata, std::unique_ptr<Payload> payload) {
+            K2DEBUG("Received message with verb: " << int(verb));
+            this->_messageObserver(Request(verb, _endpoint, std::move(metadata), std::move(payload)));
+        }
+    );
+    _rpcParser.registerParserFailureObserver(
+        [this](std::exception_ptr exc) {
+            K2WARN_EXC("Received parser exception", exc);
+            _fail(exc);
+        }
+    );
+}
+
+ShmRPCChannel::~ShmRPCChannel(){
+    K2DEBUG("dtor");
+    if (!_closingInProgress) {
+        K2WARN("destructor without graceful close: " << _endpoint.getURL());
+    }
+}
+
+void ShmRPCChannel::send(Verb verb, std::unique_ptr<Payload> payload, MessageMetadata metadata) {
+    if (_closingInProgress) {
+        K2WARN("channel is going down. ignoring send");
+        return;
+    }
+    for (auto& buf: _rpcParser.prepareForSend(verb, std::move(payload), std::move(metadata))) {
+        _pendingWrites.push_back(std::move(buf));
+    }
+    // try to deliver right away
+    _writePending();
+}
+
+bool ShmRPCChannel::_writePending() {
+    bool wrote = false;
+    while (!_pendingWrites.empty()) {
+        auto& buf = _pendingWrites.front();
+        auto written = _out.write(buf.get(), buf.size());
+        if (written > 0) {
+            wrote = true;
+        }
+        if (written < buf.size()) {
+            // the ring is full. Keep the rest for the next poll
+            buf.trim_front(written);
+            break;
+        }
+        _pendingWrites.pop_front();
+    }
+    return wrote;
+}
+
+bool ShmRPCChannel::poll() {
+    if (_closingInProgress) {
+        return false;
+    }
+    bool active = _writePending();
+    if (_rpcParser.canDispatch()) {
+        K2DEBUG("RPC parser can dispatch more messages as-is. not reading from ring this round");
+        _rpcParser.dispatchSome();
+        return true;
+    }
+    auto readable = _in.readable();
+    if (readable > 0) {
+        Binary packet(readable);
+        packet.trim(_in.read(packet.get_write(), readable));
+        K2DEBUG("Read "<< packet.size());
+        _rpcParser.feed(std::move(packet));
+        _rpcParser.dispatchSome();
+        active = true;
+    }
+    return active;
+}
+
+void ShmRPCChannel::checkPeer() {
+    if (_closingInProgress) {
+        return;
+    }
+    auto& peerClosed = _isClient ? _header->serverClosed : _header->clientClosed;
+    if (peerClosed.load(std::memory_order_acquire)) {
+        K2DEBUG("peer closed channel " << _endpoint.getURL());
+        _fail(nullptr);
+        return;
+    }
+    if (_peerPid == 0) {
+        // the client learns the server pid when the server accepts the connection
+        _peerPid = _header->serverPid.load(std::memory_order_acquire);
+    }
+    if (_peerPid != 0 && ::kill(_peerPid, 0) != 0 && errno == ESRCH) {
+        K2WARN("peer process " << _peerPid << " is gone for channel " << _endpoint.getURL());
+        _fail(std::make_exception_ptr(std::runtime_error("shm peer process is gone")));
+    }
+}
+
+void ShmRPCChannel::_fail(std::exception_ptr exc) {
+    if (!_failed) {
+        _failed = true;
+        _failureObserver(_endpoint, exc);
+    }
+}
+
+void ShmRPCChannel::registerMessageObserver(RequestObserver_t observer) {
+    K2DEBUG("register msg observer");
+    if (observer == nullptr) {
+        K2DEBUG("Setting default message observer");
+        _messageObserver = [this](Request&& request) {
+            if (!this->_closingInProgress) {
+                K2WARN("Message: " << request.verb
+                << " ignored since there is no message observer registered...");
+            }
+        };
+    }
+    else {
+        _messageObserver = observer;
+    }
+}
+
+void ShmRPCChannel::registerFailureObserver(FailureObserver_t observer) {
+    K2DEBUG("register failure observer");
+    if (observer == nullptr) {
+        K2DEBUG("Setting default failure observer");
+        _failureObserver = [this](TXEndpoint&, std::exception_ptr) {
+            if (!this->_closingInProgress) {
+                K2WARN("Ignoring failure since there is no failure observer registered...");
+            }
+        };
+    }
+    else {
+        _failureObserver = observer;
+    }
+}
+
+seastar::future<> ShmRPCChannel::gracefulClose(Duration timeout) {
+    (void) timeout;
+    K2DEBUG("graceful close: " << _endpoint.getURL());
+    if (!_closingInProgress) {
+        // best effort to deliver anything we still have. The peer may still read it after it sees the close
+        _writePending();
+        if (!_pendingWrites.empty()) {
+            K2WARN("dropping " << _pendingWrites.size() << " pending writes on close of " << _endpoint.getURL());
+        }
+        _closingInProgress = true;
+        auto& closed = _isClient ? _header->clientClosed : _header->serverClosed;
+        closed.store(1, std::memory_order_release);
+    }
+    return seastar::make_ready_future();
+}
+
+TXEndpoint& ShmRPCChannel::getTXEndpoint() { return _endpoint; }
+
+bool ShmRPCChannel::isPeerCompactCapable() const { return _rpcParser.isPeerCompactCapable(); }
+
+} // k2
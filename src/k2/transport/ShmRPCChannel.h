@@ -0,0 +1,134 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// stl
+#include <deque>
+
+// third-party
+#include <seastar/core/future.hh>
+
+// k2
+#include <k2/common/Common.h>
+#include "BaseTypes.h"
+#include "RPCHeader.h"
+#include "RPCParser.h"
+#include "Request.h"
+#include "ShmRing.h"
+#include "TXEndpoint.h"
+
+namespace k2 {
+
+// A shm channel wraps a shared memory segment(see ShmSegmentHeader) with an RPCParser to enable sending and
+// receiving RPC messages to a process on the same host. The channel doesn't have its own read loop. Instead, the
+// ShmRPCProtocol polls all of its channels (see poll())
+// The class provides Observer interface to allow for user to observe RPC messages coming over this channel
+class ShmRPCChannel {
+public: // lifecycle
+    // Construct a new channel over the given segment. The client creates(and initializes) the segment, and
+    // the server attaches to it.
+    // Throws std::invalid_argument if the segment is not a valid shm segment
+    ShmRPCChannel(std::unique_ptr<ShmMapping> segment, bool isClient, TXEndpoint endpoint,
+                  RequestObserver_t requestObserver, FailureObserver_t failureObserver);
+
+    // destructor
+    ~ShmRPCChannel();
+
+    // close the channel gracefully within the given timeout.
+    // That is, we stop reading data, and we try to flush out any pending writes
+    // returns a future which completes when we shut down
+    seastar::future<> gracefulClose(Duration timeout={});
+
+public: // API
+    // Invokes the remote rpc for the given verb with the given payload. This is an asyncronous API. No guarantees
+    // are made on the delivery of the payload after the call returns.
+    // The RPC message is configured with the given metadata
+    void send(Verb verb, std::unique_ptr<Payload> payload, MessageMetadata meta);
+
+    // Call this method with a callback to observe incoming RPC messages
+    void registerMessageObserver(RequestObserver_t observer);
+
+    // Call this method with a callback to observe the failure of this channel (e.g. the peer closed the channel)
+    void registerFailureObserver(FailureObserver_t observer);
+
+    // Obtain the endpoint for this channel
+    TXEndpoint& getTXEndpoint();
+
+    // true if the peer has told us over this channel that it can parse compact payloads
+    bool isPeerCompactCapable() const;
+
+    // Moves data between the rings and the parser: writes out any pending sends, and dispatches the received
+    // messages. Returns true if any data was moved
+    bool poll();
+
+    // checks if the peer is still around. Signals failure if the peer process is gone or closed the channel
+    void checkPeer();
+
+private: // methods
+    // write as much of the pending data as fits into the outgoing ring
+    bool _writePending();
+
+    // signal failure to our observer(nullptr for a clean close by the peer)
+    void _fail(std::exception_ptr exc);
+
+private: // fields
+    // this is the RPC message parser
+    RPCParser _rpcParser;
+
+    // the observer for rpc messages
+    RequestObserver_t _messageObserver;
+
+    // the observer for connection failures
+    FailureObserver_t _failureObserver;
+
+    // the endpoint for the channel
+    TXEndpoint _endpoint;
+
+    // the shared memory segment and the rings in it
+    std::unique_ptr<ShmMapping> _segment;
+    ShmSegmentHeader* _header;
+    ShmRing _in;
+    ShmRing _out;
+    bool _isClient;
+
+    // the peer process
+    int _peerPid;
+
+    // the data which didn't fit in the outgoing ring yet
+    std::deque<Binary> _pendingWrites;
+
+    // flag to tell if the channel is closing
+    bool _closingInProgress = false;
+
+    // flag to tell if we've signaled failure already
+    bool _failed = false;
+
+private: // Not needed
+    ShmRPCChannel(const ShmRPCChannel& o) = delete;
+    ShmRPCChannel(ShmRPCChannel&& o) = delete;
+    ShmRPCChannel& operator=(const ShmRPCChannel& o) = delete;
+    ShmRPCChannel& operator=(ShmRPCChannel&& o) = delete;
+
+}; // ShmRPCChannel
+} //k2
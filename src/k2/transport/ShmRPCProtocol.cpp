@@ -0,0 +1,407 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "ShmRPCProtocol.h"
+
+// stl
+#include <cstdlib>
+#include <random>
+
+// third-party
+#include <seastar/core/future-util.hh>
+#include <seastar/core/sleep.hh>
+#include <unistd.h>
+
+//k2
+#include <k2/common/Log.h>
+#include "HostIdentity.h"
+
+namespace k2 {
+const String ShmRPCProtocol::proto("shm+k2rpc");
+
+ShmRPCProtocol::ShmRPCProtocol(VirtualNetworkStack::Dist_t& vnet):
+    IRPCProtocol(vnet, proto),
+    _stopped(true) {
+    K2DEBUG("ctor");
+}
+
+ShmRPCProtocol::~ShmRPCProtocol() {
+    K2DEBUG("dtor");
+}
+
+RPCProtocolFactory::BuilderFunc_t ShmRPCProtocol::builder(VirtualNetworkStack::Dist_t& vnet) {
+    K2DEBUG("builder creating shm protocol");
+    return [&vnet]() mutable -> seastar::shared_ptr<IRPCProtocol> {
+        K2DEBUG("builder running");
+        return seastar::static_pointer_cast<IRPCProtocol>(
+            seastar::make_shared<ShmRPCProtocol>(vnet));
+    };
+}
+
+void ShmRPCProtocol::start() {
+    K2DEBUG("start");
+    _stopped = false;
+    if (_listen()) {
+        if (getHostBootId().empty()) {
+            K2ERROR("Unable to determine the host identity. Not listening for shm connections");
+        }
+        else {
+            _mailbox = ShmMapping::create("k2shm-mailbox", sizeof(ShmMailbox));
+        }
+        if (_mailbox) {
+            std::random_device rd;
+            uint64_t nonce = (uint64_t(rd()) << 32) | rd();
+            auto* mbox = static_cast<ShmMailbox*>(_mailbox->data());
+            mbox->pid = ::getpid();
+            // 0 is the nonce of the endpoints of accepted connections, which aren't mailboxes
+            mbox->nonce = nonce == 0 ? 1 : nonce;
+            mbox->magic = ShmMailbox::MAGIC;
+            _svrEndpoint = seastar::make_lw_shared<TXEndpoint>(String(proto), _makeHost(mbox->pid, mbox->nonce),
+                                                               _mailbox->fd(), _vnet.local().getTCPAllocator());
+            K2INFO("Starting listening shm Proto on: " << _svrEndpoint->getURL());
+        }
+        else if (!getHostBootId().empty()) {
+            K2ERROR("Unable to create shm mailbox. Not listening for shm connections");
+        }
+    }
+    else {
+        K2INFO("Starting non-listening shm Proto...");
+    }
+
+    if (_mailbox) {
+        _startPolling();
+    }
+}
+
+void ShmRPCProtocol::_startPolling() {
+    if (_polling || _stopped) {
+        return;
+    }
+    K2DEBUG("start polling");
+    _polling = true;
+    _lastActivity = _lastPeerCheck = Clock::now();
+    // a previous loop may still be completing, so run after it
+    _pollDone = _pollDone.then([this] {
+        return seastar::do_until(
+            [this] {
+                if (_stopped || (!_mailbox && _channels.empty())) {
+                    K2DEBUG("stop polling");
+                    _polling = false;
+                    return true;
+                }
+                return false;
+            },
+            [this] {
+                auto now = Clock::now();
+                if (_pollOnce()) {
+                    _lastActivity = now;
+                }
+                if (now - _lastPeerCheck >= _peerCheckInterval()) {
+                    _lastPeerCheck = now;
+                    std::vector<seastar::lw_shared_ptr<ShmRPCChannel>> channels;
+                    for (auto& [ep, chan]: _channels) {
+                        channels.push_back(chan);
+                    }
+                    for (auto& chan: channels) {
+                        chan->checkPeer();
+                    }
+                }
+                if (now - _lastActivity < _spinDuration()) {
+                    // keep polling on every reactor cycle while we're busy
+                    return seastar::later();
+                }
+                return seastar::sleep(_idlePollInterval());
+            });
+    });
+}
+
+seastar::future<> ShmRPCProtocol::stop() {
+    K2DEBUG("stop");
+    // immediately prevent accepting further read/write work
+    _stopped = true;
+
+    // place all channels in a list so that we can clear the map
+    std::vector<seastar::lw_shared_ptr<ShmRPCChannel>> channels;
+    for (auto&& iter: _channels) {
+        channels.push_back(iter.second);
+    }
+    _channels.clear();
+
+    // now schedule futures for graceful close of all channels
+    std::vector<seastar::future<>> futs;
+    futs.push_back(std::move(_pollDone));
+    for (auto chan: channels) {
+        // we're about to kill this so unregister observers
+        chan->registerFailureObserver(nullptr);
+        chan->registerMessageObserver(nullptr);
+
+        futs.push_back(chan->gracefulClose().then([chan](){}));
+    }
+
+    // the mailbox goes away once the polling loop is done with it
+    return seastar::when_all_succeed(futs.begin(), futs.end()).discard_result()
+        .then([this] {
+            _mailbox.reset();
+        });
+}
+
+std::unique_ptr<TXEndpoint> ShmRPCProtocol::getTXEndpoint(String url) {
+    if (_stopped) {
+        K2WARN("Unable to create endpoint since we're stopped for url " << url);
+        return nullptr;
+    }
+    K2DEBUG("get endpoint for " << url);
+    auto ep = TXEndpoint::fromURL(url, _vnet.local().getTCPAllocator());
+    if (!ep || ep->getProtocol() != proto) {
+        K2WARN("Cannot construct non-`" << proto << "` endpoint");
+        return nullptr;
+    }
+    auto now = Clock::now();
+    auto iter = _localURLs.find(ep->getURL());
+    if (iter == _localURLs.end() || now - iter->second.checkedAt >= _localURLTTL()) {
+        // the mailbox may have come or gone since we last checked
+        _pruneLocalURLs(now);
+        bool isLocal = _openMailbox(*ep) != nullptr;
+        iter = _localURLs.insert_or_assign(ep->getURL(), LocalURLCheck{isLocal, now}).first;
+    }
+    if (!iter->second.isLocal) {
+        K2DEBUG("not a shm endpoint on this host: " << url);
+        return nullptr;
+    }
+    return ep;
+}
+
+seastar::lw_shared_ptr<TXEndpoint> ShmRPCProtocol::getServerEndpoint() {
+    return _svrEndpoint;
+}
+
+bool ShmRPCProtocol::isCompactPeer(const TXEndpoint& endpoint) {
+    auto iter = _channels.find(endpoint);
+    return iter != _channels.end() && iter->second->isPeerCompactCapable();
+}
+
+void ShmRPCProtocol::send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) {
+    if (_stopped) {
+        K2WARN("Dropping message since we're stopped: verb=" << int(verb) << ", url=" << endpoint.getURL());
+        return;
+    }
+
+    auto&& chan = _getOrMakeChannel(endpoint);
+    if (!chan) {
+        K2WARN("Dropping message: Unable to create connection for endpoint " << endpoint.getURL());
+        return;
+    }
+    chan->send(verb, std::move(payload), std::move(metadata));
+    // keep spinning so that we pick up the response quickly
+    _lastActivity = Clock::now();
+}
+
+String ShmRPCProtocol::_makeHost(int pid, uint64_t nonce) {
+    return getHostBootId() + "." + seastar::to_sstring(pid) + "." + seastar::to_sstring(nonce);
+}
+
+void ShmRPCProtocol::_pruneLocalURLs(TimePoint now) {
+    for (auto iter = _localURLs.begin(); iter != _localURLs.end();) {
+        if (now - iter->second.checkedAt >= _localURLTTL()) {
+            iter = _localURLs.erase(iter);
+        }
+        else {
+            ++iter;
+        }
+    }
+}
+
+std::unique_ptr<ShmMapping> ShmRPCProtocol::_openMailbox(const TXEndpoint& endpoint) {
+    // the host is <boot id>.<pid>.<nonce>
+    const String& host = endpoint.getIP();
+    auto firstDot = host.find('.');
+    auto lastDot = host.find_last_of('.');
+    if (firstDot == String::npos || firstDot == lastDot) {
+        K2DEBUG("malformed shm endpoint: " << endpoint.getURL());
+        return nullptr;
+    }
+    // check the host before we look for the process: a remote process may have the same pid as a local one
+    if (getHostBootId().empty() || host.substr(0, firstDot) != getHostBootId()) {
+        K2DEBUG("shm endpoint is not on this host: " << endpoint.getURL());
+        return nullptr;
+    }
+    char* end = nullptr;
+    auto pid = std::strtol(host.c_str() + firstDot + 1, &end, 10);
+    if (end != host.c_str() + lastDot || pid <= 0) {
+        K2DEBUG("not a pid in shm endpoint: " << endpoint.getURL());
+        return nullptr;
+    }
+    auto nonce = std::strtoull(host.c_str() + lastDot + 1, &end, 10);
+    if (*end != '\0' || nonce == 0) {
+        K2DEBUG("not a mailbox nonce in shm endpoint: " << endpoint.getURL());
+        return nullptr;
+    }
+    auto mailbox = ShmMapping::open(pid, endpoint.getPort());
+    if (!mailbox || mailbox->size() < sizeof(ShmMailbox)) {
+        return nullptr;
+    }
+    auto* mbox = static_cast<ShmMailbox*>(mailbox->data());
+    if (mbox->magic != ShmMailbox::MAGIC || mbox->pid != pid || mbox->nonce != nonce) {
+        K2DEBUG("not a shm mailbox: " << endpoint.getURL());
+        return nullptr;
+    }
+    return mailbox;
+}
+
+seastar::lw_shared_ptr<ShmRPCChannel> ShmRPCProtocol::_getOrMakeChannel(TXEndpoint& endpoint) {
+    // look for an existing channel
+    K2DEBUG("get or make channel: " << endpoint.getURL());
+    auto iter = _channels.find(endpoint);
+    if (iter != _channels.end()) {
+        K2DEBUG("found existing channel");
+        return iter->second;
+    }
+    K2DEBUG("creating new channel");
+    auto mailbox = _openMailbox(endpoint);
+    if (!mailbox) {
+        return nullptr;
+    }
+
+    // create and initialize our segment before we post it
+    auto ringSize = _ringSize();
+    auto segment = ShmMapping::create("k2shm-segment", ShmSegmentHeader::segmentSize(ringSize));
+    if (!segment) {
+        return nullptr;
+    }
+    auto* header = static_cast<ShmSegmentHeader*>(segment->data());
+    header->ringCapacity = ringSize;
+    header->clientPid = ::getpid();
+    try {
+        header->clientToServer(true);
+        header->serverToClient(true);
+    }
+    catch (std::invalid_argument& exc) {
+        K2ERROR("Unable to create shm rings of size " << ringSize << ": " << exc.what());
+        return nullptr;
+    }
+    header->magic = ShmSegmentHeader::MAGIC;
+
+    auto* mbox = static_cast<ShmMailbox*>(mailbox->data());
+    for (auto& slot: mbox->slots) {
+        uint32_t expected = ShmMailbox::Free;
+        if (slot.state.compare_exchange_strong(expected, ShmMailbox::Claimed, std::memory_order_acquire)) {
+            slot.pid = header->clientPid;
+            slot.fd = segment->fd();
+            slot.state.store(ShmMailbox::Posted, std::memory_order_release);
+            // we can start writing right away. The server will see the data once it accepts the connection
+            return _handleNewChannel(std::move(segment), true, endpoint);
+        }
+    }
+    K2WARN("No free slots in shm mailbox " << endpoint.getURL());
+    return nullptr;
+}
+
+bool ShmRPCProtocol::_acceptPosted() {
+    if (!_mailbox) {
+        return false;
+    }
+    bool accepted = false;
+    auto* mbox = static_cast<ShmMailbox*>(_mailbox->data());
+    for (auto& slot: mbox->slots) {
+        if (slot.state.load(std::memory_order_acquire) != ShmMailbox::Posted) {
+            continue;
+        }
+        int pid = slot.pid;
+        int fd = slot.fd;
+        slot.state.store(ShmMailbox::Free, std::memory_order_release);
+        accepted = true;
+
+        auto segment = ShmMapping::open(pid, fd);
+        if (!segment) {
+            K2WARN("Unable to open shm segment " << fd << " of process " << pid);
+            continue;
+        }
+        TXEndpoint ep(String(proto), _makeHost(pid, 0), fd, _vnet.local().getTCPAllocator());
+        K2DEBUG("Accepted connection from " << ep.getURL());
+        auto iter = _channels.find(ep);
+        if (iter != _channels.end()) {
+            // the client must have closed the old segment and reused the fd number
+            K2DEBUG("replacing stale channel " << ep.getURL());
+            auto chan = iter->second;
+            _channels.erase(iter);
+            (void) chan->gracefulClose().then([chan] {});
+        }
+        _handleNewChannel(std::move(segment), false, std::move(ep));
+    }
+    return accepted;
+}
+
+bool ShmRPCProtocol::_pollOnce() {
+    bool active = _acceptPosted();
+    // the channels can come and go as we dispatch messages
+    std::vector<seastar::lw_shared_ptr<ShmRPCChannel>> channels;
+    channels.reserve(_channels.size());
+    for (auto& [ep, chan]: _channels) {
+        channels.push_back(chan);
+    }
+    for (auto& chan: channels) {
+        active = chan->poll() || active;
+    }
+    return active;
+}
+
+seastar::lw_shared_ptr<ShmRPCChannel>
+ShmRPCProtocol::_handleNewChannel(std::unique_ptr<ShmMapping> segment, bool isClient, TXEndpoint endpoint) {
+    K2DEBUG("processing channel: "<< endpoint.getURL());
+    seastar::lw_shared_ptr<ShmRPCChannel> chan;
+    try {
+        chan = seastar::make_lw_shared<ShmRPCChannel>(std::move(segment), isClient, std::move(endpoint),
+            [this] (Request&& request) {
+                K2DEBUG("Message " << request.verb << " received from " << request.endpoint.getURL());
+                if (!_stopped) {
+                    _messageObserver(std::move(request));
+                }
+            },
+            [this] (TXEndpoint& endpoint, auto exc) {
+                if (!_stopped) {
+                    if (exc) {
+                        K2WARN("Channel " << endpoint.getURL() << ", failed due to " << exc);
+                    }
+                    // the mailbox may be gone too
+                    _localURLs.erase(endpoint.getURL());
+                    auto chanIter = _channels.find(endpoint);
+                    if (chanIter != _channels.end()) {
+                        auto chan = chanIter->second;
+                        _channels.erase(chanIter);
+                        return chan->gracefulClose().then([chan] {});
+                    }
+                }
+                return seastar::make_ready_future();
+            });
+    }
+    catch (std::invalid_argument& exc) {
+        K2WARN("Unable to create shm channel: " << exc.what());
+        return nullptr;
+    }
+    _channels.emplace(chan->getTXEndpoint(), chan);
+    _lastActivity = Clock::now();
+    _startPolling();
+    return chan;
+}
+
+} // namespace k2
@@ -0,0 +1,184 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// third-party
+#include <seastar/core/future.hh>
+#include <seastar/core/shared_ptr.hh>
+
+// k2
+#include <k2/config/Config.h>
+#include "IRPCProtocol.h"
+#include "VirtualNetworkStack.h"
+#include "RPCProtocolFactory.h"
+#include "ShmRPCChannel.h"
+#include "RPCHeader.h"
+
+namespace k2 {
+
+// ShmRPCProtocol is a protocol for processes on the same host, which exchanges messages over shared memory rings
+// instead of going through the network stack. Its responsibility is to:
+// - accept incoming connections, if listening is enabled(shm_listen)
+// - create outgoing connections when asked to send messages
+// - poll all connections, and pass the incoming messages on to the message observer for the protocol. We only poll
+//   while we have a mailbox or a connection, so cores which don't use shm don't spend any cycles on it
+//
+// Each listening core creates a mailbox memfd (see ShmMailbox). Its endpoint is
+//      shm+k2rpc://<host boot id>.<server pid>.<mailbox nonce>:<mailbox memfd>
+// A client core connects by creating a segment memfd with a pair of SPSC rings(see ShmSegmentHeader) and posting
+// it into the mailbox. The processes map each other's memfds via /proc/<pid>/fd/<fd>, so we can only vend endpoints
+// for processes on this host(see getTXEndpoint()). The boot id tells us if the endpoint is on this host at all,
+// and the nonce tells us if the mailbox we find under the pid and fd is the one the endpoint was created for.
+// NB, the class is meant to be used as a distributed<> container
+class ShmRPCProtocol: public IRPCProtocol {
+public: // types
+    // Convenience builder which listens on all cores if shm_listen is set
+    static RPCProtocolFactory::BuilderFunc_t builder(VirtualNetworkStack::Dist_t& vnet);
+
+    // The official protocol name supported for communications over shm channels
+    static const String proto;
+
+public: // lifecycle
+    // Construct the protocol with a vnet, which we use for allocating payloads
+    ShmRPCProtocol(VirtualNetworkStack::Dist_t& vnet);
+
+    // Destructor
+    virtual ~ShmRPCProtocol();
+
+public: // API
+    // This method creates an endpoint for a given URL. The endpoint is needed in order to
+    // 1. obtain protocol-specific payloads
+    // 2. send messages.
+    // returns blank pointer if we failed to parse the url, if the protocol is not supported, or if the
+    // endpoint is not a shm mailbox on this host. The result of the mailbox check is cached for shm_local_url_ttl
+    std::unique_ptr<TXEndpoint> getTXEndpoint(String url) override;
+
+    // Invokes the remote rpc for the given verb with the given payload. This is an asyncronous API. No guarantees
+    // are made on the delivery of the payload after the call returns.
+    // This is a lower-level API which is useful for sending messages that do not expect replies.
+    // The RPC message is configured with the given metadata
+    void send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) override;
+
+    // Returns the endpoint where this protocol accepts incoming connections.
+    seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint() override;
+
+    // Returns true if any of our connections to the endpoint has seen the peer advertise compact payloads
+    bool isCompactPeer(const TXEndpoint& endpoint) override;
+
+public: // distributed<> interface
+    // iface: called by seastar's distributed mechanism when stop() is invoked on the distributed container.
+    // The method's returned future completes once all channels had a chance to complete a graceful shutdown
+    seastar::future<> stop() override;
+
+    // Should be called by user when all distributed objects have been created
+    void start() override;
+
+private: // methods
+    // utility method which we use to obtain a connection(either existing or new) for the given endpoint
+    seastar::lw_shared_ptr<ShmRPCChannel> _getOrMakeChannel(TXEndpoint& endpoint);
+
+    // process a new channel creation
+    seastar::lw_shared_ptr<ShmRPCChannel>
+    _handleNewChannel(std::unique_ptr<ShmMapping> segment, bool isClient, TXEndpoint endpoint);
+
+    // maps the mailbox for the given endpoint. Returns nullptr if the endpoint is not a mailbox on this host
+    std::unique_ptr<ShmMapping> _openMailbox(const TXEndpoint& endpoint);
+
+    // the host part of an endpoint url for the given process and mailbox nonce
+    static String _makeHost(int pid, uint64_t nonce);
+
+    // drops the cached mailbox checks which are older than shm_local_url_ttl
+    void _pruneLocalURLs(TimePoint now);
+
+    // accept any connections posted to our mailbox. Returns true if we accepted any
+    bool _acceptPosted();
+
+    // one round of polling over the mailbox and all channels. Returns true if there was any activity
+    bool _pollOnce();
+
+    // starts the polling loop, unless it is running already. The loop exits once there is nothing to poll
+    void _startPolling();
+
+private: // fields
+    // we use this flag to signal exit
+    bool _stopped;
+
+    // our mailbox for incoming connections, if we're listening
+    std::unique_ptr<ShmMapping> _mailbox;
+
+    // the endpoint version of our mailbox
+    seastar::lw_shared_ptr<TXEndpoint> _svrEndpoint;
+
+    // the channels we're dealing with
+    std::unordered_map<TXEndpoint, seastar::lw_shared_ptr<ShmRPCChannel>> _channels;
+
+    // the result of checking if an url is a mailbox on this host
+    struct LocalURLCheck {
+        bool isLocal;
+        TimePoint checkedAt;
+    };
+
+    // cache of the urls which we've checked for being local mailboxes
+    std::unordered_map<String, LocalURLCheck> _localURLs;
+
+    // completes when the polling loop exits
+    seastar::future<> _pollDone = seastar::make_ready_future();
+
+    // true while the polling loop is running
+    bool _polling = false;
+
+    // the last time we moved any data
+    TimePoint _lastActivity;
+
+    // the last time we checked the channel peers
+    TimePoint _lastPeerCheck;
+
+    // open a mailbox on each core and accept incoming connections
+    ConfigVar<bool> _listen{"shm_listen", false};
+
+    // the capacity of each ring in the connections we create. Must be a power of 2
+    ConfigVar<size_t> _ringSize{"shm_ring_size", 1024*1024};
+
+    // we poll continuously for this long after the last activity...
+    ConfigDuration _spinDuration{"shm_spin_duration", 1ms};
+
+    // ...and at this interval once we're idle
+    ConfigDuration _idlePollInterval{"shm_idle_poll_interval", 50us};
+
+    // how often we check if the peers of our channels are still around
+    ConfigDuration _peerCheckInterval{"shm_peer_check_interval", 1s};
+
+    // how long we trust the result of checking if an url is a mailbox on this host
+    ConfigDuration _localURLTTL{"shm_local_url_ttl", 1s};
+
+private: // not needed
+    ShmRPCProtocol() = delete;
+    ShmRPCProtocol(const ShmRPCProtocol& o) = delete;
+    ShmRPCProtocol(ShmRPCProtocol&& o) = delete;
+    ShmRPCProtocol &operator=(const ShmRPCProtocol& o) = delete;
+    ShmRPCProtocol &operator=(ShmRPCProtocol&& o) = delete;
+
+}; // class ShmRPCProtocol
+
+} // namespace k2
@@ -0,0 +1,184 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "ShmRing.h"
+
+// stl
+#include <cstring>
+#include <stdexcept>
+
+// third-party
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// k2
+#include <k2/common/Log.h>
+
+namespace k2 {
+
+size_t ShmRing::memorySize(size_t capacity) {
+    return sizeof(Header) + capacity;
+}
+
+ShmRing::ShmRing(void* mem, size_t capacity, bool init):
+    _header(static_cast<Header*>(mem)),
+    _data(static_cast<char*>(mem) + sizeof(Header)),
+    _mask(capacity - 1) {
+    if (capacity == 0 || (capacity & _mask) != 0) {
+        throw std::invalid_argument("shm ring capacity must be a power of 2");
+    }
+    if (init) {
+        _header->head.store(0, std::memory_order_relaxed);
+        _header->tail.store(0, std::memory_order_relaxed);
+        _header->capacity = capacity;
+    }
+    else if (_header->capacity != capacity) {
+        throw std::invalid_argument("shm ring capacity mismatch");
+    }
+}
+
+size_t ShmRing::write(const char* data, size_t size) {
+    // we're the only writer of head, so relaxed is enough for it. The tail is written by the consumer
+    auto head = _header->head.load(std::memory_order_relaxed);
+    auto tail = _header->tail.load(std::memory_order_acquire);
+    size = std::min(size, capacity() - (head - tail));
+    if (size == 0) {
+        return 0;
+    }
+    auto offset = head & _mask;
+    auto first = std::min(size, capacity() - offset);
+    std::memcpy(_data + offset, data, first);
+    std::memcpy(_data, data + first, size - first);
+    // publish the data
+    _header->head.store(head + size, std::memory_order_release);
+    return size;
+}
+
+size_t ShmRing::read(char* data, size_t size) {
+    // we're the only writer of tail, so relaxed is enough for it. The head is written by the producer
+    auto tail = _header->tail.load(std::memory_order_relaxed);
+    auto head = _header->head.load(std::memory_order_acquire);
+    size = std::min(size, size_t(head - tail));
+    if (size == 0) {
+        return 0;
+    }
+    auto offset = tail & _mask;
+    auto first = std::min(size, capacity() - offset);
+    std::memcpy(data, _data + offset, first);
+    std::memcpy(data + first, _data, size - first);
+    // release the space back to the producer
+    _header->tail.store(tail + size, std::memory_order_release);
+    return size;
+}
+
+size_t ShmRing::readable() const {
+    return _header->head.load(std::memory_order_acquire) - _header->tail.load(std::memory_order_relaxed);
+}
+
+size_t ShmRing::writable() const {
+    return capacity() - (_header->head.load(std::memory_order_relaxed) - _header->tail.load(std::memory_order_acquire));
+}
+
+size_t ShmRing::capacity() const {
+    return _mask + 1;
+}
+
+std::unique_ptr<ShmMapping> ShmMapping::create(const char* name, size_t size) {
+    int fd = ::memfd_create(name, 0);
+    if (fd < 0) {
+        K2WARN("unable to create memfd: " << strerror(errno));
+        return nullptr;
+    }
+    if (::ftruncate(fd, size) != 0) {
+        K2WARN("unable to size memfd to " << size << ": " << strerror(errno));
+        ::close(fd);
+        return nullptr;
+    }
+    void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        K2WARN("unable to map memfd: " << strerror(errno));
+        ::close(fd);
+        return nullptr;
+    }
+    return std::unique_ptr<ShmMapping>(new ShmMapping(data, size, fd));
+}
+
+std::unique_ptr<ShmMapping> ShmMapping::open(int pid, int fd) {
+    auto path = "/proc/" + std::to_string(pid) + "/fd/" + std::to_string(fd);
+    int myfd = ::open(path.c_str(), O_RDWR);
+    if (myfd < 0) {
+        K2DEBUG("unable to open " << path << ": " << strerror(errno));
+        return nullptr;
+    }
+    struct stat st;
+    if (::fstat(myfd, &st) != 0 || st.st_size <= 0) {
+        K2WARN("unable to determine size of " << path);
+        ::close(myfd);
+        return nullptr;
+    }
+    void* data = ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, myfd, 0);
+    // the mapping keeps the memory alive. We don't need the fd anymore
+    ::close(myfd);
+    if (data == MAP_FAILED) {
+        K2WARN("unable to map " << path << ": " << strerror(errno));
+        return nullptr;
+    }
+    return std::unique_ptr<ShmMapping>(new ShmMapping(data, st.st_size, -1));
+}
+
+ShmMapping::ShmMapping(void* data, size_t size, int fd): _data(data), _size(size), _fd(fd) {
+}
+
+ShmMapping::~ShmMapping() {
+    ::munmap(_data, _size);
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+}
+
+void* ShmMapping::data() const { return _data; }
+
+size_t ShmMapping::size() const { return _size; }
+
+int ShmMapping::fd() const { return _fd; }
+
+// the header is padded to a cache line so that the ring headers are cache-aligned
+static size_t segmentHeaderSize() {
+    return (sizeof(ShmSegmentHeader) + 63) & ~size_t(63);
+}
+
+size_t ShmSegmentHeader::segmentSize(size_t ringCapacity) {
+    return segmentHeaderSize() + 2 * ShmRing::memorySize(ringCapacity);
+}
+
+ShmRing ShmSegmentHeader::clientToServer(bool init) {
+    return ShmRing(reinterpret_cast<char*>(this) + segmentHeaderSize(), ringCapacity, init);
+}
+
+ShmRing ShmSegmentHeader::serverToClient(bool init) {
+    return ShmRing(reinterpret_cast<char*>(this) + segmentHeaderSize() + ShmRing::memorySize(ringCapacity), ringCapacity, init);
+}
+
+} // namespace k2
@@ -0,0 +1,165 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// stl
+#include <atomic>
+#include <memory>
+
+// k2
+#include <k2/common/Common.h>
+
+namespace k2 {
+
+// Single-producer/single-consumer byte ring in shared memory. The producer and the consumer can be in different
+// processes, as long as both map the ring's memory.
+// The ring is a byte stream: writes and reads transfer as many bytes as fit/are available, and may be partial
+class ShmRing {
+public:
+    // the layout of the ring's memory. The data area follows the header
+    struct Header {
+        // total bytes ever written. Only modified by the producer
+        alignas(64) std::atomic<uint64_t> head;
+        // total bytes ever read. Only modified by the consumer
+        alignas(64) std::atomic<uint64_t> tail;
+        // size of the data area. It is a power of 2
+        alignas(64) uint64_t capacity;
+    };
+
+    // the number of bytes of shared memory needed for a ring with the given capacity
+    static size_t memorySize(size_t capacity);
+
+    // Attach to the ring at the given memory. If init is true, the ring is initialized(empty) with the given
+    // capacity. Otherwise, the memory must hold a ring with the given capacity.
+    // Throws std::invalid_argument if the capacity is not a power of 2, or doesn't match the ring in memory
+    ShmRing(void* mem, size_t capacity, bool init);
+
+    // a detached ring
+    ShmRing() = default;
+
+    // copy up to size bytes into the ring. Returns the number of bytes copied
+    size_t write(const char* data, size_t size);
+
+    // copy up to size bytes out of the ring. Returns the number of bytes copied
+    size_t read(char* data, size_t size);
+
+    // the number of bytes available for reading
+    size_t readable() const;
+
+    // the number of bytes which can be written
+    size_t writable() const;
+
+    // the size of the ring's data area
+    size_t capacity() const;
+
+private:
+    Header* _header = nullptr;
+    char* _data = nullptr;
+    size_t _mask = 0;
+};
+
+// RAII wrapper for a mapped memfd. Memfds are shared between processes by opening them via /proc/<pid>/fd/<fd>
+class ShmMapping {
+public:
+    // creates and maps a new (zero-filled) memfd of the given size. Returns nullptr on failure
+    static std::unique_ptr<ShmMapping> create(const char* name, size_t size);
+
+    // maps the memfd which process pid has open as fd. Returns nullptr on failure
+    static std::unique_ptr<ShmMapping> open(int pid, int fd);
+
+    ~ShmMapping();
+
+    // the mapped memory
+    void* data() const;
+
+    // the size of the mapped memory
+    size_t size() const;
+
+    // the memfd, if we created it. -1 for mappings which we opened from another process
+    int fd() const;
+
+private:
+    ShmMapping(void* data, size_t size, int fd);
+    ShmMapping(const ShmMapping&) = delete;
+    ShmMapping& operator=(const ShmMapping&) = delete;
+
+    void* _data;
+    size_t _size;
+    int _fd;
+};
+
+// The shared memory for a single shm connection, created by the client: this header, followed by the
+// client-to-server ring, followed by the server-to-client ring
+struct ShmSegmentHeader {
+    static constexpr uint64_t MAGIC = 0x4b325348'4d534547ull; // "K2SHMSEG"
+    uint64_t magic;
+    // the capacity of each of the rings
+    uint64_t ringCapacity;
+    // the client process
+    int32_t clientPid;
+    // the server process. Set by the server when it accepts the connection
+    std::atomic<int32_t> serverPid;
+    // set when the client/server close the connection
+    std::atomic<uint32_t> clientClosed;
+    std::atomic<uint32_t> serverClosed;
+
+    // the total segment size for rings with the given capacity
+    static size_t segmentSize(size_t ringCapacity);
+
+    // the rings in the segment which starts with this header
+    ShmRing clientToServer(bool init);
+    ShmRing serverToClient(bool init);
+};
+
+// The mailbox where a server accepts new connections. Each listening core has a mailbox memfd, and the
+// mailbox is addressed by the host boot id, the server pid, the mailbox nonce and the memfd number
+// (see ShmRPCProtocol).
+// Clients post their segments into free slots, and the server polls for posted slots.
+struct ShmMailbox {
+    static constexpr uint64_t MAGIC = 0x4b325348'4d4d4258ull; // "K2SHMMBX"
+    static constexpr size_t NUM_SLOTS = 64;
+
+    enum SlotState : uint32_t {
+        Free = 0,    // the slot can be claimed by a client
+        Claimed = 1, // a client is writing the slot
+        Posted = 2   // the slot holds a new connection for the server
+    };
+
+    struct Slot {
+        std::atomic<uint32_t> state;
+        // the client pid and the segment memfd in the client process
+        int32_t pid;
+        int32_t fd;
+    };
+
+    uint64_t magic;
+    // the server process
+    int32_t pid;
+    // random number picked by the server. A client checks it against the endpoint, so that it doesn't connect
+    // to an unrelated mailbox which happens to have the same pid and fd(e.g. after the server restarted)
+    uint64_t nonce;
+    Slot slots[NUM_SLOTS];
+};
+
+} // namespace k2
@@ -28,18 +28,22 @@ Copyright(c) 2020 Futurewei Cloud
 
 // third-party
 #include <seastar/net/inet_address.hh>
+#include <seastar/core/sleep.hh>
 
 namespace k2 {
 
 TCPRPCChannel::TCPRPCChannel(seastar::future<seastar::connected_socket> futureSocket, TXEndpoint endpoint,
-                  RequestObserver_t requestObserver, FailureObserver_t failureObserver):
-    _rpcParser([]{return seastar::need_preempt();}, Config()["enable_tx_checksum"].as<bool>()),
+                  RequestObserver_t requestObserver, FailureObserver_t failureObserver,
+                  seastar::lw_shared_ptr<TCPSendStats> sendStats):
+    _rpcParser([]{return seastar::need_preempt();}, Config()["enable_tx_checksum"].as<bool>(),
+               Config()["enable_tx_compression"].as<bool>()),
     _endpoint(std::move(endpoint)),
     _fdIsSet(false),
     _closingInProgress(false),
     _running(false),
     _futureSocket(std::move(futureSocket)),
-    _sendFuture(seastar::make_ready_future<>()){
+    _sendFuture(seastar::make_ready_future<>()),
+    _sendStats(sendStats ? std::move(sendStats) : seastar::make_lw_shared<TCPSendStats>()) {
     K2DEBUG("new future channel");
     registerMessageObserver(requestObserver);
     registerFailureObserver(failureObserver);
@@ -76,6 +80,10 @@ void TCPRPCChannel::send(Verb verb, std::unique_ptr<Payload> payload, MessageMet
         K2WARN("channel is going down. ignoring send");
         return;
     }
+    _lastActivity = Clock::now();
+    if (metadata.isRequestIDSet()) {
+        _outstandingRequests.add(metadata.requestID, _lastActivity);
+    }
     seastar::net::packet packet;
     for (auto& buf : _rpcParser.prepareForSend(verb, std::move(payload), std::move(metadata))) {
         packet = seastar::net::packet(std::move(packet), std::move(buf));
@@ -90,13 +98,54 @@ void TCPRPCChannel::send(Verb verb, std::unique_ptr<Payload> payload, MessageMet
 }
 
 void TCPRPCChannel::_sendPacket(seastar::net::packet&& packet) {
-    _sendFuture = _sendFuture->then([packet = std::move(packet), this]() mutable {
-        return _out.write(std::move(packet));
-    }).then([this]() {
-        return _out.flush();
+    if (_sendBatches.empty() || _sendBatches.back().packet.len() >= _coalesceMaxBytes()) {
+        _sendBatches.emplace_back();
+    }
+    auto& batch = _sendBatches.back();
+    batch.packet.append(std::move(packet));
+    batch.messages++;
+
+    if (_flushPending) {
+        // the flush loop will pick up this message
+        return;
+    }
+    _flushPending = true;
+    // let the rest of this poll cycle add messages to the batch. The loop runs after any in-progress write completes
+    _sendFuture = _sendFuture->then([this] {
+        return _coalesceMaxDelay() > 0us ? seastar::sleep(_coalesceMaxDelay()) : seastar::later();
+    }).then([this] {
+        return _flushBatches();
+    }).handle_exception([this](auto exc) {
+        // the stream is broken. Allow a later send to retry the flush (and fail on its own)
+        _flushPending = false;
+        return seastar::make_exception_future<>(exc);
     });
 }
 
+seastar::future<> TCPRPCChannel::_flushBatches() {
+    return seastar::do_until(
+        [this] {
+            // clear the flag in the same task which sees the queue drained. A send which runs after this
+            // point starts a new flush loop instead of relying on this one
+            if (_sendBatches.empty()) {
+                _flushPending = false;
+                return true;
+            }
+            return false;
+        },
+        [this] {
+            auto batch = std::move(_sendBatches.front());
+            _sendBatches.pop_front();
+            K2DEBUG("flushing batch of " << batch.messages << " messages, " << batch.packet.len() << " bytes");
+            _sendStats->flushes++;
+            _sendStats->messages += batch.messages;
+            _sendStats->bytes += batch.packet.len();
+            return _out.write(std::move(batch.packet)).then([this] {
+                return _out.flush();
+            });
+        });
+}
+
 seastar::future<> TCPRPCChannel::_setConnectedSocket(seastar::connected_socket sock) {
     K2DEBUG("Setting connected socket")
     assert(!_fdIsSet);
@@ -107,6 +156,10 @@ seastar::future<> TCPRPCChannel::_setConnectedSocket(seastar::connected_socket s
     _rpcParser.registerMessageObserver(
         [this](Verb verb, MessageMetadata metadata, std::unique_ptr<Payload> payload) {
             K2DEBUG("Received message with verb: " << int(verb));
+            _lastActivity = Clock::now();
+            if (metadata.isResponseIDSet()) {
+                _outstandingRequests.remove(metadata.responseID);
+            }
             this->_messageObserver(Request(verb, _endpoint, std::move(metadata), std::move(payload)));
         }
     );
@@ -247,4 +300,13 @@ void TCPRPCChannel::_closeSocket() {
 
 TXEndpoint& TCPRPCChannel::getTXEndpoint() { return _endpoint;}
 
+bool TCPRPCChannel::isPeerCompactCapable() const { return _rpcParser.isPeerCompactCapable();}
+
+size_t TCPRPCChannel::getOutstandingRequests() {
+    _outstandingRequests.expire(Clock::now() - _outstandingRequestExpiry());
+    return _outstandingRequests.size();
+}
+
+TimePoint TCPRPCChannel::getLastActivity() const { return _lastActivity;}
+
 } // k2
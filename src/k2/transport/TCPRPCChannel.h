@@ -28,10 +28,16 @@ Copyright(c) 2020 Futurewei Cloud
 #include <seastar/net/api.hh> // seastar's network stuff
 #include <seastar/util/std-compat.hh>
 #include <seastar/net/packet.hh>
+#include <seastar/core/shared_ptr.hh>
+
+// stl
+#include <deque>
 
 // k2
 #include <k2/common/Common.h>
+#include <k2/config/Config.h>
 #include "BaseTypes.h"
+#include "OutstandingRequests.h"
 #include "RPCHeader.h"
 #include "RPCParser.h"
 #include "Request.h"
@@ -39,6 +45,16 @@ Copyright(c) 2020 Futurewei Cloud
 
 namespace k2 {
 
+// Counters for the coalesced sends of TCP channels. A stats object can be shared among channels
+struct TCPSendStats {
+    // number of write+flush rounds on the socket
+    uint64_t flushes = 0;
+    // number of RPC messages sent in these flushes
+    uint64_t messages = 0;
+    // number of bytes sent in these flushes
+    uint64_t bytes = 0;
+};
+
 // A TCP channel wraps a seastar connected_socket with an RPCParser to enable sending and receiving
 // RPC messages over a TCP connection
 // The class provides Observer interface to allow for user to observe RPC messages coming over this channel
@@ -46,8 +62,10 @@ class TCPRPCChannel {
 
 public: // lifecycle
     // Construct a new channel, wrapping a future connected socket to a client at the given address
+    // Send statistics are accumulated in the given stats object if one is provided
     TCPRPCChannel(seastar::future<seastar::connected_socket> futureSocket, TXEndpoint endpoint,
-                  RequestObserver_t requestObserver, FailureObserver_t failureObserver);
+                  RequestObserver_t requestObserver, FailureObserver_t failureObserver,
+                  seastar::lw_shared_ptr<TCPSendStats> sendStats=nullptr);
 
     // destructor
     ~TCPRPCChannel();
@@ -72,9 +90,19 @@ public: // API
     // Obtain the endpoint for this channel
     TXEndpoint& getTXEndpoint();
 
+    // true if the peer has told us over this channel that it can parse compact payloads
+    bool isPeerCompactCapable() const;
+
     // This method needs to be called so that the channel can begin processing messages
     void run();
 
+    // the number of requests sent over this channel for which we haven't seen a response yet. Requests which
+    // haven't seen a response within tcp_outstanding_request_expiry(e.g. they timed out) are not counted
+    size_t getOutstandingRequests();
+
+    // the last time we sent or received a message over this channel
+    TimePoint getLastActivity() const;
+
 private: // methods
     // we call this method when we successfully connect to a remote end.
     // While we're connecting, any writes are queued in the channel and now we have to flush them
@@ -83,9 +111,13 @@ private: // methods
     // helper method to setup an incoming connected socket
     seastar::future<> _setConnectedSocket(seastar::connected_socket sock);
 
-    // helper method used to send a packet
+    // helper method used to send a packet. Packets are coalesced into batches, which are written out by the
+    // flush loop (see _flushBatches())
     void _sendPacket(seastar::net::packet&& packet);
 
+    // writes out the queued batches, one write and one flush per batch, until there are no more batches
+    seastar::future<> _flushBatches();
+
 private: // fields
     // this is the RPC message parser
     RPCParser _rpcParser;
@@ -135,6 +167,38 @@ private: // fields
     // used to properly chain sends
     seastar::compat::optional<seastar::future<>> _sendFuture;
 
+    // A group of messages which are sent with a single write and flush
+    struct SendBatch {
+        seastar::net::packet packet;
+        size_t messages = 0;
+    };
+
+    // the batches waiting to be flushed. New messages are appended to the last batch until it fills up
+    std::deque<SendBatch> _sendBatches;
+
+    // flag to tell if the flush loop is scheduled or running
+    bool _flushPending = false;
+
+    // see getOutstandingRequests()
+    OutstandingRequests _outstandingRequests;
+
+    // see getLastActivity()
+    TimePoint _lastActivity = Clock::now();
+
+    // where we accumulate our send statistics
+    seastar::lw_shared_ptr<TCPSendStats> _sendStats;
+
+    // Max size of a batch. Once a batch reaches this size, the following messages go into a new batch
+    ConfigVar<size_t> _coalesceMaxBytes{"tcp_coalesce_max_bytes", 64*1024};
+
+    // How long to hold messages to collect a batch when the channel is idle. By default(0) we only collect the
+    // messages sent in the current reactor poll cycle
+    ConfigDuration _coalesceMaxDelay{"tcp_coalesce_max_delay", 0us};
+
+    // How long a request counts as outstanding without a response. This should be no shorter than the RPC timeouts
+    // used by the application
+    ConfigDuration _outstandingRequestExpiry{"tcp_outstanding_request_expiry", 10s};
+
 private: // Not needed
     TCPRPCChannel(const TCPRPCChannel& o) = delete;
     TCPRPCChannel(TCPRPCChannel&& o) = delete;
@@ -29,6 +29,9 @@ Copyright(c) 2020 Futurewei Cloud
 #include <arpa/inet.h> // for inet_ntop
 #include <seastar/net/inet_address.hh> // for inet_address
 
+// stl
+#include <algorithm>
+
 //k2
 #include <k2/common/Log.h>
 
@@ -56,6 +59,11 @@ TCPRPCProtocol::~TCPRPCProtocol() {
 void TCPRPCProtocol::start() {
     K2DEBUG("start");
     _stopped = false;
+    _registerMetrics();
+    if (_channelIdleTimeout() > 0s) {
+        _idleTimer.set_callback([this] { _closeIdleChannels(); });
+        _idleTimer.arm_periodic(_channelIdleTimeout());
+    }
     if (_svrEndpoint) {
         K2INFO("Starting listening TCP Proto on: " << _svrEndpoint->getURL());
 
@@ -134,15 +142,21 @@ seastar::future<> TCPRPCProtocol::stop() {
     }
 
     // place all channels in a list so that we can clear the map
+    _idleTimer.cancel();
     std::vector<seastar::lw_shared_ptr<TCPRPCChannel>> channels;
     for (auto&& iter: _channels) {
-        channels.push_back(iter.second);
+        for (auto& pooled: iter.second.channels) {
+            channels.push_back(pooled.chan);
+        }
     }
     _channels.clear();
+    _metricGroups.clear();
+    K2INFO("TCP sends: flushes=" << _sendStats->flushes << ", messages=" << _sendStats->messages << ", bytes=" << _sendStats->bytes);
 
     // now schedule futures for graceful close of all channels
     std::vector<seastar::future<>> futs;
     futs.push_back(std::move(_listenerClosed));
+    futs.push_back(std::move(_idleChannelsClosed));
     for (auto chan: channels) {
         // schedule a graceful close. Note the empty continuation which captures the shared pointer to the channel
         // by copy so that the channel isn't going to get destroyed mid-sentence
@@ -175,6 +189,19 @@ seastar::lw_shared_ptr<TXEndpoint> TCPRPCProtocol::getServerEndpoint() {
     return _svrEndpoint;
 }
 
+bool TCPRPCProtocol::isCompactPeer(const TXEndpoint& endpoint) {
+    auto iter = _channels.find(endpoint);
+    if (iter == _channels.end()) {
+        return false;
+    }
+    for (auto& pooled: iter->second.channels) {
+        if (pooled.chan->isPeerCompactCapable()) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void TCPRPCProtocol::send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) {
     if (_stopped) {
         K2WARN("Dropping message since we're stopped: verb=" << int(verb) << ", url=" << endpoint.getURL());
@@ -193,9 +220,9 @@ seastar::lw_shared_ptr<TCPRPCChannel> TCPRPCProtocol::_getOrMakeChannel(TXEndpoi
     // look for an existing channel
     K2DEBUG("get or make channel: " << endpoint.getURL());
     auto iter = _channels.find(endpoint);
-    if (iter != _channels.end()) {
+    if (iter != _channels.end() && !_shouldGrowPool(iter->second)) {
         K2DEBUG("found existing channel");
-        return iter->second;
+        return _selectChannel(iter->second);
     }
     K2DEBUG("creating new channel");
 
@@ -212,9 +239,75 @@ seastar::lw_shared_ptr<TCPRPCChannel> TCPRPCProtocol::_getOrMakeChannel(TXEndpoi
     return _handleNewChannel(std::move(futureConn), endpoint);
 }
 
+bool TCPRPCProtocol::_shouldGrowPool(const ChannelPool& pool) {
+    if (pool.channels.size() >= _connectionsPerEndpoint()) {
+        return false;
+    }
+    for (auto& pooled: pool.channels) {
+        if (pooled.chan->getOutstandingRequests() == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+seastar::lw_shared_ptr<TCPRPCChannel> TCPRPCProtocol::_selectChannel(ChannelPool& pool) {
+    assert(!pool.channels.empty());
+    auto start = pool.next++ % pool.channels.size();
+    if (!_leastOutstanding()) {
+        return pool.channels[start].chan;
+    }
+    // start scanning at the round-robin cursor so that we spread the load among equally loaded channels
+    auto best = start;
+    for (size_t i = 1; i < pool.channels.size(); ++i) {
+        auto candidate = (start + i) % pool.channels.size();
+        if (pool.channels[candidate].chan->getOutstandingRequests() < pool.channels[best].chan->getOutstandingRequests()) {
+            best = candidate;
+        }
+    }
+    return pool.channels[best].chan;
+}
+
+seastar::lw_shared_ptr<TCPRPCChannel> TCPRPCProtocol::_removeChannel(const TXEndpoint& endpoint, uint64_t id) {
+    auto poolIter = _channels.find(endpoint);
+    if (poolIter == _channels.end()) {
+        return nullptr;
+    }
+    auto& channels = poolIter->second.channels;
+    auto chanIter = std::find_if(channels.begin(), channels.end(), [id](auto& pooled) { return pooled.id == id; });
+    if (chanIter == channels.end()) {
+        return nullptr;
+    }
+    auto chan = chanIter->chan;
+    channels.erase(chanIter);
+    if (channels.empty()) {
+        _channels.erase(poolIter);
+    }
+    return chan;
+}
+
+void TCPRPCProtocol::_closeIdleChannels() {
+    auto idleSince = Clock::now() - _channelIdleTimeout();
+    std::vector<std::tuple<TXEndpoint, uint64_t>> idle;
+    for (auto& [endpoint, pool]: _channels) {
+        for (auto& pooled: pool.channels) {
+            if (pooled.chan->getOutstandingRequests() == 0 && pooled.chan->getLastActivity() < idleSince) {
+                idle.emplace_back(endpoint, pooled.id);
+            }
+        }
+    }
+    for (auto& [endpoint, id]: idle) {
+        auto chan = _removeChannel(endpoint, id);
+        K2DEBUG("closing idle channel to " << endpoint.getURL());
+        _idleChannelsClosed = seastar::when_all_succeed(std::move(_idleChannelsClosed), chan->gracefulClose())
+            .discard_result().then([chan] {});
+    }
+}
+
 seastar::lw_shared_ptr<TCPRPCChannel>
 TCPRPCProtocol::_handleNewChannel(seastar::future<seastar::connected_socket> futureSocket, const TXEndpoint& endpoint) {
     K2DEBUG("processing channel: "<< endpoint.getURL());
+    auto id = _nextChannelId++;
     auto chan = seastar::make_lw_shared<TCPRPCChannel>(std::move(futureSocket), endpoint,
         [this] (Request&& request) {
             K2DEBUG("Message " << request.verb << " received from " << request.endpoint.getURL());
@@ -222,26 +315,39 @@ TCPRPCProtocol::_handleNewChannel(seastar::future<seastar::connected_socket> fut
                 _messageObserver(std::move(request));
             }
         },
-        [this] (TXEndpoint& endpoint, auto exc) {
+        [this, id] (TXEndpoint& endpoint, auto exc) {
             if (!_stopped) {
                 if (exc) {
                     K2WARN("Channel " << endpoint.getURL() << ", failed due to " << exc);
                 }
-                auto chanIter = _channels.find(endpoint);
-                if (chanIter != _channels.end()) {
-                    auto chan = chanIter->second;
-                    _channels.erase(chanIter);
+                auto chan = _removeChannel(endpoint, id);
+                if (chan) {
                     return chan->gracefulClose().then([chan] {});
                 }
             }
             return seastar::make_ready_future();
-        });
+        },
+        _sendStats);
     assert(chan->getTXEndpoint().canAllocate());
-    _channels.emplace(chan->getTXEndpoint(), chan);
+    _channels[chan->getTXEndpoint()].channels.push_back(PooledChannel{id, chan});
     chan->run();
     return chan;
 }
 
+void TCPRPCProtocol::_registerMetrics() {
+    namespace sm = seastar::metrics;
+    _metricGroups.clear();
+    std::vector<sm::label_instance> labels;
+    _metricGroups.add_group("tcp_transport", {
+        sm::make_counter("flushes", _sendStats->flushes, sm::description("Total socket write+flush rounds"), labels),
+        sm::make_counter("sent_messages", _sendStats->messages, sm::description("Total RPC messages sent"), labels),
+        sm::make_counter("sent_bytes", _sendStats->bytes, sm::description("Total bytes sent"), labels),
+        sm::make_gauge("messages_per_flush",
+            [this] { return _sendStats->flushes ? double(_sendStats->messages) / _sendStats->flushes : 0.0; },
+            sm::description("Average number of RPC messages coalesced in a socket flush"), labels),
+    });
+}
+
 TXEndpoint TCPRPCProtocol::_endpointFromAddress(SocketAddress addr) {
     const size_t bufsize = 64;
     char buffer[bufsize];
@@ -24,18 +24,22 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 #include <seastar/core/future.hh>
 #include <seastar/core/shared_ptr.hh>
+#include <seastar/core/metrics.hh>
+#include <seastar/core/timer.hh>
 // k2
 #include "IRPCProtocol.h"
 #include "VirtualNetworkStack.h"
 #include "RPCProtocolFactory.h"
 #include "TCPRPCChannel.h"
 #include "RPCHeader.h"
+#include <k2/config/Config.h>
 
 namespace k2 {
 
 // TCPRPCProtocol is a protocol which use the currently configured TCP stack, with responsibility to:
 // - listen for incoming TCP connections
-// - create outgoing TCP connections when asked to send messages
+// - create outgoing TCP connections when asked to send messages. We keep a pool of up to
+//   tcp_connections_per_endpoint connections to each remote endpoint, and spread the messages among them
 // - receive incoming messages and pass them on to the message observer for the protocol
 // NB, the class is meant to be used as a distributed<> container
 class TCPRPCProtocol: public IRPCProtocol {
@@ -78,6 +82,9 @@ public: // API
     // Returns the endpoint where this protocol accepts incoming connections.
     seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint() override;
 
+    // Returns true if any of our connections to the endpoint has seen the peer advertise compact payloads
+    bool isCompactPeer(const TXEndpoint& endpoint) override;
+
 public: // distributed<> interface
     // iface: called by seastar's distributed mechanism when stop() is invoked on the distributed container.
     // The method's returned future completes once all channels had a chance to complete a graceful shutdown
@@ -90,6 +97,32 @@ private: // methods
     // utility method which ew use to obtain a connection(either existing or new) for the given endpoint
     seastar::lw_shared_ptr<TCPRPCChannel> _getOrMakeChannel(TXEndpoint& endpoint);
 
+    // A channel in a connection pool. The id identifies the channel when it fails
+    struct PooledChannel {
+        uint64_t id;
+        seastar::lw_shared_ptr<TCPRPCChannel> chan;
+    };
+
+    // The connections to a single endpoint
+    struct ChannelPool {
+        std::vector<PooledChannel> channels;
+        // round-robin cursor
+        size_t next = 0;
+    };
+
+    // We open connections lazily: a pool grows only when all of its connections have outstanding requests
+    bool _shouldGrowPool(const ChannelPool& pool);
+
+    // pick a connection from the (non-empty) pool according to the configured selection policy
+    seastar::lw_shared_ptr<TCPRPCChannel> _selectChannel(ChannelPool& pool);
+
+    // removes the channel with the given id from the pool for the given endpoint.
+    // Returns the removed channel or nullptr if not found
+    seastar::lw_shared_ptr<TCPRPCChannel> _removeChannel(const TXEndpoint& endpoint, uint64_t id);
+
+    // closes the channels which have been idle for longer than tcp_channel_idle_timeout
+    void _closeIdleChannels();
+
     // process a new channel creation
     seastar::lw_shared_ptr<TCPRPCChannel>
     _handleNewChannel(seastar::future<seastar::connected_socket> futureSocket, const TXEndpoint& endpoint);
@@ -97,6 +130,9 @@ private: // methods
     // Helper method to create an TXEndpoint from a socket address
     TXEndpoint _endpointFromAddress(SocketAddress addr);
 
+    // register the send metrics of this protocol
+    void _registerMetrics();
+
 private: // fields
     // the address we're listening on
     SocketAddress _addr;
@@ -111,7 +147,29 @@ private: // fields
     seastar::future<> _listenerClosed = seastar::make_ready_future();
 
     // the underlying TCP channels we're dealing with
-    std::unordered_map<TXEndpoint, seastar::lw_shared_ptr<TCPRPCChannel>> _channels;
+    std::unordered_map<TXEndpoint, ChannelPool> _channels;
+
+    // used to generate channel ids
+    uint64_t _nextChannelId = 0;
+
+    // completes when all idle channels we've closed are closed
+    seastar::future<> _idleChannelsClosed = seastar::make_ready_future();
+
+    // timer used to periodically close idle channels
+    seastar::timer<> _idleTimer;
+
+    // the max number of connections we open to the same endpoint
+    ConfigVar<size_t> _connectionsPerEndpoint{"tcp_connections_per_endpoint", 1};
+
+    // if true, pick the connection with fewest outstanding requests. Otherwise, pick connections round-robin
+    ConfigVar<bool> _leastOutstanding{"tcp_least_outstanding", true};
+
+    // close connections which haven't been used for this long. Idle connections are not closed if this is 0
+    ConfigDuration _channelIdleTimeout{"tcp_channel_idle_timeout", 0s};
+
+    // the send statistics, shared by all of our channels
+    seastar::lw_shared_ptr<TCPSendStats> _sendStats = seastar::make_lw_shared<TCPSendStats>();
+    seastar::metrics::metric_groups _metricGroups;
 
 private: // not needed
     TCPRPCProtocol() = delete;
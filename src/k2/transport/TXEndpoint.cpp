@@ -37,10 +37,25 @@ namespace k2 {
 // 2. or ipv4, e.g. "tcp+k2rpc://1.2.3.4:12345"
 // must have: protocol(group1), ip(group2==ipv4, group3==ipv6), port(group4)
 const static std::regex urlregex("(.+)://(?:([^:\\[\\]]+)|\\[(.+)\\]):(\\d+)");
+// 3. or a filesystem path (e.g. for unix sockets), with an optional port, e.g. "unix+k2rpc:///run/k2/node.sock".
+// The path may be qualified with a hex host id, e.g. "unix+k2rpc://0123abcd/run/k2/node.sock"
+// must have: protocol(group1), optionally host id(group2), path(group3), and optionally port(group4)
+const static std::regex pathurlregex("(.+)://([0-9a-f]*)(/[^:]*)(?::(\\d+))?");
 
 std::unique_ptr<TXEndpoint> TXEndpoint::fromURL(const String& url, BinaryAllocatorFunctor&& allocator) {
     K2DEBUG("Parsing url " << url);
     std::cmatch matches;
+    if (std::regex_match(url.c_str(), matches, pathurlregex)) {
+        String protocol(matches[1].str());
+        String path(matches[2].str() + matches[3].str());
+        int64_t parsedport = matches[4].length() > 0 ? std::stoll(matches[4].str()) : 0;
+        if (parsedport < 0 || parsedport > std::numeric_limits<uint32_t>::max()) {
+            K2WARN("unable to parse port as int in " << url);
+            return nullptr;
+        }
+        K2DEBUG("Parsed url " << url << ", into: proto=" << protocol << ", path=" << path  << ", port=" << parsedport);
+        return std::make_unique<TXEndpoint>(std::move(protocol), std::move(path), (uint32_t)parsedport, std::move(allocator));
+    }
     if (!std::regex_match(url.c_str(), matches, urlregex)) {
         K2WARN("Unable to parse url: " << url);
         return nullptr;
@@ -87,7 +102,11 @@ TXEndpoint::TXEndpoint(String&& protocol, String&& ip, uint32_t port, BinaryAllo
     _allocator(std::move(allocator)) {
     bool isIpv6 = _ip.find(":") != String::npos;
     _url = _protocol + "://" + (isIpv6?"[":"") + _ip + (isIpv6?"]":"");
-    _url += ":" + std::to_string(_port);
+    // path addresses(e.g. unix sockets) don't need a port
+    bool isPath = _ip.find('/') != String::npos;
+    if (!isPath || _port != 0) {
+        _url += ":" + std::to_string(_port);
+    }
     _hash = std::hash<String>()(_url);
 
     K2DEBUG("Created endpoint " << _url);
@@ -38,6 +38,10 @@ namespace k2 {
 //      proto=tcp+k2rpc, ip=10.0.0.1, port=12345
 // e.g. ipv6/rdma: rdma+k2rpc://[2001:db8:85a3::8a2e:370:7334]:1234567
 //      proto=rdma+k2rpc, ip=2001:db8:85a3::8a2e:370:7334, port=1234567
+// e.g. unix socket path: unix+k2rpc:///run/k2/node.sock
+//      proto=unix+k2rpc, ip=/run/k2/node.sock, port=0 (the port is optional for paths)
+// e.g. unix socket path on a given host: unix+k2rpc://0123abcd/run/k2/node.sock
+//      proto=unix+k2rpc, ip=0123abcd/run/k2/node.sock, port=0 (the host id is lowercase hex)
 class TXEndpoint {
 
 public: // lifecycle
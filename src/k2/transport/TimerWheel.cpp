@@ -0,0 +1,106 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "TimerWheel.h"
+
+// stl
+#include <algorithm>
+#include <stdexcept>
+
+namespace k2 {
+
+TimerWheel::TimerWheel(Duration tick, size_t buckets) :
+    _tickDuration(tick), _buckets(buckets), _occupied(buckets / 64) {
+    if (tick <= Duration::zero() || buckets == 0 || buckets % 64 != 0) {
+        throw std::invalid_argument("timer wheel needs a positive tick and a multiple of 64 buckets");
+    }
+}
+
+TimePoint TimerWheel::add(uint32_t id, TimePoint deadline, TimePoint now) {
+    if (_entries == 0) {
+        // the wheel was idle. Catch up to now
+        _tick = _toTick(now);
+    }
+    // round up so that we never time out early. Entries due in the tick we're in go in the next bucket
+    auto tick = std::max(_toTick(deadline + _tickDuration - Duration(1)), _tick + 1);
+    _push(tick % _buckets.size(), id);
+    return _fromTick(tick);
+}
+
+std::optional<TimePoint> TimerWheel::nextDue() const {
+    if (_entries == 0) {
+        return std::nullopt;
+    }
+    // scan the bitmap from the bucket after the last processed tick, wrapping around once
+    auto start = (_tick + 1) % _buckets.size();
+    for (size_t scanned = 0; scanned < _buckets.size() + 64;) {
+        auto index = (start + scanned) % _buckets.size();
+        auto word = _occupied[index / 64] >> (index % 64);
+        if (word != 0) {
+            return _fromTick(_tick + 1 + scanned + __builtin_ctzll(word));
+        }
+        scanned += 64 - index % 64;
+    }
+    return std::nullopt;
+}
+
+size_t TimerWheel::size() const {
+    return _entries;
+}
+
+void TimerWheel::clear() {
+    for (auto& bucket: _buckets) {
+        bucket.clear();
+    }
+    std::fill(_occupied.begin(), _occupied.end(), 0);
+    _entries = 0;
+}
+
+uint64_t TimerWheel::_toTick(TimePoint tp) const {
+    return tp.time_since_epoch() / _tickDuration;
+}
+
+TimePoint TimerWheel::_fromTick(uint64_t tick) const {
+    return TimePoint(_tickDuration * int64_t(tick));
+}
+
+bool TimerWheel::_isOccupied(size_t index) const {
+    return _occupied[index / 64] & (1ull << (index % 64));
+}
+
+void TimerWheel::_setOccupied(size_t index, bool occupied) {
+    if (occupied) {
+        _occupied[index / 64] |= 1ull << (index % 64);
+    }
+    else {
+        _occupied[index / 64] &= ~(1ull << (index % 64));
+    }
+}
+
+void TimerWheel::_push(size_t index, uint32_t id) {
+    _buckets[index].push_back(id);
+    _setOccupied(index, true);
+    _entries++;
+}
+
+} // namespace k2
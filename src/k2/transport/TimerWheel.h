@@ -0,0 +1,111 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// stl
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// k2
+#include <k2/common/Chrono.h>
+
+namespace k2 {
+
+// Hashed timer wheel for the timeouts of pending requests. Each bucket holds the ids which come due during the ticks
+// which hash to the bucket. The wheel doesn't have a timer of its own: the owner arms a single reactor timer for
+// nextDue(), and calls expire() when it fires, so the timer only wakes up for ticks which have entries.
+// Entries are not removed when their request completes. expire() asks the owner about each entry in a due bucket
+class TimerWheel {
+public:
+    // a wheel with the given tick and number of buckets(a multiple of 64).
+    // Throws std::invalid_argument for other sizes or a non-positive tick
+    TimerWheel(Duration tick, size_t buckets);
+
+    // schedules the given id to come due at the deadline, rounded up to the next tick. Returns the time at which
+    // the id's bucket comes due
+    TimePoint add(uint32_t id, TimePoint deadline, TimePoint now);
+
+    // Visits the entries of the buckets which have come due by now. For each entry, keep(id) returns true if
+    // the entry should stay in the wheel(e.g. it is due on a later rotation of the wheel). keep() may add new entries
+    template <class Func>
+    void expire(TimePoint now, Func&& keep) {
+        auto nowTick = _toTick(now);
+        if (nowTick <= _tick) {
+            return;
+        }
+        // if we fell behind by more than a rotation, we only need to look at each bucket once
+        auto tick = std::max(_tick + 1, nowTick >= _buckets.size() ? nowTick - _buckets.size() + 1 : 0);
+        _tick = nowTick;
+        for (; tick <= nowTick; ++tick) {
+            auto index = tick % _buckets.size();
+            if (!_isOccupied(index)) {
+                continue;
+            }
+            // process from the scratch space since keep() may add entries to this bucket
+            _scratch.swap(_buckets[index]);
+            _entries -= _scratch.size();
+            _setOccupied(index, false);
+            for (auto id: _scratch) {
+                if (keep(id)) {
+                    _push(index, id);
+                }
+            }
+            _scratch.clear();
+        }
+    }
+
+    // the time at which the next non-empty bucket comes due, if there are any entries
+    std::optional<TimePoint> nextDue() const;
+
+    // the number of entries in the wheel, including the ones for completed requests
+    size_t size() const;
+
+    // removes all entries
+    void clear();
+
+private:
+    uint64_t _toTick(TimePoint tp) const;
+    TimePoint _fromTick(uint64_t tick) const;
+    bool _isOccupied(size_t index) const;
+    void _setOccupied(size_t index, bool occupied);
+    void _push(size_t index, uint32_t id);
+
+    Duration _tickDuration;
+    std::vector<std::vector<uint32_t>> _buckets;
+
+    // one bit per bucket, set if the bucket has entries
+    std::vector<uint64_t> _occupied;
+
+    // the last tick we processed
+    uint64_t _tick = 0;
+
+    size_t _entries = 0;
+
+    // scratch space used while we process a bucket
+    std::vector<uint32_t> _scratch;
+};
+
+} // namespace k2
@@ -0,0 +1,318 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include "UnixRPCProtocol.h"
+
+// third-party
+#include <seastar/core/future-util.hh>
+#include <seastar/net/api.hh>
+#include <seastar/net/unix_address.hh>
+
+// stl
+#include <cerrno>
+#include <cstring> // for strnlen, strerror
+#include <stdexcept>
+#include <sys/socket.h> // for the probe connection
+#include <sys/stat.h> // for lstat
+#include <sys/un.h>
+#include <unistd.h> // for unlink
+
+//k2
+#include <k2/common/Log.h>
+#include "HostIdentity.h"
+
+namespace k2 {
+const String UnixRPCProtocol::proto("unix+k2rpc");
+
+// the ip of a unix endpoint is <host id><socket path>, where the host id may be empty
+static String _hostOf(const String& ip) {
+    return ip.substr(0, ip.find('/'));
+}
+
+static String _pathOf(const String& ip) {
+    auto slash = ip.find('/');
+    return slash == String::npos ? String() : ip.substr(slash);
+}
+
+UnixRPCProtocol::UnixRPCProtocol(VirtualNetworkStack::Dist_t& vnet):
+    IRPCProtocol(vnet, proto),
+    _stopped(true) {
+    K2DEBUG("ctor");
+}
+
+UnixRPCProtocol::UnixRPCProtocol(VirtualNetworkStack::Dist_t& vnet, String path):
+    IRPCProtocol(vnet, proto),
+    _path(std::move(path)),
+    _svrEndpoint(seastar::make_lw_shared<TXEndpoint>(String(proto), getHostBootId() + _path, 0, _vnet.local().getTCPAllocator())),
+    _stopped(true) {
+    K2DEBUG("ctor");
+}
+
+UnixRPCProtocol::~UnixRPCProtocol() {
+    K2DEBUG("dtor");
+}
+
+void UnixRPCProtocol::start() {
+    K2DEBUG("start");
+    _stopped = false;
+    if (_svrEndpoint) {
+        if (getHostBootId().empty()) {
+            K2WARN("Unable to determine the host identity. Our endpoint is only usable by clients which are told it's local");
+        }
+        K2INFO("Starting listening Unix Proto on: " << _svrEndpoint->getURL());
+        // a previous process may have left its socket file behind, which would make the bind fail
+        _removeStaleSocket();
+        _listen_socket = _vnet.local().listenUnix(seastar::socket_address(seastar::unix_domain_addr(_path.c_str())));
+        struct stat st;
+        if (::lstat(_path.c_str(), &st) == 0) {
+            _ownSocketFile = true;
+            _socketDev = st.st_dev;
+            _socketIno = st.st_ino;
+        }
+
+        _listenerClosed = seastar::do_until(
+            [this] { return _stopped;},
+            [this] {
+            return _listen_socket->accept().then(
+                [this] (seastar::accept_result&& result) {
+                    // unix clients are unnamed so we make up a unique endpoint for the connection
+                    TXEndpoint ep(String(proto), String(_svrEndpoint->getIP()), ++_acceptedConnections, _vnet.local().getTCPAllocator());
+                    K2DEBUG("Accepted connection " << ep.getURL());
+                    _handleNewChannel(seastar::make_ready_future<seastar::connected_socket>(std::move(result.connection)), ep);
+                    return seastar::make_ready_future();
+                }
+            )
+            .handle_exception([this] (auto exc) {
+                if (!_stopped) {
+                    K2WARN_EXC("Accept received exception(ignoring)", exc);
+                }
+                else {
+                    // let the loop keep going. The _stopped flag above will cause it to break
+                    K2DEBUG("Server is exiting...");
+                }
+                return seastar::make_ready_future();
+            });
+        }).or_terminate();
+    }
+    else {
+        K2INFO("Starting non-listening Unix Proto...");
+    }
+}
+
+RPCProtocolFactory::BuilderFunc_t UnixRPCProtocol::builder(VirtualNetworkStack::Dist_t& vnet) {
+    K2DEBUG("builder creating non-listening unix protocol");
+    return [&vnet]() mutable -> seastar::shared_ptr<IRPCProtocol> {
+        K2DEBUG("builder running");
+        return seastar::static_pointer_cast<IRPCProtocol>(
+            seastar::make_shared<UnixRPCProtocol>(vnet));
+    };
+}
+
+RPCProtocolFactory::BuilderFunc_t UnixRPCProtocol::builder(VirtualNetworkStack::Dist_t& vnet, IAddressProvider& addrProvider) {
+    K2DEBUG("builder creating multi-address unix protocol");
+    return [&vnet, &addrProvider]() mutable -> seastar::shared_ptr<IRPCProtocol> {
+        auto myID = seastar::engine().cpu_id() % seastar::smp::count;
+        K2DEBUG("builder created");
+        auto addr = addrProvider.getAddress(myID);
+        if (addr.family() != AF_UNIX) {
+            throw std::invalid_argument("unix protocol requires a unix domain address");
+        }
+        String path(addr.u.un.sun_path, ::strnlen(addr.u.un.sun_path, sizeof(addr.u.un.sun_path)));
+        return seastar::static_pointer_cast<IRPCProtocol>(
+            seastar::make_shared<UnixRPCProtocol>(vnet, std::move(path)));
+    };
+}
+
+seastar::future<> UnixRPCProtocol::stop() {
+    K2DEBUG("stop");
+    // immediately prevent accepting further read/write work
+    _stopped = true;
+    if (_listen_socket) {
+        _listen_socket.release();
+        // only remove the socket file if it is still the one we created
+        struct stat st;
+        if (_ownSocketFile && ::lstat(_path.c_str(), &st) == 0 && st.st_dev == _socketDev && st.st_ino == _socketIno) {
+            ::unlink(_path.c_str());
+        }
+        _ownSocketFile = false;
+    }
+
+    // place all channels in a list so that we can clear the map
+    std::vector<seastar::lw_shared_ptr<TCPRPCChannel>> channels;
+    for (auto&& iter: _channels) {
+        channels.push_back(iter.second);
+    }
+    _channels.clear();
+
+    // now schedule futures for graceful close of all channels
+    std::vector<seastar::future<>> futs;
+    futs.push_back(std::move(_listenerClosed));
+    for (auto chan: channels) {
+        // schedule a graceful close. Note the empty continuation which captures the shared pointer to the channel
+        // by copy so that the channel isn't going to get destroyed mid-sentence
+        // we're about to kill this so unregister observers
+        chan->registerFailureObserver(nullptr);
+        chan->registerMessageObserver(nullptr);
+
+        futs.push_back(chan->gracefulClose().then([chan](){}));
+    }
+
+    // here we return a future which completes once all GracefulClose futures complete.
+    return seastar::when_all_succeed(futs.begin(), futs.end()).discard_result();
+}
+
+std::unique_ptr<TXEndpoint> UnixRPCProtocol::getTXEndpoint(String url) {
+    if (_stopped) {
+        K2WARN("Unable to create endpoint since we're stopped for url " << url);
+        return nullptr;
+    }
+    K2DEBUG("get endpoint for " << url);
+    auto ep = TXEndpoint::fromURL(url, _vnet.local().getTCPAllocator());
+    if (!ep || ep->getProtocol() != proto) {
+        K2WARN("Cannot construct non-`" << proto << "` endpoint");
+        return nullptr;
+    }
+    // only vend endpoints on this host. This lets discovery prefer unix sockets when they are usable
+    auto host = _hostOf(ep->getIP());
+    if (!host.empty() && host != getHostBootId()) {
+        K2DEBUG("Not a unix socket on this host: " << url);
+        return nullptr;
+    }
+    return ep;
+}
+
+void UnixRPCProtocol::_removeStaleSocket() {
+    struct stat st;
+    if (::lstat(_path.c_str(), &st) != 0) {
+        if (errno == ENOENT) {
+            return; // nothing to remove
+        }
+        K2ERROR("Unable to stat unix socket path " << _path << ": " << ::strerror(errno));
+        throw std::runtime_error("unable to stat unix socket path");
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        K2ERROR("Unix socket path " << _path << " exists and is not a socket");
+        throw std::runtime_error("unix socket path exists and is not a socket");
+    }
+
+    // see if someone is still listening on the socket. The probe is non-blocking, so a full accept queue shows
+    // up as EAGAIN, which also means there is a listener
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (_path.size() >= sizeof(addr.sun_path)) {
+        K2ERROR("Unix socket path is too long: " << _path);
+        throw std::invalid_argument("unix socket path is too long");
+    }
+    std::memcpy(addr.sun_path, _path.c_str(), _path.size());
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        K2ERROR("Unable to create probe socket: " << ::strerror(errno));
+        throw std::runtime_error("unable to create unix probe socket");
+    }
+    int rc = ::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    int err = rc == 0 ? 0 : errno;
+    ::close(fd);
+    if (err != ECONNREFUSED) {
+        K2ERROR("Unix socket path " << _path << " is in use by another listener: "
+                << (err == 0 ? "connected" : ::strerror(err)));
+        throw std::runtime_error("unix socket path is in use");
+    }
+    K2INFO("Removing stale unix socket " << _path);
+    ::unlink(_path.c_str());
+}
+
+seastar::lw_shared_ptr<TXEndpoint> UnixRPCProtocol::getServerEndpoint() {
+    return _svrEndpoint;
+}
+
+bool UnixRPCProtocol::isCompactPeer(const TXEndpoint& endpoint) {
+    auto iter = _channels.find(endpoint);
+    return iter != _channels.end() && iter->second->isPeerCompactCapable();
+}
+
+void UnixRPCProtocol::send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) {
+    if (_stopped) {
+        K2WARN("Dropping message since we're stopped: verb=" << int(verb) << ", url=" << endpoint.getURL());
+        return;
+    }
+
+    auto&& chan = _getOrMakeChannel(endpoint);
+    if (!chan) {
+        K2WARN("Dropping message: Unable to create connection for endpoint " << endpoint.getURL());
+        return;
+    }
+    chan->send(verb, std::move(payload), std::move(metadata));
+}
+
+seastar::lw_shared_ptr<TCPRPCChannel> UnixRPCProtocol::_getOrMakeChannel(TXEndpoint& endpoint) {
+    // look for an existing channel
+    K2DEBUG("get or make channel: " << endpoint.getURL());
+    auto iter = _channels.find(endpoint);
+    if (iter != _channels.end()) {
+        K2DEBUG("found existing channel");
+        return iter->second;
+    }
+    K2DEBUG("creating new channel");
+
+    // we can only get a future for a connection at some point.
+    auto futureConn = _vnet.local().connectUnix(seastar::socket_address(seastar::unix_domain_addr(_pathOf(endpoint.getIP()).c_str())));
+    if (futureConn.failed()) {
+        // the conn failed immediately
+        return nullptr;
+    }
+    // wrap the connection into a TCPChannel
+    return _handleNewChannel(std::move(futureConn), endpoint);
+}
+
+seastar::lw_shared_ptr<TCPRPCChannel>
+UnixRPCProtocol::_handleNewChannel(seastar::future<seastar::connected_socket> futureSocket, const TXEndpoint& endpoint) {
+    K2DEBUG("processing channel: "<< endpoint.getURL());
+    auto chan = seastar::make_lw_shared<TCPRPCChannel>(std::move(futureSocket), endpoint,
+        [this] (Request&& request) {
+            K2DEBUG("Message " << request.verb << " received from " << request.endpoint.getURL());
+            if (!_stopped) {
+                _messageObserver(std::move(request));
+            }
+        },
+        [this] (TXEndpoint& endpoint, auto exc) {
+            if (!_stopped) {
+                if (exc) {
+                    K2WARN("Channel " << endpoint.getURL() << ", failed due to " << exc);
+                }
+                auto chanIter = _channels.find(endpoint);
+                if (chanIter != _channels.end()) {
+                    auto chan = chanIter->second;
+                    _channels.erase(chanIter);
+                    return chan->gracefulClose().then([chan] {});
+                }
+            }
+            return seastar::make_ready_future();
+        },
+        _sendStats);
+    assert(chan->getTXEndpoint().canAllocate());
+    _channels.emplace(chan->getTXEndpoint(), chan);
+    chan->run();
+    return chan;
+}
+
+} // namespace k2
@@ -0,0 +1,154 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+
+// stl
+#include <sys/types.h> // for dev_t, ino_t
+
+// third-party
+#include <seastar/core/future.hh>
+#include <seastar/core/shared_ptr.hh>
+// k2
+#include "IRPCProtocol.h"
+#include "VirtualNetworkStack.h"
+#include "RPCProtocolFactory.h"
+#include "TCPRPCChannel.h"
+#include "RPCHeader.h"
+
+namespace k2 {
+
+// UnixRPCProtocol is a protocol which uses unix-domain stream sockets, for processes on the same host. It has the
+// same framing as TCPRPCProtocol(we use TCPRPCChannels over the unix sockets) but it skips the TCP/IP stack.
+// Its responsibility is to:
+// - listen for incoming unix socket connections
+// - create outgoing unix socket connections when asked to send messages
+// - receive incoming messages and pass them on to the message observer for the protocol
+// The endpoints are the socket paths qualified with the boot id of the host(see getHostBootId()), e.g.
+// unix+k2rpc://<host boot id>/run/k2/node.sock, because the same path can exist on every host. Endpoints without a
+// host id, e.g. unix+k2rpc:///run/k2/node.sock, are taken to be on this host.
+// Unix socket clients don't have addresses, so we give each accepted connection a unique endpoint by using the
+// connection's sequence number as the port, e.g. unix+k2rpc://<host boot id>/run/k2/node.sock:7
+// On start, we only replace a socket file at our path if nobody is listening on it, and on stop we only remove the
+// socket file we created, so that two processes configured with the same path don't break each other.
+// NB, the class is meant to be used as a distributed<> container
+class UnixRPCProtocol: public IRPCProtocol {
+public: // types
+    // Convenience builder which does not create a listener (client-mode only)
+    static RPCProtocolFactory::BuilderFunc_t builder(VirtualNetworkStack::Dist_t& vnet);
+
+    // Allow building of protocols with an address provider, which should return unix_domain_addr addresses
+    static RPCProtocolFactory::BuilderFunc_t builder(VirtualNetworkStack::Dist_t& vnet, IAddressProvider& addrProvider);
+
+    // The official protocol name supported for communications over unix sockets
+    static const String proto;
+
+public: // lifecycle
+    // Construct the protocol with a vnet which supports unix sockets and listens on the given socket path
+    UnixRPCProtocol(VirtualNetworkStack::Dist_t& vnet, String path);
+
+    // Construct the protocol with a vnet which supports unix sockets and no ability to accept incoming connections
+    UnixRPCProtocol(VirtualNetworkStack::Dist_t& vnet);
+
+    // Destructor
+    virtual ~UnixRPCProtocol();
+
+public: // API
+    // This method creates an endpoint for a given URL. The endpoint is needed in order to
+    // 1. obtain protocol-specific payloads
+    // 2. send messages.
+    // returns blank pointer if we failed to parse the url, if the protocol is not supported or if the endpoint
+    // is on another host.
+    // We don't touch the filesystem here: if there is no socket at the path, the connection fails when we send.
+    std::unique_ptr<TXEndpoint> getTXEndpoint(String url) override;
+
+    // Invokes the remote rpc for the given verb with the given payload. This is an asyncronous API. No guarantees
+    // are made on the delivery of the payload after the call returns.
+    // This is a lower-level API which is useful for sending messages that do not expect replies.
+    // The RPC message is configured with the given metadata
+    void send(Verb verb, std::unique_ptr<Payload> payload, TXEndpoint& endpoint, MessageMetadata metadata) override;
+
+    // Returns the endpoint where this protocol accepts incoming connections.
+    seastar::lw_shared_ptr<TXEndpoint> getServerEndpoint() override;
+
+    // Returns true if any of our connections to the endpoint has seen the peer advertise compact payloads
+    bool isCompactPeer(const TXEndpoint& endpoint) override;
+
+public: // distributed<> interface
+    // iface: called by seastar's distributed mechanism when stop() is invoked on the distributed container.
+    // The method's returned future completes once all channels had a chance to complete a graceful shutdown
+    seastar::future<> stop() override;
+
+    // Should be called by user when all distributed objects have been created
+    void start() override;
+
+private: // methods
+    // utility method which we use to obtain a connection(either existing or new) for the given endpoint
+    seastar::lw_shared_ptr<TCPRPCChannel> _getOrMakeChannel(TXEndpoint& endpoint);
+
+    // process a new channel creation
+    seastar::lw_shared_ptr<TCPRPCChannel>
+    _handleNewChannel(seastar::future<seastar::connected_socket> futureSocket, const TXEndpoint& endpoint);
+
+    // remove a leftover socket file at our path so that we can bind to it. Throws if the path is in use by a
+    // listener in another process or if it isn't a socket
+    void _removeStaleSocket();
+
+
+private: // fields
+    // the socket path we're listening on. Empty if we're not listening
+    String _path;
+
+    // the endpoint version of the path we're listening on
+    seastar::lw_shared_ptr<TXEndpoint> _svrEndpoint;
+
+    // we use this flag to signal exit
+    bool _stopped;
+    // our listening socket
+    seastar::lw_shared_ptr<seastar::server_socket> _listen_socket;
+    seastar::future<> _listenerClosed = seastar::make_ready_future();
+
+    // identity of the socket file we created, so that on stop we don't remove a file someone else put at our path
+    bool _ownSocketFile = false;
+    dev_t _socketDev = 0;
+    ino_t _socketIno = 0;
+
+    // used to give unique endpoints to accepted connections
+    uint32_t _acceptedConnections = 0;
+
+    // the underlying channels we're dealing with
+    std::unordered_map<TXEndpoint, seastar::lw_shared_ptr<TCPRPCChannel>> _channels;
+
+    // the send statistics, shared by all of our channels
+    seastar::lw_shared_ptr<TCPSendStats> _sendStats = seastar::make_lw_shared<TCPSendStats>();
+
+private: // not needed
+    UnixRPCProtocol() = delete;
+    UnixRPCProtocol(const UnixRPCProtocol& o) = delete;
+    UnixRPCProtocol(UnixRPCProtocol&& o) = delete;
+    UnixRPCProtocol &operator=(const UnixRPCProtocol& o) = delete;
+    UnixRPCProtocol &operator=(UnixRPCProtocol&& o) = delete;
+
+}; // class UnixRPCProtocol
+
+} // namespace k2
@@ -29,6 +29,7 @@ Copyright(c) 2020 Futurewei Cloud
 
 // k2
 #include <k2/common/Log.h>
+#include "BufferPool.h"
 
 // determine the packet size we should allocate: mtu - tcp_header_size - ip_header_size - ethernet_header_size
 const uint16_t tcpsegsize = seastar::net::hw_features().mtu
@@ -63,8 +64,34 @@ VirtualNetworkStack::connectTCP(SocketAddress remoteAddress, SocketAddress sourc
     return seastar::engine().net().connect(std::move(remoteAddress), std::move(sourceAddress));
 }
 
+seastar::server_socket VirtualNetworkStack::listenUnix(SocketAddress sa) {
+    K2DEBUG("listen unix on: " << sa);
+    return seastar::engine().net().listen(std::move(sa), seastar::listen_options{});
+}
+
+seastar::future<seastar::connected_socket>
+VirtualNetworkStack::connectUnix(SocketAddress remoteAddress) {
+    return seastar::engine().net().connect(std::move(remoteAddress));
+}
+
 void VirtualNetworkStack::start(){
     K2DEBUG("start");
+    BufferPool::local().setMaxBytes(_bufferPoolMaxBytes());
+    _registerMetrics();
+}
+
+void VirtualNetworkStack::_registerMetrics() {
+    namespace sm = seastar::metrics;
+    _metricGroups.clear();
+    std::vector<sm::label_instance> labels;
+    _metricGroups.add_group("tx_buffer_pool", {
+        sm::make_counter("hits", [] { return BufferPool::local().hits(); },
+            sm::description("Total buffer allocations satisfied from the pool"), labels),
+        sm::make_counter("misses", [] { return BufferPool::local().misses(); },
+            sm::description("Total buffer allocations which needed new memory"), labels),
+        sm::make_gauge("bytes_held", [] { return BufferPool::local().bytesHeld(); },
+            sm::description("Bytes held in free buffers by the pool"), labels),
+    });
 }
 
 BinaryAllocatorFunctor VirtualNetworkStack::getTCPAllocator() {
@@ -79,7 +106,7 @@ BinaryAllocatorFunctor VirtualNetworkStack::getTCPAllocator() {
         // NB, there is no performance benefit of allocating smaller chunks. Chunks up to 16384 are allocated from
         // seastar pool allocator and overhead is the same regardless of size(~10ns per allocation)
         K2DEBUG("allocating binary with size=" << tcpsegsize);
-        return Binary(tcpsegsize);
+        return BufferPool::local().allocate(tcpsegsize);
     };
 }
 
@@ -97,6 +124,9 @@ void VirtualNetworkStack::registerLowTCPMemoryObserver(LowMemoryObserver_t obser
 
 seastar::future<> VirtualNetworkStack::stop() {
     K2DEBUG("stop");
+    _metricGroups.clear();
+    // stop pooling. Any buffers still in use are freed when released
+    BufferPool::local().setMaxBytes(0);
     return seastar::make_ready_future<>();
 }
 
@@ -113,7 +143,7 @@ VirtualNetworkStack::connectRRDMA(seastar::rdma::EndPoint remoteAddress) {
 BinaryAllocatorFunctor VirtualNetworkStack::getRRDMAAllocator() {
     return []() {
         K2DEBUG("rrdma allocating binary with size=" << rrdmasegsize);
-        return Binary(rrdmasegsize);
+        return BufferPool::local().allocate(rrdmasegsize);
     };
 }
 
@@ -27,10 +27,12 @@ Copyright(c) 2020 Futurewei Cloud
 #include <seastar/core/distributed.hh> // distributed<> stuff
 #include <seastar/net/api.hh> // socket/network stuff
 #include <seastar/core/future.hh> // future stuff
+#include <seastar/core/metrics.hh>
 #include <seastar/net/rdma.hh>
 
 // k2
 #include <k2/common/Common.h>
+#include <k2/config/Config.h>
 #include "BaseTypes.h"
 
 namespace k2 {
@@ -64,7 +66,7 @@ public: // TCP API
     // It is up to caller to shutdown the input/output when the socket should be closed
     seastar::future<seastar::connected_socket> connectTCP(SocketAddress remoteAddress, SocketAddress sourceAddress={});
 
-    // Create a payload from the TCP provider
+    // Create a payload from the TCP provider. Buffers are recycled via the per-core BufferPool
     BinaryAllocatorFunctor getTCPAllocator();
 
     // registerLowTCPMemoryObserver allows the user to register a observer which will be called when
@@ -77,6 +79,15 @@ public: // TCP API
     // the requiredNumberOfBytes parameter in their callback.
     void registerLowTCPMemoryObserver(LowMemoryObserver_t observer);
 
+public: // Unix socket API
+    // Create a server(listening) unix-domain stream socket at the given address(a seastar::unix_domain_addr).
+    // Unix sockets are only supported by the posix network stack.
+    // It is up to caller to call abort_listen if the socket should be closed.
+    seastar::server_socket listenUnix(SocketAddress sa);
+
+    // Create a unix-domain stream socket connected to the given address
+    seastar::future<seastar::connected_socket> connectUnix(SocketAddress remoteAddress);
+
 public: // UDP API
     // TODO add UDP support
 
@@ -87,7 +98,7 @@ public: // RDMA API
     // Create an RRDMA connection to connect to a given remote address.
     std::unique_ptr<seastar::rdma::RDMAConnection> connectRRDMA(seastar::rdma::EndPoint remoteAddress);
 
-    // Create a binary from the RRDMA provider
+    // Create a binary from the RRDMA provider. Buffers are recycled via the per-core BufferPool
     BinaryAllocatorFunctor getRRDMAAllocator();
 
     // RegisterLowRRDMAMemoryObserver allows the user to register a observer which will be called when
@@ -107,10 +118,19 @@ public: // distributed<> interface
     // called by seastar's distributed mechanism when stop() is invoked on the distributed container.
     seastar::future<> stop();
 
+private: // methods
+    // register the metrics of the buffer pool on this core
+    void _registerMetrics();
+
 private: // fields
     LowMemoryObserver_t _lowTCPMemObserver;
     LowMemoryObserver_t _lowRRDMAMemObserver;
 
+    seastar::metrics::metric_groups _metricGroups;
+
+    // the most memory the buffer pool on this core may hold in free buffers
+    ConfigVar<size_t> _bufferPoolMaxBytes{"tx_buffer_pool_max_bytes", 16*1024*1024};
+
 private: // Not needed
     VirtualNetworkStack(const VirtualNetworkStack& o) = delete;
     VirtualNetworkStack(VirtualNetworkStack&& o) = delete;
@@ -21,170 +21,265 @@ Copyright(c) 2020 Futurewei Cloud
     SOFTWARE.
 */
 
-#pragma once
-#include <chrono>
-#include <climits>
-#include <tuple>
-
-// third-party
-#include <seastar/core/distributed.hh>  // for distributed<>
-#include <seastar/core/future.hh>       // for future stuff
-
-#include <k2/appbase/Appbase.h>
-#include <k2/common/Chrono.h>
-#include <k2/dto/MessageVerbs.h>
-#include <k2/dto/TimestampBatch.h>
-
-namespace k2
-{
-
-using namespace dto;
-
-// TSO client lib - providing K2 Timestamp to app
-class TSO_ClientLib
-{
-public:
-    // constructor
-    // startDelay - a delay/sleep duration in start(). This is for testing purpose where the client lib start need to delay waiting for server starts
-    // TODO: instead of pass in TSOServerURL, we need to change later to CPO URL and get URLs of TSO servers from there instead.
-    TSO_ClientLib(Duration startDelay) : _startDelay(startDelay) { K2INFO("ctor");}
-
-    ~TSO_ClientLib() { K2INFO("dtor");}
-
-    seastar::future<> start();
-    seastar::future<> gracefulStop();
-
-    // get the timestamp from TSO (distributed from TSOClient Timestamp batch)
-    seastar::future<Timestamp> GetTimestampFromTSO(const TimePoint& requestLocalTime);
-    // get the timestamp with MTL(Minimum Transaction Latency) - alternatively instead of this new API, consider put MTL inside timestamp.
-    // seastar::future<std::tuple<Timestamp, Duration>> GetTimeStampWithMTLFromTSO(const TimePoint& requestLocalTime);
-
-private:
-
-    // discover TSO server worker cores, populating _curTSOServerWorkerEndPoints, during start() and server change.
-    seastar::future<> DiscoverServerWorkerEndPoints(const k2::String& serverURL);
-
-    seastar::future<TimestampBatch> GetTimestampBatch(uint16_t batchSize);
-
-    // process returned batch from TSO server
-    void ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTriggeredTime);
-
-    ConfigVar<k2::String> TSOServerURL{"tso_endpoint"};
-
-    bool _stopped{false};
-
-    // a vector of TSO servers
-    // TODO: currently just use one, we will use multiple later, with more info like location(local or remote), availability status etc. Also get them from CPO instead.
-    //       the CPO should give the list of TSO servers in preference order in the vector.
-    std::vector<k2::String> _tSOServerURLs;
-
-    // all URLs of workers of current TSO server
-    std::vector<k2::TXEndpoint> _curTSOServerWorkerEndPoints;
-    size_t _curWorkerIdx{0};
-
-    // For debugging and verification purpose, as we are processing request with steady clock, use this to verify
-    // the requet we see are always coming in with bigger value steady clock.
-    TimePoint _lastSeenRequestTime{};
-
-    // For correctness verification purpose, we keep track of the latest _triggeredTime of the batches whenever we issued timestamp from a (new) batch
-    // So that if an out-of-order old batch comes in, we will discard it.
-    TimePoint _lastIssuedBatchTriggeredTime;
-
-    // startDelay - a delay/sleep duration in start(). This is for testing purpose where the client lib start need to delay waiting for server starts
-    Duration _startDelay;
-
-    // info about queued request that is promised but not yet fulfilled
-    struct ClientRequest
-    {
-        TimePoint   _requestTime;
-        seastar::lw_shared_ptr<seastar::promise<Timestamp>> _promise;       // promise for this client request
-        bool        _triggeredBatchRequest{false};  // if this client request tirggered a batch request to TSO server
-    };
-
-
-
-    // returned available timestamp batch
-    struct TimestampBatchInfo
-    {
-        TimestampBatch _batch;
-        bool _isAvailable{false};   // if this issued batch is already fulfilled.
-        uint8_t _usedCount{0};
-        TimePoint _triggeredTime; // triggered time for this batch, any other later client request comes in before this value + batch TTL could be fulfilled by this batch timewise.
-        uint16_t    _expectedBatchSize{0}; // the count of timestamp in triggered/not returned batch request, used for estimate. The TSO server may return less amount of TS
-        uint16_t    _expectedTTL{0};       // in nanosecond, estimated TTL in triggered/not returned batch request. The TSO server control the value, returned in _batch.
-        bool _isTriggeredByReplacement{false};   // when timestamp batch request was triggerred by replacment for the TSBatch that is returned out of order and discarded
-
-        const TimePoint ExpirationTime()
-        {
-            K2ASSERT(_isAvailable, "Doesn't support ExpirationTime on unavailable TimestampBatch as true TTL from server is not available.");
-
-            std::chrono::nanoseconds TTL(_batch.TTLNanoSec);
-
-            return _triggeredTime + TTL;
-        }
-
-        const TimePoint ExpectedExpirationTime()
-        {
-            std::chrono::nanoseconds TTL(_expectedTTL);
-
-            return _triggeredTime + TTL;
-        }
-    };
-
-    // Design Notes on matching incoming client request and outgoing batch request to TSO server
-    // 1. Client side issues request to get timestamp one by one, but TSOClientLib as proxy and get timestamp batch from TSO server.
-    //    Sometime there are pending client requests waiting for batch result to fulfill, sometimes there are left over Timestamp from returned batch(s).
-    //    Thus, we have two deques,  _pendingClientRequest and _timestampBatchQueue to hold the info.
-    // 2. Client request comes in with request time(steady clock) in order and will be only fulfilled in order as well.
-    // 3. timestamp batch coming back from TSO server(s) could be out of order occasionly, we will discard the older batch if we already start to issue timestam from newer batch
-    //    When such discard happens, we may need to issue another replacment batch request to TSO server.
-    //    Also, there is case the TSO server may return a batch with less amount of timestamps that we requested,
-    //    in this case, we will issue a Replacement batch request as well with current time as triggerred time.
-    // 4. TimestampBatch has TTL, if the client side request fits in the TTL, the request can be fulfilled with Timestamp from the batch.
-    //    Obey the TTL is critical to guarantee (external) causal consistency in 3SI protocol. Detailed analysis is available in TSO design spec.
-    // 5. When a client request comes in, if there is no other pending client request and no batch available,
-    //    a batch request will be issued to TSO server asynchonously with its placeholder entry inserted into _timestampBatchQue and ClientRequest for this request is added into _pendingClientRequest
-    //    and the future of ClientRequest._promise is returned to the client, which will be fulfilled later when the batch returned.
-    // 6. when a client request comes in, if there is previous pending client request and no batch available,
-    //    we need to check if this client request could be fulfilled with latest outgoing batch request, there are two conditions for this
-    //          a) Time - if this client request time fits in batch TTL + the time of the last pending client request,
-    //          b) Count - total pending requests matched to this batch is less than the expected expetedBatchSize.
-    //    if this client request could not be fulfilled with existing pending batch request, a new batch request to TSO server need to be issued.
-    // 7. When a batch returned from TSO server, we will first check if we should dicard the batch to make sure we can use it. We will discard these out of order batch in two cases
-    //          a) its _triggeredTime is smaller(older) than the batch we already issued timstamp from.
-    //          b) Its _triggeredTime + TTL is smaller (order) than minimal timepoint bar, which is either current time or the request time of the first pending client request.
-    //    If it is not discarded, we will  into the _timestampBatchQue matching its _triggeredTime(normally should be head if not out of order).
-    //    Then, if there is any entry in _pendingClientRequest, we will try to fufill the client request. The logic is following
-    //          a) remove all obsolete head entries from _timestampBatchAvailable, i.e. those has _timestampBatchAvailable + TTL that is less than _pendingClientRequest's head's request time
-    //          b) for all available/ready enties in _timestampBatchQue, we fulfill the pending request in time order with TTL varification. If during the process,
-    //            an unavailable batch encountered(with a newer available batch already arrived), the unavailable batch entry will be discarded and replacment batch
-    //            request will be issued, as we want to aggressively fulfil the client request as quickly as possible.
-    //            (NOTE: maybe wait a limited amount of time if two batch triggered time are very close, for optimization. So far feels no need due to cost of wait
-    //             and low chance of such out of order issue. We should evalue this again with real life cases)
-    // 8. When a client request comes in, if there is batches available in _timestampBatchQue, try to issue timestamp from availalbe batch. If these batches are obsolete,
-    //    discard them from _timestampBatchQue and issue new batch request asynchronously.
-
-    std::deque<ClientRequest>  _pendingClientRequests;
-    std::deque<TimestampBatchInfo> _timestampBatchQue;
-};
-
-class TimeStampRequestOutOfOrderException : public std::exception {
-    public:
-    TimeStampRequestOutOfOrderException(uint64_t requestTime, uint64_t lastSeenRequestTime)
-        : _requestTime(requestTime), _lastSeenRequestTime(lastSeenRequestTime) {};
-
-    private:
-    virtual const char* what() const noexcept override { return "requestLocalTime is older than _lastSeenRequestTime "; }
-
-    uint64_t _requestTime;
-    uint64_t _lastSeenRequestTime;
-};
-
-// operations invalid during server shutdown
-class TSOClientLibShutdownException : public std::exception {
-    private:
-    virtual const char* what() const noexcept override { return "TSO ClientLib shuts down."; }
-};
-
-
-}
+#pragma once
+#include <chrono>
+#include <climits>
+#include <optional>
+#include <tuple>
+
+// third-party
+#include <seastar/core/distributed.hh>  // for distributed<>
+#include <seastar/core/future.hh>       // for future stuff
+#include <seastar/core/shared_future.hh>
+
+#include <k2/appbase/Appbase.h>
+#include <k2/common/Chrono.h>
+#include <k2/common/LatencyTracker.h>
+#include <k2/dto/MessageVerbs.h>
+#include <k2/dto/TimestampBatch.h>
+
+namespace k2
+{
+
+using namespace dto;
+
+// TSO client lib - providing K2 Timestamp to app
+class TSO_ClientLib
+{
+public:
+    // constructor
+    // startDelay - a delay/sleep duration in start(). This is for testing purpose where the client lib start need to delay waiting for server starts
+    // TODO: instead of pass in TSOServerURL, we need to change later to CPO URL and get URLs of TSO servers from there instead.
+    TSO_ClientLib(Duration startDelay) : _startDelay(startDelay) { K2INFO("ctor");}
+
+    ~TSO_ClientLib() { K2INFO("dtor");}
+
+    seastar::future<> start();
+    seastar::future<> gracefulStop();
+
+    // get the timestamp from TSO (distributed from TSOClient Timestamp batch)
+    seastar::future<Timestamp> GetTimestampFromTSO(const TimePoint& requestLocalTime);
+    // get the timestamp with MTL(Minimum Transaction Latency) - alternatively instead of this new API, consider put MTL inside timestamp.
+    // seastar::future<std::tuple<Timestamp, Duration>> GetTimeStampWithMTLFromTSO(const TimePoint& requestLocalTime);
+
+private:
+
+    // discover TSO server worker cores, populating _curTSOServerWorkerEndPoints, during start() and server change.
+    seastar::future<> DiscoverServerWorkerEndPoints(const k2::String& serverURL);
+
+    // check with all known TSO servers in order and discover the workers of the one confirming itself as master.
+    // retry every _failoverRetryInterval, as the standby may take a lease period to take over, until timeout.
+    seastar::future<> FindMasterServer(Duration timeout);
+    // ask the TSO server if it is the master
+    seastar::future<bool> IsMasterServer(const k2::String& serverURL);
+    // when current TSO server fails, find the new master. Concurrent failed batch requests share the same failover.
+    seastar::future<> FailoverTSOServer();
+
+    // timeouts derived from _masterLease, so that we don't spend longer than a lease on a server before failing over
+    Duration MasterCheckTimeout();
+    Duration BatchRequestStartTimeout();
+
+    // get a batch from current TSO server, failover to other TSO server and retry once if failed.
+    seastar::future<TimestampBatch> GetTimestampBatch(uint16_t batchSize);
+    seastar::future<TimestampBatch> GetTimestampBatchFromCurrentServer(uint16_t batchSize);
+
+    // process returned batch from TSO server
+    void ProcessReturnedBatch(TimestampBatch batch, TimePoint batchTriggeredTime);
+
+    // insert the placeholder entry for a new outgoing batch request into _timestampBatchQue and send the request to TSO server asynchronously
+    void IssueBatchRequest(TimePoint triggeredTime, uint16_t batchSize, bool isTriggeredByReplacement, bool isPrefetch);
+
+    // check the request rate against the remaining timestamps/TTL of available batches and issue a prefetch batch request if
+    // the available batches are expected to be used up or expire before a new batch could come back.
+    void CheckAndPrefetch();
+
+    // update the moving averages used by prefetch decision
+    void UpdateRequestRate(const TimePoint& requestLocalTime);
+    void UpdateBatchRTT(Duration rtt);
+
+    void registerMetrics();
+
+    ConfigVar<k2::String> TSOServerURL{"tso_endpoint"};
+    // other TSO server instances of the cluster, for failover
+    ConfigVar<std::vector<k2::String>> _standbyServerURLs{"tso_standby_endpoints"};
+    // max time to find a new master TSO server when current one fails, should be longer than the TSO master lease
+    ConfigDuration _failoverTimeout{"tso_client_failover_timeout", 1s};
+    ConfigDuration _failoverRetryInterval{"tso_client_failover_retry_interval", 5ms};
+    ConfigVar<uint16_t> _minBatchSize{"tso_client_min_batch_size", 4};
+    ConfigVar<uint16_t> _maxBatchSize{"tso_client_max_batch_size", 512};
+    // if true, issue the next batch request before available batches are used up or expire, based on observed request rate and batch RTT
+    ConfigVar<bool> _prefetchEnabled{"tso_client_prefetch", true};
+    // extra time ahead of the expected batch RTT to start prefetching
+    ConfigDuration _prefetchMargin{"tso_client_prefetch_margin", 2us};
+    // if true, the timeout of batch requests is derived from the observed batch RTT(multiplier x p99),
+    // but no less than the min timeout and no more than the fixed starting timeout
+    ConfigVar<bool> _adaptiveTimeout{"tso_client_adaptive_timeout", false};
+    ConfigVar<double> _timeoutMultiplier{"tso_client_timeout_multiplier", 4.0};
+    ConfigDuration _minTimeout{"tso_client_min_timeout", 100us};
+    // the TSO master lease, which should match the TSO servers' (3 heartbeats + 1ms, 31ms by default). A standby can take over once
+    // the master's lease expires, so batch requests to a server, including retries, give up within a lease and fail over
+    ConfigDuration _masterLease{"tso_client_master_lease", 31ms};
+    // how many times a batch request is tried on current TSO server before failing over
+    ConfigVar<int> _batchRetries{"tso_client_batch_retries", 2};
+    // timeout of asking a TSO server if it is the master during failover, capped at the master lease
+    ConfigDuration _masterCheckTimeout{"tso_client_master_check_timeout", 10ms};
+
+    bool _stopped{false};
+
+    // a vector of TSO servers, tso_endpoint followed by tso_standby_endpoints
+    // TODO: add more info like location(local or remote), availability status etc. Also get them from CPO instead.
+    //       the CPO should give the list of TSO servers in preference order in the vector.
+    std::vector<k2::String> _tSOServerURLs;
+    // index of current(master) TSO server in _tSOServerURLs
+    size_t _curTSOServerIdx{0};
+    // the ongoing failover, if any
+    std::optional<seastar::shared_future<>> _failoverFuture;
+
+    // all URLs of workers of current TSO server
+    std::vector<k2::TXEndpoint> _curTSOServerWorkerEndPoints;
+    size_t _curWorkerIdx{0};
+
+    // For debugging and verification purpose, as we are processing request with steady clock, use this to verify
+    // the requet we see are always coming in with bigger value steady clock.
+    TimePoint _lastSeenRequestTime{};
+
+    // For correctness verification purpose, we keep track of the latest _triggeredTime of the batches whenever we issued timestamp from a (new) batch
+    // So that if an out-of-order old batch comes in, we will discard it.
+    TimePoint _lastIssuedBatchTriggeredTime;
+
+    // startDelay - a delay/sleep duration in start(). This is for testing purpose where the client lib start need to delay waiting for server starts
+    Duration _startDelay;
+
+    // exponential moving averages(in nanoseconds) of client request inter-arrival time and batch request round trip time, used for prefetch
+    // the TTL is the last one returned from the server, which controls it.
+    static constexpr double EWMAWeight{0.125};
+    double _requestIntervalEWMA{0};
+    double _batchRTTEWMA{0};
+    // round trip times of recent batch request attempts, used to derive the batch request timeout. Attempts which
+    // time out are recorded as taking the timeout
+    LatencyTracker _batchRTT;
+    uint32_t _lastBatchTTL{8000};
+
+    // metrics
+    sm::metric_groups _metric_groups;
+    uint64_t _totalRequests{0};
+    uint64_t _immediateRequests{0};   // requests fulfilled without waiting for a batch from TSO server
+    uint64_t _batchRequests{0};
+    uint64_t _prefetchRequests{0};
+    uint64_t _discardedBatches{0};
+    uint64_t _failovers{0};
+
+    // info about queued request that is promised but not yet fulfilled
+    struct ClientRequest
+    {
+        TimePoint   _requestTime;
+        seastar::lw_shared_ptr<seastar::promise<Timestamp>> _promise;       // promise for this client request
+        bool        _triggeredBatchRequest{false};  // if this client request tirggered a batch request to TSO server
+    };
+
+
+
+    // returned available timestamp batch
+    struct TimestampBatchInfo
+    {
+        TimestampBatch _batch;
+        bool _isAvailable{false};   // if this issued batch is already fulfilled.
+        uint16_t _usedCount{0};
+        TimePoint _triggeredTime; // triggered time for this batch, any other later client request comes in before this value + batch TTL could be fulfilled by this batch timewise.
+        uint16_t    _expectedBatchSize{0}; // the count of timestamp in triggered/not returned batch request, used for estimate. The TSO server may return less amount of TS
+        uint32_t    _expectedTTL{0};       // in nanosecond, estimated TTL in triggered/not returned batch request. The TSO server control the value, returned in _batch.
+        bool _isTriggeredByReplacement{false};   // when timestamp batch request was triggerred by replacment for the TSBatch that is returned out of order and discarded
+        bool _isPrefetch{false};    // when timestamp batch request was triggered ahead of time by prefetch, not by a client request
+
+        const TimePoint ExpirationTime()
+        {
+            K2ASSERT(_isAvailable, "Doesn't support ExpirationTime on unavailable TimestampBatch as true TTL from server is not available.");
+
+            std::chrono::nanoseconds TTL(_batch.TTLNanoSec);
+
+            return _triggeredTime + TTL;
+        }
+
+        const TimePoint ExpectedExpirationTime()
+        {
+            std::chrono::nanoseconds TTL(_expectedTTL);
+
+            return _triggeredTime + TTL;
+        }
+    };
+
+    // Design Notes on matching incoming client request and outgoing batch request to TSO server
+    // 1. Client side issues request to get timestamp one by one, but TSOClientLib as proxy and get timestamp batch from TSO server.
+    //    Sometime there are pending client requests waiting for batch result to fulfill, sometimes there are left over Timestamp from returned batch(s).
+    //    Thus, we have two deques,  _pendingClientRequest and _timestampBatchQueue to hold the info.
+    // 2. Client request comes in with request time(steady clock) in order and will be only fulfilled in order as well.
+    // 3. timestamp batch coming back from TSO server(s) could be out of order occasionly, we will discard the older batch if we already start to issue timestam from newer batch
+    //    When such discard happens, we may need to issue another replacment batch request to TSO server.
+    //    Also, there is case the TSO server may return a batch with less amount of timestamps that we requested,
+    //    in this case, we will issue a Replacement batch request as well with current time as triggerred time.
+    // 4. TimestampBatch has TTL, if the client side request fits in the TTL, the request can be fulfilled with Timestamp from the batch.
+    //    Obey the TTL is critical to guarantee (external) causal consistency in 3SI protocol. Detailed analysis is available in TSO design spec.
+    // 5. When a client request comes in, if there is no other pending client request and no batch available,
+    //    a batch request will be issued to TSO server asynchonously with its placeholder entry inserted into _timestampBatchQue and ClientRequest for this request is added into _pendingClientRequest
+    //    and the future of ClientRequest._promise is returned to the client, which will be fulfilled later when the batch returned.
+    // 6. when a client request comes in, if there is previous pending client request and no batch available,
+    //    we need to check if this client request could be fulfilled with latest outgoing batch request, there are two conditions for this
+    //          a) Time - if this client request time fits in batch TTL + the time of the last pending client request,
+    //          b) Count - total pending requests matched to this batch is less than the expected expetedBatchSize.
+    //    if this client request could not be fulfilled with existing pending batch request, a new batch request to TSO server need to be issued.
+    // 7. When a batch returned from TSO server, we will first check if we should dicard the batch to make sure we can use it. We will discard these out of order batch in two cases
+    //          a) its _triggeredTime is smaller(older) than the batch we already issued timstamp from.
+    //          b) Its _triggeredTime + TTL is smaller (order) than minimal timepoint bar, which is either current time or the request time of the first pending client request.
+    //    If it is not discarded, we will  into the _timestampBatchQue matching its _triggeredTime(normally should be head if not out of order).
+    //    Then, if there is any entry in _pendingClientRequest, we will try to fufill the client request. The logic is following
+    //          a) remove all obsolete head entries from _timestampBatchAvailable, i.e. those has _timestampBatchAvailable + TTL that is less than _pendingClientRequest's head's request time
+    //          b) for all available/ready enties in _timestampBatchQue, we fulfill the pending request in time order with TTL varification. If during the process,
+    //            an unavailable batch encountered(with a newer available batch already arrived), the unavailable batch entry will be discarded and replacment batch
+    //            request will be issued, as we want to aggressively fulfil the client request as quickly as possible.
+    //            (NOTE: maybe wait a limited amount of time if two batch triggered time are very close, for optimization. So far feels no need due to cost of wait
+    //             and low chance of such out of order issue. We should evalue this again with real life cases)
+    // 8. When a client request comes in, if there is batches available in _timestampBatchQue, try to issue timestamp from availalbe batch. If these batches are obsolete,
+    //    discard them from _timestampBatchQue and issue new batch request asynchronously.
+    // 9. Prefetch - after a timestamp is issued or a batch is returned and there is no pending client request nor outgoing batch request, we estimate how many
+    //    client requests will come in within one batch round trip time(plus a margin) from the moving average of request inter-arrival time. If the left over
+    //    timestamps in available batches are not enough, or the last available batch will expire within that time, a prefetch batch request is issued with
+    //    current time as triggered time. So an available batch may be followed by an outgoing(prefetch) batch in _timestampBatchQue, but an outgoing batch
+    //    is never followed by an available batch. The prefetch batch size is the expected number of client requests within the batch TTL, clamped to
+    //    [tso_client_min_batch_size, tso_client_max_batch_size]. Prefetch is skipped when the client is idle, i.e. expected next request is beyond the TTL.
+
+    std::deque<ClientRequest>  _pendingClientRequests;
+    std::deque<TimestampBatchInfo> _timestampBatchQue;
+};
+
+class TimeStampRequestOutOfOrderException : public std::exception {
+    public:
+    TimeStampRequestOutOfOrderException(uint64_t requestTime, uint64_t lastSeenRequestTime)
+        : _requestTime(requestTime), _lastSeenRequestTime(lastSeenRequestTime) {};
+
+    private:
+    virtual const char* what() const noexcept override { return "requestLocalTime is older than _lastSeenRequestTime "; }
+
+    uint64_t _requestTime;
+    uint64_t _lastSeenRequestTime;
+};
+
+// none of the known TSO servers confirms itself as master
+class TSONoMasterServerException : public std::exception {
+    private:
+    virtual const char* what() const noexcept override { return "No master TSO server found."; }
+};
+
+// the TSO worker can't serve the request, e.g. it is stopping. It replies empty in place of S503_Service_Unavailable
+class TSOServiceUnavailableException : public std::exception {
+    private:
+    virtual const char* what() const noexcept override { return "TSO worker replied service unavailable(503)."; }
+};
+
+// operations invalid during server shutdown
+class TSOClientLibShutdownException : public std::exception {
+    private:
+    virtual const char* what() const noexcept override { return "TSO ClientLib shuts down."; }
+};
+
+
+}
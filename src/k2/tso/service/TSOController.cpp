@@ -22,6 +22,7 @@ Copyright(c) 2020 Futurewei Cloud
 */
 
 #include <algorithm>    // std::min/max
+#include <limits>
 #include <tuple>
 
 #include <boost/range/irange.hpp>
@@ -45,7 +46,15 @@ seastar::future<> TSOService::TSOController::start()
     // TODO: handle exception
     return InitializeInternal()
         .then([this] () mutable {return JoinServerCluster();})
-        .then([this] (std::tuple<bool, uint64_t> joinResult) mutable { return SetRoleInternal(std::get<0>(joinResult), std::get<1>(joinResult)); })
+        .then([this] (std::tuple<bool, uint64_t> joinResult) mutable {
+            if (!std::get<0>(joinResult))
+            {
+                // workers are initialized as not ready to issue timestamp, nothing to change for standby
+                K2INFO("Joined as standby, master is:" << _masterInstanceURL);
+                return seastar::make_ready_future<>();
+            }
+            return SetRoleInternal(true, std::get<1>(joinResult));
+        })
         .then([this] () mutable {
             // set timers
             _heartBeatTimer.arm(_heartBeatTimerInterval());
@@ -97,14 +106,21 @@ seastar::future<> TSOService::TSOController::InitializeInternal()
 
 void TSOService::TSOController::InitWorkerControlInfo()
 {
+    // TsDelta is 16 bit, cap the window instead of letting it be truncated
+    uint64_t windowNanoSec = std::min<uint64_t>(nsec(_defaultTBWindowSize()).count(), std::numeric_limits<uint16_t>::max());
+    if (windowNanoSec < (uint64_t)nsec(_defaultTBWindowSize()).count())
+    {
+        K2WARN("tso.ctrol_ts_batch_win_size " << _defaultTBWindowSize() << " is too large, using " << windowNanoSec << "ns");
+    }
+
     // initialize TSOWorkerControlInfo
     _lastSentControlInfo.TBENanoSecStep =   seastar::smp::count - 1;            // same as number of worker cores
-    _lastSentControlInfo.TsDelta =          _defaultTBWindowSize().count();     // uncertain window size of timestamp from the batch is also default _defaultTBWindowSize
-    _lastSentControlInfo.BatchTTL =         _defaultTBWindowSize().count();     // batch's TTL is also _defaultTBWindowSize
+    _lastSentControlInfo.TsDelta =          windowNanoSec;                      // uncertain window size of timestamp from the batch is also default _defaultTBWindowSize
+    _lastSentControlInfo.BatchTTL =         windowNanoSec;                      // batch's TTL is also _defaultTBWindowSize
 
     _controlInfoToSend.TBENanoSecStep =     seastar::smp::count - 1;            
-    _controlInfoToSend.TsDelta =            _defaultTBWindowSize().count();
-    _controlInfoToSend.BatchTTL =           _defaultTBWindowSize().count();
+    _controlInfoToSend.TsDelta =            windowNanoSec;
+    _controlInfoToSend.BatchTTL =           windowNanoSec;
 }
 
 seastar::future<> TSOService::TSOController::GetAllWorkerURLs()
@@ -196,12 +212,144 @@ seastar::future<> TSOService::TSOController::SetRoleInternal(bool isMaster, uint
     }
 };
 
+seastar::future<std::tuple<bool, uint64_t>> TSOService::TSOController::JoinServerCluster()
+{
+    K2INFO("JoinServerCluster");
+    _myURL = k2::RPC().getServerEndpoint(k2::TCPRPCProtocol::proto)->getURL();
+    // a write which can't get the store's lock within a heartbeat is retried by the next heartbeat
+    _leaseStore = TSOLeaseStore::Create(_leaseStorePath(), _heartBeatTimerInterval());
+
+    return _leaseStore->Read()
+        .then([this] (TSOLeaseRecord&& record) mutable {
+            _leaseRecord = std::move(record);
+            return TryAcquireMasterLease();
+        });
+}
+
+seastar::future<std::tuple<bool, uint64_t>> TSOService::TSOController::TryAcquireMasterLease()
+{
+    // a live master with different URL holds the master role. If it is our own URL, it is our previous life(before restart) and we can take it over directly.
+    if (_leaseRecord.HasLiveMaster(TimeAuthorityNow()) && _leaseRecord.MasterURL != _myURL)
+    {
+        _masterInstanceURL = _leaseRecord.MasterURL;
+        return seastar::make_ready_future<std::tuple<bool, uint64_t>>(std::make_tuple(false, 0));
+    }
+
+    // the previous master may have issued timestamps up to its ReservedTimeShreshold, which we need to wait out.
+    // Keep it in the record till our heartbeat extends it.
+    uint64_t prevReservedTimeShreshold = _leaseRecord.ReservedTimeShreshold;
+    TSOLeaseRecord newRecord = _leaseRecord;
+    newRecord.MasterTSOId = _outer.TSOId();
+    newRecord.MasterURL = _myURL;
+    newRecord.LeaseExpiry = GenNewLeaseVal();
+
+    return _leaseStore->ConditionalWrite(_leaseRecord.Version, std::move(newRecord))
+        .then([this, prevReservedTimeShreshold] (std::tuple<bool, TSOLeaseRecord>&& result) mutable {
+            auto& [success, record] = result;
+            _leaseRecord = std::move(record);
+            _masterInstanceURL = _leaseRecord.MasterURL;
+            if (success)
+            {
+                _myLease = _leaseRecord.LeaseExpiry;
+                K2INFO("Acquired master lease. TSOId:" << _leaseRecord.MasterTSOId << " lease:" << _myLease << " prevReservedTimeShreshold:" << prevReservedTimeShreshold);
+            }
+            else
+            {
+                K2INFO("Lost the race for master lease to:" << _leaseRecord.MasterURL);
+            }
+
+            return seastar::make_ready_future<std::tuple<bool, uint64_t>>(std::make_tuple(success, success ? prevReservedTimeShreshold : 0));
+        });
+}
+
+seastar::future<> TSOService::TSOController::WriteMasterLease(uint64_t newLease, uint64_t newReservedTimeShreshold)
+{
+    TSOLeaseRecord newRecord = _leaseRecord;
+    newRecord.LeaseExpiry = newLease;
+    // ReservedTimeShreshold never goes backward in the lease store
+    newRecord.ReservedTimeShreshold = std::max(_leaseRecord.ReservedTimeShreshold, newReservedTimeShreshold);
+
+    return _leaseStore->ConditionalWrite(_leaseRecord.Version, std::move(newRecord))
+        .then([this] (std::tuple<bool, TSOLeaseRecord>&& result) mutable {
+            auto& [success, record] = result;
+            _leaseRecord = std::move(record);
+            _masterInstanceURL = _leaseRecord.MasterURL;
+            if (!success)
+            {
+                K2WARN("Master lease is taken by another instance:" << _leaseRecord.MasterURL);
+                return seastar::make_exception_future<>(TSOMasterLeaseLostException());
+            }
+
+            return seastar::make_ready_future<>();
+        });
+}
+
+seastar::future<uint64_t> TSOService::TSOController::RenewLeaseOnly()
+{
+    uint64_t newLease = GenNewLeaseVal();
+    return WriteMasterLease(newLease, _leaseRecord.ReservedTimeShreshold)
+        .then([newLease] () {
+            return seastar::make_ready_future<uint64_t>(newLease);
+        });
+}
+
+seastar::future<std::tuple<uint64_t, uint64_t>> TSOService::TSOController::RenewLeaseAndExtendReservedTimeThreshold()
+{
+    auto extendedLeaseAndThreshold = GenNewLeaseVal();
+    return WriteMasterLease(extendedLeaseAndThreshold, extendedLeaseAndThreshold)
+        .then([extendedLeaseAndThreshold] () {
+            std::tuple<uint64_t, uint64_t> tup(extendedLeaseAndThreshold, extendedLeaseAndThreshold);
+            return seastar::make_ready_future<std::tuple<uint64_t, uint64_t>>(tup);
+        });
+}
+
+seastar::future<> TSOService::TSOController::ReleaseMasterLease()
+{
+    TSOLeaseRecord newRecord = _leaseRecord;
+    newRecord.MasterTSOId = 0;
+    newRecord.MasterURL = "";
+    newRecord.LeaseExpiry = 0;
+
+    return _leaseStore->ConditionalWrite(_leaseRecord.Version, std::move(newRecord))
+        .then([this] (std::tuple<bool, TSOLeaseRecord>&& result) mutable {
+            auto& [success, record] = result;
+            _leaseRecord = std::move(record);
+            _masterInstanceURL = _leaseRecord.MasterURL;
+            K2INFO("Released master lease, success:" << success);
+        })
+        .handle_exception([] (auto exc) {
+            // standby will take over after our lease expires
+            K2WARN_EXC("Failed to release master lease: ", exc);
+        });
+}
+
+seastar::future<> TSOService::TSOController::UpdateStandByHeartBeat()
+{
+    return _leaseStore->Read()
+        .then([this] (TSOLeaseRecord&& record) mutable {
+            _leaseRecord = std::move(record);
+            _masterInstanceURL = _leaseRecord.MasterURL;
+            return TryAcquireMasterLease();
+        })
+        .then([this] (std::tuple<bool, uint64_t> acquireResult) mutable {
+            if (!std::get<0>(acquireResult))
+            {
+                return seastar::make_ready_future<>();
+            }
+
+            K2INFO("Standby takes over master role");
+            return SetRoleInternal(true, std::get<1>(acquireResult));
+        });
+}
+
 void TSOService::TSOController::RegisterGetTSOMasterURL()
 {
     k2::RPC().registerMessageObserver(dto::Verbs:: GET_TSO_MASTERSERVER_URL, [this](k2::Request&& request) mutable
     {
+        // standby replies the master it knows from lease store, so that TSO client can find the master from any instance
         auto response = request.endpoint.newPayload();
-        K2INFO("Master TSO TCP endpoint is: " << _masterInstanceURL);
+        K2DEBUG("Master TSO TCP endpoint is: " << _masterInstanceURL);
+        // the URL is sent as raw bytes without a length prefix, as it always has been, so that existing clients keep working
         response->write((void*)_masterInstanceURL.c_str(), _masterInstanceURL.size());
         k2::RPC().sendReply(std::move(response), request);
     });
@@ -220,6 +368,10 @@ void TSOService::TSOController::RegisterGetTSOWorkersURLs()
 void TSOService::TSOController::HeartBeat()
 {
     _heartBeatFuture = DoHeartBeat()
+        .handle_exception([] (auto exc) {
+            // e.g. lease store is not reachable, keep heartbeating. If we are master and lost lease, SendWorkersControlInfo() will handle it.
+            K2WARN_EXC("HeartBeat failed: ", exc);
+        })
         .then([this] () mutable
         {
             if (!_stopRequested)
@@ -266,7 +418,12 @@ seastar::future<> TSOService::TSOController::DoHeartBeat()
         if (_prevReservedTimeShreshold > curTimeTSECount &&
             (_prevReservedTimeShreshold - curTimeTSECount >= (uint64_t) _heartBeatTimerInterval().count()))
         {
-            return RenewLeaseOnly().then([this](uint64_t newLease) {_myLease = newLease;});
+            return RenewLeaseOnly()
+                .then([this](uint64_t newLease) {_myLease = newLease;})
+                .handle_exception_type([this] (TSOMasterLeaseLostException&) {
+                    // another instance took over the master role, step down
+                    return SetRoleInternal(false, 0);
+                });
         }
 
         // case 4, regular situation, extending lease and ReservedTimeThreshold, then SendWorkersControlInfo
@@ -282,6 +439,10 @@ seastar::future<> TSOService::TSOController::DoHeartBeat()
 
                 // update worker!
                 return SendWorkersControlInfo();
+            })
+            .handle_exception_type([this] (TSOMasterLeaseLostException&) {
+                // another instance took over the master role, step down
+                return SetRoleInternal(false, 0);
             });
     }
     else
@@ -316,8 +477,8 @@ seastar::future<> TSOService::TSOController::DoHeartBeatDuringStop()
         // set no longer master.
         _isMasterInstance = false;
 
-        // remove our lease on Paxos
-        return RemoveLeaseFromPaxos();
+        // remove our lease on lease store
+        return ReleaseMasterLease();
     }
 
     // set _isMasterInstance to false send to workers first to stop issuing timestamp
@@ -330,8 +491,8 @@ seastar::future<> TSOService::TSOController::DoHeartBeatDuringStop()
             //uint64_t newReservedTimeShresholdTSECount = now_nsec_count()
             //    + std::max(_lastSentControlInfo.TBEAdjustment, (uint64_t) _defaultTBWindowSize().count());
 
-            // remove our lease on Paxos and update ReservedTimeShreshold
-            return RemoveLeaseFromPaxosWithUpdatingReservedTimeShreshold(/*newReservedTimeShresholdTSECount*/);
+            // remove our lease on lease store
+            return ReleaseMasterLease();
         });
 }
 
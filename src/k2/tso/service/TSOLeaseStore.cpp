@@ -0,0 +1,197 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <seastar/core/sleep.hh>
+
+#include <k2/common/Log.h>
+#include <k2/transport/PayloadFileUtil.h>
+
+#include "TSOLeaseStore.h"
+
+namespace k2
+{
+
+std::unique_ptr<TSOLeaseStore> TSOLeaseStore::Create(const k2::String& path, Duration lockTimeout)
+{
+    if (path.empty())
+    {
+        K2INFO("Using in process TSO lease store");
+        return std::make_unique<InProcessTSOLeaseStore>();
+    }
+
+    K2INFO("Using file TSO lease store at: " << path);
+    return std::make_unique<FileTSOLeaseStore>(path, lockTimeout);
+}
+
+seastar::future<TSOLeaseRecord> InProcessTSOLeaseStore::Read()
+{
+    return seastar::make_ready_future<TSOLeaseRecord>(_record);
+}
+
+seastar::future<std::tuple<bool, TSOLeaseRecord>> InProcessTSOLeaseStore::ConditionalWrite(uint64_t expectedVersion, TSOLeaseRecord record)
+{
+    bool success = _record.Version == expectedVersion;
+    if (success)
+    {
+        _record = std::move(record);
+        _record.Version = expectedVersion + 1;
+    }
+
+    return seastar::make_ready_future<std::tuple<bool, TSOLeaseRecord>>(std::make_tuple(success, _record));
+}
+
+FileTSOLeaseStore::FileTSOLeaseStore(k2::String path, Duration lockTimeout) :
+    _path(std::move(path)), _lockPath(_path + ".lock"), _lockTimeout(lockTimeout)
+{
+    // this is the only blocking call of the store, done once when the TSO server joins the cluster
+    _lockFd = ::open(_lockPath.c_str(), O_CREAT | O_RDWR, 0666);
+    if (_lockFd < 0)
+    {
+        K2ERROR("Unable to open TSO lease lock file: " << _lockPath << ", err=" << strerror(errno));
+    }
+}
+
+FileTSOLeaseStore::~FileTSOLeaseStore()
+{
+    if (_lockFd >= 0)
+    {
+        // closing the file also releases the flock
+        ::close(_lockFd);
+    }
+}
+
+seastar::future<TSOLeaseRecord> FileTSOLeaseStore::ReadRecord()
+{
+    return fileutil::fileExistsAsync(_path)
+        .then([this] (bool exists) {
+            if (!exists)
+            {
+                // no one has written the record yet
+                return seastar::make_ready_future<TSOLeaseRecord>();
+            }
+
+            return seastar::do_with(Payload(), [this] (Payload& payload) {
+                return fileutil::readFileAsync(payload, _path)
+                    .then([this, &payload] (bool success) {
+                        TSOLeaseRecord record;
+                        if (!success || !payload.read(record))
+                        {
+                            K2ERROR("Unable to read TSO lease record from: " << _path);
+                            return seastar::make_exception_future<TSOLeaseRecord>(TSOLeaseStoreException("unable to read lease record"));
+                        }
+
+                        return seastar::make_ready_future<TSOLeaseRecord>(std::move(record));
+                    });
+            });
+        });
+}
+
+seastar::future<TSOLeaseRecord> FileTSOLeaseStore::Read()
+{
+    // the record file is always replaced as a whole with rename(), so no need to lock for read
+    return ReadRecord();
+}
+
+seastar::future<> FileTSOLeaseStore::Lock()
+{
+    if (_lockFd < 0)
+    {
+        return seastar::make_exception_future<>(TSOLeaseStoreException("unable to open lease lock file"));
+    }
+
+    auto deadline = Clock::now() + _lockTimeout;
+    return seastar::repeat([this, deadline] {
+        if (::flock(_lockFd, LOCK_EX | LOCK_NB) == 0)
+        {
+            return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+        }
+
+        if (errno != EWOULDBLOCK)
+        {
+            K2ERROR("Unable to lock TSO lease lock file: " << _lockPath << ", err=" << strerror(errno));
+            return seastar::make_exception_future<seastar::stop_iteration>(TSOLeaseStoreException("unable to lock lease lock file"));
+        }
+
+        if (Clock::now() >= deadline)
+        {
+            K2WARN("Timed out waiting for TSO lease lock file: " << _lockPath);
+            return seastar::make_exception_future<seastar::stop_iteration>(TSOLeaseStoreException("timed out locking lease lock file"));
+        }
+
+        // another TSO server instance is writing, which only takes a couple of file operations
+        return seastar::sleep(LockRetryInterval).then([] { return seastar::stop_iteration::no; });
+    });
+}
+
+void FileTSOLeaseStore::Unlock()
+{
+    if (::flock(_lockFd, LOCK_UN) != 0)
+    {
+        K2ERROR("Unable to unlock TSO lease lock file: " << _lockPath << ", err=" << strerror(errno));
+    }
+}
+
+seastar::future<std::tuple<bool, TSOLeaseRecord>> FileTSOLeaseStore::ConditionalWrite(uint64_t expectedVersion, TSOLeaseRecord record)
+{
+    using ResultT = std::tuple<bool, TSOLeaseRecord>;
+
+    return seastar::with_semaphore(_writeSem, 1, [this, expectedVersion, record=std::move(record)] () mutable {
+        return Lock()
+            .then([this, expectedVersion, record=std::move(record)] () mutable {
+                return ReadRecord()
+                    .then([this, expectedVersion, record=std::move(record)] (TSOLeaseRecord&& current) mutable {
+                        if (current.Version != expectedVersion)
+                        {
+                            return seastar::make_ready_future<ResultT>(std::make_tuple(false, std::move(current)));
+                        }
+
+                        record.Version = expectedVersion + 1;
+
+                        // the record is written to a temp file which is renamed over the record file, so that readers never see partially written record
+                        Payload payload([] { return Binary(4096); });
+                        payload.write(record);
+                        return fileutil::writeFileAtomicAsync(std::move(payload), _path)
+                            .then([this, record=std::move(record)] (bool success) mutable {
+                                if (!success)
+                                {
+                                    K2ERROR("Unable to write TSO lease record to: " << _path);
+                                    return seastar::make_exception_future<ResultT>(TSOLeaseStoreException("unable to write lease record"));
+                                }
+
+                                return seastar::make_ready_future<ResultT>(std::make_tuple(true, std::move(record)));
+                            });
+                    })
+                    .finally([this] {
+                        Unlock();
+                    });
+            });
+    });
+}
+
+}
@@ -0,0 +1,131 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#pragma once
+#include <memory>
+#include <tuple>
+
+// third-party
+#include <seastar/core/future.hh>       // for future stuff
+#include <seastar/core/semaphore.hh>
+
+#include <k2/common/Common.h>
+#include <k2/transport/PayloadSerialization.h>
+
+namespace k2
+{
+
+// The master lease record of a TSO cluster, shared by all TSO server instances of the cluster through TSOLeaseStore.
+// All time values are TA(Time Authority) nanosec counts.
+struct TSOLeaseRecord
+{
+    uint64_t    Version{0};                 // increased by one with each successful write, used for conditional write
+    uint32_t    MasterTSOId{0};             // TSOId of current master instance, 0 if there is none
+    k2::String  MasterURL;                  // controller TCP URL of current master instance, empty if there is none
+    uint64_t    LeaseExpiry{0};             // master's lease, any instance can take the master role after this time
+    uint64_t    ReservedTimeShreshold{0};   // ReservedTimeShreshold granted to masters so far, a new master need to wait out this time before issuing timestamps
+
+    // if there is a master with a valid lease at the given time
+    bool HasLiveMaster(uint64_t curTimeTSECount) const { return !MasterURL.empty() && LeaseExpiry >= curTimeTSECount; }
+
+    K2_PAYLOAD_FIELDS(Version, MasterTSOId, MasterURL, LeaseExpiry, ReservedTimeShreshold);
+};
+
+// TSOLeaseStore - the consensus service(Paxos) the TSO controllers compete for master role and maintain master lease with.
+// Only a single record with conditional write is needed, so that it can be easily backed by different implementations.
+// TODO: add the Paxos backed implementation through TSOInternalVerbs.
+class TSOLeaseStore
+{
+public:
+    virtual ~TSOLeaseStore() {}
+
+    // read current lease record
+    virtual seastar::future<TSOLeaseRecord> Read() = 0;
+
+    // write the record if the stored record's Version is still expectedVersion, the written record has Version expectedVersion + 1
+    // return tuple
+    //  - element 0 - if the write succeeded.
+    //  - element 1 - the stored record after this call, i.e. the written record if succeeded, or current record if not.
+    virtual seastar::future<std::tuple<bool, TSOLeaseRecord>> ConditionalWrite(uint64_t expectedVersion, TSOLeaseRecord record) = 0;
+
+    // create the lease store. If path is empty, an in process store is created, which is only good for single TSO server instance.
+    // Otherwise a file based store at the path is created, which can be shared by multiple TSO server instances on same host or a shared file system.
+    // A conditional write to the file based store fails if it can't get the write lock within lockTimeout.
+    static std::unique_ptr<TSOLeaseStore> Create(const k2::String& path, Duration lockTimeout);
+};
+
+// lease store in memory of this process
+class InProcessTSOLeaseStore : public TSOLeaseStore
+{
+public:
+    seastar::future<TSOLeaseRecord> Read() override;
+    seastar::future<std::tuple<bool, TSOLeaseRecord>> ConditionalWrite(uint64_t expectedVersion, TSOLeaseRecord record) override;
+
+private:
+    TSOLeaseRecord _record;
+};
+
+// lease store in a local file, a stand-in of Paxos for multiple TSO server instances.
+// Conditional write is serialized by flock() on a lock file next to the record file, and the record file is replaced atomically with rename().
+// The record file is read and written with seastar's file API. The lock file is opened once when the store is created and flock() is only
+// tried without blocking, so none of the operations block the reactor.
+class FileTSOLeaseStore : public TSOLeaseStore
+{
+public:
+    FileTSOLeaseStore(k2::String path, Duration lockTimeout);
+    ~FileTSOLeaseStore();
+
+    seastar::future<TSOLeaseRecord> Read() override;
+    seastar::future<std::tuple<bool, TSOLeaseRecord>> ConditionalWrite(uint64_t expectedVersion, TSOLeaseRecord record) override;
+
+private:
+    // read the record from file, a missing file is an empty record.
+    seastar::future<TSOLeaseRecord> ReadRecord();
+
+    // take the lock file's flock(), polling until lockTimeout
+    seastar::future<> Lock();
+    void Unlock();
+
+    static constexpr Duration LockRetryInterval{100us};
+
+    k2::String _path;
+    k2::String _lockPath;
+    Duration _lockTimeout;
+    // -1 if the lock file couldn't be opened
+    int _lockFd{-1};
+    // flock() is held per open file and so doesn't serialize the writes of this process, which all use _lockFd
+    seastar::semaphore _writeSem{1};
+};
+
+// the lease store is not reachable or failed to process the request
+class TSOLeaseStoreException : public std::exception {
+    public:
+    TSOLeaseStoreException(k2::String reason) : _reason(std::move(reason)) {};
+
+    private:
+    virtual const char* what() const noexcept override { return _reason.c_str(); }
+
+    k2::String _reason;
+};
+
+}
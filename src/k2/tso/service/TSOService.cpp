@@ -21,6 +21,8 @@ Copyright(c) 2020 Futurewei Cloud
     SOFTWARE.
 */
 
+#include <random>
+
 #include "seastar/core/sleep.hh"
 
 #include <k2/common/Log.h>
@@ -85,6 +87,28 @@ seastar::future<> TSOService::start()
     }
 }
 
+uint32_t TSOService::TSOId()
+{
+    if (_tsoId() != 0)
+    {
+        return _tsoId();
+    }
+
+    // a function static is shared by all cores, so they all issue the same id
+    static const uint32_t derivedTSOId = []
+    {
+        std::random_device rd;
+        uint32_t id = 0;
+        while (id == 0)
+        {
+            id = rd();
+        }
+        K2WARN("tso.id is not set, using derived TSOId:" << id);
+        return id;
+    }();
+    return derivedTSOId;
+}
+
 void TSOService::UpdateWorkerControlInfo(const TSOWorkerControlInfo& controlInfo)
 {
     K2ASSERT(seastar::engine().cpu_id() != 0 && _worker != nullptr, "UpdateWorkerControlInfo should be on worker core only!");
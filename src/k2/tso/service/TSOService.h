@@ -24,6 +24,7 @@ Copyright(c) 2020 Futurewei Cloud
 #pragma once
 #include <chrono>
 #include <climits>
+#include <deque>
 #include <tuple>
 
 // third-party
@@ -35,6 +36,8 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/dto/MessageVerbs.h>
 #include <k2/dto/TimestampBatch.h>
 
+#include "TSOLeaseStore.h"
+
 namespace k2
 {
 using namespace dto;
@@ -63,7 +66,7 @@ public: // types
         uint64_t    TBEAdjustment;       // batch ending time adjustment from current chrono::system_clock::now(), in nanoSec;
         uint16_t    TsDelta;                // batch starting time adjustment from TbeTSEAdjustment, basically the uncertainty window size, in nanoSec
         uint64_t    ReservedTimeShreshold;  // reservedTimeShreshold upper bound, the generated batch and TS in it can't be bigger than that, in nanoSec counts
-        uint16_t    BatchTTL;               // TTL of batch issued in nanoseconds, not expected to change once set
+        uint32_t    BatchTTL;               // TTL of batch issued in nanoseconds, not expected to change once set
 
         TSOWorkerControlInfo() : IsReadyToIssueTS(false), TBENanoSecStep(0), TBEAdjustment(0), TsDelta(0), ReservedTimeShreshold(0), BatchTTL(0) {};
     };
@@ -78,8 +81,9 @@ public :  // application lifespan
     seastar::future<> gracefulStop();
     seastar::future<> start();
 
-    //TODO: implement this
-    uint32_t TSOId() {return 1;};
+    // id of this TSO server instance, part of each issued timestamp. This is tso.id, or an id derived once per process
+    // if tso.id isn't set, so that instances started without the flag don't issue timestamps with the same TSOId
+    uint32_t TSOId();
 
     // worker public APIs
     // worker API updating the controlInfo, triggered from controller through SS cross-core communication
@@ -105,6 +109,8 @@ private:
     std::unique_ptr<TSOController> _controller;
     std::unique_ptr<TSOWorker> _worker;
 
+    // 0 means not set
+    ConfigVar<uint32_t> _tsoId{"tso.id", 0};
 };  // class TSOService
 
 // TSOController - core 0 of a TSO server, all other cores are TSOWorkers.
@@ -164,20 +170,15 @@ class TSOService::TSOController
 
     seastar::future<> GetAllWorkerURLs();
 
-    // Join the TSO server cluster during start().
+    // Join the TSO server cluster during start(), i.e. connect to the lease store and try to become master.
     // return tuple
     //  - element 0 - if this instance is a master or not.
     //  - element 1 - prevReservedTimeShreshold if this instance is mater, the value need to be waited out by this master instnace to avoid duplicate timestamp.
-    // TODO: implement this
-    seastar::future<std::tuple<bool, uint64_t>> JoinServerCluster()
-    {
-        K2INFO("JoinServerCluster");
-        // fake new master
-        std::tuple<bool, uint64_t> result(true, 0);
-        _myLease = GenNewLeaseVal();
-        _masterInstanceURL = k2::RPC().getServerEndpoint(k2::TCPRPCProtocol::proto)->getURL();
-        return seastar::make_ready_future<std::tuple<bool, uint64_t>>(result);
-    }
+    seastar::future<std::tuple<bool, uint64_t>> JoinServerCluster();
+
+    // try to take the master role with a conditional write to the lease store, if there is no live master in _leaseRecord.
+    // return same tuple as JoinServerCluster()
+    seastar::future<std::tuple<bool, uint64_t>> TryAcquireMasterLease();
 
     // APIs registration
     // APIs to TSO clients
@@ -238,25 +239,24 @@ class TSOService::TSOController
     void Suicide();
 
 
-    // helpers to talk to Paxos
-    // TODO: Consider role change,
-    // TODO: implement this
-    seastar::future<> RemoveLeaseFromPaxos() {return seastar::make_ready_future<>();}
-    seastar::future<> RemoveLeaseFromPaxosWithUpdatingReservedTimeShreshold(/*uint64_t newReservedTimsShreshold*/) {return seastar::make_ready_future<>();}
-    seastar::future<uint64_t> RenewLeaseOnly() {return seastar::make_ready_future<uint64_t>(GenNewLeaseVal());}
+    // helpers to talk to the lease store
+    // When a master finds out another instance has taken the master role in the lease store, the returned future fails with TSOMasterLeaseLostException.
+
+    // give up master role in lease store when stopping, so that a standby can take over in its next heartbeat instead of waiting the lease out.
+    // ReservedTimeShreshold is kept, the new master still need to wait it out.
+    seastar::future<> ReleaseMasterLease();
+    // return newly extended Lease in nanosec count
+    seastar::future<uint64_t> RenewLeaseOnly();
 
-    // regular heartbeat update to Paxos when not a master
-    seastar::future<> UpdateStandByHeartBeat() {return seastar::make_ready_future<>();}
+    // regular heartbeat update to lease store when not a master, take over master role if master's lease expired
+    seastar::future<> UpdateStandByHeartBeat();
 
-    // regular heartbeat update to Paxos when is a master
+    // regular heartbeat update to lease store when is a master
     // return future contains newly extended Lease and ReservedTimeThreshold in nanosec count
-    seastar::future<std::tuple<uint64_t, uint64_t>>RenewLeaseAndExtendReservedTimeThreshold()
-    {
+    seastar::future<std::tuple<uint64_t, uint64_t>>RenewLeaseAndExtendReservedTimeThreshold();
 
-        auto extendedLeaseAndThreshold = GenNewLeaseVal();
-        std::tuple<uint64_t, uint64_t> tup(extendedLeaseAndThreshold, extendedLeaseAndThreshold);
-        return seastar::make_ready_future<std::tuple<uint64_t, uint64_t>>(tup);
-    }
+    // conditional write of our master lease record with new lease and ReservedTimeShreshold
+    seastar::future<> WriteMasterLease(uint64_t newLease, uint64_t newReservedTimeShreshold);
 
     // (in nanosec counts) Current TA time + three times of heartBeat + 1 extra millisecond to allow missing up to 3 heartbeat before loose leases
     inline uint64_t GenNewLeaseVal() { return TimeAuthorityNow() + _heartBeatTimerInterval().count() * 3 + 1*1000*1000;}
@@ -270,6 +270,15 @@ class TSOService::TSOController
     // URL of current TSO master instance
     k2::String _masterInstanceURL;
 
+    // URL of this instance's controller, what is recorded in the lease store when this is master
+    k2::String _myURL;
+
+    // lease store and the lease record we've seen last time
+    std::unique_ptr<TSOLeaseStore> _leaseStore;
+    TSOLeaseRecord _leaseRecord;
+    // path of the file lease store shared by TSO server instances of the cluster, in process lease store is used if empty
+    ConfigVar<k2::String> _leaseStorePath{"tso.lease_store_path", ""};
+
     // worker cores' URLs, each worker can have mulitple urls
     std::vector<std::vector<k2::String>> _workersURLs;
 
@@ -284,8 +293,8 @@ class TSOService::TSOController
     // and wait out this time if current time is less than this value
     uint64_t _prevReservedTimeShreshold{ULLONG_MAX};
 
-    // Lease at the Paxos, whem this is master, updated by heartbeat.
-    uint64_t _myLease;
+    // Lease at the lease store, whem this is master, updated by heartbeat.
+    uint64_t _myLease{0};
 
     // set when stop() is called
     bool _stopRequested{false};
@@ -307,7 +316,9 @@ class TSOService::TSOController
     // this is the batch uncertainty windows size, should be less than MTL(minimal transaction latency), 
     // this is also used at the TSO client side as batch's TTL(Time To Live)
     // TODO: consider derive this value from MTL configuration.
-    ConfigDuration _defaultTBWindowSize{"tso.ctrol_ts_batch_win_size", 8ms}; 
+    // NOTE: the default used to be 8ms, but TsDelta and BatchTTL were 16 bit nanosecond counts, so it was truncated to 4608ns. 8us keeps
+    // the effective window at the same scale and still fits TsDelta, which is 16 bit.
+    ConfigDuration _defaultTBWindowSize{"tso.ctrol_ts_batch_win_size", 8us};
 
     seastar::timer<> _statsUpdateTimer;
     ConfigDuration _statsUpdateTimerInterval{"tso.ctrol_stats_update_interval", 1s};
@@ -323,7 +334,10 @@ class TSOService::TSOController
 class TSOService::TSOWorker
 {
     public:
-    TSOWorker(TSOService& outer) : _outer(outer){};
+    TSOWorker(TSOService& outer) :
+        _outer(outer),
+        _pauseTimer([this]{this->ResumeWorker();}),
+        _stallProbeTimer([this]{this->ProbeStall();}){};
 
     seastar::future<> gracefulStop();
     seastar::future<> start();
@@ -344,11 +358,16 @@ class TSOService::TSOWorker
     // current worker control info
     TSOWorkerControlInfo _curControlInfo;
 
-    // last request's TBE(Timestamp Batch End) time rounded at microsecond level 
-    uint64_t _lastRequestTBEMicroSecRounded{0};  
-    // count of timestamp issued in last request's timestamp batch 
-    // Note: each worker core can issue up to (1000/TBENanoSecStep) timestamps within same microsecond (at TBE)
-    uint16_t _lastRequestTimeStampCount{0};
+    // last request's TBE(Timestamp Batch End) time rounded at microsecond level, i.e. the microsecond of _lastIssuedTBE
+    uint64_t _lastRequestTBEMicroSecRounded{0};
+    // TBE of the last timestamp issued by this worker core
+    // Note: all TBE issued by a worker core are congruent to (cpu_id - 1) modulo TBENanoSecStep, so that each core can issue up to
+    // about (1000/TBENanoSecStep) timestamps within same microsecond, and a batch can span multiple microseconds without colliding with other cores.
+    uint64_t _lastIssuedTBE{0};
+
+    // max time span of TBE in a single batch, allowing large batches to take timestamps from upcoming microseconds
+    ConfigDuration _maxBatchSpan{"tso.worker_max_batch_span", 10us};
+    uint64_t _maxBatchSpanNanoSec{1000};
 
     // TODO: statistics structure
 
@@ -360,11 +379,62 @@ class TSOService::TSOWorker
     TimestampBatch GetTimestampFromTSO(uint16_t batchSizeRequested);
     // helper function to issue timestamp (or check error situation)
     TimestampBatch GetTimeStampFromTSOLessFrequentHelper(uint16_t batchSizeRequested, uint64_t nowMicroSecRounded);
+    // issue a batch starting at baseTBE with as many timestamps as requested but not beyond lastAllowedTBE
+    TimestampBatch IssueTimestampBatch(uint64_t baseTBE, uint64_t lastAllowedTBE, uint16_t batchSizeRequested);
+    // the first TBE at or after given tbe that belongs to this worker core
+    inline uint64_t AlignTBE(uint64_t tbe)
+    {
+        uint64_t step = _curControlInfo.TBENanoSecStep;
+        return tbe + (seastar::engine().cpu_id() - 1 + step - tbe % step) % step;
+    }
+
+    // issue timestamp batch for the request and send the reply
+    void HandleGetTimestampBatch(uint16_t batchSize, uint8_t wireVersion, k2::Request& request);
 
     // private helper
     // helpers for updateWorkerControlInfo
     void AdjustWorker(const TSOWorkerControlInfo& controlInfo);
 
+    // end the pause started by AdjustWorker(), apply _pendingControlInfo and answer parked requests
+    void ResumeWorker();
+
+    // reply to a timestamp batch request which we can't serve, e.g. when stopping
+    void ReplyUnavailable(k2::Request& request);
+
+    // periodic probe, records how late it runs as reactor stall
+    void ProbeStall();
+
+    // When a controlInfo change requires to wait out some time before issuing more timestamps, the worker is paused without blocking the reactor.
+    // The new controlInfo is kept in _pendingControlInfo and applied when _pauseTimer fires. Timestamp batch requests
+    // coming in during the pause are parked in _parkedRequests and answered in order after resume.
+    struct ParkedRequest
+    {
+        uint16_t batchSize;
+        uint8_t wireVersion;
+        k2::Request request;
+    };
+    bool _isPaused{false};
+    TSOWorkerControlInfo _pendingControlInfo;
+    seastar::timer<> _pauseTimer;
+    TimePoint _pauseStartTime;
+    std::deque<ParkedRequest> _parkedRequests;
+
+    // metrics
+    void registerMetrics();
+    sm::metric_groups _metric_groups;
+    uint64_t _pauseCount{0};
+    uint64_t _pausedNanoSec{0};
+    uint64_t _parkedRequestCount{0};
+    // time this worker core spent in busy wait for the next microsecond, blocking all other tasks on the core
+    uint64_t _busyWaitNanoSec{0};
+    k2::ExponentialHistogram _busyWaitLatency;
+    // reactor stall - how late _stallProbeTimer fires. This covers anything that blocks the core, not only the busy wait above
+    ConfigDuration _stallProbeInterval{"tso.worker_stall_probe_interval", 1ms};
+    seastar::timer<> _stallProbeTimer;
+    TimePoint _stallProbeDeadline;
+    uint64_t _stallNanoSec{0};
+    k2::ExponentialHistogram _stallLatency;
+
 
 };
 
@@ -386,6 +456,12 @@ class TSONotReadyException : public std::exception {
     virtual const char* what() const noexcept override { return "Server not ready to issue timestamp, please retry later."; }
 };
 
+// master finds out another instance has taken the master role in lease store
+class TSOMasterLeaseLostException : public std::exception {
+    private:
+    virtual const char* what() const noexcept override { return "TSO master lease is taken by another instance."; }
+};
+
 // operations invalid during server shutdown
 class TSOShutdownException : public std::exception {
     private:
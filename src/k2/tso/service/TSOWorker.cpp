@@ -38,8 +38,14 @@ namespace k2
 seastar::future<> TSOService::TSOWorker::start()
 {
     _tsoId = _outer.TSOId();
+    // a batch spans at least one microsecond
+    _maxBatchSpanNanoSec = std::max<uint64_t>(nsec(_maxBatchSpan()).count() / 1000 * 1000, 1000);
 
+    registerMetrics();
     RegisterGetTSOTimestampBatch();
+
+    _stallProbeDeadline = Clock::now() + _stallProbeInterval();
+    _stallProbeTimer.arm(_stallProbeInterval());
     return seastar::make_ready_future<>();
 }
 
@@ -47,9 +53,56 @@ seastar::future<> TSOService::TSOWorker::gracefulStop()
 {
     // unregistar all APIs
     RPC().registerMessageObserver(dto::Verbs::GET_TSO_TIMESTAMP_BATCH, nullptr);
+    _pauseTimer.cancel();
+    _stallProbeTimer.cancel();
+    // don't leave the parked requests to time out on the client, tell them right away we're not serving
+    while (!_parkedRequests.empty())
+    {
+        auto parked = std::move(_parkedRequests.front());
+        _parkedRequests.pop_front();
+        ReplyUnavailable(parked.request);
+    }
+    _metric_groups.clear();
     return seastar::make_ready_future<>();
 }
 
+void TSOService::TSOWorker::registerMetrics()
+{
+    _metric_groups.clear();
+    std::vector<sm::label_instance> labels;
+    labels.push_back(sm::label_instance("total_cores", seastar::smp::count));
+
+    _metric_groups.add_group("tso_worker", {
+        sm::make_counter("pause_count", _pauseCount, sm::description("Number of times worker paused issuing timestamp due to control info change"), labels),
+        sm::make_counter("paused_time_ns", _pausedNanoSec, sm::description("Total time in nanoseconds worker paused issuing timestamp"), labels),
+        sm::make_counter("parked_requests", _parkedRequestCount, sm::description("Number of timestamp batch requests parked during pause"), labels),
+        sm::make_counter("busy_wait_ns", _busyWaitNanoSec, sm::description("Total time in nanoseconds the reactor is blocked in busy wait for the next microsecond"), labels),
+        sm::make_histogram("busy_wait", [this]{ return _busyWaitLatency.getHistogram();}, sm::description("Duration of reactor blocking busy waits for the next microsecond"), labels),
+        sm::make_counter("reactor_stall_ns", _stallNanoSec, sm::description("Total time in nanoseconds the reactor ran late, measured by a periodic probe timer"), labels),
+        sm::make_histogram("reactor_stall", [this]{ return _stallLatency.getHistogram();}, sm::description("How late the periodic probe timer ran, i.e. how long the reactor was blocked"), labels)
+    });
+}
+
+void TSOService::TSOWorker::ProbeStall()
+{
+    // any time the reactor spends blocked(e.g. busy waits) delays this timer, so its lateness is the stall
+    auto now = Clock::now();
+    if (now > _stallProbeDeadline)
+    {
+        auto stall = now - _stallProbeDeadline;
+        _stallNanoSec += nsec(stall).count();
+        _stallLatency.add(stall);
+    }
+    _stallProbeDeadline = now + _stallProbeInterval();
+    _stallProbeTimer.arm(_stallProbeInterval());
+}
+
+void TSOService::TSOWorker::ReplyUnavailable(k2::Request& request)
+{
+    // the timestamp batch reply has no status, an empty reply is how the worker says S503_Service_Unavailable
+    k2::RPC().sendReply(request.endpoint.newPayload(), request);
+}
+
 void TSOService::TSOWorker::RegisterGetTSOTimestampBatch()
 {
     k2::RPC().registerMessageObserver(dto::Verbs::GET_TSO_TIMESTAMP_BATCH, [this](k2::Request&& request) mutable
@@ -58,13 +111,22 @@ void TSOService::TSOWorker::RegisterGetTSOTimestampBatch()
         {
             uint16_t batchSize;
             request.payload->read((void*)&batchSize, sizeof(batchSize));
+            // newer clients append the highest TimestampBatch wire version they can read, older ones are version 1
+            uint8_t wireVersion = 1;
+            if (request.payload->getDataRemaining() > 0 && !request.payload->read(wireVersion))
+            {
+                wireVersion = 1;
+            }
+
+            if (_isPaused)
+            {
+                // answer it once the pause is over
+                _parkedRequestCount++;
+                _parkedRequests.push_back(ParkedRequest{batchSize, wireVersion, std::move(request)});
+                return;
+            }
 
-            // TODO: handle exceptions
-            auto response = request.endpoint.newPayload();
-            auto timestampBatch = GetTimestampFromTSO(batchSize);
-            //K2INFO("time stamp batch returned is: " << timestampBatch);
-            response->write(timestampBatch);
-            k2::RPC().sendReply(std::move(response), request);
+            HandleGetTimestampBatch(batchSize, wireVersion, request);
         }
         else
         {
@@ -74,6 +136,17 @@ void TSOService::TSOWorker::RegisterGetTSOTimestampBatch()
     });
 }
 
+void TSOService::TSOWorker::HandleGetTimestampBatch(uint16_t batchSize, uint8_t wireVersion, k2::Request& request)
+{
+    // TODO: handle exceptions
+    auto response = request.endpoint.newPayload();
+    auto timestampBatch = GetTimestampFromTSO(batchSize);
+    timestampBatch.FormatVersion = std::min(wireVersion, TimestampBatch::WireVersion);
+    //K2INFO("time stamp batch returned is: " << timestampBatch);
+    response->write(timestampBatch);
+    k2::RPC().sendReply(std::move(response), request);
+}
+
 void TSOService::TSOWorker::UpdateWorkerControlInfo(const TSOWorkerControlInfo& controlInfo)
 {
     if (_curControlInfo.IsReadyToIssueTS && controlInfo.IsReadyToIssueTS)
@@ -100,7 +173,17 @@ void TSOService::TSOWorker::UpdateWorkerControlInfo(const TSOWorkerControlInfo&
         // step 2/3 stop periodical statistics report task and report last residue statistics
 
         // step 3/3 set controlInfo and start/stop accepting request
-        _curControlInfo = controlInfo;
+        if (_isPaused)
+        {
+            // no need to wait out the pause as we stop issuing timestamp, parked requests will be rejected
+            _pauseTimer.cancel();
+            _pendingControlInfo = controlInfo;
+            ResumeWorker();
+        }
+        else
+        {
+            _curControlInfo = controlInfo;
+        }
     }
     else
     {
@@ -148,6 +231,9 @@ void TSOService::TSOWorker::AdjustWorker(const TSOWorkerControlInfo& controlInfo
     }
 
     // wait out the required pause time if duration since last request is issued is smaller
+    // Note: if the worker is already paused by previous adjustment, no timestamp is issued since then with _curControlInfo,
+    //       so the pause is still computed against _curControlInfo and controlInfo replaces the pending one.
+    uint64_t sleepNanoSecCount = 0;
     if (timeToPauseWorkerNanoSec > 0)
     {
         K2INFO("AdjustWorker: worker core need to sleep(ns)" << std::to_string(timeToPauseWorkerNanoSec));
@@ -156,77 +242,122 @@ void TSOService::TSOWorker::AdjustWorker(const TSOWorkerControlInfo& controlInfo
 
         if ((curTBEMicroSecRounded - timeToPauseWorkerNanoSec) < _lastRequestTBEMicroSecRounded)
         {
-            // TODO: warning if sleep more than 10 microsecond
-            auto sleepNanoSecCount = _lastRequestTBEMicroSecRounded + timeToPauseWorkerNanoSec - curTBEMicroSecRounded;  
-            K2INFO("Due to TSOWorkerControlInfo change, worker core:" << seastar::engine().cpu_id() << " going to sleep "<< sleepNanoSecCount << " nanosec.");
+            sleepNanoSecCount = _lastRequestTBEMicroSecRounded + timeToPauseWorkerNanoSec - curTBEMicroSecRounded;
+            K2INFO("Due to TSOWorkerControlInfo change, worker core:" << seastar::engine().cpu_id() << " going to pause "<< sleepNanoSecCount << " nanosec.");
             if (sleepNanoSecCount >  10 * 1000)
             {
-                K2WARN("TSOWorkerControlInfo change trigger long sleep. Worker core:" << seastar::engine().cpu_id() << " going to sleep "<< sleepNanoSecCount << " nanosec.");
+                K2WARN("TSOWorkerControlInfo change trigger long pause. Worker core:" << seastar::engine().cpu_id() << " going to pause "<< sleepNanoSecCount << " nanosec.");
             }
+        }
+    }
 
-            // busy sleep
-            while ((curTBEMicroSecRounded - timeToPauseWorkerNanoSec) < _lastRequestTBEMicroSecRounded) 
-            {
-                curTBEMicroSecRounded = (now_nsec_count() +  _curControlInfo.TBEAdjustment) / 1000 * 1000;
-            }
+    // step 3/3 set controlInfo and resume, or pause with a timer without blocking the reactor.
+    _pendingControlInfo = controlInfo;
+    _pauseTimer.cancel();
+    if (sleepNanoSecCount == 0)
+    {
+        if (_isPaused)
+        {
+            ResumeWorker();
         }
+        else
+        {
+            _curControlInfo = controlInfo;
+        }
+        return;
     }
 
-    // step 3/3 set controlInfo and resume
-    _curControlInfo =  controlInfo;
-    return;
+    if (!_isPaused)
+    {
+        _isPaused = true;
+        _pauseCount++;
+        _pauseStartTime = Clock::now();
+    }
+    _pauseTimer.arm(std::chrono::nanoseconds(sleepNanoSecCount));
+}
+
+void TSOService::TSOWorker::ResumeWorker()
+{
+    K2ASSERT(_isPaused, "Only resume paused worker");
+    _curControlInfo = _pendingControlInfo;
+    _isPaused = false;
+    _pausedNanoSec += nsec(Clock::now() - _pauseStartTime).count();
+    K2DEBUG("Resume worker core:" << seastar::engine().cpu_id() << " with parked requests:" << _parkedRequests.size());
+
+    // answer parked requests in arrival order
+    while (!_parkedRequests.empty())
+    {
+        auto parked = std::move(_parkedRequests.front());
+        _parkedRequests.pop_front();
+        try
+        {
+            HandleGetTimestampBatch(parked.batchSize, parked.wireVersion, parked.request);
+        }
+        catch (std::exception& exc)
+        {
+            // e.g. the worker is stopped. Reply unavailable instead of letting the request time out
+            K2WARN("Failed to issue timestamp batch for parked request: " << exc.what());
+            ReplyUnavailable(parked.request);
+        }
+    }
 }
 
 // API issuing Timestamp to the TSO client
 TimestampBatch TSOService::TSOWorker::GetTimestampFromTSO(uint16_t batchSizeRequested)
 {
-    TimestampBatch result;
-
     //K2INFO("Start getting a timestamp batch");
 
     // this function is on hotpath, code organized to optimized the most common happy case for efficiency
     // In most of time, it is happy path, where current TBE(Timestamp Batch End) time at microsecond level(curTBEMicroSecRounded) is greater than last call's Timebatch end time
     // i.e. each worker core has one call or less per microsecond
-    // In such case, simply issue timebatch associated with curTBEMicroSecRounded, timestamp counts up to either batchSizeRequested or max allowed from 1 microsec
+    // In such case, simply issue timebatch starting at curTBEMicroSecRounded, timestamp counts up to either batchSizeRequested or max allowed within _maxBatchSpan
     uint64_t curTBEMicroSecRounded = (now_nsec_count() +  _curControlInfo.TBEAdjustment) / 1000 * 1000;
     //K2INFO("Start getting a timestamp batch, got current time.");
 
     // most straightward happy case, fast path
     if (_curControlInfo.IsReadyToIssueTS &&
-        curTBEMicroSecRounded + 1000 < _curControlInfo.ReservedTimeShreshold &&
-        curTBEMicroSecRounded > _lastRequestTBEMicroSecRounded) 
+        curTBEMicroSecRounded + _maxBatchSpanNanoSec < _curControlInfo.ReservedTimeShreshold &&
+        curTBEMicroSecRounded > _lastRequestTBEMicroSecRounded)
     {
-        uint16_t batchSizeToIssue = std::min(batchSizeRequested, (uint16_t)(1000/_curControlInfo.TBENanoSecStep));
+        return IssueTimestampBatch(AlignTBE(curTBEMicroSecRounded), curTBEMicroSecRounded + _maxBatchSpanNanoSec - 1, batchSizeRequested);
+    }
 
-        result.TBEBase = curTBEMicroSecRounded + seastar::engine().cpu_id() - 1;
-        result.TSOId = _tsoId;
-        result.TsDelta = _curControlInfo.TsDelta;
-        result.TTLNanoSec = _curControlInfo.BatchTTL;
-        result.TSCount = batchSizeToIssue;
-        result.TBENanoSecStep = _curControlInfo.TBENanoSecStep;
+    // otherwise, handle less frequent situation
+    return GetTimeStampFromTSOLessFrequentHelper(batchSizeRequested, curTBEMicroSecRounded);
+}
+
+TimestampBatch TSOService::TSOWorker::IssueTimestampBatch(uint64_t baseTBE, uint64_t lastAllowedTBE, uint16_t batchSizeRequested)
+{
+    K2ASSERT(baseTBE <= lastAllowedTBE, "need at least one timestamp to issue");
+    uint64_t step = _curControlInfo.TBENanoSecStep;
+    uint16_t batchSizeToIssue = (uint16_t) std::min<uint64_t>(std::max<uint16_t>(batchSizeRequested, 1), (lastAllowedTBE - baseTBE) / step + 1);
 
-        /*K2INFO("returning a tsBatch reqSize:" << batchSizeRequested << " at rounded request time:[" << curTBEMicroSecRounded 
-            << ":"<< _lastRequestTBEMicroSecRounded << "]TbeAdj:" << _curControlInfo.TBEAdjustment 
-            << " batch value(tbe:tsdelta:TTL:TSCount:Step)[" << result.TBEBase << ":" <<result.TsDelta << ":" << result.TTLNanoSec
-            << ":" << batchSizeToIssue << ":" << result.TBENanoSecStep <<"]");
-        */
+    TimestampBatch result;
+    result.TBEBase = baseTBE;
+    result.TSOId = _tsoId;
+    result.TsDelta = _curControlInfo.TsDelta;
+    result.TTLNanoSec = _curControlInfo.BatchTTL;
+    result.TSCount = batchSizeToIssue;
+    result.TBENanoSecStep = _curControlInfo.TBENanoSecStep;
 
-        _lastRequestTBEMicroSecRounded = curTBEMicroSecRounded;
-        _lastRequestTimeStampCount = batchSizeToIssue;
+    /*K2INFO("returning a tsBatch reqSize:" << batchSizeRequested << " at rounded request time:[" << curTBEMicroSecRounded
+        << ":"<< _lastRequestTBEMicroSecRounded << "]TbeAdj:" << _curControlInfo.TBEAdjustment
+        << " batch value(tbe:tsdelta:TTL:TSCount:Step)[" << result.TBEBase << ":" <<result.TsDelta << ":" << result.TTLNanoSec
+        << ":" << batchSizeToIssue << ":" << result.TBENanoSecStep <<"]");
+    */
 
-        // TODO: accumulate statistics
+    _lastIssuedTBE = baseTBE + (batchSizeToIssue - 1) * step;
+    _lastRequestTBEMicroSecRounded = _lastIssuedTBE / 1000 * 1000;
 
-        return result;
-    }
+    // TODO: accumulate statistics
 
-    // otherwise, handle less frequent situation
-    return GetTimeStampFromTSOLessFrequentHelper(batchSizeRequested, curTBEMicroSecRounded);
+    return result;
 }
 
 // helper function to issue timestamp (or check error situation)
-TimestampBatch TSOService::TSOWorker::GetTimeStampFromTSOLessFrequentHelper(uint16_t batchSizeRequested, uint64_t curTBEMicroSecRounded) 
+TimestampBatch TSOService::TSOWorker::GetTimeStampFromTSOLessFrequentHelper(uint16_t batchSizeRequested, uint64_t curTBEMicroSecRounded)
 {
-    K2INFO("getting a timestamp batch in helper");
+    K2DEBUG("getting a timestamp batch in helper");
     // step 1/4 sanity check, check IsReadyToIssueTS and possible issued timestamp is within ReservedTimeShreshold
     if (!_curControlInfo.IsReadyToIssueTS)
     {
@@ -246,46 +377,38 @@ TimestampBatch TSOService::TSOWorker::GetTimeStampFromTSOLessFrequentHelper(uint
         throw TSONotReadyException();
     }
 
-    // step 3/4 if somehow current time is smaller than last request time
-    if (curTBEMicroSecRounded < _lastRequestTBEMicroSecRounded)
+    // the next timestamp of this core has to be after the last issued one, which may be in current or even upcoming microseconds
+    // as a batch can span multiple microseconds. Also the batch can't be beyond the max span from current time or ReservedTimeShreshold.
+    uint64_t baseTBE = AlignTBE(std::max(curTBEMicroSecRounded, _lastIssuedTBE + 1));
+    uint64_t lastAllowedTBE = std::min(curTBEMicroSecRounded + _maxBatchSpanNanoSec, _curControlInfo.ReservedTimeShreshold) - 1;
+
+    // step 3/4 if somehow current time is smaller than last issued time beyond the max batch span
+    if (baseTBE > lastAllowedTBE + 1000)
     {
-        // this is rare, normally should be a bug, add detal debug info later
-        K2DEBUG("curTBEMicroSecRounded:" << curTBEMicroSecRounded << "< _lastRequestTBEMicroSecRounded:" <<_lastRequestTBEMicroSecRounded);
+        // this is rare, normally should be a bug(or time adjustment not waited out), add detal debug info later
+        K2DEBUG("curTBEMicroSecRounded:" << curTBEMicroSecRounded << " is too far behind _lastIssuedTBE:" <<_lastIssuedTBE);
         // let client retry, maybe we should blocking sleep if there is a case this happening legit and the difference is small, e.g. a few microseconds
         throw TSONotReadyException();
     }
 
-    // step 4/4 handle the case curTBEMicroSecRounded == _lastRequestTBEMicroSecRounded
-    // If leftover timestamp of this microSec is sufficient, issue them out, otherwise, busy wait to next microsec and issue timestamp.
-    K2ASSERT(curTBEMicroSecRounded == _lastRequestTBEMicroSecRounded, "last and this requests are in same microsecond!");
-    uint16_t leftoverTS = 1000 / _curControlInfo.TBENanoSecStep - _lastRequestTimeStampCount;
-
-    if (leftoverTS < batchSizeRequested)
+    // step 4/4 If there is any leftover timestamp within the span, issue them out, otherwise,
+    // busy wait to next microsec(at most one microsecond due to step 3) and issue timestamp.
+    if (baseTBE > lastAllowedTBE)
     {
-        // not enough timestamp at current microsecond to issue out,
-        // busy wait out and go through normal code path to issue timestamp on next microsecond
-        while (curTBEMicroSecRounded == _lastRequestTBEMicroSecRounded)
+        uint64_t startTBEMicroSecRounded = curTBEMicroSecRounded;
+        auto busyWaitStart = Clock::now();
+        while (curTBEMicroSecRounded == startTBEMicroSecRounded)
         {
             curTBEMicroSecRounded = (now_nsec_count() +  _curControlInfo.TBEAdjustment) / 1000 * 1000;
         }
+        auto busyWaitDuration = Clock::now() - busyWaitStart;
+        _busyWaitNanoSec += nsec(busyWaitDuration).count();
+        _busyWaitLatency.add(busyWaitDuration);
 
         return GetTimestampFromTSO(batchSizeRequested);
     }
 
-    K2ASSERT(curTBEMicroSecRounded == _lastRequestTBEMicroSecRounded, "last and this requests are in same microsecond!");
-
-    TimestampBatch result;
-    result.TBEBase = curTBEMicroSecRounded + seastar::engine().cpu_id() - 1 + _lastRequestTimeStampCount * _curControlInfo.TBENanoSecStep;
-    result.TSOId = _tsoId;
-    result.TsDelta = _curControlInfo.TsDelta;
-    result.TTLNanoSec = _curControlInfo.BatchTTL;
-    result.TSCount = batchSizeRequested;
-    result.TBENanoSecStep = _curControlInfo.TBENanoSecStep;
-
-    //_lastRequestTBEMicroSecRounded = curTBEMicroSecRounded;   // they are same, no need to set.
-    _lastRequestTimeStampCount += batchSizeRequested; // we've just issued batchSizeRequested
-
-    return result;
+    return IssueTimestampBatch(baseTBE, lastAllowedTBE, batchSizeRequested);
 }
 
 }
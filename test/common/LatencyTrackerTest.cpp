@@ -0,0 +1,111 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+// k2
+#include <k2/common/LatencyTracker.h>
+// catch
+#include "catch2/catch.hpp"
+using namespace k2;
+
+SCENARIO("test latency tracker without samples") {
+    LatencyTracker tracker;
+    REQUIRE(tracker.count() == 0);
+    REQUIRE(tracker.percentile(99) == Duration::zero());
+    REQUIRE(tracker.average() == Duration::zero());
+    REQUIRE(tracker.timeout(4.0, 10us, 1ms) == 1ms);
+}
+
+SCENARIO("test latency tracker percentiles") {
+    LatencyTracker tracker;
+    for (int i = 100; i >= 1; --i) {
+        tracker.record(i * 1us);
+    }
+    REQUIRE(tracker.count() == 100);
+    REQUIRE(tracker.percentile(0) == 1us);
+    REQUIRE(tracker.percentile(50) == 51us);
+    REQUIRE(tracker.percentile(99) == 99us);
+    REQUIRE(tracker.percentile(100) == 100us);
+}
+
+SCENARIO("test latency tracker keeps the most recent samples") {
+    LatencyTracker tracker;
+    for (size_t i = 0; i < LatencyTracker::WINDOW; ++i) {
+        tracker.record(1ms);
+    }
+    REQUIRE(tracker.percentile(0) == 1ms);
+    for (size_t i = 0; i < LatencyTracker::WINDOW; ++i) {
+        tracker.record(10us);
+    }
+    REQUIRE(tracker.count() == LatencyTracker::WINDOW);
+    REQUIRE(tracker.percentile(100) == 10us);
+    // the moving average converges to the recent latency
+    REQUIRE(tracker.average() < 11us);
+}
+
+SCENARIO("test latency tracker timeout") {
+    LatencyTracker tracker;
+    for (size_t i = 0; i < LatencyTracker::MIN_SAMPLES - 1; ++i) {
+        tracker.record(100us);
+    }
+    // not enough samples to trust the estimate
+    REQUIRE(tracker.timeout(4.0, 10us, 10ms) == 10ms);
+    tracker.record(100us);
+    REQUIRE(tracker.timeout(4.0, 10us, 10ms) == 400us);
+    // clamped
+    REQUIRE(tracker.timeout(4.0, 1ms, 10ms) == 1ms);
+    REQUIRE(tracker.timeout(4.0, 10us, 200us) == 200us);
+}
+
+SCENARIO("test latency tracker timeouts grow after the latency goes up") {
+    LatencyTracker tracker;
+    for (size_t i = 0; i < LatencyTracker::WINDOW; ++i) {
+        tracker.record(100us);
+    }
+    REQUIRE(tracker.timeout(4.0, 10us, 100ms) == 400us);
+
+    // the latency goes up to 10ms. Every request times out until the derived timeout exceeds the latency
+    const Duration latency = 10ms;
+    int timeouts = 0;
+    for (; timeouts < 100; ++timeouts) {
+        auto timeout = tracker.timeout(4.0, 10us, 100ms);
+        if (timeout > latency) {
+            break;
+        }
+        tracker.recordTimeout(timeout);
+    }
+    REQUIRE(timeouts <= 8);
+    tracker.record(latency);
+    REQUIRE(tracker.timeout(4.0, 10us, 100ms) > latency);
+}
+
+SCENARIO("test latency tracker timeouts are reflected right away") {
+    LatencyTracker tracker;
+    for (size_t i = 0; i < LatencyTracker::WINDOW; ++i) {
+        tracker.record(100us);
+    }
+    REQUIRE(tracker.percentile(100) == 100us);
+    // a regular sample may not be reflected until a few more samples arrive
+    tracker.recordTimeout(1ms);
+    REQUIRE(tracker.percentile(100) == 1ms);
+}
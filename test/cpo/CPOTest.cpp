@@ -47,6 +47,14 @@ seastar::future<> CPOTest::start() {
     K2INFO("start");
     ConfigVar<String> configEp("cpo_endpoint");
     _cpoEndpoint = RPC().getTXEndpoint(configEp());
+    // we don't listen for connections, so the CPO pushes these over our connection to it
+    RPC().registerRPCObserver<dto::PartitionMapUpdateRequest, dto::PartitionMapUpdateResponse>(dto::Verbs::CPO_PARTITION_MAP_UPDATE,
+        [this](dto::PartitionMapUpdateRequest&& update) {
+            if (update.name == "collectionAssign") {
+                _pushedVersion = std::max(_pushedVersion, update.version);
+            }
+            return RPCResponse(Statuses::S200_OK("update received"), dto::PartitionMapUpdateResponse());
+        });
 
     // let start() finish and then run the tests
     _testTimer.set_callback([this] {
@@ -55,6 +63,8 @@ seastar::future<> CPOTest::start() {
         .then([this] { return runTest3(); })
         .then([this] { return runTest4(); })
         .then([this] { return runTest5(); })
+        .then([this] { return runTest6(); })
+        .then([this] { return runTest7(); })
         .then([this] {
             K2INFO("======= All tests passed ========");
             exitcode = 0;
@@ -175,10 +185,19 @@ seastar::future<> CPOTest::runTest5() {
     };
     return RPC()
         .callRPC<dto::CollectionCreateRequest, dto::CollectionCreateResponse>(dto::Verbs::CPO_COLLECTION_CREATE, request, *_cpoEndpoint, 1s)
-        .then([](auto&& response) {
+        .then([this](auto&& response) {
             // create the collection
             auto& [status, resp] = response;
             K2EXPECT(status, Statuses::S201_Created);
+            // subscribe while the partitions are being assigned, so that the assignments are pushed to us
+            auto request = dto::CollectionSubscribeRequest{.name = "collectionAssign"};
+            return RPC()
+                .callRPC<dto::CollectionSubscribeRequest, dto::CollectionSubscribeResponse>(dto::Verbs::CPO_COLLECTION_SUBSCRIBE, request, *_cpoEndpoint, 100ms);
+        })
+        .then([this](auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(status, Statuses::S200_OK);
+            _subscribedVersion = resp.version;
         })
         .then([] {
             // wait for collection to get assigned
@@ -200,8 +219,11 @@ seastar::future<> CPOTest::runTest5() {
             K2EXPECT(resp.collection.metadata.capacity.dataCapacityMegaBytes, 1000);
             K2EXPECT(resp.collection.metadata.capacity.readIOPs, 100000);
             K2EXPECT(resp.collection.metadata.capacity.writeIOPs, 100000);
-            K2EXPECT(resp.collection.partitionMap.version, 3);
+            // one version per created partition, and one more per completed assignment
+            K2EXPECT(resp.collection.partitionMap.version, 6);
             K2EXPECT(resp.collection.partitionMap.partitions.size(), 3);
+            // we got the assignments which completed after we subscribed
+            K2EXPECT(std::max(_subscribedVersion, _pushedVersion), 6);
 
             // how many partitions we have
             uint64_t numparts = _k2ConfigEps().size();
@@ -221,3 +243,54 @@ seastar::future<> CPOTest::runTest5() {
             }
         });
 }
+
+seastar::future<> CPOTest::runTest6() {
+    K2INFO(">>> Test6: subscribe to partition map changes");
+    auto request = dto::CollectionSubscribeRequest{.name = "collection1"};
+    return RPC()
+        .callRPC<dto::CollectionSubscribeRequest, dto::CollectionSubscribeResponse>(dto::Verbs::CPO_COLLECTION_SUBSCRIBE, request, *_cpoEndpoint, 100ms)
+        .then([this](auto&& response) {
+            // can't subscribe to a collection which doesn't exist
+            auto& [status, resp] = response;
+            K2EXPECT(status, Statuses::S404_Not_Found);
+            auto request = dto::CollectionSubscribeRequest{.name = "collectionAssign"};
+            return RPC()
+                .callRPC<dto::CollectionSubscribeRequest, dto::CollectionSubscribeResponse>(dto::Verbs::CPO_COLLECTION_SUBSCRIBE, request, *_cpoEndpoint, 100ms);
+        })
+        .then([](auto&& response) {
+            auto& [status, resp] = response;
+            K2EXPECT(status, Statuses::S200_OK);
+            // the version of the fully assigned collection from test5
+            K2EXPECT(resp.version, 6);
+        });
+}
+
+seastar::future<> CPOTest::runTest7() {
+    K2INFO(">>> Test7: concurrent creates of the same collection");
+    auto request = dto::CollectionCreateRequest{
+        .metadata{
+            .name = "collectionRace",
+            .hashScheme=dto::HashScheme::HashCRC32C,
+            .storageDriver=dto::StorageDriver::K23SI,
+            .capacity{
+                .dataCapacityMegaBytes = 1,
+                .readIOPs = 100,
+                .writeIOPs = 200
+            },
+            .retentionPeriod = 1h
+        },
+        .clusterEndpoints{}};
+    return seastar::do_with(request, request, [this](auto& request1, auto& request2) {
+        return seastar::when_all_succeed(
+            RPC().callRPC<dto::CollectionCreateRequest, dto::CollectionCreateResponse>(dto::Verbs::CPO_COLLECTION_CREATE, request1, *_cpoEndpoint, 1s),
+            RPC().callRPC<dto::CollectionCreateRequest, dto::CollectionCreateResponse>(dto::Verbs::CPO_COLLECTION_CREATE, request2, *_cpoEndpoint, 1s))
+        .then([](auto&& response1, auto&& response2) {
+            // exactly one of the creates succeeds
+            auto& [status1, resp1] = response1;
+            auto& [status2, resp2] = response2;
+            K2EXPECT(status1.is2xxOK() != status2.is2xxOK(), true);
+            auto& rejected = status1.is2xxOK() ? status2 : status1;
+            K2EXPECT(rejected, Statuses::S403_Forbidden);
+        });
+    });
+}
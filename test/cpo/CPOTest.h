@@ -39,6 +39,8 @@ public:  // application lifespan
     seastar::future<> runTest3();
     seastar::future<> runTest4();
     seastar::future<> runTest5();
+    seastar::future<> runTest6();
+    seastar::future<> runTest7();
 
 private:
     int exitcode = -1;
@@ -46,4 +48,7 @@ private:
     k2::ConfigVar<std::vector<k2::String>> _k2ConfigEps{"k2_endpoints"};
     seastar::future<> _testFuture = seastar::make_ready_future();
     seastar::timer<> _testTimer;
+    // the partition map versions of collectionAssign when we subscribed, and in the last update pushed to us
+    uint64_t _subscribedVersion = 0;
+    uint64_t _pushedVersion = 0;
 };
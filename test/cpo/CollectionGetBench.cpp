@@ -0,0 +1,147 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// CPO collection get microbenchmark.
+// Reports ns/get for serving a collection get the way the CPO did before it kept collections in memory(read the
+// collection file with the blocking fileutil helper, parse it, and serialize the response), and from an in-memory
+// snapshot(copy the snapshot into the response and serialize it), for collections of several sizes. The time spent
+// in the blocking file calls is also reported, since that is time in which the reactor can't serve anything else.
+// Usage: collection_get_bench [iterations]
+#include <k2/common/Common.h>
+#include <k2/dto/Collection.h>
+#include <k2/dto/ControlPlaneOracle.h>
+#include <k2/transport/Payload.h>
+#include <k2/transport/PayloadFileUtil.h>
+#include <k2/transport/PayloadSerialization.h>
+#include <k2/transport/Status.h>
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+using namespace k2;
+
+static const size_t allocSize = 8192;
+
+// a collection as the CPO creates it, with one assigned partition per node
+dto::Collection makeCollection(size_t partitions) {
+    dto::Collection collection;
+    collection.metadata.name = "bench";
+    collection.metadata.hashScheme = dto::HashScheme::HashCRC32C;
+    collection.metadata.storageDriver = dto::StorageDriver::K23SI;
+    collection.metadata.id = 1;
+    const uint64_t max = std::numeric_limits<uint64_t>::max();
+    uint64_t partSize = max / partitions;
+    for (size_t i = 0; i < partitions; ++i) {
+        dto::Partition part;
+        part.pvid = dto::Partition::PVID{.id = i, .rangeVersion = 1, .assignmentVersion = 1};
+        part.startKey = std::to_string(i * partSize);
+        part.endKey = std::to_string(i == partitions - 1 ? max : (i + 1) * partSize - 1);
+        part.endpoints = {"tcp+k2rpc://192.168.100." + std::to_string(i % 256) + ":" + std::to_string(10000 + i)};
+        part.astate = dto::AssignmentState::Assigned;
+        collection.partitionMap.partitions.push_back(std::move(part));
+        collection.partitionMap.version += 2;
+    }
+    return collection;
+}
+
+// serializes the response to a get, as the RPC dispatcher does
+size_t respond(dto::CollectionGetResponse& response) {
+    Payload reply([] { return Binary(allocSize); });
+    auto status = Statuses::S200_OK("collection found");
+    reply.reserveFor(status, response);
+    reply.write(status);
+    reply.write(response);
+    return reply.getSize();
+}
+
+void bench(size_t partitions, const String& dir, size_t iterations) {
+    volatile size_t sink = 0;
+    auto snapshot = makeCollection(partitions);
+    auto path = dir + "/bench_" + std::to_string(partitions) + ".collection";
+    Payload file([] { return Binary(allocSize); });
+    file.write(snapshot);
+    auto fileSize = file.getSize();
+    if (!fileutil::writeFile(std::move(file), path)) {
+        std::cerr << "unable to write " << path << std::endl;
+        std::exit(1);
+    }
+
+    Duration blocking{0};
+    auto start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        auto readStart = Clock::now();
+        // the file is read into a non-allocating payload
+        Payload p;
+        if (!fileutil::readFile(p, path)) {
+            std::cerr << "unable to read " << path << std::endl;
+            std::exit(1);
+        }
+        blocking += Clock::now() - readStart;
+        dto::CollectionGetResponse response;
+        if (!p.read(response.collection)) {
+            std::cerr << "unable to parse " << path << std::endl;
+            std::exit(1);
+        }
+        sink = sink + respond(response);
+    }
+    auto fileNs = (double)nsec(Clock::now() - start).count() / iterations;
+    auto blockingNs = (double)nsec(blocking).count() / iterations;
+
+    start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        dto::CollectionGetResponse response;
+        response.collection = snapshot;
+        sink = sink + respond(response);
+    }
+    auto snapshotNs = (double)nsec(Clock::now() - start).count() / iterations;
+    ::unlink(path.c_str());
+
+    std::cout << std::right << std::fixed << std::setprecision(1)
+              << std::setw(6) << partitions << " partitions"
+              << std::setw(10) << fileSize << " bytes"
+              << std::setw(12) << fileNs << " ns/get from file"
+              << std::setw(12) << blockingNs << " ns/get blocked in file calls"
+              << std::setw(12) << snapshotNs << " ns/get from snapshot" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000;
+    if (iterations == 0) {
+        std::cerr << "usage: " << argv[0] << " [iterations]" << std::endl;
+        return 1;
+    }
+    char dirTemplate[] = "/tmp/collection_get_bench.XXXXXX";
+    if (::mkdtemp(dirTemplate) == nullptr) {
+        std::cerr << "unable to create a temporary directory" << std::endl;
+        return 1;
+    }
+    String dir(dirTemplate);
+
+    for (size_t partitions : {3, 64, 1024}) {
+        bench(partitions, dir, iterations);
+    }
+    ::rmdir(dir.c_str());
+    return 0;
+}
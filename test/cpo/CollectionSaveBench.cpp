@@ -0,0 +1,189 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// CPO collection save microbenchmark.
+// Reports the cost of persisting a collection, for collections of several sizes:
+// - blocking: the blocking fileutil::writeFile the CPO used to call on its reactor. The whole call is a reactor stall
+// - durable: the same steps writeFileAtomicAsync performs(write a temp file, fsync it, rename it over the target,
+//   fsync the directory), done here with blocking calls. This is how long a save takes end to end, and how long the
+//   reactor would stall if it made these calls itself. writeFileAtomicAsync waits for them without blocking
+// - on reactor: the part of writeFileAtomicAsync which does run on the reactor: serializing the collection and
+//   copying it into an aligned buffer for the DMA write
+// Usage: collection_save_bench [iterations]
+#include <k2/common/Common.h>
+#include <k2/dto/Collection.h>
+#include <k2/transport/Payload.h>
+#include <k2/transport/PayloadFileUtil.h>
+#include <k2/transport/PayloadSerialization.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+using namespace k2;
+
+static const size_t allocSize = 8192;
+static const size_t dmaAlignment = 4096;
+
+// a collection as the CPO creates it, with one assigned partition per node
+dto::Collection makeCollection(size_t partitions) {
+    dto::Collection collection;
+    collection.metadata.name = "bench";
+    collection.metadata.hashScheme = dto::HashScheme::HashCRC32C;
+    collection.metadata.storageDriver = dto::StorageDriver::K23SI;
+    collection.metadata.id = 1;
+    const uint64_t max = std::numeric_limits<uint64_t>::max();
+    uint64_t partSize = max / partitions;
+    for (size_t i = 0; i < partitions; ++i) {
+        dto::Partition part;
+        part.pvid = dto::Partition::PVID{.id = i, .rangeVersion = 1, .assignmentVersion = 1};
+        part.startKey = std::to_string(i * partSize);
+        part.endKey = std::to_string(i == partitions - 1 ? max : (i + 1) * partSize - 1);
+        part.endpoints = {"tcp+k2rpc://192.168.100." + std::to_string(i % 256) + ":" + std::to_string(10000 + i)};
+        part.astate = dto::AssignmentState::Assigned;
+        collection.partitionMap.partitions.push_back(std::move(part));
+        collection.partitionMap.version += 2;
+    }
+    return collection;
+}
+
+Payload serialize(const dto::Collection& collection) {
+    Payload p([] { return Binary(allocSize); });
+    p.write(collection);
+    p.truncateToCurrent();
+    return p;
+}
+
+// copies the payload into one aligned buffer, as writeFileAtomicAsync does before the DMA write
+Binary alignedCopy(Payload&& payload) {
+    auto size = payload.getSize();
+    auto buf = Binary::aligned(dmaAlignment, (std::max<size_t>(size, 1) + dmaAlignment - 1) / dmaAlignment * dmaAlignment);
+    std::memset(buf.get_write(), 0, buf.size());
+    size_t offset = 0;
+    for (auto& part : payload.release()) {
+        auto tocopy = std::min(part.size(), size - offset);
+        std::memcpy(buf.get_write() + offset, part.get(), tocopy);
+        offset += tocopy;
+        if (offset == size) break;
+    }
+    return buf;
+}
+
+// write a temp file, fsync it, rename it over the target and fsync the directory, with blocking calls
+bool durableWrite(const Binary& buf, size_t size, const String& path, const String& dir) {
+    auto tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    if (fd < 0) return false;
+    bool ok = ::write(fd, buf.get(), size) == (ssize_t)size && ::fsync(fd) == 0;
+    ok = ::close(fd) == 0 && ok;
+    if (!ok || ::rename(tmpPath.c_str(), path.c_str()) != 0) return false;
+    int dfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dfd < 0) return false;
+    ok = ::fsync(dfd) == 0;
+    return ::close(dfd) == 0 && ok;
+}
+
+struct Stats {
+    std::vector<double> us;
+    void add(Duration d) { us.push_back(nsec(d).count() / 1000.0); }
+    double mean() const {
+        double sum = 0;
+        for (auto v : us) sum += v;
+        return sum / us.size();
+    }
+    double percentile(double pct) {
+        std::sort(us.begin(), us.end());
+        return us[std::min(us.size() - 1, (size_t)(pct / 100 * us.size()))];
+    }
+};
+
+std::ostream& operator<<(std::ostream& os, Stats& stats) {
+    return os << std::setw(10) << stats.mean() << std::setw(10) << stats.percentile(99)
+              << std::setw(10) << stats.percentile(100);
+}
+
+void bench(size_t partitions, const String& dir, size_t iterations) {
+    volatile size_t sink = 0;
+    auto collection = makeCollection(partitions);
+    auto path = dir + "/bench_" + std::to_string(partitions) + ".collection";
+    size_t fileSize = serialize(collection).getSize();
+
+    Stats blocking;
+    for (size_t i = 0; i < iterations; ++i) {
+        auto start = Clock::now();
+        Payload p([] { return Binary(allocSize); });
+        p.write(collection);
+        if (!fileutil::writeFile(std::move(p), path)) {
+            std::cerr << "unable to write " << path << std::endl;
+            std::exit(1);
+        }
+        blocking.add(Clock::now() - start);
+    }
+
+    Stats durable;
+    Stats onReactor;
+    for (size_t i = 0; i < iterations; ++i) {
+        auto start = Clock::now();
+        auto buf = alignedCopy(serialize(collection));
+        onReactor.add(Clock::now() - start);
+        sink = sink + buf.size();
+
+        start = Clock::now();
+        if (!durableWrite(buf, fileSize, path, dir)) {
+            std::cerr << "unable to write " << path << ": " << strerror(errno) << std::endl;
+            std::exit(1);
+        }
+        durable.add(Clock::now() - start);
+    }
+    ::unlink(path.c_str());
+
+    std::cout << std::right << std::fixed << std::setprecision(1)
+              << std::setw(6) << partitions << std::setw(10) << fileSize
+              << blocking << durable << onReactor << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000;
+    if (iterations == 0) {
+        std::cerr << "usage: " << argv[0] << " [iterations]" << std::endl;
+        return 1;
+    }
+    char dirTemplate[] = "/tmp/collection_save_bench.XXXXXX";
+    if (::mkdtemp(dirTemplate) == nullptr) {
+        std::cerr << "unable to create a temporary directory" << std::endl;
+        return 1;
+    }
+    String dir(dirTemplate);
+
+    std::cout << "partitions     bytes | blocking(us): mean, p99, max | durable(us): mean, p99, max | "
+              << "on reactor(us): mean, p99, max" << std::endl;
+    for (size_t partitions : {3, 64, 1024}) {
+        bench(partitions, dir, iterations);
+    }
+    ::rmdir(dir.c_str());
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/appbase/Appbase.h>
+#include <k2/appbase/AppEssentials.h>
+#include <k2/cpo/client/CPOClient.h>
+#include <k2/dto/Collection.h>
+#include <k2/dto/K23SI.h>
+#include <k2/dto/MessageVerbs.h>
+#include <k2/transport/TCPRPCProtocol.h>
+#include <k2/transport/UnixRPCProtocol.h>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/sleep.hh>
+
+using namespace k2;
+
+// the value returned by the test servers, so that we can tell which server answered a read
+struct ServedBy {
+    uint64_t core = 0;
+    K2_PAYLOAD_FIELDS(core);
+};
+
+// how long the server on this core takes to answer a read
+static thread_local Duration readDelay = 0us;
+
+// Exercises request cancellation and the hedging of partition requests. Needs 3 cores: core 0 is the client and
+// cores 1 and 2 are two nodes which serve the same partition
+class HedgingTest {
+public:  // application lifespan
+    HedgingTest() { K2INFO("ctor"); }
+    ~HedgingTest() { K2INFO("dtor"); }
+
+    seastar::future<> gracefulStop() {
+        K2INFO("stop");
+        return std::move(_testFuture);
+    }
+
+    seastar::future<> start() {
+        K2INFO("start");
+        if (seastar::engine().cpu_id() != 0) {
+            RPC().registerRPCObserver<dto::K23SIReadRequest, dto::K23SIReadResponse<ServedBy>>(dto::Verbs::K23SI_READ,
+                [](dto::K23SIReadRequest&&) {
+                    return seastar::sleep(readDelay).then([] {
+                        dto::K23SIReadResponse<ServedBy> response;
+                        response.value.val.core = seastar::engine().cpu_id();
+                        return RPCResponse(dto::K23SIStatus::OK("read"), std::move(response));
+                    });
+                });
+            return seastar::make_ready_future<>();
+        }
+        if (seastar::smp::count < 3) {
+            return seastar::make_exception_future<>(std::runtime_error("the test needs 3 cores"));
+        }
+
+        // let start() finish on all cores and then run the tests
+        _testTimer.set_callback([this] {
+            _testFuture = _getURL(1)
+            .then([this](String&& url) {
+                _urls.push_back(std::move(url));
+                return _getURL(2);
+            })
+            .then([this](String&& url) {
+                _urls.push_back(std::move(url));
+                _client = std::make_unique<CPOClient>();
+                return runTest1();
+            })
+            .then([this] { return runTest2(); })
+            .then([this] { return runTest3(); })
+            .then([this] {
+                K2INFO("======= All tests passed ========");
+                exitcode = 0;
+            })
+            .handle_exception([this](auto exc) {
+                try {
+                    std::rethrow_exception(exc);
+                } catch (std::exception& e) {
+                    K2ERROR("======= Test failed with exception [" << e.what() << "] ========");
+                    exitcode = -1;
+                }
+            })
+            .finally([this] {
+                K2INFO("======= Test ended ========");
+                auto f = _client ? _client->gracefulStop() : seastar::make_ready_future<>();
+                return f.then([this] {
+                    seastar::engine().exit(exitcode);
+                });
+            });
+        });
+        _testTimer.arm(0ms);
+        return seastar::make_ready_future<>();
+    }
+
+    seastar::future<> runTest1() {
+        K2INFO(">>> Test1: the alternate endpoint is another node over the preferred transport");
+        // the node on core 1 also lists a unix socket, which is preferred. The other node has no unix socket
+        auto getter = dto::PartitionGetter(_makeCollection({_urls[0], _urls[1], "unix+k2rpc:///tmp/k2_hedging_test.sock"}));
+        auto& partition = getter.getPartitionForKey(_key());
+        K2EXPECT(bool(partition.preferredEndpoint), true);
+        K2EXPECT(partition.preferredEndpoint->getProtocol(), UnixRPCProtocol::proto);
+        K2EXPECT(bool(partition.alternateEndpoint), false);
+
+        auto tcpGetter = dto::PartitionGetter(_makeCollection({_urls[0], _urls[1]}));
+        auto& tcpPartition = tcpGetter.getPartitionForKey(_key());
+        K2EXPECT(bool(tcpPartition.preferredEndpoint), true);
+        K2EXPECT(bool(tcpPartition.alternateEndpoint), true);
+        K2EXPECT((tcpPartition.preferredEndpoint->getURL() != tcpPartition.alternateEndpoint->getURL()), true);
+        return seastar::make_ready_future<>();
+    }
+
+    seastar::future<> runTest2() {
+        K2INFO(">>> Test2: a cancelled request fails right away");
+        return _setDelay(1, 500ms).then([this] {
+            _endpoint = RPC().getTXEndpoint(_urls[0]);
+            K2EXPECT(bool(_endpoint), true);
+            dto::K23SIReadRequest request{.pvid={}, .collectionId=1, .mtr={}, .key=_key()};
+            auto payload = _endpoint->newPayload();
+            payload->write(request);
+            auto start = Clock::now();
+            auto fut = RPC().sendRequest(dto::Verbs::K23SI_READ, std::move(payload), *_endpoint, 5s, &_handle);
+            K2EXPECT(bool(_handle.requestId), true);
+            K2EXPECT(RPC().pendingRequests(), 1u);
+            RPC().cancelRequest(_handle);
+            K2EXPECT(RPC().pendingRequests(), 0u);
+            return fut.then_wrapped([start](auto&& fut) {
+                K2EXPECT(fut.failed(), true);
+                try {
+                    fut.get();
+                }
+                catch (const RPCDispatcher::RequestCancelledException&) {
+                    K2EXPECT((Clock::now() - start < 100ms), true);
+                    return;
+                }
+                throw std::runtime_error("the request did not fail with RequestCancelledException");
+            });
+        })
+        .then([this] {
+            // cancelling a request which is no longer pending does nothing
+            RPC().cancelRequest(_handle);
+            K2EXPECT(bool(_handle.requestId), false);
+        });
+    }
+
+    seastar::future<> runTest3() {
+        K2INFO(">>> Test3: a slow read is hedged to the other node and the slow attempt is cancelled");
+        _client->collections["hedging"] = dto::PartitionGetter(_makeCollection({_urls[0], _urls[1]}));
+        _client->collectionsById[1] = &_client->collections["hedging"];
+        auto& partition = _client->collections["hedging"].getPartitionForKey(_key());
+        auto preferredCore = partition.preferredEndpoint->getURL() == _urls[0] ? 1u : 2u;
+        auto otherCore = preferredCore == 1u ? 2u : 1u;
+
+        // warm up the latency estimate of the preferred endpoint. No request is hedged until we have it
+        return _setDelay(preferredCore, 0us)
+        .then([this, preferredCore] {
+            return seastar::do_until([this] { return _reads == LatencyTracker::MIN_SAMPLES; }, [this, preferredCore] {
+                return _read().then([this, preferredCore] (auto&& result) {
+                    auto& [status, response] = result;
+                    K2EXPECT(status, dto::K23SIStatus::OK);
+                    K2EXPECT(response.value.val.core, preferredCore);
+                    _reads++;
+                });
+            });
+        })
+        .then([this, preferredCore] {
+            return _setDelay(preferredCore, 500ms);
+        })
+        .then([this, otherCore] {
+            auto start = Clock::now();
+            return _read().then([start, otherCore] (auto&& result) {
+                auto& [status, response] = result;
+                K2EXPECT(status, dto::K23SIStatus::OK);
+                K2EXPECT(response.value.val.core, otherCore);
+                K2EXPECT((Clock::now() - start < 250ms), true);
+                // the attempt to the slow node is no longer pending
+                K2EXPECT(RPC().pendingRequests(), 0u);
+            });
+        });
+    }
+
+private:
+    seastar::future<String> _getURL(unsigned core) {
+        return seastar::smp::submit_to(core, [] {
+            return RPC().getServerEndpoint(TCPRPCProtocol::proto)->getURL();
+        });
+    }
+
+    seastar::future<> _setDelay(unsigned core, Duration delay) {
+        return seastar::smp::submit_to(core, [delay] {
+            readDelay = delay;
+        });
+    }
+
+    static dto::Key _key() {
+        return dto::Key{.partitionKey="key", .rangeKey=""};
+    }
+
+    static dto::Collection _makeCollection(std::set<String> endpoints) {
+        dto::Collection collection;
+        collection.metadata.name = "hedging";
+        collection.metadata.hashScheme = dto::HashScheme::HashCRC32C;
+        collection.metadata.storageDriver = dto::StorageDriver::K23SI;
+        collection.metadata.id = 1;
+        dto::Partition partition;
+        partition.pvid = dto::Partition::PVID{.id=1, .rangeVersion=1, .assignmentVersion=1};
+        partition.startKey = "0";
+        partition.endKey = std::to_string(std::numeric_limits<uint64_t>::max());
+        partition.endpoints = std::move(endpoints);
+        partition.astate = dto::AssignmentState::Assigned;
+        collection.partitionMap.partitions.push_back(std::move(partition));
+        return collection;
+    }
+
+    seastar::future<std::tuple<Status, dto::K23SIReadResponse<ServedBy>>> _read() {
+        _request = dto::K23SIReadRequest{.pvid={}, .collectionId=1, .mtr={}, .key=_key()};
+        return _client->PartitionRequest<dto::K23SIReadRequest, dto::K23SIReadResponse<ServedBy>, dto::Verbs::K23SI_READ>
+            (Deadline<>(5s), _request);
+    }
+
+    int exitcode = -1;
+    std::vector<String> _urls;
+    std::unique_ptr<CPOClient> _client;
+    std::unique_ptr<TXEndpoint> _endpoint;
+    RPCDispatcher::RequestHandle _handle;
+    dto::K23SIReadRequest _request;
+    size_t _reads = 0;
+    seastar::future<> _testFuture = seastar::make_ready_future();
+    seastar::timer<> _testTimer;
+};
+
+int main(int argc, char** argv) {
+    App app("HedgingTest");
+    app.addOptions()
+        ("partition_request_timeout", bpo::value<ParseableDuration>(), "Timeout of K23SI operations, as chrono literals")
+        ("partition_request_hedging", bpo::value<bool>()->default_value(false), "Hedge slow idempotent K23SI operations");
+    app.addApplet<HedgingTest>();
+    return app.start(argc, argv);
+}
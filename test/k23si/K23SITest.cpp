@@ -118,6 +118,7 @@ public:  // application lifespan
             .then([this] { return runScenario03(); })
             .then([this] { return runScenario04(); })
             .then([this] { return runScenario05(); })
+            .then([this] { return runScenario06(); })
             .then([this] {
                 K2INFO("======= All tests passed ========");
                 exitcode = 0;
@@ -157,14 +158,19 @@ private:
     dto::PartitionGetter _pgetter;
     uint64_t txnids = 10000;
 
+    // the CPO-assigned id of the test collection
+    uint64_t collid() const {
+        return _pgetter.collection.metadata.id;
+    }
+
     template <typename DataType>
     seastar::future<std::tuple<Status, dto::K23SIWriteResponse>>
-    doWrite(const dto::Key& key, const DataType& data, const dto::K23SI_MTR& mtr, const dto::Key& trh, const String& cname, bool isDelete, bool isTRH) {
+    doWrite(const dto::Key& key, const DataType& data, const dto::K23SI_MTR& mtr, const dto::Key& trh, uint64_t cid, bool isDelete, bool isTRH) {
         K2DEBUG("key=" << key << ",partition hash=" << key.partitionHash())
         auto& part = _pgetter.getPartitionForKey(key);
         dto::K23SIWriteRequest<DataType> request;
         request.pvid = part.partition->pvid;
-        request.collectionName = cname;
+        request.collectionId = cid;
         request.mtr = mtr;
         request.trh = trh;
         request.isDelete = isDelete;
@@ -176,13 +182,13 @@ private:
 
     template <typename ResponseType>
     seastar::future<std::tuple<Status, dto::K23SIReadResponse<ResponseType>>>
-    doRead(const dto::Key& key, const dto::K23SI_MTR& mtr, const String& cname) {
+    doRead(const dto::Key& key, const dto::K23SI_MTR& mtr, uint64_t cid) {
         K2DEBUG("key=" << key << ",partition hash=" << key.partitionHash())
         auto& part = _pgetter.getPartitionForKey(key);
         // read wrong collection
         dto::K23SIReadRequest request {
             .pvid = part.partition->pvid,
-            .collectionName = cname,
+            .collectionId = cid,
             .mtr =mtr,
             .key=key
         };
@@ -191,18 +197,28 @@ private:
     }
 
     seastar::future<std::tuple<Status, dto::K23SITxnEndResponse>>
-    doEnd(dto::Key trh, dto::K23SI_MTR mtr, String cname, bool isCommit, std::vector<dto::Key> wkeys) {
+    doEnd(dto::Key trh, dto::K23SI_MTR mtr, uint64_t cid, bool isCommit, std::vector<dto::Key> wkeys) {
         K2DEBUG("key=" << trh << ",partition hash=" << trh.partitionHash())
         auto& part = _pgetter.getPartitionForKey(trh);
         dto::K23SITxnEndRequest request;
         request.pvid = part.partition->pvid;
-        request.collectionName = cname;
+        request.collectionId = cid;
         request.mtr = mtr;
         request.key = trh;
         request.action = isCommit ? dto::EndAction::Commit : dto::EndAction::Abort;
         request.writeKeys = wkeys;
         return RPC().callRPC<dto::K23SITxnEndRequest, dto::K23SITxnEndResponse>(dto::Verbs::K23SI_TXN_END, request, *part.preferredEndpoint, 100ms);
     }
+
+    // an endpoint of the cluster which doesn't serve the given partition
+    TXEndpoint& otherEndpoint(dto::PartitionGetter::PartitionWithEndpoint& part) {
+        for (auto& ep: _k2Endpoints) {
+            if (ep->getPort() != part.preferredEndpoint->getPort()) {
+                return *ep;
+            }
+        }
+        throw std::runtime_error("no endpoint other than the partition's");
+    }
 public: // tests
 
 seastar::future<> runScenarioUnassignedNodes() {
@@ -214,7 +230,7 @@ seastar::future<> runScenario01() {
     K2INFO("Scenario 01: empty node");
     return seastar::make_ready_future()
     .then([this] {
-        return doRead<Payload>({"Key1","rKey1"},{txnids++,dto::Timestamp(100000, 1, 1000),dto::TxnPriority::Medium}, "somebadcoll");
+        return doRead<Payload>({"Key1","rKey1"},{txnids++,dto::Timestamp(100000, 1, 1000),dto::TxnPriority::Medium}, collid() + 1);
     })
     .then([](auto&& response) {
         auto& [status, resp] = response;
@@ -303,16 +319,16 @@ cases requiring client to refresh collection pmap
             dto::Key{.partitionKey = "Key1", .rangeKey = "rKey1"},
             DataRec{.f1="field1", .f2="field2"},
             [this] (dto::K23SI_MTR& mtr, dto::Key& key, dto::Key& trh, DataRec& rec) {
-                return doWrite<DataRec>(key, rec, mtr, trh, collname, false, true)
+                return doWrite<DataRec>(key, rec, mtr, trh, collid(), false, true)
                 .then([this, &mtr, &key, &trh](auto&& response) {
                     auto& [status, resp] = response;
                     K2EXPECT(status, dto::K23SIStatus::Created);
-                    return doEnd(trh, mtr, collname, true, {key});
+                    return doEnd(trh, mtr, collid(), true, {key});
                 })
                 .then([this, &key, &mtr](auto&& response) {
                     auto& [status, resp] = response;
                     K2EXPECT(status, dto::K23SIStatus::OK);
-                    return doRead<DataRec>(key, mtr, collname);
+                    return doRead<DataRec>(key, mtr, collid());
                 })
                 .then([&rec](auto&& response) {
                     auto& [status, resp] = response;
@@ -340,7 +356,7 @@ seastar::future<> runScenario04() {
                     m1.txnid = txnids++;
                     m1.timestamp = ts;
                     m1.priority = dto::TxnPriority::Medium;
-                    return doWrite<DataRec>(k1, {"fk1", "f2"}, m1, k1, collname, false, true);
+                    return doWrite<DataRec>(k1, {"fk1", "f2"}, m1, k1, collid(), false, true);
                 })
                 .then([&](auto&& result) {
                     auto& [status, r] = result;
@@ -351,12 +367,12 @@ seastar::future<> runScenario04() {
                     m2.txnid = txnids++;
                     m2.timestamp = ts;
                     m2.priority = dto::TxnPriority::Medium;
-                    return doWrite<DataRec>(k2, {"fk2", "f2"}, m2, k2, collname, false, true);
+                    return doWrite<DataRec>(k2, {"fk2", "f2"}, m2, k2, collid(), false, true);
                 })
                 .then([&](auto&& result) {
                     auto& [status, r] = result;
                     K2EXPECT(status, dto::K23SIStatus::Created);
-                    return seastar::when_all(doEnd(k1, m1, collname, true, {k1}), doEnd(k2, m2, collname, true, {k2}));
+                    return seastar::when_all(doEnd(k1, m1, collid(), true, {k1}), doEnd(k2, m2, collid(), true, {k2}));
                 })
                 .then([&](auto&& result) mutable {
                     auto& [r1, r2] = result;
@@ -367,13 +383,13 @@ seastar::future<> runScenario04() {
                     K2EXPECT(status1, dto::K23SIStatus::OperationNotAllowed);
                     K2EXPECT(status2, dto::K23SIStatus::OK);
                     // do end for first txn with Abort
-                    return doEnd(k1, m1, collname, false, {k1});
+                    return doEnd(k1, m1, collid(), false, {k1});
                 })
                 .then([&](auto&& result) {
                     auto& [status, resp] = result;
                     K2EXPECT(status, dto::K23SIStatus::OK);
 
-                    return seastar::when_all(doRead<DataRec>(k1, m1, collname), doRead<DataRec>(k2, m2, collname));
+                    return seastar::when_all(doRead<DataRec>(k1, m1, collid()), doRead<DataRec>(k2, m2, collid()));
                 })
                 .then([&](auto&& result) mutable {
                     auto& [r1, r2] = result;
@@ -400,7 +416,7 @@ seastar::future<> runScenario05() {
                     m1.txnid = txnids++;
                     m1.timestamp = ts;
                     m1.priority = dto::TxnPriority::Medium;
-                    return doWrite<DataRec>(k1, {"fk1","f2"}, m1, k1, collname, false, true);
+                    return doWrite<DataRec>(k1, {"fk1","f2"}, m1, k1, collid(), false, true);
                 })
                 .then([&](auto&& result) {
                     auto& [status, r] = result;
@@ -411,12 +427,12 @@ seastar::future<> runScenario05() {
                     m2.txnid = txnids++;
                     m2.timestamp = ts;
                     m2.priority = dto::TxnPriority::Medium;
-                    return doWrite<DataRec>(k2, {"fk2", "f2"}, m2, k2, collname, false, true);
+                    return doWrite<DataRec>(k2, {"fk2", "f2"}, m2, k2, collid(), false, true);
                 })
                 .then([&](auto&& result) {
                     auto& [status, r] = result;
                     K2EXPECT(status, dto::K23SIStatus::Created);
-                    return seastar::when_all(doEnd(k1, m1, collname, true, {k1}), doEnd(k2, m2, collname, true, {k2}));
+                    return seastar::when_all(doEnd(k1, m1, collid(), true, {k1}), doEnd(k2, m2, collid(), true, {k2}));
                 })
                 .then([&](auto&& result) mutable {
                     auto& [r1, r2] = result;
@@ -424,7 +440,7 @@ seastar::future<> runScenario05() {
                     auto [status2, result2] = r2.get0();
                     K2EXPECT(status1, dto::K23SIStatus::OK);
                     K2EXPECT(status2, dto::K23SIStatus::OK);
-                    return seastar::when_all(doRead<DataRec>(k1, m1, collname), doRead<DataRec>(k2, m2, collname));
+                    return seastar::when_all(doRead<DataRec>(k1, m1, collid()), doRead<DataRec>(k2, m2, collid()));
                 })
                 .then([&](auto&& result) mutable {
                     auto& [r1, r2] = result;
@@ -440,6 +456,73 @@ seastar::future<> runScenario05() {
         });
 }
 
+seastar::future<> runScenario06() {
+    K2INFO("Scenario 06: requests which reach another core of the node which owns the partition");
+    return seastar::do_with(
+        dto::K23SI_MTR{},
+        dto::Key{"s06-pkey1", "rkey1"},
+        [this](auto& mtr, auto& key) {
+            return getTimeNow()
+                .then([&](dto::Timestamp&& ts) {
+                    mtr.txnid = txnids++;
+                    mtr.timestamp = ts;
+                    mtr.priority = dto::TxnPriority::Medium;
+                    auto& part = _pgetter.getPartitionForKey(key);
+                    dto::K23SIWriteRequest<DataRec> request;
+                    request.pvid = part.partition->pvid;
+                    request.collectionId = collid();
+                    request.mtr = mtr;
+                    request.trh = key;
+                    request.isDelete = false;
+                    request.designateTRH = true;
+                    request.key = key;
+                    request.value.val = DataRec{"fk1", "f2"};
+                    // the request is forwarded to the owning core
+                    return RPC().callRPC<dto::K23SIWriteRequest<DataRec>, dto::K23SIWriteResponse>
+                        (dto::Verbs::K23SI_WRITE, request, otherEndpoint(part), 100ms);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(status, dto::K23SIStatus::Created);
+                    return doEnd(key, mtr, collid(), true, {key});
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(status, dto::K23SIStatus::OK);
+                    auto& part = _pgetter.getPartitionForKey(key);
+                    dto::K23SIReadRequest request {
+                        .pvid = part.partition->pvid,
+                        .collectionId = collid(),
+                        .mtr = mtr,
+                        .key = key
+                    };
+                    return RPC().callRPC<dto::K23SIReadRequest, dto::K23SIReadResponse<DataRec>>
+                        (dto::Verbs::K23SI_READ, request, otherEndpoint(part), 100ms);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(status, dto::K23SIStatus::OK);
+                    DataRec d1{"fk1", "f2"};
+                    K2EXPECT(r.value.val, d1);
+                    // a stale partition version is not forwarded: the client has to refresh
+                    auto& part = _pgetter.getPartitionForKey(key);
+                    dto::K23SIReadRequest request {
+                        .pvid = part.partition->pvid,
+                        .collectionId = collid(),
+                        .mtr = mtr,
+                        .key = key
+                    };
+                    request.pvid.rangeVersion++;
+                    return RPC().callRPC<dto::K23SIReadRequest, dto::K23SIReadResponse<DataRec>>
+                        (dto::Verbs::K23SI_READ, request, otherEndpoint(part), 100ms);
+                })
+                .then([&](auto&& result) {
+                    auto& [status, r] = result;
+                    K2EXPECT(status, dto::K23SIStatus::RefreshCollection);
+                });
+        });
+}
+
 };  // class K23SITest
 } // ns k2
 
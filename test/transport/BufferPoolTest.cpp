@@ -0,0 +1,86 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+// std
+#include <thread>
+#include <vector>
+// k2
+#include <k2/transport/BufferPool.h>
+// catch
+#include "catch2/catch.hpp"
+using namespace k2;
+
+SCENARIO("test buffer pool recycling") {
+    auto& pool = BufferPool::local();
+    pool.setMaxBytes(10000);
+    auto hits = pool.hits();
+    auto misses = pool.misses();
+
+    // the buffer returns to the pool once the last reference is dropped
+    {
+        auto buf = pool.allocate(1000);
+        REQUIRE(buf.size() == 1000);
+        auto shared = buf.share();
+        buf = Binary();
+        REQUIRE(pool.bytesHeld() == 0);
+    }
+    REQUIRE(pool.misses() == misses + 1);
+    REQUIRE(pool.bytesHeld() == 1024);
+
+    // same size class is recycled
+    {
+        auto buf = pool.allocate(600);
+        REQUIRE(pool.hits() == hits + 1);
+        REQUIRE(pool.bytesHeld() == 0);
+    }
+
+    // the pool holds at most max bytes
+    {
+        std::vector<Binary> bufs;
+        for (int i = 0; i < 5; ++i) {
+            bufs.push_back(pool.allocate(4096));
+        }
+    }
+    REQUIRE(pool.bytesHeld() <= 10000);
+
+    // buffers larger than the largest size class are not pooled
+    auto held = pool.bytesHeld();
+    {
+        auto buf = pool.allocate(1 << 20);
+        REQUIRE(buf.size() == 1 << 20);
+    }
+    REQUIRE(pool.bytesHeld() == held);
+
+    // buffers dropped on another thread are not recycled
+    {
+        auto buf = pool.allocate(512);
+        std::thread([buf = std::move(buf)]() mutable { buf = Binary(); }).join();
+    }
+    REQUIRE(pool.bytesHeld() == held);
+
+    REQUIRE(pool.shrink(1) > 0);
+    pool.shrink(held);
+    REQUIRE(pool.bytesHeld() == 0);
+    pool.setMaxBytes(0);
+}
@@ -0,0 +1,262 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/appbase/Appbase.h>
+#include <k2/appbase/AppEssentials.h>
+#include <k2/transport/RPCParser.h>
+#include <seastar/core/reactor.hh>
+
+#include <random>
+
+using namespace k2;
+
+// One side of a channel: a parser and the messages it has dispatched
+struct Peer {
+    struct Message {
+        MessageMetadata metadata;
+        String data;
+    };
+
+    Peer(bool useCompression, bool useChecksum=false) : parser([] { return false; }, useChecksum, useCompression) {
+        parser.registerMessageObserver([this](Verb, MessageMetadata metadata, std::unique_ptr<Payload> payload) {
+            String data;
+            if (payload) {
+                data = String(payload->getSize(), '\0');
+                payload->seek(0);
+                K2EXPECT(payload->read(data.data(), data.size()), true);
+            }
+            received.push_back(Message{std::move(metadata), std::move(data)});
+        });
+        parser.registerParserFailureObserver([this](std::exception_ptr exc) { failure = exc; });
+    }
+
+    // feeds the given wire buffers to this peer's parser
+    void feed(std::vector<Binary>&& wire) {
+        for (auto& binary : wire) {
+            feed(std::move(binary));
+        }
+    }
+
+    void feed(Binary&& binary) {
+        parser.feed(std::move(binary));
+        while (parser.canDispatch()) {
+            parser.dispatchSome();
+        }
+    }
+
+    RPCParser parser;
+    std::vector<Message> received;
+    std::exception_ptr failure;
+};
+
+// Exercises the payload compression in the RPC parser: negotiation, round trips and corrupt compressed messages.
+// Expects --tx_compression_threshold 1024 --tx_compression_max_size 65536
+class CompressionTest {
+public:  // application lifespan
+    CompressionTest() { K2INFO("ctor"); }
+    ~CompressionTest() { K2INFO("dtor"); }
+
+    seastar::future<> gracefulStop() {
+        K2INFO("stop");
+        return seastar::make_ready_future();
+    }
+
+    seastar::future<> start() {
+        K2INFO("start");
+        _testTimer.set_callback([this] {
+            try {
+                runTest1();
+                runTest2();
+                runTest3();
+                runTest4();
+                K2INFO("======= All tests passed ========");
+                exitcode = 0;
+            } catch (std::exception& e) {
+                K2ERROR("======= Test failed with exception [" << e.what() << "] ========");
+                exitcode = -1;
+            }
+            K2INFO("======= Test ended ========");
+            seastar::engine().exit(exitcode);
+        });
+        _testTimer.arm(0ms);
+        return seastar::make_ready_future<>();
+    }
+
+    // compresses well: a repeating record
+    static String compressible(size_t size) {
+        String record = "{\"warehouse\": 17, \"district\": 4, \"name\": \"customer\", \"balance\": -10.00}";
+        String result(size, '\0');
+        for (size_t i = 0; i < size; ++i) {
+            result[i] = record[i % record.size()];
+        }
+        return result;
+    }
+
+    // doesn't compress at all
+    static String incompressible(size_t size) {
+        std::mt19937 gen(42);
+        String result(size, '\0');
+        for (auto& c : result) {
+            c = char(gen());
+        }
+        return result;
+    }
+
+    // sends the data from one peer to the other. Returns the number of bytes on the wire
+    static size_t send(Peer& from, Peer& to, const String& data) {
+        auto wire = prepare(from, data);
+        size_t wireSize = 0;
+        for (auto& binary : wire) {
+            wireSize += binary.size();
+        }
+        to.feed(std::move(wire));
+        return wireSize;
+    }
+
+    static std::vector<Binary> prepare(Peer& from, const String& data) {
+        auto payload = std::make_unique<Payload>([] { return Binary(8192); });
+        payload->skip(txconstants::MAX_HEADER_SIZE);
+        payload->write(data.data(), data.size());
+        return from.parser.prepareForSend(100, std::move(payload), MessageMetadata());
+    }
+
+    void runTest1() {
+        K2INFO(">>> Test1: no compression with a peer which hasn't enabled it");
+        Peer a(true), b(false);
+        auto data = compressible(16384);
+
+        // we advertise that we can decompress, but don't compress before the peer does the same
+        send(a, b, data);
+        K2EXPECT(b.received.size(), 1u);
+        K2EXPECT(b.received[0].metadata.isCompressCapableSet(), true);
+        K2EXPECT(b.received[0].metadata.isCompressedSet(), false);
+        K2EXPECT((b.received[0].data == data), true);
+
+        // the peer never advertises, so we never compress
+        send(b, a, data);
+        K2EXPECT(a.received.size(), 1u);
+        K2EXPECT(a.received[0].metadata.isCompressCapableSet(), false);
+        K2EXPECT(a.received[0].metadata.isCompressedSet(), false);
+        send(a, b, data);
+        K2EXPECT(b.received.size(), 2u);
+        K2EXPECT(b.received[1].metadata.isCompressedSet(), false);
+        K2EXPECT((b.received[1].data == data), true);
+        K2EXPECT(bool(a.failure), false);
+        K2EXPECT(bool(b.failure), false);
+    }
+
+    void runTest2() {
+        K2INFO(">>> Test2: compressed round trips");
+        for (bool useChecksum : {false, true}) {
+            Peer a(true, useChecksum), b(true, useChecksum);
+            auto data = compressible(16384);
+
+            // the first message is not compressed: we haven't heard from the peer yet
+            send(a, b, data);
+            K2EXPECT(b.received.back().metadata.isCompressedSet(), false);
+            K2EXPECT((b.received.back().data == data), true);
+
+            // once the peer has advertised, large payloads are compressed
+            send(b, a, "hello");
+            auto wireSize = send(a, b, data);
+            K2INFO("compressed " << data.size() << " bytes to " << wireSize << " bytes on the wire");
+            K2EXPECT((wireSize < data.size() / 4), true);
+            K2EXPECT(b.received.size(), 2u);
+            K2EXPECT(b.received.back().metadata.isCompressedSet(), true);
+            K2EXPECT((b.received.back().data == data), true);
+
+            // messages which span several wire buffers are reassembled before decompression
+            auto wire = prepare(a, compressible(60000));
+            for (auto& binary : wire) {
+                while (binary.size() > 100) {
+                    b.feed(binary.share(0, 100));
+                    binary.trim_front(100);
+                }
+                b.feed(std::move(binary));
+            }
+            K2EXPECT(b.received.size(), 3u);
+            K2EXPECT(b.received.back().metadata.isCompressedSet(), true);
+            K2EXPECT((b.received.back().data == compressible(60000)), true);
+            K2EXPECT(bool(a.failure), false);
+            K2EXPECT(bool(b.failure), false);
+        }
+    }
+
+    void runTest3() {
+        K2INFO(">>> Test3: payloads which are sent uncompressed to a peer which can decompress");
+        Peer a(true), b(true);
+        send(b, a, "hello");
+
+        // too small to be worth it
+        send(a, b, compressible(1000));
+        K2EXPECT(b.received.back().metadata.isCompressedSet(), false);
+        K2EXPECT((b.received.back().data == compressible(1000)), true);
+
+        // doesn't compress
+        send(a, b, incompressible(16384));
+        K2EXPECT(b.received.back().metadata.isCompressedSet(), false);
+        K2EXPECT((b.received.back().data == incompressible(16384)), true);
+
+        // too large to compress on the reactor
+        send(a, b, compressible(65537));
+        K2EXPECT(b.received.back().metadata.isCompressedSet(), false);
+        K2EXPECT((b.received.back().data == compressible(65537)), true);
+
+        // the largest size we compress
+        send(a, b, compressible(65536));
+        K2EXPECT(b.received.back().metadata.isCompressedSet(), true);
+        K2EXPECT((b.received.back().data == compressible(65536)), true);
+        K2EXPECT(b.received.size(), 4u);
+        K2EXPECT(bool(b.failure), false);
+    }
+
+    void runTest4() {
+        K2INFO(">>> Test4: compressed messages with a corrupt uncompressed size fail the stream");
+        // the uncompressed size is the last header field when there is no checksum and no request/response ID
+        const size_t sizeOffset = sizeof(FixedHeader) + sizeof(MessageMetadata::payloadSize);
+        auto data = compressible(16384);
+        for (uint32_t badSize : {uint32_t(16383), uint32_t(16385), uint32_t(16384 * 1000), UINT32_MAX}) {
+            Peer a(true), b(true);
+            send(b, a, "hello");
+            auto wire = prepare(a, data);
+            uint32_t size = 0;
+            std::memcpy(&size, wire[0].get() + sizeOffset, sizeof(size));
+            K2EXPECT(size, uint32_t(16384));
+            std::memcpy(wire[0].get_write() + sizeOffset, &badSize, sizeof(badSize));
+
+            b.feed(std::move(wire));
+            K2EXPECT(b.received.size(), 0u);
+            K2EXPECT(bool(b.failure), true);
+        }
+    }
+
+private:
+    int exitcode = -1;
+    seastar::timer<> _testTimer;
+};
+
+int main(int argc, char** argv) {
+    App app("CompressionTest");
+    app.addApplet<CompressionTest>();
+    return app.start(argc, argv);
+}
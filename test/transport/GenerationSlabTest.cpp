@@ -0,0 +1,106 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+// stl
+#include <set>
+// k2
+#include <k2/transport/GenerationSlab.h>
+// catch
+#include "catch2/catch.hpp"
+using namespace k2;
+
+SCENARIO("test generation slab add, find and release") {
+    GenerationSlab<int> slab;
+    REQUIRE(slab.size() == 0);
+    REQUIRE(!slab.full());
+
+    auto a = slab.add(1);
+    auto b = slab.add(2);
+    REQUIRE(a != b);
+    REQUIRE(slab.size() == 2);
+    REQUIRE(*slab.find(a) == 1);
+    REQUIRE(*slab.find(b) == 2);
+
+    REQUIRE(slab.release(a) == 1);
+    REQUIRE(slab.size() == 1);
+    REQUIRE(slab.find(a) == nullptr);
+    REQUIRE(*slab.find(b) == 2);
+
+    // ids of slots which were never handed out are not found
+    REQUIRE(slab.find(12345) == nullptr);
+
+    int sum = 0;
+    slab.forEach([&sum](int& value) { sum += value; });
+    REQUIRE(sum == 2);
+
+    slab.clear();
+    REQUIRE(slab.size() == 0);
+    REQUIRE(slab.find(b) == nullptr);
+}
+
+SCENARIO("test generation slab reuse") {
+    GenerationSlab<int> slab;
+    auto first = slab.add(1);
+    slab.release(first);
+
+    // the slot is reused with a new generation, so the stale id doesn't find the new value
+    auto second = slab.add(2);
+    REQUIRE((second & GenerationSlab<int>::INDEX_MASK) == (first & GenerationSlab<int>::INDEX_MASK));
+    REQUIRE(second != first);
+    REQUIRE(slab.find(first) == nullptr);
+    REQUIRE(*slab.find(second) == 2);
+
+    // released slots are reused least recently released first
+    auto c = slab.add(3);
+    auto d = slab.add(4);
+    slab.release(c);
+    slab.release(d);
+    auto e = slab.add(5);
+    REQUIRE((e & GenerationSlab<int>::INDEX_MASK) == (c & GenerationSlab<int>::INDEX_MASK));
+}
+
+SCENARIO("test generation slab generations wrap around") {
+    GenerationSlab<int> slab;
+    auto first = slab.add(0);
+    slab.release(first);
+    // a slot goes through all of its generations before an id repeats
+    const uint32_t generations = UINT32_MAX >> GenerationSlab<int>::INDEX_BITS;
+    std::set<uint32_t> ids{first};
+    for (uint32_t i = 0; i < generations; ++i) {
+        auto id = slab.add(int(i));
+        REQUIRE(ids.insert(id).second);
+        slab.release(id);
+    }
+    REQUIRE(ids.count(slab.add(0)) == 1);
+}
+
+SCENARIO("test generation slab capacity") {
+    GenerationSlab<char> slab;
+    for (size_t i = 0; i < GenerationSlab<char>::MAX_SIZE; ++i) {
+        REQUIRE(!slab.full());
+        slab.add('x');
+    }
+    REQUIRE(slab.full());
+    REQUIRE(slab.size() == GenerationSlab<char>::MAX_SIZE);
+}
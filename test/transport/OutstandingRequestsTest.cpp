@@ -0,0 +1,87 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+// k2
+#include <k2/transport/OutstandingRequests.h>
+// catch
+#include "catch2/catch.hpp"
+using namespace k2;
+
+SCENARIO("test outstanding requests with responses") {
+    OutstandingRequests reqs;
+    auto now = Clock::now();
+    reqs.add(1, now);
+    reqs.add(2, now + 1ms);
+    reqs.add(3, now + 2ms);
+    REQUIRE(reqs.size() == 3);
+
+    // responses can arrive in any order
+    REQUIRE(reqs.remove(2));
+    REQUIRE(reqs.size() == 2);
+    REQUIRE(reqs.remove(1));
+    REQUIRE(reqs.remove(3));
+    REQUIRE(reqs.size() == 0);
+
+    // unknown and duplicate responses(e.g. multiple stream frames) are ignored
+    REQUIRE(!reqs.remove(3));
+    REQUIRE(!reqs.remove(42));
+    REQUIRE(reqs.size() == 0);
+}
+
+SCENARIO("test outstanding requests which time out") {
+    OutstandingRequests reqs;
+    auto now = Clock::now();
+    reqs.add(1, now);
+    reqs.add(2, now + 10ms);
+    reqs.add(3, now + 20ms);
+
+    // the response for the first request never arrives. It no longer counts once it expires
+    REQUIRE(reqs.remove(2));
+    reqs.expire(now + 5ms);
+    REQUIRE(reqs.size() == 1);
+
+    // a late response for the expired request is ignored
+    REQUIRE(!reqs.remove(1));
+    REQUIRE(reqs.size() == 1);
+
+    // nothing is outstanding after all requests time out
+    reqs.expire(now + 30ms);
+    REQUIRE(reqs.size() == 0);
+    REQUIRE(!reqs.remove(3));
+}
+
+SCENARIO("test outstanding requests with reused IDs") {
+    OutstandingRequests reqs;
+    auto now = Clock::now();
+    reqs.add(1, now);
+    reqs.add(2, now + 1ms);
+    REQUIRE(reqs.remove(2));
+
+    // the ID of the answered request is reused. Expiring the old entry must not drop the new request
+    reqs.add(2, now + 20ms);
+    reqs.expire(now + 10ms);
+    REQUIRE(reqs.size() == 1);
+    REQUIRE(reqs.remove(2));
+    REQUIRE(reqs.size() == 0);
+}
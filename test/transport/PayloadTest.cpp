@@ -26,6 +26,7 @@ Copyright(c) 2020 Futurewei Cloud
 #include <k2/transport/Payload.h>
 #include <k2/common/Common.h>
 #include <k2/transport/PayloadSerialization.h>
+#include <k2/dto/Collection.h>
 // catch
 #include "catch2/catch.hpp"
 using namespace k2;
@@ -282,3 +283,295 @@ SCENARIO("rpc parsing") {
     RPCParser([] { return false; }, true) parseCRC;
 }
 */
+
+struct keyView {
+    PayloadStringView a;
+    PayloadStringView b;
+    K2_PAYLOAD_FIELDS(a, b);
+};
+
+SCENARIO("test zero-copy string views") {
+    // buffer size chosen so that the second string spans two buffers
+    Payload dst([] { return Binary(16); });
+    String a("short");
+    String b("this one spans buffers");
+    embeddedComplex cmplx{.a=a, .b=1, .c='c'};
+    dst.write(a);
+    dst.write(b);
+    dst.write(cmplx);
+    dst.write(b);
+    dst.write(a);
+
+    dst.seek(0);
+    std::string_view va;
+    REQUIRE(dst.read(va));
+    REQUIRE(va == std::string_view(a.data(), a.size()));
+
+    // doesn't fit in the current buffer: fail and keep the position
+    auto pos = dst.getCurrentPosition().offset;
+    std::string_view vb;
+    REQUIRE(!dst.read(vb));
+    REQUIRE(dst.getCurrentPosition().offset == pos);
+
+    // the view falls back to copy
+    PayloadStringView pvb;
+    REQUIRE(dst.read(pvb));
+    REQUIRE(pvb == std::string_view(b.data(), b.size()));
+    REQUIRE(pvb.toString() == b);
+
+    // views have the same wire format as strings
+    keyView kv;
+    dst.seek(pos);
+    REQUIRE(dst.read(kv));
+    REQUIRE(kv.a.toString() == b);
+    REQUIRE(kv.b.toString() == a);
+
+    PayloadStringView shared;
+    {
+        Payload src([] { return Binary(64); });
+        src.write(b);
+        src.seek(0);
+        REQUIRE(src.read(shared));
+    }
+    // the shared buffer outlives the payload
+    REQUIRE(shared.toString() == b);
+
+    // write a view back
+    Payload dst2([] { return Binary(16); });
+    dst2.write(shared);
+    dst2.write(kv);
+    dst2.seek(0);
+    String sb, sc, sa;
+    REQUIRE(dst2.read(sb));
+    REQUIRE(dst2.read(sc));
+    REQUIRE(dst2.read(sa));
+    REQUIRE(sb == b);
+    REQUIRE(sc == b);
+    REQUIRE(sa == a);
+}
+
+SCENARIO("test payload slice") {
+    Payload dst([] { return Binary(7); });
+    String s(100, 'x');
+    dst.write(s);
+    dst.write(uint32_t(42));
+
+    dst.seek(0);
+    Payload slice;
+    REQUIRE(dst.readSlice(slice, dst.getSize() - sizeof(uint32_t)));
+    REQUIRE(slice.getSize() == dst.getSize() - sizeof(uint32_t));
+    String parsed;
+    REQUIRE(slice.read(parsed));
+    REQUIRE(parsed == s);
+    REQUIRE(slice.getDataRemaining() == 0);
+
+    uint32_t val = 0;
+    REQUIRE(dst.read(val));
+    REQUIRE(val == 42);
+
+    // not enough data
+    Payload tooBig;
+    REQUIRE(!dst.readSlice(tooBig, 1));
+}
+
+SCENARIO("test embedded payload") {
+    Payload dst([] { return Binary(7); });
+    Payload embedded([] { return Binary(11); });
+    String s(100, 'x');
+    embedded.write(s);
+    dst.write(embedded);
+    dst.write(uint32_t(42));
+
+    // the embedded payload spans multiple buffers
+    dst.seek(0);
+    Payload parsedPayload;
+    REQUIRE(dst.read(parsedPayload));
+    REQUIRE(parsedPayload.getSize() == embedded.getSize());
+    String parsed;
+    REQUIRE(parsedPayload.read(parsed));
+    REQUIRE(parsed == s);
+    REQUIRE(parsedPayload.getDataRemaining() == 0);
+
+    uint32_t val = 0;
+    REQUIRE(dst.read(val));
+    REQUIRE(val == 42);
+
+    // not enough data: fail and keep the position
+    Payload truncated([] { return Binary(7); });
+    truncated.write(size_t(1000));
+    truncated.seek(0);
+    Payload tooBig;
+    REQUIRE(!truncated.read(tooBig));
+    REQUIRE(truncated.getCurrentPosition().offset == 0);
+}
+
+SCENARIO("test key views") {
+    dto::Key key{.partitionKey="a partition key which spans buffers", .rangeKey="rkey"};
+    Payload dst([] { return Binary(16); });
+    dst.write(key);
+
+    // a Key is read as a KeyView without copying the strings out of the payload
+    dst.seek(0);
+    dto::KeyView view;
+    REQUIRE(dst.read(view));
+    REQUIRE(dst.getDataRemaining() == 0);
+    REQUIRE(view == key);
+    REQUIRE(view.compare(key) == 0);
+    REQUIRE(view.partitionHash() == key.partitionHash());
+    REQUIRE(view.toKey() == key);
+
+    dto::Key bigger{.partitionKey=key.partitionKey, .rangeKey="rkey2"};
+    REQUIRE(view.compare(bigger) < 0);
+    REQUIRE(!(view == bigger));
+
+    // and written back as a Key
+    Payload dst2([] { return Binary(16); });
+    dst2.write(view);
+    dst2.seek(0);
+    dto::Key parsed;
+    REQUIRE(dst2.read(parsed));
+    REQUIRE(parsed == key);
+}
+
+// a hand-written serialization whose size doesn't match what it writes
+struct badSize {
+    uint32_t a = 1;
+    struct __K2PayloadSerializableTraitTag__ {};
+    void __writeFields(k2::Payload& payload) const { payload.write(a); }
+    bool __readFields(k2::Payload& payload) { return payload.read(a); }
+    template <bool Compact = false>
+    size_t __getFieldsSize() const { return sizeof(a) + 1; }
+};
+
+SCENARIO("test SerializeAsPayload size mismatch") {
+    // this must fail in release builds too, as the size prefix would make the message unparseable
+    Payload dst([] { return Binary(64); });
+    SerializeAsPayload<badSize> bad{.val=badSize{}};
+    REQUIRE_THROWS_AS(dst.write(bad), std::runtime_error);
+
+    // same in the compact encoding, where the size prefix is a varint
+    Payload compact([] { return Binary(64); });
+    compact.setCompactEncoding(true);
+    REQUIRE_THROWS_AS(compact.write(bad), std::runtime_error);
+}
+
+SCENARIO("test serialized size and fused writes") {
+    // small buffers so that runs of fixed size fields span buffer boundaries
+    for (size_t allocSize : {3, 7, 16, 8192}) {
+        Payload dst([allocSize] { return Binary(allocSize); });
+        auto src = makeData(1, 2, 'x', 3, 'y', 4, "za", 5, 'z', "payload", "dd", 5, 6ms);
+        std::vector<embeddedSimple> simples{embeddedSimple{.a = 1, .b = 'a', .c = 2}, embeddedSimple{.a = 3, .b = 'b', .c = 4}};
+        std::map<String, uint32_t> m{{"a", 1}, {"bb", 2}};
+
+        size_t expected = Payload::getSerializedSizeOfMany(src, simples, m);
+        dst.reserveFor(src, simples, m);
+        REQUIRE(dst.getCapacity() >= expected);
+        dst.writeMany(src, simples, m);
+        REQUIRE(dst.getSize() == expected);
+
+        dst.seek(0);
+        data<embeddedComplex> parsed;
+        std::vector<embeddedSimple> parsedSimples;
+        std::map<String, uint32_t> parsedM;
+        REQUIRE(dst.readMany(parsed, parsedSimples, parsedM));
+        REQUIRE(parsed == src);
+        REQUIRE(parsedSimples == simples);
+        REQUIRE(parsedM == m);
+        REQUIRE(dst.getDataRemaining() == 0);
+
+        // a fused read which runs past the end fails
+        Payload small([allocSize] { return Binary(allocSize); });
+        uint32_t a = 1;
+        uint8_t b = 2;
+        uint64_t c = 0;
+        small.writeMany(a, b);
+        small.seek(0);
+        REQUIRE(!small.readMany(a, b, c));
+    }
+}
+
+enum class smallEnum : uint16_t { A = 1, B = 300 };
+
+struct compactData {
+    int64_t neg = 0;
+    uint64_t big = 0;
+    uint32_t small = 0;
+    smallEnum e = smallEnum::A;
+    bool flag = false;
+    double d = 0;
+    Duration dur{0};
+    String s;
+    std::vector<uint64_t> vec;
+    std::map<String, int32_t> m;
+    SerializeAsPayload<embeddedComplex> w;
+    embeddedSimple copyable;
+    K2_PAYLOAD_FIELDS(neg, big, small, e, flag, d, dur, s, vec, m, w, copyable);
+    bool operator==(const compactData& o) const {
+        return neg == o.neg && big == o.big && small == o.small && e == o.e && flag == o.flag && d == o.d &&
+               dur == o.dur && s == o.s && vec == o.vec && m == o.m && w.val == o.w.val && copyable == o.copyable;
+    }
+};
+
+SCENARIO("test compact encoding") {
+    compactData src;
+    src.neg = -5;
+    src.big = std::numeric_limits<uint64_t>::max();
+    src.small = 42;
+    src.e = smallEnum::B;
+    src.flag = true;
+    src.d = 1.5;
+    src.dur = 10ms;
+    src.s = "hello";
+    src.vec = {0, 127, 128, 1ull << 40};
+    src.m = {{"a", -1}, {"b", std::numeric_limits<int32_t>::min()}};
+    src.w.val = embeddedComplex{.a = "embedded", .b = -300, .c = 'c'};
+    src.copyable = embeddedSimple{.a = 1, .b = 'b', .c = 2};
+
+    for (size_t allocSize : {3, 7, 8192}) {
+        Payload fixed([allocSize] { return Binary(allocSize); });
+        fixed.write(src);
+
+        Payload compact([allocSize] { return Binary(allocSize); });
+        compact.setCompactEncoding(true);
+        REQUIRE(compact.isCompactEncoding());
+        compact.reserveFor(src);
+        compact.write(src);
+        REQUIRE(compact.getSize() == Payload::getSerializedSizeOf<true>(src));
+        REQUIRE(compact.getSize() < fixed.getSize());
+
+        // the encoding is carried over to shared payloads
+        Payload shared = compact.share();
+        REQUIRE(shared.isCompactEncoding());
+        compactData parsed;
+        REQUIRE(shared.read(parsed));
+        REQUIRE(parsed == src);
+        REQUIRE(shared.getDataRemaining() == 0);
+
+        // zero-copy views work in the compact encoding too
+        compact.seek(0);
+        compact.write(src.s);
+        compact.seek(0);
+        PayloadStringView view;
+        REQUIRE(compact.read(view));
+        REQUIRE(view == src.s);
+    }
+
+    // values which don't fit the target type fail to parse and leave the position unmodified
+    Payload compact([] { return Binary(8192); });
+    compact.setCompactEncoding(true);
+    compact.write(uint64_t(1) << 40);
+    compact.seek(0);
+    uint32_t narrow = 0;
+    REQUIRE(!compact.read(narrow));
+    REQUIRE(compact.getCurrentPosition().offset == 0);
+    uint64_t wide = 0;
+    REQUIRE(compact.read(wide));
+    REQUIRE(wide == uint64_t(1) << 40);
+
+    // truncated varints fail to parse
+    Payload truncated([] { return Binary(8192); });
+    truncated.write(char(0x80));
+    truncated.setCompactEncoding(true);
+    truncated.seek(0);
+    REQUIRE(!truncated.read(wide));
+}
@@ -0,0 +1,189 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/appbase/Appbase.h>
+#include <k2/appbase/AppEssentials.h>
+#include <k2/transport/TCPRPCProtocol.h>
+#include <seastar/core/reactor.hh>
+
+using namespace k2;
+
+// The marker is not serialized, so the server only sees it if the request was delivered in-process
+struct LoopbackRequest {
+    uint64_t value = 0;
+    uint64_t marker = 0;
+    K2_PAYLOAD_FIELDS(value);
+    K2_RPC_LOOPBACK_SAFE;
+};
+
+// Same as above, but not marked as safe for in-process delivery
+struct PlainRequest {
+    uint64_t value = 0;
+    uint64_t marker = 0;
+    K2_PAYLOAD_FIELDS(value);
+};
+
+struct LoopbackResponse {
+    uint64_t value = 0;
+    uint64_t marker = 0;
+    uint64_t core = 0;
+    uint64_t calls = 0;
+    K2_PAYLOAD_FIELDS(value, marker, core, calls);
+    K2_RPC_LOOPBACK_SAFE;
+};
+
+// Exercises the in-process delivery of RPCs to the endpoints of this process. Needs 2 cores and rpc_loopback
+class RPCLoopbackTest {
+public:  // types
+    enum Verbs : Verb {
+        LOOPBACK = 100,
+        PLAIN = 101
+    };
+
+public:  // application lifespan
+    RPCLoopbackTest() { K2INFO("ctor"); }
+    ~RPCLoopbackTest() { K2INFO("dtor"); }
+
+    seastar::future<> gracefulStop() {
+        K2INFO("stop");
+        return std::move(_testFuture);
+    }
+
+    seastar::future<> start() {
+        K2INFO("start");
+        // the observer counts its calls, so that we can tell if the dispatch table and the in-process path share it
+        RPC().registerRPCObserver<LoopbackRequest, LoopbackResponse>(LOOPBACK,
+            [calls=uint64_t(0)](LoopbackRequest&& request) mutable {
+                calls++;
+                return RPCResponse(Statuses::S200_OK("loopback"),
+                    LoopbackResponse{.value=request.value, .marker=request.marker, .core=seastar::engine().cpu_id(), .calls=calls});
+            });
+        RPC().registerRPCObserver<PlainRequest, LoopbackResponse>(PLAIN, [](PlainRequest&& request) {
+            return RPCResponse(Statuses::S200_OK("plain"),
+                LoopbackResponse{.value=request.value, .marker=request.marker, .core=seastar::engine().cpu_id(), .calls=0});
+        });
+        if (seastar::engine().cpu_id() != 0) {
+            return seastar::make_ready_future<>();
+        }
+        if (seastar::smp::count < 2) {
+            return seastar::make_exception_future<>(std::runtime_error("the test needs 2 cores"));
+        }
+
+        // let start() finish on all cores and then run the tests
+        _testTimer.set_callback([this] {
+            _testFuture = seastar::smp::submit_to(1, [] {
+                return RPC().getServerEndpoint(TCPRPCProtocol::proto)->getURL();
+            })
+            .then([this](String&& url) {
+                _remoteEndpoint = RPC().getTXEndpoint(url);
+                K2EXPECT(bool(_remoteEndpoint), true);
+                return runTest1();
+            })
+            .then([this] { return runTest2(); })
+            .then([this] { return runTest3(); })
+            .then([this] {
+                K2INFO("======= All tests passed ========");
+                exitcode = 0;
+            })
+            .handle_exception([this](auto exc) {
+                try {
+                    std::rethrow_exception(exc);
+                } catch (std::exception& e) {
+                    K2ERROR("======= Test failed with exception [" << e.what() << "] ========");
+                    exitcode = -1;
+                }
+            })
+            .finally([this] {
+                K2INFO("======= Test ended ========");
+                seastar::engine().exit(exitcode);
+            });
+        });
+        _testTimer.arm(0ms);
+        return seastar::make_ready_future<>();
+    }
+
+    seastar::future<> runTest1() {
+        K2INFO(">>> Test1: the request is delivered on the serving core, without serialization");
+        LoopbackRequest request{.value=1, .marker=42};
+        return RPC().callRPC<LoopbackRequest, LoopbackResponse>(LOOPBACK, request, *_remoteEndpoint, 1s)
+        .then([](auto&& result) {
+            auto& [status, response] = result;
+            K2EXPECT(status, Statuses::S200_OK);
+            K2EXPECT(response.value, 1u);
+            K2EXPECT(response.marker, 42u);
+            K2EXPECT(response.core, 1u);
+        });
+    }
+
+    seastar::future<> runTest2() {
+        K2INFO(">>> Test2: types which don't opt in are serialized");
+        PlainRequest request{.value=2, .marker=42};
+        return RPC().callRPC<PlainRequest, LoopbackResponse>(PLAIN, request, *_remoteEndpoint, 1s)
+        .then([](auto&& result) {
+            auto& [status, response] = result;
+            K2EXPECT(status, Statuses::S200_OK);
+            K2EXPECT(response.value, 2u);
+            K2EXPECT(response.marker, 0u);
+            K2EXPECT(response.core, 1u);
+        });
+    }
+
+    seastar::future<> runTest3() {
+        K2INFO(">>> Test3: the network and in-process paths use the same observer");
+        // send a serialized request, which goes through the dispatch table on the serving core
+        LoopbackRequest request{.value=3};
+        auto payload = _remoteEndpoint->newPayload();
+        payload->write(request);
+        return RPC().sendRequest(LOOPBACK, std::move(payload), *_remoteEndpoint, 1s)
+        .then([](std::unique_ptr<Payload>&& responsePayload) {
+            Status status;
+            LoopbackResponse response;
+            K2EXPECT(responsePayload->read(status), true);
+            K2EXPECT(responsePayload->read(response), true);
+            K2EXPECT(status, Statuses::S200_OK);
+            return response.calls;
+        })
+        .then([this](uint64_t callsBefore) {
+            LoopbackRequest request{.value=4, .marker=42};
+            return RPC().callRPC<LoopbackRequest, LoopbackResponse>(LOOPBACK, request, *_remoteEndpoint, 1s)
+            .then([callsBefore](auto&& result) {
+                auto& [status, response] = result;
+                K2EXPECT(status, Statuses::S200_OK);
+                K2EXPECT(response.marker, 42u);
+                K2EXPECT(response.calls, callsBefore + 1);
+            });
+        });
+    }
+
+private:
+    int exitcode = -1;
+    std::unique_ptr<TXEndpoint> _remoteEndpoint;
+    seastar::future<> _testFuture = seastar::make_ready_future();
+    seastar::timer<> _testTimer;
+};
+
+int main(int argc, char** argv) {
+    App app("RPCLoopbackTest");
+    app.addApplet<RPCLoopbackTest>();
+    return app.start(argc, argv);
+}
@@ -0,0 +1,257 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/appbase/Appbase.h>
+#include <k2/appbase/AppEssentials.h>
+#include <k2/transport/RPCStream.h>
+#include <k2/transport/TCPRPCProtocol.h>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/sleep.hh>
+
+using namespace k2;
+
+// the messages used by the test streams
+struct StreamRequest {
+    uint64_t count = 0;
+    K2_PAYLOAD_FIELDS(count);
+};
+
+struct StreamFrame {
+    uint64_t value = 0;
+    K2_PAYLOAD_FIELDS(value);
+};
+
+// Exercises streaming RPCs over the loopback of the TCP server endpoint
+class RPCStreamTest {
+public:  // types
+    enum Verbs : Verb {
+        // sends `count` frames and completes
+        COUNT = 100,
+        // sends frames until the client cancels
+        ENDLESS = 101,
+        // doesn't send anything for a while, as if the server had gone away
+        STALL = 102
+    };
+
+public:  // application lifespan
+    RPCStreamTest() { K2INFO("ctor"); }
+    ~RPCStreamTest() { K2INFO("dtor"); }
+
+    seastar::future<> gracefulStop() {
+        K2INFO("stop");
+        return std::move(_testFuture);
+    }
+
+    seastar::future<> start() {
+        K2INFO("start");
+        _serverEndpoint = RPC().getServerEndpoint(TCPRPCProtocol::proto);
+        if (!_serverEndpoint) {
+            return seastar::make_exception_future<>(std::runtime_error("the test needs a TCP endpoint"));
+        }
+        _registerObservers();
+
+        // let start() finish and then run the tests
+        _testTimer.set_callback([this] {
+            _testFuture = runTest1()
+            .then([this] { return runTest2(); })
+            .then([this] { return runTest3(); })
+            .then([this] { return runTest4(); })
+            .then([this] { return runTest5(); })
+            .then([this] {
+                K2INFO("======= All tests passed ========");
+                exitcode = 0;
+            })
+            .handle_exception([this](auto exc) {
+                try {
+                    std::rethrow_exception(exc);
+                } catch (std::exception& e) {
+                    K2ERROR("======= Test failed with exception [" << e.what() << "] ========");
+                    exitcode = -1;
+                }
+            })
+            .finally([this] {
+                // let the stalled handlers complete before we shut down
+                return _waitFor([this] { return _stalledStreams == 0; }, 5s).handle_exception([](auto) {});
+            })
+            .finally([this] {
+                K2INFO("======= Test ended ========");
+                seastar::engine().exit(exitcode);
+            });
+        });
+        _testTimer.arm(0ms);
+        return seastar::make_ready_future<>();
+    }
+
+    seastar::future<> runTest1() {
+        K2INFO(">>> Test1: read a stream to completion");
+        StreamRequest request{.count=10};
+        // use few credits so that the server has to wait for us
+        auto reader = RPC().callStreamRPC<StreamRequest, StreamFrame>(COUNT, request, *_serverEndpoint, 1s, 2);
+        return seastar::do_with(std::move(reader), uint64_t(0), [](auto& reader, auto& expected) {
+            return seastar::repeat([&reader, &expected] {
+                return reader.next().then([&reader, &expected](auto&& frame) {
+                    if (!frame) {
+                        K2EXPECT(expected, 10u);
+                        K2EXPECT(reader.getStatus(), Statuses::S200_OK);
+                        return seastar::stop_iteration::yes;
+                    }
+                    K2EXPECT(frame->value, expected);
+                    expected++;
+                    return seastar::stop_iteration::no;
+                });
+            });
+        });
+    }
+
+    seastar::future<> runTest2() {
+        K2INFO(">>> Test2: cancel a stream");
+        StreamRequest request{};
+        auto cancelledBefore = _cancelledStreams;
+        auto reader = RPC().callStreamRPC<StreamRequest, StreamFrame>(ENDLESS, request, *_serverEndpoint, 1s, 2);
+        return seastar::do_with(std::move(reader), [this, cancelledBefore](auto& reader) {
+            return reader.next()
+            .then([&reader](auto&& frame) {
+                K2EXPECT(bool(frame), true);
+                return reader.next();
+            })
+            .then([&reader](auto&& frame) {
+                K2EXPECT(bool(frame), true);
+                reader.cancel();
+                return reader.next();
+            })
+            .then([&reader](auto&& frame) {
+                K2EXPECT(bool(frame), false);
+                K2EXPECT(reader.getStatus(), Statuses::S499_Client_Closed_Request);
+            })
+            .then([this, cancelledBefore] {
+                // the server should see the cancellation
+                return _waitFor([this, cancelledBefore] { return _cancelledStreams > cancelledBefore; }, 1s);
+            });
+        });
+    }
+
+    seastar::future<> runTest3() {
+        K2INFO(">>> Test3: drop a reader without cancelling it");
+        StreamRequest request{};
+        auto cancelledBefore = _cancelledStreams;
+        auto reader = RPC().callStreamRPC<StreamRequest, StreamFrame>(ENDLESS, request, *_serverEndpoint, 1s, 2);
+        return seastar::do_with(std::move(reader), [](auto& reader) {
+            return reader.next().then([](auto&& frame) {
+                K2EXPECT(bool(frame), true);
+            });
+        })
+        .then([this, cancelledBefore] {
+            // the reader is gone. The server should see the stream cancelled
+            return _waitFor([this, cancelledBefore] { return _cancelledStreams > cancelledBefore; }, 1s);
+        });
+    }
+
+    seastar::future<> runTest4() {
+        K2INFO(">>> Test4: the server goes away while we're waiting for a frame");
+        StreamRequest request{};
+        auto reader = RPC().callStreamRPC<StreamRequest, StreamFrame>(STALL, request, *_serverEndpoint, 100ms);
+        return seastar::do_with(std::move(reader), [](auto& reader) {
+            return reader.next().then([&reader](auto&& frame) {
+                K2EXPECT(bool(frame), false);
+                K2EXPECT(reader.getStatus(), Statuses::S503_Service_Unavailable);
+            });
+        });
+    }
+
+    seastar::future<> runTest5() {
+        K2INFO(">>> Test5: the server goes away while we're not reading");
+        StreamRequest request{};
+        auto reader = RPC().callStreamRPC<StreamRequest, StreamFrame>(STALL, request, *_serverEndpoint, 100ms);
+        return seastar::do_with(std::move(reader), [](auto& reader) {
+            // the stream should expire on its own, without a pending next()
+            return seastar::sleep(300ms).then([&reader] {
+                return reader.next();
+            })
+            .then([&reader](auto&& frame) {
+                K2EXPECT(bool(frame), false);
+                K2EXPECT(reader.getStatus(), Statuses::S503_Service_Unavailable);
+            });
+        });
+    }
+
+private:
+    void _registerObservers() {
+        RPC().registerStreamRPCObserver<StreamRequest, StreamFrame>(COUNT,
+            [](StreamRequest&& request, RPCStreamWriter<StreamFrame> writer) {
+                return seastar::do_with(std::move(writer), uint64_t(0), [count=request.count](auto& writer, auto& value) {
+                    return seastar::do_until([&value, count] { return value == count; }, [&writer, &value] {
+                        return writer.write(StreamFrame{.value=value++});
+                    })
+                    .then([] { return Statuses::S200_OK("stream completed"); });
+                });
+            });
+
+        RPC().registerStreamRPCObserver<StreamRequest, StreamFrame>(ENDLESS,
+            [this](StreamRequest&&, RPCStreamWriter<StreamFrame> writer) {
+                return seastar::do_with(std::move(writer), uint64_t(0), [this](auto& writer, auto& value) {
+                    return seastar::repeat([&writer, &value] {
+                        return writer.write(StreamFrame{.value=value++}).then([] { return seastar::stop_iteration::no; });
+                    })
+                    .handle_exception_type([this](StreamCancelledException&) { _cancelledStreams++; })
+                    .then([] { return Statuses::S200_OK("stream cancelled"); });
+                });
+            });
+
+        RPC().registerStreamRPCObserver<StreamRequest, StreamFrame>(STALL,
+            [this](StreamRequest&&, RPCStreamWriter<StreamFrame>) {
+                _stalledStreams++;
+                return seastar::sleep(500ms).then([this] {
+                    _stalledStreams--;
+                    return Statuses::S200_OK("stall completed");
+                });
+            });
+    }
+
+    // polls the given condition until it is true, or fails once the timeout expires
+    template <class Func>
+    seastar::future<> _waitFor(Func&& cond, Duration timeout) {
+        auto deadline = Clock::now() + timeout;
+        return seastar::repeat([cond=std::forward<Func>(cond), deadline] () mutable {
+            if (cond()) {
+                return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+            }
+            if (Clock::now() > deadline) {
+                return seastar::make_exception_future<seastar::stop_iteration>(std::runtime_error("timed out waiting for condition"));
+            }
+            return seastar::sleep(1ms).then([] { return seastar::stop_iteration::no; });
+        });
+    }
+
+    int exitcode = -1;
+    seastar::lw_shared_ptr<TXEndpoint> _serverEndpoint;
+    uint64_t _cancelledStreams = 0;
+    uint64_t _stalledStreams = 0;
+    seastar::future<> _testFuture = seastar::make_ready_future();
+    seastar::timer<> _testTimer;
+};
+
+int main(int argc, char** argv) {
+    App app("RPCStreamTest");
+    app.addApplet<RPCStreamTest>();
+    return app.start(argc, argv);
+}
@@ -0,0 +1,247 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+// Serialization microbenchmark for the K23SI DTOs.
+// Reports ns/message for writing (with and without precomputed size reservation) and reading each message type,
+// and the message size and ns/message in the compact encoding. It also compares reading a Key by copy and as a
+// zero-copy KeyView
+// Usage: serialization_bench [iterations]
+#include <k2/common/Common.h>
+#include <k2/dto/K23SI.h>
+#include <k2/transport/Payload.h>
+#include <k2/transport/PayloadSerialization.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+using namespace k2;
+
+static const size_t allocSize = 8192;
+
+struct BenchValue {
+    String data;
+    uint64_t version = 0;
+    K2_PAYLOAD_FIELDS(data, version);
+    bool operator==(const BenchValue& o) const { return data == o.data && version == o.version; }
+};
+
+dto::K23SI_MTR makeMTR(uint64_t txnid) {
+    dto::K23SI_MTR mtr;
+    mtr.txnid = txnid;
+    mtr.timestamp = dto::Timestamp(100000055, 123, 1000);
+    mtr.priority = dto::TxnPriority::Medium;
+    return mtr;
+}
+
+dto::Key makeKey(size_t i) {
+    return dto::Key{.partitionKey = "partkey_" + std::to_string(i), .rangeKey = "rangekey_" + std::to_string(i)};
+}
+
+template <typename T>
+bool equalPayload(const T& a, const T& b) {
+    Payload pa([] { return Binary(allocSize); });
+    Payload pb([] { return Binary(allocSize); });
+    pa.write(a);
+    pb.write(b);
+    return pa == pb;
+}
+
+template <typename T>
+void bench(const char* name, const T& msg, size_t iterations) {
+    volatile size_t sink = 0;
+    auto nsPerMsg = [iterations](auto start) {
+        return (double)nsec(Clock::now() - start).count() / iterations;
+    };
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        Payload p([] { return Binary(allocSize); });
+        p.write(msg);
+        sink = sink + p.getSize();
+    }
+    auto writeNs = nsPerMsg(start);
+
+    start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        Payload p([] { return Binary(allocSize); });
+        p.reserveFor(msg);
+        p.write(msg);
+        sink = sink + p.getSize();
+    }
+    auto reservedWriteNs = nsPerMsg(start);
+
+    Payload src([] { return Binary(allocSize); });
+    src.write(msg);
+    start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        Payload p = src.share();
+        T parsed;
+        if (!p.read(parsed)) {
+            std::cerr << name << ": unable to parse message" << std::endl;
+            std::exit(1);
+        }
+        sink = sink + p.getSize();
+    }
+    auto readNs = nsPerMsg(start);
+
+    start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        Payload p([] { return Binary(allocSize); });
+        p.setCompactEncoding(true);
+        p.reserveFor(msg);
+        p.write(msg);
+        sink = sink + p.getSize();
+    }
+    auto compactWriteNs = nsPerMsg(start);
+
+    Payload compactSrc([] { return Binary(allocSize); });
+    compactSrc.setCompactEncoding(true);
+    compactSrc.write(msg);
+    start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        Payload p = compactSrc.share();
+        T parsed;
+        if (!p.read(parsed)) {
+            std::cerr << name << ": unable to parse compact message" << std::endl;
+            std::exit(1);
+        }
+        sink = sink + p.getSize();
+    }
+    auto compactReadNs = nsPerMsg(start);
+
+    // verify the round trip and the precomputed size
+    T parsed;
+    src.seek(0);
+    if (!src.read(parsed) || !equalPayload(parsed, msg) || Payload::getSerializedSizeOf(msg) != src.getSize()) {
+        std::cerr << name << ": round trip mismatch" << std::endl;
+        std::exit(1);
+    }
+    T compactParsed;
+    compactSrc.seek(0);
+    if (!compactSrc.read(compactParsed) || !equalPayload(compactParsed, msg) ||
+        Payload::getSerializedSizeOf<true>(msg) != compactSrc.getSize()) {
+        std::cerr << name << ": compact round trip mismatch" << std::endl;
+        std::exit(1);
+    }
+
+    std::cout << std::left << std::setw(40) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(8) << src.getSize() << " bytes"
+              << std::setw(12) << writeNs << " ns/write"
+              << std::setw(12) << reservedWriteNs << " ns/reserved write"
+              << std::setw(12) << readNs << " ns/read"
+              << std::setw(8) << compactSrc.getSize() << " compact bytes"
+              << std::setw(12) << compactWriteNs << " ns/compact write"
+              << std::setw(12) << compactReadNs << " ns/compact read" << std::endl;
+}
+
+// ns/read of the key of a message, as an owned Key and as a KeyView which shares the payload buffers
+template <typename KeyT>
+double benchKeyRead(Payload& src, size_t iterations) {
+    volatile size_t sink = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        Payload p = src.share();
+        KeyT parsed;
+        if (!p.read(parsed)) {
+            std::cerr << "unable to parse key" << std::endl;
+            std::exit(1);
+        }
+        sink = sink + parsed.partitionKey.size();
+    }
+    return (double)nsec(Clock::now() - start).count() / iterations;
+}
+
+void benchKey(const char* name, const dto::Key& key, size_t iterations) {
+    Payload src([] { return Binary(allocSize); });
+    src.write(key);
+    auto copyNs = benchKeyRead<dto::Key>(src, iterations);
+    auto viewNs = benchKeyRead<dto::KeyView>(src, iterations);
+    std::cout << std::left << std::setw(40) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(8) << src.getSize() << " bytes"
+              << std::setw(12) << copyNs << " ns/Key read"
+              << std::setw(12) << viewNs << " ns/KeyView read" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    if (iterations == 0) {
+        std::cerr << "usage: " << argv[0] << " [iterations]" << std::endl;
+        return 1;
+    }
+
+    dto::K23SIReadRequest read{
+        .pvid = dto::Partition::PVID{.id = 10, .rangeVersion = 2, .assignmentVersion = 3},
+        .collectionId = 7,
+        .mtr = makeMTR(1),
+        .key = makeKey(1)};
+    bench("K23SIReadRequest", read, iterations);
+
+    dto::K23SIReadResponse<BenchValue> readResp;
+    readResp.value.val = BenchValue{.data = String(100, 'v'), .version = 5};
+    bench("K23SIReadResponse<BenchValue>", readResp, iterations);
+
+    dto::K23SIWriteRequest<BenchValue> write;
+    write.pvid = dto::Partition::PVID{.id = 10, .rangeVersion = 2, .assignmentVersion = 3};
+    write.collectionId = 7;
+    write.mtr = makeMTR(2);
+    write.trh = makeKey(0);
+    write.isDelete = false;
+    write.designateTRH = true;
+    write.key = makeKey(2);
+    write.value.val = BenchValue{.data = String(100, 'v'), .version = 5};
+    bench("K23SIWriteRequest<BenchValue>", write, iterations);
+
+    dto::K23SITxnPushRequest push;
+    push.pvid = dto::Partition::PVID{.id = 10, .rangeVersion = 2, .assignmentVersion = 3};
+    push.collectionId = 7;
+    push.key = makeKey(3);
+    push.incumbentMTR = makeMTR(3);
+    push.challengerMTR = makeMTR(4);
+    bench("K23SITxnPushRequest", push, iterations);
+
+    dto::K23SITxnEndRequest end;
+    end.pvid = dto::Partition::PVID{.id = 10, .rangeVersion = 2, .assignmentVersion = 3};
+    end.collectionId = 7;
+    end.key = makeKey(4);
+    end.mtr = makeMTR(5);
+    end.action = dto::EndAction::Commit;
+    for (size_t i = 0; i < 10; ++i) {
+        end.writeKeys.push_back(makeKey(100 + i));
+    }
+    end.syncFinalize = true;
+    bench("K23SITxnEndRequest(10 keys)", end, iterations);
+
+    dto::K23SITxnHeartbeatRequest hb;
+    hb.pvid = dto::Partition::PVID{.id = 10, .rangeVersion = 2, .assignmentVersion = 3};
+    hb.collectionId = 7;
+    hb.key = makeKey(5);
+    hb.mtr = makeMTR(6);
+    bench("K23SITxnHeartbeatRequest", hb, iterations);
+
+    benchKey("Key(short)", makeKey(1), iterations);
+    benchKey("Key(64B partition key)", dto::Key{.partitionKey = String(64, 'p'), .rangeKey = "rangekey_1"}, iterations);
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/appbase/Appbase.h>
+#include <k2/appbase/AppEssentials.h>
+#include <k2/transport/HostIdentity.h>
+#include <k2/transport/ShmRPCProtocol.h>
+#include <seastar/core/reactor.hh>
+
+#include <algorithm>
+
+using namespace k2;
+
+struct EchoMessage {
+    uint64_t value = 0;
+    K2_PAYLOAD_FIELDS(value);
+};
+
+// Exercises the shm protocol against the shm mailbox of this process
+class ShmRPCTest {
+public:  // types
+    enum Verbs : Verb {
+        ECHO = 100
+    };
+
+public:  // application lifespan
+    ShmRPCTest() { K2INFO("ctor"); }
+    ~ShmRPCTest() { K2INFO("dtor"); }
+
+    seastar::future<> gracefulStop() {
+        K2INFO("stop");
+        return std::move(_testFuture);
+    }
+
+    seastar::future<> start() {
+        K2INFO("start");
+        _serverEndpoint = RPC().getServerEndpoint(ShmRPCProtocol::proto);
+        if (!_serverEndpoint) {
+            return seastar::make_exception_future<>(std::runtime_error("the test needs a shm endpoint"));
+        }
+        RPC().registerRPCObserver<EchoMessage, EchoMessage>(ECHO, [](EchoMessage&& request) {
+            return RPCResponse(Statuses::S200_OK("echo"), std::move(request));
+        });
+
+        // let start() finish and then run the tests
+        _testTimer.set_callback([this] {
+            _testFuture = runTest1()
+            .then([this] { return runTest2(); })
+            .then([this] {
+                K2INFO("======= All tests passed ========");
+                exitcode = 0;
+            })
+            .handle_exception([this](auto exc) {
+                try {
+                    std::rethrow_exception(exc);
+                } catch (std::exception& e) {
+                    K2ERROR("======= Test failed with exception [" << e.what() << "] ========");
+                    exitcode = -1;
+                }
+            })
+            .finally([this] {
+                K2INFO("======= Test ended ========");
+                seastar::engine().exit(exitcode);
+            });
+        });
+        _testTimer.arm(0ms);
+        return seastar::make_ready_future<>();
+    }
+
+    seastar::future<> runTest1() {
+        K2INFO(">>> Test1: round trips over our own mailbox");
+        auto ep = RPC().getTXEndpoint(_serverEndpoint->getURL());
+        K2EXPECT(bool(ep), true);
+        K2EXPECT(ep->getProtocol(), ShmRPCProtocol::proto);
+        return seastar::do_with(std::move(ep), std::vector<Duration>(), uint64_t(0),
+            [](auto& ep, auto& latencies, auto& value) {
+            return seastar::do_until([&value] { return value == 10000; }, [&ep, &latencies, &value] {
+                EchoMessage request{.value=value};
+                auto start = Clock::now();
+                return RPC().callRPC<EchoMessage, EchoMessage>(ECHO, request, *ep, 1s)
+                .then([&latencies, &value, start](auto&& result) {
+                    latencies.push_back(Clock::now() - start);
+                    auto& [status, response] = result;
+                    K2EXPECT(status, Statuses::S200_OK);
+                    K2EXPECT(response.value, value);
+                    value++;
+                });
+            })
+            .then([&latencies] {
+                // informational only: the latency depends on the host
+                std::sort(latencies.begin(), latencies.end());
+                K2INFO("shm round trip latency: p50=" << latencies[latencies.size() / 2]
+                        << ", p90=" << latencies[latencies.size() * 9 / 10]
+                        << ", p99=" << latencies[latencies.size() * 99 / 100]);
+            });
+        });
+    }
+
+    seastar::future<> runTest2() {
+        K2INFO(">>> Test2: endpoints of other hosts and other mailboxes are rejected");
+        // our url is shm+k2rpc://<boot id>.<pid>.<nonce>:<fd>
+        auto& host = _serverEndpoint->getIP();
+        auto firstDot = host.find('.');
+        auto lastDot = host.find_last_of('.');
+        K2EXPECT(host.substr(0, firstDot), getHostBootId());
+        auto pid = host.substr(firstDot + 1, lastDot - firstDot - 1);
+        auto nonce = host.substr(lastDot + 1);
+        auto fd = seastar::to_sstring(_serverEndpoint->getPort());
+        String proto = ShmRPCProtocol::proto + "://";
+
+        // same pid and fd on another host
+        String otherHost = getHostBootId();
+        otherHost[0] = otherHost[0] == '0' ? '1' : '0';
+        K2EXPECT(bool(RPC().getTXEndpoint(proto + otherHost + "." + pid + "." + nonce + ":" + fd)), false);
+
+        // our pid and fd, but another mailbox
+        auto otherNonce = seastar::to_sstring(std::stoull(std::string(nonce.data(), nonce.size())) + 1);
+        K2EXPECT(bool(RPC().getTXEndpoint(proto + getHostBootId() + "." + pid + "." + otherNonce + ":" + fd)), false);
+
+        // urls without a host identity
+        K2EXPECT(bool(RPC().getTXEndpoint(proto + pid + ":" + fd)), false);
+        K2EXPECT(bool(RPC().getTXEndpoint(proto + getHostBootId() + "." + pid + ":" + fd)), false);
+        return seastar::make_ready_future();
+    }
+
+private:
+    int exitcode = -1;
+    seastar::lw_shared_ptr<TXEndpoint> _serverEndpoint;
+    seastar::future<> _testFuture = seastar::make_ready_future();
+    seastar::timer<> _testTimer;
+};
+
+int main(int argc, char** argv) {
+    App app("ShmRPCTest");
+    app.addApplet<ShmRPCTest>();
+    return app.start(argc, argv);
+}
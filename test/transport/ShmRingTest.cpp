@@ -0,0 +1,147 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+// std
+#include <thread>
+#include <vector>
+#include <unistd.h>
+// k2
+#include <k2/transport/ShmRing.h>
+// catch
+#include "catch2/catch.hpp"
+using namespace k2;
+
+SCENARIO("test shm ring read and write") {
+    std::vector<char> mem(ShmRing::memorySize(16));
+    ShmRing ring(mem.data(), 16, true);
+    REQUIRE(ring.capacity() == 16);
+    REQUIRE(ring.readable() == 0);
+    REQUIRE(ring.writable() == 16);
+    REQUIRE_THROWS_AS(ShmRing(mem.data(), 15, true), std::invalid_argument);
+    REQUIRE_THROWS_AS(ShmRing(mem.data(), 32, false), std::invalid_argument);
+
+    char out[32];
+    REQUIRE(ring.read(out, sizeof(out)) == 0);
+
+    // partial write when full
+    REQUIRE(ring.write("0123456789", 10) == 10);
+    REQUIRE(ring.write("abcdefghij", 10) == 6);
+    REQUIRE(ring.writable() == 0);
+    REQUIRE(ring.readable() == 16);
+
+    REQUIRE(ring.read(out, 12) == 12);
+    REQUIRE(String(out, 12) == "0123456789ab");
+
+    // wrap around the end of the data area
+    REQUIRE(ring.write("klmnopqr", 8) == 8);
+    REQUIRE(ring.readable() == 12);
+    REQUIRE(ring.read(out, sizeof(out)) == 12);
+    REQUIRE(String(out, 12) == "cdefklmnopqr");
+
+    // another view of the same memory sees the same ring
+    ShmRing other(mem.data(), 16, false);
+    REQUIRE(other.readable() == 0);
+    REQUIRE(ring.write("xyz", 3) == 3);
+    REQUIRE(other.read(out, sizeof(out)) == 3);
+    REQUIRE(String(out, 3) == "xyz");
+}
+
+SCENARIO("test shm ring with concurrent producer and consumer") {
+    std::vector<char> mem(ShmRing::memorySize(64));
+    ShmRing producer(mem.data(), 64, true);
+    ShmRing consumer(mem.data(), 64, false);
+    const size_t total = 1000000;
+
+    std::thread writer([&] {
+        size_t sent = 0;
+        char buf[37];
+        while (sent < total) {
+            auto size = std::min(sizeof(buf), total - sent);
+            for (size_t i = 0; i < size; ++i) {
+                buf[i] = char((sent + i) % 251);
+            }
+            size_t written = 0;
+            while (written < size) {
+                auto w = producer.write(buf + written, size - written);
+                if (w == 0) {
+                    std::this_thread::yield();
+                }
+                written += w;
+            }
+            sent += size;
+        }
+    });
+
+    size_t received = 0;
+    size_t mismatches = 0;
+    char buf[29];
+    while (received < total) {
+        auto read = consumer.read(buf, sizeof(buf));
+        if (read == 0) {
+            std::this_thread::yield();
+        }
+        for (size_t i = 0; i < read; ++i) {
+            if (buf[i] != char((received + i) % 251)) {
+                mismatches++;
+            }
+        }
+        received += read;
+    }
+    writer.join();
+    REQUIRE(mismatches == 0);
+    REQUIRE(consumer.readable() == 0);
+}
+
+SCENARIO("test shm mapping") {
+    auto created = ShmMapping::create("k2shm-test", ShmSegmentHeader::segmentSize(4096));
+    REQUIRE(created);
+    REQUIRE(created->fd() >= 0);
+    REQUIRE(created->size() == ShmSegmentHeader::segmentSize(4096));
+
+    auto* header = static_cast<ShmSegmentHeader*>(created->data());
+    header->ringCapacity = 4096;
+    auto c2s = header->clientToServer(true);
+    auto s2c = header->serverToClient(true);
+    header->magic = ShmSegmentHeader::MAGIC;
+
+    // map the memfd again, the way a peer process would
+    auto opened = ShmMapping::open(::getpid(), created->fd());
+    REQUIRE(opened);
+    REQUIRE(opened->fd() == -1);
+    REQUIRE(opened->size() == created->size());
+    auto* peerHeader = static_cast<ShmSegmentHeader*>(opened->data());
+    REQUIRE(peerHeader->magic == ShmSegmentHeader::MAGIC);
+    auto peerIn = peerHeader->clientToServer(false);
+    auto peerOut = peerHeader->serverToClient(false);
+
+    char out[16];
+    REQUIRE(c2s.write("request", 7) == 7);
+    REQUIRE(peerIn.read(out, sizeof(out)) == 7);
+    REQUIRE(String(out, 7) == "request");
+    REQUIRE(peerOut.write("response", 8) == 8);
+    REQUIRE(s2c.read(out, sizeof(out)) == 8);
+    REQUIRE(String(out, 8) == "response");
+
+    REQUIRE(!ShmMapping::open(::getpid(), 999999));
+}
@@ -0,0 +1,172 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <k2/appbase/Appbase.h>
+#include <k2/appbase/AppEssentials.h>
+#include <k2/transport/TCPRPCChannel.h>
+#include <k2/transport/TCPRPCProtocol.h>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/net/api.hh>
+
+using namespace k2;
+
+// Exercises the send coalescing of a client TCPRPCChannel against the TCP server endpoint of the app
+class TCPCoalesceTest {
+public:  // types
+    enum Verbs : Verb {
+        // the server counts these
+        BURST = 100,
+        // the server answers with a PONG
+        PING = 101,
+        PONG = 102
+    };
+
+public:  // application lifespan
+    TCPCoalesceTest() { K2INFO("ctor"); }
+    ~TCPCoalesceTest() { K2INFO("dtor"); }
+
+    seastar::future<> gracefulStop() {
+        K2INFO("stop");
+        return std::move(_testFuture);
+    }
+
+    seastar::future<> start() {
+        K2INFO("start");
+        auto serverEndpoint = RPC().getServerEndpoint(TCPRPCProtocol::proto);
+        if (!serverEndpoint) {
+            return seastar::make_exception_future<>(std::runtime_error("the test needs a TCP endpoint"));
+        }
+        RPC().registerMessageObserver(BURST, [this](Request&&) { _bursts++; });
+        RPC().registerMessageObserver(PING, [](Request&& request) {
+            RPC().send(PONG, request.endpoint.newPayload(), request.endpoint);
+        });
+
+        // connect a channel of our own so that we can look at its send statistics
+        auto address = seastar::make_ipv4_address({serverEndpoint->getIP().c_str(), uint16_t(serverEndpoint->getPort())});
+        _channel = seastar::make_lw_shared<TCPRPCChannel>(seastar::connect(address), *serverEndpoint,
+            [this](Request&& request) {
+                if (request.verb == PONG) {
+                    _pongs++;
+                    if (_pongs < _rounds) {
+                        _ping();
+                    }
+                }
+            },
+            [](TXEndpoint& endpoint, std::exception_ptr) {
+                K2WARN("channel to " << endpoint.getURL() << " failed");
+            },
+            _stats);
+        _channel->run();
+
+        // let start() finish and then run the tests
+        _testTimer.set_callback([this] {
+            _testFuture = runTest1()
+            .then([this] { return runTest2(); })
+            .then([this] {
+                K2INFO("======= All tests passed ========");
+                exitcode = 0;
+            })
+            .handle_exception([this](auto exc) {
+                try {
+                    std::rethrow_exception(exc);
+                } catch (std::exception& e) {
+                    K2ERROR("======= Test failed with exception [" << e.what() << "] ========");
+                    exitcode = -1;
+                }
+            })
+            .finally([this] {
+                return _channel->gracefulClose(1s).handle_exception([](auto) {});
+            })
+            .finally([this] {
+                K2INFO("======= Test ended ========");
+                seastar::engine().exit(exitcode);
+            });
+        });
+        _testTimer.arm(0ms);
+        return seastar::make_ready_future<>();
+    }
+
+    seastar::future<> runTest1() {
+        K2INFO(">>> Test1: messages sent in the same poll cycle share a flush");
+        const uint64_t count = 1000;
+        for (uint64_t i = 0; i < count; ++i) {
+            auto payload = _channel->getTXEndpoint().newPayload();
+            payload->write(i);
+            _channel->send(BURST, std::move(payload), MessageMetadata{});
+        }
+        return _waitFor([this, count] { return _bursts == count; }, 5s)
+        .then([this, count] {
+            K2INFO("sent " << _stats->messages << " messages in " << _stats->flushes << " flushes");
+            K2EXPECT(_stats->messages, count);
+            // the batch only breaks when it reaches tcp_coalesce_max_bytes
+            K2EXPECT(_stats->flushes < 10, true);
+        });
+    }
+
+    seastar::future<> runTest2() {
+        K2INFO(">>> Test2: a send issued while the flush loop drains is not stranded");
+        // each ping is sent from the pong handler, that is, right around the time the previous flush loop
+        // finds its queue empty. A stranded send stalls the exchange
+        _ping();
+        return _waitFor([this] { return _pongs == _rounds; }, 5s)
+        .then([this] {
+            K2EXPECT(_pongs, _rounds);
+        });
+    }
+
+private:
+    void _ping() {
+        _channel->send(PING, _channel->getTXEndpoint().newPayload(), MessageMetadata{});
+    }
+
+    // polls the given condition until it is true, or fails once the timeout expires
+    template <class Func>
+    seastar::future<> _waitFor(Func&& cond, Duration timeout) {
+        auto deadline = Clock::now() + timeout;
+        return seastar::repeat([cond=std::forward<Func>(cond), deadline] () mutable {
+            if (cond()) {
+                return seastar::make_ready_future<seastar::stop_iteration>(seastar::stop_iteration::yes);
+            }
+            if (Clock::now() > deadline) {
+                return seastar::make_exception_future<seastar::stop_iteration>(std::runtime_error("timed out waiting for condition"));
+            }
+            return seastar::sleep(1ms).then([] { return seastar::stop_iteration::no; });
+        });
+    }
+
+    int exitcode = -1;
+    const uint64_t _rounds = 1000;
+    uint64_t _bursts = 0;
+    uint64_t _pongs = 0;
+    seastar::lw_shared_ptr<TCPSendStats> _stats = seastar::make_lw_shared<TCPSendStats>();
+    seastar::lw_shared_ptr<TCPRPCChannel> _channel;
+    seastar::future<> _testFuture = seastar::make_ready_future();
+    seastar::timer<> _testTimer;
+};
+
+int main(int argc, char** argv) {
+    App app("TCPCoalesceTest");
+    app.addApplet<TCPCoalesceTest>();
+    return app.start(argc, argv);
+}
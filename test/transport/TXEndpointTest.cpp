@@ -0,0 +1,99 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+// k2
+#include <k2/transport/TXEndpoint.h>
+// catch
+#include "catch2/catch.hpp"
+using namespace k2;
+
+SCENARIO("test parsing unix socket urls") {
+    auto ep = TXEndpoint::fromURL("unix+k2rpc:///run/k2/node.sock", nullptr);
+    REQUIRE(ep);
+    REQUIRE(ep->getProtocol() == "unix+k2rpc");
+    REQUIRE(ep->getIP() == "/run/k2/node.sock");
+    REQUIRE(ep->getPort() == 0);
+    // path endpoints without a port print without one
+    REQUIRE(ep->getURL() == "unix+k2rpc:///run/k2/node.sock");
+
+    // accepted connections are told apart by the port
+    auto accepted = TXEndpoint::fromURL("unix+k2rpc:///run/k2/node.sock:7", nullptr);
+    REQUIRE(accepted);
+    REQUIRE(accepted->getIP() == "/run/k2/node.sock");
+    REQUIRE(accepted->getPort() == 7);
+    REQUIRE(accepted->getURL() == "unix+k2rpc:///run/k2/node.sock:7");
+    REQUIRE(!(*accepted == *ep));
+
+    // the url round-trips
+    auto again = TXEndpoint::fromURL(accepted->getURL(), nullptr);
+    REQUIRE(again);
+    REQUIRE(*again == *accepted);
+}
+
+SCENARIO("test parsing unix socket urls with a host id") {
+    auto ep = TXEndpoint::fromURL("unix+k2rpc://0123abcd/run/k2/node.sock", nullptr);
+    REQUIRE(ep);
+    REQUIRE(ep->getProtocol() == "unix+k2rpc");
+    REQUIRE(ep->getIP() == "0123abcd/run/k2/node.sock");
+    REQUIRE(ep->getPort() == 0);
+    REQUIRE(ep->getURL() == "unix+k2rpc://0123abcd/run/k2/node.sock");
+
+    auto accepted = TXEndpoint::fromURL("unix+k2rpc://0123abcd/run/k2/node.sock:7", nullptr);
+    REQUIRE(accepted);
+    REQUIRE(accepted->getIP() == "0123abcd/run/k2/node.sock");
+    REQUIRE(accepted->getPort() == 7);
+    REQUIRE(accepted->getURL() == "unix+k2rpc://0123abcd/run/k2/node.sock:7");
+
+    // the same path on different hosts are different endpoints
+    auto other = TXEndpoint::fromURL("unix+k2rpc://4567abcd/run/k2/node.sock", nullptr);
+    REQUIRE(other);
+    REQUIRE(!(*other == *ep));
+}
+
+SCENARIO("test parsing bad unix socket urls") {
+    // paths must be absolute
+    REQUIRE(!TXEndpoint::fromURL("unix+k2rpc://run/k2/node.sock", nullptr));
+    // the port has to fit in 32 bits
+    REQUIRE(!TXEndpoint::fromURL("unix+k2rpc:///run/k2/node.sock:4294967296", nullptr));
+    // there has to be a protocol
+    REQUIRE(!TXEndpoint::fromURL(":///run/k2/node.sock", nullptr));
+}
+
+SCENARIO("test parsing ip urls") {
+    auto tcp = TXEndpoint::fromURL("tcp+k2rpc://1.2.3.4:12345", nullptr);
+    REQUIRE(tcp);
+    REQUIRE(tcp->getProtocol() == "tcp+k2rpc");
+    REQUIRE(tcp->getIP() == "1.2.3.4");
+    REQUIRE(tcp->getPort() == 12345);
+    REQUIRE(tcp->getURL() == "tcp+k2rpc://1.2.3.4:12345");
+
+    auto rdma = TXEndpoint::fromURL("rdma+k2rpc://[fe80::1]:1234", nullptr);
+    REQUIRE(rdma);
+    REQUIRE(rdma->getProtocol() == "rdma+k2rpc");
+    REQUIRE(rdma->getPort() == 1234);
+
+    // ip urls need a port
+    REQUIRE(!TXEndpoint::fromURL("tcp+k2rpc://1.2.3.4", nullptr));
+    REQUIRE(!TXEndpoint::fromURL("tcp+k2rpc://1.2.3.4:4294967296", nullptr));
+}
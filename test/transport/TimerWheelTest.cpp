@@ -0,0 +1,136 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#define CATCH_CONFIG_MAIN
+// stl
+#include <set>
+// k2
+#include <k2/transport/TimerWheel.h>
+// catch
+#include "catch2/catch.hpp"
+using namespace k2;
+
+// collects the ids which expire by the given time. Ids in `pending` are kept in the wheel
+static std::set<uint32_t> expire(TimerWheel& wheel, TimePoint now, const std::set<uint32_t>& pending={}) {
+    std::set<uint32_t> result;
+    wheel.expire(now, [&](uint32_t id) {
+        if (pending.count(id)) {
+            return true;
+        }
+        result.insert(id);
+        return false;
+    });
+    return result;
+}
+
+SCENARIO("test timer wheel construction") {
+    REQUIRE_THROWS_AS(TimerWheel(10us, 100), std::invalid_argument);
+    REQUIRE_THROWS_AS(TimerWheel(0us, 64), std::invalid_argument);
+    TimerWheel wheel(10us, 64);
+    REQUIRE(wheel.size() == 0);
+    REQUIRE(!wheel.nextDue());
+}
+
+SCENARIO("test timer wheel sub-millisecond deadlines") {
+    TimerWheel wheel(10us, 1024);
+    auto now = TimePoint(1s);
+    // a 100us timeout comes due at 100us, not at the next millisecond
+    auto due = wheel.add(1, now + 100us, now);
+    REQUIRE(due == now + 100us);
+    // deadlines are rounded up to the tick, never down
+    REQUIRE(wheel.add(2, now + 105us, now) == now + 110us);
+    REQUIRE(*wheel.nextDue() == now + 100us);
+
+    REQUIRE(expire(wheel, now + 99us).empty());
+    REQUIRE(expire(wheel, now + 100us) == std::set<uint32_t>{1});
+    REQUIRE(*wheel.nextDue() == now + 110us);
+    REQUIRE(expire(wheel, now + 110us) == std::set<uint32_t>{2});
+    REQUIRE(wheel.size() == 0);
+    REQUIRE(!wheel.nextDue());
+}
+
+SCENARIO("test timer wheel deadlines in the current tick") {
+    TimerWheel wheel(10us, 64);
+    auto now = TimePoint(1s) + 5us;
+    // already due: goes in the next tick, so that it is picked up by the next expire()
+    REQUIRE(wheel.add(1, now - 1ms, now) == TimePoint(1s) + 10us);
+    REQUIRE(expire(wheel, TimePoint(1s) + 10us) == std::set<uint32_t>{1});
+}
+
+SCENARIO("test timer wheel deadlines beyond one rotation") {
+    TimerWheel wheel(10us, 64);
+    auto now = TimePoint(1s);
+    // the wheel spans 640us. An entry due later shares a bucket with an earlier tick
+    wheel.add(1, now + 100us, now);
+    wheel.add(2, now + 100us + 640us, now);
+    REQUIRE(*wheel.nextDue() == now + 100us);
+
+    // the owner keeps entries which are not due yet
+    REQUIRE(expire(wheel, now + 100us, {2}) == std::set<uint32_t>{1});
+    REQUIRE(wheel.size() == 1);
+    REQUIRE(*wheel.nextDue() == now + 740us);
+    REQUIRE(expire(wheel, now + 740us) == std::set<uint32_t>{2});
+}
+
+SCENARIO("test timer wheel catches up after falling behind") {
+    TimerWheel wheel(10us, 64);
+    auto now = TimePoint(1s);
+    for (uint32_t i = 0; i < 10; ++i) {
+        wheel.add(i, now + 10us * (i + 1), now);
+    }
+    // we were late by many rotations. All entries come due once
+    auto expired = expire(wheel, now + 1s);
+    REQUIRE(expired.size() == 10);
+    REQUIRE(wheel.size() == 0);
+
+    // after being idle, the wheel starts from the time of the next add
+    auto later = now + 1h;
+    REQUIRE(wheel.add(42, later + 50us, later) == later + 50us);
+    REQUIRE(*wheel.nextDue() == later + 50us);
+}
+
+SCENARIO("test timer wheel next due wraps around") {
+    TimerWheel wheel(10us, 128);
+    auto now = TimePoint(1s) + 1000us; // tick 100100, bucket 4
+    // the next entry hashes to a bucket before the current one
+    wheel.add(7, now + 1260us, now); // tick 100226, bucket 2
+    REQUIRE(*wheel.nextDue() == now + 1260us);
+    REQUIRE(expire(wheel, now + 1259us).empty());
+    REQUIRE(expire(wheel, now + 1260us) == std::set<uint32_t>{7});
+}
+
+SCENARIO("test timer wheel new entries while expiring") {
+    TimerWheel wheel(10us, 64);
+    auto now = TimePoint(1s);
+    wheel.add(1, now + 10us, now);
+    // the owner may add entries from expire(), e.g. when a timed out request is retried
+    std::set<uint32_t> expired;
+    wheel.expire(now + 10us, [&](uint32_t id) {
+        expired.insert(id);
+        wheel.add(id + 1, now + 20us, now + 10us);
+        return false;
+    });
+    REQUIRE(expired == std::set<uint32_t>{1});
+    REQUIRE(wheel.size() == 1);
+    REQUIRE(expire(wheel, now + 20us) == std::set<uint32_t>{2});
+}
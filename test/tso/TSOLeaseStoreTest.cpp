@@ -0,0 +1,197 @@
+/*
+MIT License
+
+Copyright(c) 2020 Futurewei Cloud
+
+    Permission is hereby granted,
+    free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+
+    The above copyright notice and this permission notice shall be included in all copies
+    or
+    substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS",
+    WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+    DAMAGES OR OTHER
+    LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+*/
+
+#include <seastar/testing/test_case.hh>
+#include <TestUtil.h>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <k2/tso/service/TSOLeaseStore.h>
+
+using namespace k2;
+
+const auto leaseBaseDir = generateTempFolderPath("tso_lease_store_test");
+
+// the lease record path of a test, in a fresh folder
+k2::String leasePath(const std::string& testName)
+{
+    K2INFO(testName << "...... ");
+    std::filesystem::create_directories(leaseBaseDir + testName);
+    return k2::String(leaseBaseDir + testName + "/lease");
+}
+
+TSOLeaseRecord masterRecord(uint32_t tsoId, k2::String url, uint64_t leaseExpiry, uint64_t reservedTimeShreshold)
+{
+    TSOLeaseRecord record;
+    record.MasterTSOId = tsoId;
+    record.MasterURL = std::move(url);
+    record.LeaseExpiry = leaseExpiry;
+    record.ReservedTimeShreshold = reservedTimeShreshold;
+    return record;
+}
+
+SEASTAR_TEST_CASE(test_in_process_conditional_write)
+{
+    auto store = seastar::make_lw_shared<InProcessTSOLeaseStore>();
+
+    return store->ConditionalWrite(0, masterRecord(1, "tcp+k2rpc://127.0.0.1:10000", 100, 200))
+        .then([store] (auto&& result) {
+            auto& [success, record] = result;
+            BOOST_REQUIRE(success);
+            BOOST_REQUIRE(record.Version == 1);
+            BOOST_REQUIRE(record.MasterTSOId == 1);
+
+            // stale version
+            return store->ConditionalWrite(0, masterRecord(2, "tcp+k2rpc://127.0.0.1:10001", 100, 200));
+        })
+        .then([store] (auto&& result) {
+            auto& [success, record] = result;
+            BOOST_REQUIRE(!success);
+            BOOST_REQUIRE(record.Version == 1);
+            BOOST_REQUIRE(record.MasterTSOId == 1);
+        });
+}
+
+SEASTAR_TEST_CASE(test_handoff_on_release)
+{
+    // two TSO server instances sharing the lease file
+    auto path = leasePath(get_name());
+    auto storeA = seastar::make_lw_shared<FileTSOLeaseStore>(path, 10ms);
+    auto storeB = seastar::make_lw_shared<FileTSOLeaseStore>(path, 10ms);
+
+    return storeA->Read()
+        .then([storeA] (TSOLeaseRecord&& record) {
+            // no one has written the record yet
+            BOOST_REQUIRE(record.Version == 0);
+            BOOST_REQUIRE(!record.HasLiveMaster(0));
+            return storeA->ConditionalWrite(record.Version, masterRecord(1, "tcp+k2rpc://127.0.0.1:10000", 1000, 2000));
+        })
+        .then([storeB] (auto&& result) {
+            auto& [success, record] = result;
+            BOOST_REQUIRE(success);
+            BOOST_REQUIRE(record.Version == 1);
+
+            // B hasn't seen A's write, its conditional write fails and returns A's record
+            return storeB->ConditionalWrite(0, masterRecord(2, "tcp+k2rpc://127.0.0.1:10001", 1000, 2000));
+        })
+        .then([storeA] (auto&& result) {
+            auto& [success, record] = result;
+            BOOST_REQUIRE(!success);
+            BOOST_REQUIRE(record.Version == 1);
+            BOOST_REQUIRE(record.MasterURL == "tcp+k2rpc://127.0.0.1:10000");
+            BOOST_REQUIRE(record.HasLiveMaster(500));
+
+            // A releases the master role, keeping the ReservedTimeShreshold for the next master to wait out
+            return storeA->ConditionalWrite(record.Version, masterRecord(0, "", 0, record.ReservedTimeShreshold));
+        })
+        .then([storeB] (auto&& result) {
+            BOOST_REQUIRE(std::get<0>(result));
+            return storeB->Read();
+        })
+        .then([storeB] (TSOLeaseRecord&& record) {
+            BOOST_REQUIRE(record.Version == 2);
+            BOOST_REQUIRE(!record.HasLiveMaster(500));
+            BOOST_REQUIRE(record.ReservedTimeShreshold == 2000);
+            return storeB->ConditionalWrite(record.Version, masterRecord(2, "tcp+k2rpc://127.0.0.1:10001", 1500, record.ReservedTimeShreshold));
+        })
+        .then([storeA] (auto&& result) {
+            auto& [success, record] = result;
+            BOOST_REQUIRE(success);
+            BOOST_REQUIRE(record.Version == 3);
+
+            // A's write with its last seen version fails, which is how a master finds out it lost the lease
+            return storeA->ConditionalWrite(2, masterRecord(1, "tcp+k2rpc://127.0.0.1:10000", 1500, 2000));
+        })
+        .then([storeA, storeB] (auto&& result) {
+            auto& [success, record] = result;
+            BOOST_REQUIRE(!success);
+            BOOST_REQUIRE(record.MasterTSOId == 2);
+        });
+}
+
+SEASTAR_TEST_CASE(test_handoff_on_lease_expiry)
+{
+    auto path = leasePath(get_name());
+    auto storeA = seastar::make_lw_shared<FileTSOLeaseStore>(path, 10ms);
+    auto storeB = seastar::make_lw_shared<FileTSOLeaseStore>(path, 10ms);
+
+    return storeA->ConditionalWrite(0, masterRecord(1, "tcp+k2rpc://127.0.0.1:10000", 1000, 2000))
+        .then([storeB] (auto&& result) {
+            BOOST_REQUIRE(std::get<0>(result));
+            return storeB->Read();
+        })
+        .then([storeB] (TSOLeaseRecord&& record) {
+            BOOST_REQUIRE(record.HasLiveMaster(1000));
+            // A stopped heartbeating and its lease has expired
+            BOOST_REQUIRE(!record.HasLiveMaster(1001));
+            return storeB->ConditionalWrite(record.Version, masterRecord(2, "tcp+k2rpc://127.0.0.1:10001", 3000, record.ReservedTimeShreshold));
+        })
+        .then([storeA, storeB] (auto&& result) {
+            auto& [success, record] = result;
+            BOOST_REQUIRE(success);
+            BOOST_REQUIRE(record.Version == 2);
+            BOOST_REQUIRE(record.MasterTSOId == 2);
+            BOOST_REQUIRE(record.ReservedTimeShreshold == 2000);
+        });
+}
+
+SEASTAR_TEST_CASE(test_concurrent_writes)
+{
+    auto store = seastar::make_lw_shared<FileTSOLeaseStore>(leasePath(get_name()), 10ms);
+
+    // both writes expect the same version, only one can succeed
+    auto write1 = store->ConditionalWrite(0, masterRecord(1, "tcp+k2rpc://127.0.0.1:10000", 1000, 2000));
+    auto write2 = store->ConditionalWrite(0, masterRecord(2, "tcp+k2rpc://127.0.0.1:10001", 1000, 2000));
+    return write1.then([store, write2=std::move(write2)] (auto&& result1) mutable {
+        return write2.then([result1=std::move(result1)] (auto&& result2) {
+            BOOST_REQUIRE(std::get<0>(result1) != std::get<0>(result2));
+            BOOST_REQUIRE(std::get<1>(result1).Version == 1);
+            BOOST_REQUIRE(std::get<1>(result2).Version == 1);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_lock_timeout)
+{
+    auto path = leasePath(get_name());
+    auto store = seastar::make_lw_shared<FileTSOLeaseStore>(path, 5ms);
+
+    // another TSO server instance holds the lock
+    int lockFd = ::open((path + ".lock").c_str(), O_CREAT | O_RDWR, 0666);
+    BOOST_REQUIRE(lockFd >= 0);
+    BOOST_REQUIRE(::flock(lockFd, LOCK_EX) == 0);
+
+    return store->ConditionalWrite(0, masterRecord(1, "tcp+k2rpc://127.0.0.1:10000", 1000, 2000))
+        .then_wrapped([store, lockFd] (auto&& fut) {
+            BOOST_REQUIRE(fut.failed());
+            fut.ignore_ready_future();
+
+            ::close(lockFd);
+            return store->ConditionalWrite(0, masterRecord(1, "tcp+k2rpc://127.0.0.1:10000", 1000, 2000));
+        })
+        .then([store] (auto&& result) {
+            BOOST_REQUIRE(std::get<0>(result));
+        });
+}